@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <terark/stdtypes.hpp>
 #include <terark/num_to_str.hpp>
+#include <terark/db/record_cache.hpp>
 
 //using namespace terark;
 using terark::string_appender;
@@ -223,7 +224,7 @@ public:
   virtual void CreateFilter(const Slice *keys, int n, std::string *dst) const {}
   virtual bool KeyMayMatch(const Slice &key, const Slice &filter) const { return true; }
 
-  int bits_per_key_;
+  int bits_per_key_; // used as "bloomBitsPerKey" of the key index
 };
 };
 
@@ -260,6 +261,19 @@ static const char g_keyValueSchema[] = R"({
   "MinMergeSegNum": 3
 }
 )";
+// insert text right after anchor in meta
+//@returns false if anchor is not found
+static bool
+insertMetaAfter(std::string& meta, const char* anchor, const std::string& text) {
+	size_t pos = meta.find(anchor);
+	if (std::string::npos == pos) {
+		fprintf(stderr, "ERROR: missing %s in dbmeta template\n", anchor);
+		return false;
+	}
+	meta.insert(pos + strlen(anchor), text);
+	return true;
+}
+
 Status
 DB::Open(const Options &options, const std::string &name, leveldb::DB** dbptr) {
 	fs::path dbdir = fs::path(name) / "TerarkDB";
@@ -275,13 +289,36 @@ DB::Open(const Options &options, const std::string &name, leveldb::DB** dbptr) {
 			fs::create_directories(dbdir);
 		}
 		if (!fs::exists(metaPath)) {
-			WriteStringToFile(Env::Default(), g_keyValueSchema, metaPath.string());
+			std::string meta = g_keyValueSchema;
+			// bloom filter policy is mapped to per-segment bloom filter
+			// of the unique key index
+			auto filter = dynamic_cast<const FilterPolicyImpl*>(options.filter_policy);
+			if (filter && filter->bits_per_key_ > 0) {
+				string_appender<> bloom;
+				bloom << ",\n       \"bloomBitsPerKey\": " << filter->bits_per_key_;
+				if (!insertMetaAfter(meta, R"("unique": true)", bloom)) {
+					return Status::InvalidArgument("bad dbmeta template", "unique");
+				}
+			}
+			// block cache capacity is the budget of decoded records
+			auto cache = dynamic_cast<const CacheImpl*>(options.block_cache);
+			if (cache && cache->capacity_ > 0) {
+				string_appender<> cacheBytes;
+				cacheBytes << ",\n  \"StoreCacheBytes\": " << cache->capacity_;
+				if (!insertMetaAfter(meta, R"("MinMergeSegNum": 3)", cacheBytes)) {
+					return Status::InvalidArgument("bad dbmeta template", "MinMergeSegNum");
+				}
+			}
+			WriteStringToFile(Env::Default(), meta, metaPath.string());
 		}
 	}
 	if (!fs::exists(metaPath)) {
 		fprintf(stderr, "ERROR: not exists: %s\n", metaPath.string().c_str());
 		return Status::InvalidArgument("dbmeta.json is missing", dbdir.string());
 	}
+	if (auto cache = dynamic_cast<const CacheImpl*>(options.block_cache)) {
+		terark::db::RecordCache::global().ensureCapacity(cache->capacity_);
+	}
 	try {
 		*dbptr = new DbImpl(dbdir);
 		return Status::OK();
@@ -421,7 +458,7 @@ DbImpl::Write(const WriteOptions& options, WriteBatch* updates) {
 // May return some other Status on an error.
 Status
 DbImpl::Get(const ReadOptions& options, const Slice& key, std::string* value) {
-  terark::db::DbContext* ctx = GetDbContext();
+  terark::db::DbContext* ctx = GetDbContext(options);
   assert(NULL != ctx);
   ctx->indexSearchExact(0, key, &ctx->exactMatchRecIdvec);
   if (!ctx->exactMatchRecIdvec.empty()) {
@@ -441,6 +478,89 @@ DbImpl::Get(const ReadOptions& options, const Slice& key, std::string* value) {
   return Status::NotFound(key);
 }
 
+// Search all keys by one batched index search, then read values of found
+// keys by one batched read, found[i] is 0 if keys[i] is not found
+void
+DbImpl::MultiGetImpl(terark::db::DbContext* ctx, size_t n, const Slice* keys,
+                     terark::valvec<terark::valvec<unsigned char> >* bufs,
+                     terark::valvec<unsigned char>* found,
+                     terark::valvec<terark::fstring>* vals,
+                     terark::valvec<terark::db::ReadableSegmentPtr>* pins) {
+  terark::valvec<terark::fstring> keyvec(n, terark::valvec_no_init());
+  for (size_t i = 0; i < n; ++i) {
+    keyvec[i] = terark::fstring(keys[i].data(), keys[i].size());
+  }
+  terark::valvec<size_t> keyOffsets;
+  terark::valvec<terark::llong> hits;
+  ctx->indexSearchExactBatch(0, keyvec.data(), n, &hits, &keyOffsets);
+  auto& recIds = ctx->exactMatchRecIdvec;
+  recIds.resize_no_init(n);
+  for (size_t i = 0; i < n; ++i) {
+    recIds[i] = keyOffsets[i] < keyOffsets[i+1] ? hits[keyOffsets[i]] : -1;
+  }
+  bufs->resize(n);
+  found->resize_no_init(n);
+  if (vals) {
+    vals->resize_no_init(n);
+    pins->resize(n);
+  }
+  ctx->selectOneColgroupBatch(recIds.data(), n, 1, bufs->data(), found->data(),
+      vals ? vals->data() : NULL, pins ? pins->data() : NULL);
+}
+
+std::vector<Status>
+DbImpl::MultiGet(const ReadOptions& options,
+                 const std::vector<Slice>& keys,
+                 std::vector<std::string>* values) {
+  terark::db::DbContext* ctx = GetDbContext(options);
+  assert(NULL != ctx);
+  size_t n = keys.size();
+  std::vector<Status> statuses(n);
+  values->resize(n);
+  terark::valvec<terark::valvec<unsigned char> > bufs;
+  terark::valvec<unsigned char> found;
+  MultiGetImpl(ctx, n, keys.data(), &bufs, &found, NULL, NULL);
+  for (size_t i = 0; i < n; ++i) {
+    if (found[i]) {
+      (*values)[i].assign((const char*)bufs[i].data(), bufs[i].size());
+    }
+    else {
+      (*values)[i].resize(0);
+      statuses[i] = Status::NotFound(keys[i]);
+    }
+  }
+  return statuses;
+}
+
+void
+DbImpl::MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                 PinnableSlice* values, Status* statuses) {
+  terark::db::DbContext* ctx = GetDbContext(options);
+  assert(NULL != ctx);
+  terark::valvec<terark::valvec<unsigned char> > bufs;
+  terark::valvec<unsigned char> found;
+  terark::valvec<terark::fstring> vals;
+  terark::valvec<terark::db::ReadableSegmentPtr> pins;
+  MultiGetImpl(ctx, n, keys, &bufs, &found, &vals, &pins);
+  for (size_t i = 0; i < n; ++i) {
+    PinnableSlice& v = values[i];
+    v.Reset();
+    if (!found[i]) {
+      statuses[i] = Status::NotFound(keys[i]);
+      continue;
+    }
+    if (pins[i]) {
+      v.pinned_.swap(pins[i]);
+      v.Slice::operator=(Slice(vals[i].data(), vals[i].size()));
+    }
+    else {
+      v.buf_.swap(bufs[i]);
+      v.Slice::operator=(Slice((const char*)v.buf_.data(), v.buf_.size()));
+    }
+    statuses[i] = Status::OK();
+  }
+}
+
 #if HAVE_BASHOLEVELDB
 // If the database contains an entry for "key" store the
 // corresponding value in *value and return OK.
@@ -481,12 +601,29 @@ err:
 // The returned iterator should be deleted before this db is deleted.
 Iterator*
 DbImpl::NewIterator(const ReadOptions& options) {
-	return new IteratorImpl(m_tab.get());
+	auto si = static_cast<const SnapshotImpl*>(options.snapshot);
+	return new IteratorImpl(m_tab.get(), si);
 }
 
-SnapshotImpl::SnapshotImpl(DbImpl *db) :
-    Snapshot(), db_(db), context_(db->NewContext()), status_(Status::OK())
-{
+SnapshotImpl::SnapshotImpl(DbImpl *db) : Snapshot(), db_(db) {
+  pinned_ = db->m_tab->createDbContext();
+  db->m_tab->pinSnapshot(pinned_.get());
+}
+
+SnapshotImpl::~SnapshotImpl() {
+  // DbContext::~DbContext unpins the snapshot
+  ctx_.clear();
+  pinned_ = nullptr;
+}
+
+terark::db::DbContext* SnapshotImpl::GetDbContext() const {
+  terark::db::DbContextPtr& refctx = ctx_.local();
+  if (!refctx) {
+    auto tab = db_->m_tab.get();
+    refctx.reset(tab->createDbContext());
+    tab->pinSnapshot(refctx.get(), pinned_.get());
+  }
+  return refctx.get();
 }
 
 // Return a handle to the current DB state.  Iterators created with
@@ -494,8 +631,7 @@ SnapshotImpl::SnapshotImpl(DbImpl *db) :
 // state.  The caller must call ReleaseSnapshot(result) when the
 // snapshot is no longer needed.
 const Snapshot* DbImpl::GetSnapshot() {
-  THROW_STD(invalid_argument, "terark-db-leveldb-api doesn't support snapshot");
-  return NULL;
+  return new SnapshotImpl(this);
 }
 
 // Release a previously acquired snapshot.  The caller must not
@@ -503,16 +639,7 @@ const Snapshot* DbImpl::GetSnapshot() {
 void
 DbImpl::ReleaseSnapshot(const Snapshot* snapshot)
 {
-  THROW_STD(invalid_argument, "terark-db-leveldb-api doesn't support snapshot");
-  SnapshotImpl *si =
-    static_cast<SnapshotImpl*>(const_cast<Snapshot*>(snapshot));
-  if (si != NULL) {
-    // We started a transaction: we could commit it here, but it will be rolled
-    // back automatically by closing the session, which we have to do anyway.
-    int ret = si->GetContext()->Close();
-    TERARK_RT_assert(ret == 0, std::logic_error);
-    delete si;
-  }
+  delete static_cast<const SnapshotImpl*>(snapshot);
 }
 
 // DB implementations can export properties about their state
@@ -591,16 +718,7 @@ OperationContext* DbImpl::GetContext() {
 }
 
 OperationContext* DbImpl::GetContext(const ReadOptions &options) {
-  if (options.snapshot == NULL) {
-    return GetContext();
-  }
-  THROW_STD(invalid_argument,
-    "terark-db-leveldb-api doesn't support snapshot, "
-    "ReadOptions.snapshot should alsway be NULL"
-    );
-  auto si = static_cast<const SnapshotImpl*>(options.snapshot);
-  assert(si->GetStatus().ok());
-  return si->GetContext();
+  return new OperationContext(m_tab.get(), GetDbContext(options));
 }
 
 terark::db::DbContext* DbImpl::GetDbContext() {
@@ -614,12 +732,23 @@ terark::db::DbContext* DbImpl::GetDbContext() {
   return refctx.get();
 }
 
+terark::db::DbContext* DbImpl::GetDbContext(const ReadOptions &options) {
+  if (options.snapshot == NULL) {
+    return GetDbContext();
+  }
+  auto si = static_cast<const SnapshotImpl*>(options.snapshot);
+  return si->GetDbContext();
+}
+
 std::atomic<size_t> g_iterLiveCnt;
 std::atomic<size_t> g_iterCreatedCnt;
 
-IteratorImpl::IteratorImpl(terark::db::DbTable *db) {
+IteratorImpl::IteratorImpl(terark::db::DbTable *db, const SnapshotImpl* snapshot) {
 	m_tab = db;
 	m_ctx = db->createDbContext();
+	if (snapshot) {
+		db->pinSnapshot(m_ctx.get(), snapshot->pinned_.get());
+	}
 	m_recId = -1;
 	m_valid = false;
 	m_direction = Direction::forward;
@@ -661,7 +790,7 @@ IteratorImpl::SeekToFirst() {
 		m_direction = Direction::forward;
 	}
 	if (!m_iter) {
-		m_iter = m_tab->createIndexIterForward(0, nullptr);
+		m_iter = m_tab->createIndexIterForward(0, m_ctx.get());
 	}
 	m_iter->reset();
 	iterIncrement();
@@ -677,7 +806,7 @@ IteratorImpl::SeekToLast() {
 		m_direction = Direction::backward;
 	}
 	if (!m_iter) {
-		m_iter = m_tab->createIndexIterBackward(0, nullptr);
+		m_iter = m_tab->createIndexIterBackward(0, m_ctx.get());
 	}
 	m_iter->reset();
 	iterIncrement();
@@ -691,13 +820,13 @@ void
 IteratorImpl::Seek(const Slice& target) {
 	if (Direction::backward == m_direction) {
 		if (!m_iter) {
-			m_iter = m_tab->createIndexIterBackward(0, nullptr);
+			m_iter = m_tab->createIndexIterBackward(0, m_ctx.get());
 		}
 	//	fprintf(stderr, "DEBUG: %s: direction=backward\n", BOOST_CURRENT_FUNCTION);
 	}
 	else {
 		if (!m_iter) {
-			m_iter = m_tab->createIndexIterForward(0, nullptr);
+			m_iter = m_tab->createIndexIterForward(0, m_ctx.get());
 		}
 	//	fprintf(stderr, "DEBUG: %s: direction=forward\n", BOOST_CURRENT_FUNCTION);
 	}
@@ -724,7 +853,7 @@ IteratorImpl::Next() {
 		TRACE_KEY_VAL(m_key, m_val);
 	}
 	else {
-		m_iter = m_tab->createIndexIterForward(0, nullptr);
+		m_iter = m_tab->createIndexIterForward(0, m_ctx.get());
 		m_direction = Direction::forward;
 		m_posKey.swap(m_key);
 		int cmp = m_iter->seekLowerBound(m_posKey, &m_recId, &m_key);
@@ -760,7 +889,7 @@ IteratorImpl::Prev() {
 		TRACE_KEY_VAL(m_key, m_val);
 	}
 	else {
-		m_iter = m_tab->createIndexIterBackward(0, nullptr);
+		m_iter = m_tab->createIndexIterBackward(0, m_ctx.get());
 		m_direction = Direction::backward;
 		m_posKey.swap(m_key);
 		int cmp = m_iter->seekLowerBound(m_posKey, &m_recId, &m_key);
@@ -45,6 +45,7 @@
 #endif
 
 #include <terark/db/db_table.hpp>
+#include <terark/db/db_segment.hpp>
 #include <boost/filesystem.hpp>
 #include <tbb/enumerable_thread_specific.h>
 #undef min
@@ -180,7 +181,7 @@ class ColumnFamilyHandleImpl : public ColumnFamilyHandle {
 
 class IteratorImpl : public Iterator {
 public:
-  IteratorImpl(terark::db::DbTable *db);
+  IteratorImpl(terark::db::DbTable *db, const class SnapshotImpl* snapshot = NULL);
   virtual ~IteratorImpl();
 
   // An iterator is either positioned at a key/value pair, or
@@ -232,20 +233,44 @@ private:
   void operator=(const IteratorImpl&);
 };
 
+// A snapshot is a DbContext pinned by DbTable::pinSnapshot, DbContext is
+// not thread safe, so each reader thread uses its own DbContext which is
+// pinned to the same snapshot
 class SnapshotImpl : public Snapshot {
 friend class DbImpl;
 friend class IteratorImpl;
 public:
   SnapshotImpl(DbImpl *db);
-  virtual ~SnapshotImpl() { delete context_; }
+  virtual ~SnapshotImpl();
 protected:
-  OperationContext *GetContext() const { return context_; }
-  Status GetStatus() const { return status_; }
-  Status SetupTransaction();
+  terark::db::DbContext* GetDbContext() const;
 private:
   DbImpl *db_;
-  OperationContext *context_;
-  Status status_;
+  terark::db::DbContextPtr pinned_;
+  mutable tbb::enumerable_thread_specific<terark::db::DbContextPtr> ctx_;
+};
+
+// A value got by DbImpl::MultiGet, if the value is stored uncompressed in
+// a mmapped segment, it is referenced in place and the segment is pinned,
+// otherwise the value is copied into the self owned buffer.
+// The "val" column of the default dbmeta is carbin, which readonly segments
+// store in a compressed NestLoudsTrieStore, so it is always copied, only
+// tables with a fixed length value column get pinned values.
+class PinnableSlice : public Slice {
+public:
+  PinnableSlice() {}
+  bool IsPinned() const { return NULL != pinned_; }
+  void Reset() {
+    pinned_.reset();
+    buf_.erase_all();
+    Slice::operator=(Slice());
+  }
+private:
+  friend class DbImpl;
+  PinnableSlice(const PinnableSlice&);
+  void operator=(const PinnableSlice&);
+  terark::db::ReadableSegmentPtr pinned_;
+  terark::valvec<unsigned char> buf_;
 };
 
 class DbImpl : public leveldb::DB {
@@ -259,6 +284,17 @@ public:
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
   Status Get(const ReadOptions& options, const Slice& key, std::string* value) override;
 
+  // Get values of many keys by one batched index search, values of the
+  // same segment are read together in record id order.
+  // values[i] and statuses[i] are for keys[i]
+  std::vector<Status> MultiGet(const ReadOptions& options,
+                               const std::vector<Slice>& keys,
+                               std::vector<std::string>* values);
+
+  // Same as above, but values are not copied if possible
+  void MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                PinnableSlice* values, Status* statuses);
+
 #if HAVE_BASHOLEVELDB
   virtual Status Get(const ReadOptions& options, const Slice& key, Value* value);
 #endif
@@ -357,6 +393,7 @@ public:
   void ResumeCompactions() override;
 
   terark::db::DbContext* GetDbContext();
+  terark::db::DbContext* GetDbContext(const ReadOptions &options);
 
   terark::db::DbTablePtr m_tab;
 private:
@@ -369,6 +406,12 @@ private:
   OperationContext* GetContext();
   OperationContext* GetContext(const ReadOptions &options);
 
+  void MultiGetImpl(terark::db::DbContext* ctx, size_t n, const Slice* keys,
+                    terark::valvec<terark::valvec<unsigned char> >* bufs,
+                    terark::valvec<unsigned char>* found,
+                    terark::valvec<terark::fstring>* vals,
+                    terark::valvec<terark::db::ReadableSegmentPtr>* pins);
+
   // No copying allowed
   DbImpl(const DbImpl&);
   void operator=(const DbImpl&);
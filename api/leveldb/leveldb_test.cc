@@ -105,6 +105,52 @@ extern "C" int main() {
   db->ReleaseReplayIterator(replay_last);
 #endif
 
+  // A snapshot does not see writes after it was taken
+  cout << "Snapshot isolation" << endl;
+  {
+    std::string value;
+    const leveldb::Snapshot* snap = db->GetSnapshot();
+    leveldb::ReadOptions snap_options;
+    snap_options.snapshot = snap;
+    s = db->Put(leveldb::WriteOptions(), "key", "value-new");
+    assert(s.ok());
+    s = db->Delete(leveldb::WriteOptions(), "key2");
+    assert(s.ok());
+    s = db->Put(leveldb::WriteOptions(), "key7", "value7");
+    assert(s.ok());
+
+    s = db->Get(snap_options, "key", &value);
+    assert(s.ok() && value == "value");
+    s = db->Get(snap_options, "key2", &value);
+    assert(s.ok() && value == "value2");
+    s = db->Get(snap_options, "key7", &value);
+    assert(s.IsNotFound());
+
+    s = db->Get(leveldb::ReadOptions(), "key", &value);
+    assert(s.ok() && value == "value-new");
+    s = db->Get(leveldb::ReadOptions(), "key2", &value);
+    assert(s.IsNotFound());
+    s = db->Get(leveldb::ReadOptions(), "key7", &value);
+    assert(s.ok() && value == "value7");
+
+    int count = 0;
+    leveldb::Iterator* snap_iter = db->NewIterator(snap_options);
+    for (snap_iter->SeekToFirst(); snap_iter->Valid(); snap_iter->Next()) {
+      assert(snap_iter->key().ToString() != "key7");
+      if (snap_iter->key().ToString() == "key")
+        assert(snap_iter->value().ToString() == "value");
+      count++;
+    }
+    assert(snap_iter->status().ok());
+    delete snap_iter;
+    db->ReleaseSnapshot(snap);
+    assert(count >= 4); // key, key2 deleted after the snapshot, key3, key4
+    (void)count;
+
+    s = db->Put(leveldb::WriteOptions(), "key2", "value2");
+    assert(s.ok());
+  }
+
   // Read through the main database
   cout << "Read main database:" << endl;
   leveldb::ReadOptions read_options;
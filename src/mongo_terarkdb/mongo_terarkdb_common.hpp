@@ -16,6 +16,7 @@
 #include <mongo/db/storage/recovery_unit.h>
 #include <mongo/bson/bsonobjbuilder.h>
 #include <boost/filesystem.hpp>
+#include <atomic>
 #include <thread>
 #include <tbb/enumerable_thread_specific.h>
 #include <terark/db/db_table.hpp>
@@ -95,6 +96,11 @@ public:
 	gold_hash_map<llong, MVCCTime> m_records;
 	TableThreadDataPtr   m_ttd;
 	ThreadSafeTable*     m_tst;
+	// read snapshot of the recovery unit, pinned by its first cursor, NULL
+	// if recovery unit snapshots are disabled, see pinRecoveryUnitSnapshot
+	terark::db::DbContextPtr m_snapshotCtx;
+	terark::db::DbContextPtr m_sharedSnapshot;
+	SnapshotId m_snapshotId; // of the recovery unit when m_snapshotCtx is pinned
 	uint32_t m_iterNum;
 	uint32_t m_mvccTime;
 	explicit RecoveryUnitData(ThreadSafeTable* tst);
@@ -111,6 +117,7 @@ public:
 
 	RuStoreIteratorBase(RecoveryUnit* ru, ThreadSafeTable* tst);
 	~RuStoreIteratorBase();
+	terark::db::DbContext* getReadCtx() const;
 	bool getVal(llong id, valvec<unsigned char>* val) const;
 	void traceFunc(const char* func) const;
 };
@@ -145,6 +152,26 @@ public:
 	void rollbackDelete(RecoveryUnit*, RecordId id);
 
 	RuStoreIteratorBase* createStoreIter(RecoveryUnit*, bool forward);
+	// forward iterator of ids in [beginId, endId), for parallel scan
+	RuStoreIteratorBase* createStoreIterRange(RecoveryUnit*, llong beginId, llong endId);
+	// random sample iterator, see DbTable::createRandomIter
+	RuStoreIteratorBase* createRandomIter(RecoveryUnit*);
+
+	// recovery unit snapshots, enabled by env
+	// ThreadSafeTable_recoveryUnitSnapshot, cursors of a recovery unit read
+	// the snapshot pinned by its first cursor, rows written by the recovery
+	// unit itself are read from m_records
+	bool isRecoveryUnitSnapshotEnabled() const { return m_ruSnapshot; }
+	// the snapshot is pinned again when the recovery unit has abandoned
+	// the snapshot which rud has pinned
+	void pinRecoveryUnitSnapshot(RecoveryUnit*, RecoveryUnitData*);
+	void releaseSharedSnapshot(terark::db::DbContextPtr& snapshot);
+	// pin ctx of an index cursor to the snapshot of ru
+	RecoveryUnitDataPtr pinIndexIterSnapshot(RecoveryUnit*, IndexIterData*);
+	void unpinIndexIterSnapshot(RecoveryUnit*, RecoveryUnitDataPtr&);
+	// must be called after each write which may change rows visible to a
+	// new snapshot, a shared snapshot is reused until the next write
+	void bumpWriteSeq() { m_writeSeq.fetch_add(1, std::memory_order_release); }
 
 	void registerCleanOnOwnerDead(ICleanOnOwnerDead*);
 	void unregisterCleanOnOwnerDead(ICleanOnOwnerDead*);
@@ -161,6 +188,14 @@ protected:
 	std::mutex m_ruMapMutex;
 	gold_hash_map<RecoveryUnit*, RecoveryUnitDataPtr> m_ruMap;
 
+	// pinSnapshot freezes a non-empty writing segment, so a new snapshot
+	// is pinned only when the table was written after the shared one
+	bool m_ruSnapshot;
+	std::atomic<llong> m_writeSeq;
+	std::mutex m_snapshotMutex;
+	terark::db::DbContextPtr m_sharedSnapshot;
+	llong m_sharedSnapshotWriteSeq;
+
 	std::mutex m_dangerSubObjectsMutex;
 	terark::gold_hash_set<ICleanOnOwnerDead*> m_dangerSubObjects;
 };
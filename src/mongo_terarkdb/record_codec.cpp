@@ -13,6 +13,7 @@
 
 #include <mongo/util/log.h>
 #include <mongo/bson/bsonobjbuilder.h>
+#include <mongo/db/storage/index_entry_comparison.h>
 #include <mongo/util/hex.h>
 #include <terark/io/DataIO.hpp>
 #include <terark/io/MemStream.hpp>
@@ -1445,149 +1446,160 @@ SchemaRecordCoder::decode(const Schema* schema, terark::fstring encoded) {
 /////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////
 
-void encodeIndexKey(const Schema& indexSchema,
-					const BSONObj& bson,
-					terark::valvec<char>* encoded) {
-	LOG(3) << "encodeIndexKey: bson=" << bson.toString();
-	encoded->erase_all();
+// encode elem as the i'th column of indexSchema
+//@returns false if elem is an empty object which terminates the key
+static bool
+encodeIndexKeyElem(const Schema& indexSchema, size_t i,
+				   const BSONElement& elem, terark::valvec<char>* encoded) {
 	using terark::db::ColumnType;
-	BSONObj::iterator iter = bson.begin();
 	const size_t colnum = indexSchema.m_columnsMeta.end_i();
-	for(size_t i = 0; i < colnum; ++i) {
-		fstring     colname = indexSchema.m_columnsMeta.key(i);
-		const auto& colmeta = indexSchema.m_columnsMeta.val(i);
-		assert(!colname.empty());
-		BSONElement elem(iter.next());
-		const char* value = elem.value();
-		switch (elem.type()) {
-		case EOO:
-			break;
-		case Undefined:
-		case jstNULL:
-			encodeMissingField(colmeta, encoded);
-			break;
-		case MaxKey:
-			encodeMaxValueField(colmeta, encoded);
-			break;
-		case MinKey:
+	const auto& colmeta = indexSchema.m_columnsMeta.val(i);
+	assert(!indexSchema.m_columnsMeta.key(i).empty());
+	const char* value = elem.value();
+	switch (elem.type()) {
+	case EOO:
+		break;
+	case Undefined:
+	case jstNULL:
+		encodeMissingField(colmeta, encoded);
+		break;
+	case MaxKey:
+		encodeMaxValueField(colmeta, encoded);
+		break;
+	case MinKey:
+		encodeMinValueField(colmeta, encoded);
+		break;
+	case mongo::Bool:
+		if (mongo::Date == colmeta.mongoType) {
+			// bullshit mongodb use bool=true as minkey for Date
 			encodeMinValueField(colmeta, encoded);
+		}
+		else {
+			encoded->push_back(value[0] ? 1 : 0);
+			assert(ColumnType::Uint08 == colmeta.type);
+		}
+		break;
+	case NumberInt:
+		encodeConvertFrom<int32_t>(colmeta.type, value, encoded, colnum-1 == i);
+		break;
+	case NumberDouble:
+		encodeConvertFromDouble(colmeta.type, value, encoded, colnum-1 == i);
+		break;
+	case NumberLong:
+		encodeConvertFrom<int64_t>(colmeta.type, value, encoded, colnum-1 == i);
+		break;
+	case bsonTimestamp: // low 32 bit is always positive
+		encoded->append(value, 8);
+		break;
+	case mongo::Date:
+		switch (colmeta.type) {
+		default:
+			invariant(!"SchemaRecordCoder::decode: mongo::Date must map to one of terark sint32, uint32, sint64, uint64");
 			break;
-		case mongo::Bool:
-			if (mongo::Date == colmeta.mongoType) {
-				// bullshit mongodb use bool=true as minkey for Date
-				encodeMinValueField(colmeta, encoded);
-			}
-			else {
-				encoded->push_back(value[0] ? 1 : 0);
-				assert(ColumnType::Uint08 == colmeta.type);
+		case ColumnType::Sint32:
+		case ColumnType::Uint32:
+			{
+				int64_t millisec = ConstDataView(value).read<LittleEndian<int64_t>>();
+				int32_t sec = int32_t(millisec / 1000);
+				DataView(encoded->grow_no_init(4)).write(sec);
 			}
 			break;
-		case NumberInt:
-			encodeConvertFrom<int32_t>(colmeta.type, value, encoded, colnum-1 == i);
-			break;
-		case NumberDouble:
-			encodeConvertFromDouble(colmeta.type, value, encoded, colnum-1 == i);
-			break;
-		case NumberLong:
-			encodeConvertFrom<int64_t>(colmeta.type, value, encoded, colnum-1 == i);
-			break;
-		case bsonTimestamp: // low 32 bit is always positive
+		case ColumnType::Sint64:
+		case ColumnType::Uint64:
 			encoded->append(value, 8);
 			break;
-		case mongo::Date:
-			switch (colmeta.type) {
-			default:
-				invariant(!"SchemaRecordCoder::decode: mongo::Date must map to one of terark sint32, uint32, sint64, uint64");
-				break;
-			case ColumnType::Sint32:
-			case ColumnType::Uint32:
-				{
-					int64_t millisec = ConstDataView(value).read<LittleEndian<int64_t>>();
-					int32_t sec = int32_t(millisec / 1000);
-					DataView(encoded->grow_no_init(4)).write(sec);
-				}
-				break;
-			case ColumnType::Sint64:
-			case ColumnType::Uint64:
-				encoded->append(value, 8);
-				break;
-			}
-			break;
-		case jstOID:
-		//	log() << "encode: OID=" << toHexLower(value, OID::kOIDSize);
-			encoded->append(value, OID::kOIDSize);
-			assert(colmeta.type == ColumnType::Fixed);
-			assert(colmeta.fixedLen == OID::kOIDSize);
-			break;
-		case Symbol:
-		case Code:
-		case mongo::String:
-		//	log() << "encode: strlen+1=" << elem.valuestrsize() << ", str=" << elem.valuestr();
-			if (colmeta.type == ColumnType::StrZero) {
-				encoded->append(value + 4, elem.valuestrsize());
-			}
-			else {
-				encodeConvertString(colmeta.type, value + 4, encoded);
-			}
-			break;
-		case DBRef:
-			assert(0); // deprecated, should not in data
-			encoded->append(value + 4, elem.valuestrsize() + OID::kOIDSize);
-			break;
-		case mongo::Array:
-			abort(); // not supported
-			break;
-		case Object:
-			if (0 == i && elem.embeddedObject().isEmpty()) {
-				return; // done, empty object
-			}
-			abort(); // not supported
-			assert(colmeta.type == ColumnType::CarBin);
-			break;
-		case CodeWScope:
-			assert(indexSchema.getColumnType(i) == ColumnType::CarBin);
-			abort(); // not supported
-			break;
-		case BinData:
-			if (colmeta.type == ColumnType::CarBin) {
-				if (colnum-1 == i) {
-					uint32_t len = elem.valuestrsize();
-					DataView(encoded->grow_no_init(4)).write(len);
-					encoded->append(value + 4, len);
-				}
-				else {
-					THROW_STD(invalid_argument,
-						"mongo::BinData could'nt not be non-last field of an index key");
-				}
-			}
-			else if (colmeta.type == ColumnType::StrZero) {
-				BsonBinDataToTerarkStrZero(elem, *encoded, colnum-1 == i);
+		}
+		break;
+	case jstOID:
+	//	log() << "encode: OID=" << toHexLower(value, OID::kOIDSize);
+		encoded->append(value, OID::kOIDSize);
+		assert(colmeta.type == ColumnType::Fixed);
+		assert(colmeta.fixedLen == OID::kOIDSize);
+		break;
+	case Symbol:
+	case Code:
+	case mongo::String:
+	//	log() << "encode: strlen+1=" << elem.valuestrsize() << ", str=" << elem.valuestr();
+		if (colmeta.type == ColumnType::StrZero) {
+			encoded->append(value + 4, elem.valuestrsize());
+		}
+		else {
+			encodeConvertString(colmeta.type, value + 4, encoded);
+		}
+		break;
+	case DBRef:
+		assert(0); // deprecated, should not in data
+		encoded->append(value + 4, elem.valuestrsize() + OID::kOIDSize);
+		break;
+	case mongo::Array:
+		abort(); // not supported
+		break;
+	case Object:
+		if (0 == i && elem.embeddedObject().isEmpty()) {
+			return false; // done, empty object
+		}
+		abort(); // not supported
+		assert(colmeta.type == ColumnType::CarBin);
+		break;
+	case CodeWScope:
+		assert(indexSchema.getColumnType(i) == ColumnType::CarBin);
+		abort(); // not supported
+		break;
+	case BinData:
+		if (colmeta.type == ColumnType::CarBin) {
+			if (colnum-1 == i) {
+				uint32_t len = elem.valuestrsize();
+				DataView(encoded->grow_no_init(4)).write(len);
+				encoded->append(value + 4, len);
 			}
 			else {
 				THROW_STD(invalid_argument,
-					"mongo::BinData must be terarkdb CarBin or StrZero");
-			}
-			break;
-		case RegEx:
-			{
-				const char* p = value;
-				size_t len1 = strlen(p); // regex len
-				p += len1 + 1;
-				size_t len2 = strlen(p);
-				encoded->append(p, len1 + 1 + len2 + 1);
-			}
-			assert(colmeta.type == ColumnType::TwoStrZero);
-			break;
-		default:
-			{
-				StringBuilder ss;
-				ss << BOOST_CURRENT_FUNCTION
-				   << ": BSONElement: bad elem.type " << (int)elem.type();
-				std::string msg = ss.str();
-			//	damnbrain(314159269, msg.c_str(), false);
-				throw std::invalid_argument(msg);
+					"mongo::BinData could'nt not be non-last field of an index key");
 			}
 		}
+		else if (colmeta.type == ColumnType::StrZero) {
+			BsonBinDataToTerarkStrZero(elem, *encoded, colnum-1 == i);
+		}
+		else {
+			THROW_STD(invalid_argument,
+				"mongo::BinData must be terarkdb CarBin or StrZero");
+		}
+		break;
+	case RegEx:
+		{
+			const char* p = value;
+			size_t len1 = strlen(p); // regex len
+			p += len1 + 1;
+			size_t len2 = strlen(p);
+			encoded->append(p, len1 + 1 + len2 + 1);
+		}
+		assert(colmeta.type == ColumnType::TwoStrZero);
+		break;
+	default:
+		{
+			StringBuilder ss;
+			ss << BOOST_CURRENT_FUNCTION
+			   << ": BSONElement: bad elem.type " << (int)elem.type();
+			std::string msg = ss.str();
+		//	damnbrain(314159269, msg.c_str(), false);
+			throw std::invalid_argument(msg);
+		}
+	}
+	return true;
+}
+
+void encodeIndexKey(const Schema& indexSchema,
+					const BSONObj& bson,
+					terark::valvec<char>* encoded) {
+	LOG(3) << "encodeIndexKey: bson=" << bson.toString();
+	encoded->erase_all();
+	using terark::db::ColumnType;
+	BSONObj::iterator iter = bson.begin();
+	const size_t colnum = indexSchema.m_columnsMeta.end_i();
+	for(size_t i = 0; i < colnum; ++i) {
+		BSONElement elem(iter.next());
+		if (!encodeIndexKeyElem(indexSchema, i, elem, encoded))
+			return;
 	}
 	if (indexSchema.getColumnType(indexSchema.columnNum()-1) == ColumnType::StrZero) {
 		invariant(0 == encoded->back());
@@ -1595,6 +1607,62 @@ void encodeIndexKey(const Schema& indexSchema,
 	}
 }
 
+// encode seekPoint without building the query bson of makeQueryObject:
+// fields are encoded up to and including the exclusive field, the columns
+// after an exclusive field are padded with their max value (forward) or min
+// value (backward), so all keys which have the exclusive prefix sort before
+// (forward) or after (backward) the encoded key
+//@returns true if the seek is exclusive, then the cursor must be positioned
+//         by seekUpperBound, else by seekLowerBound
+bool encodeIndexSeekPoint(const Schema& indexSchema,
+						  const IndexSeekPoint& seekPoint,
+						  bool forward,
+						  terark::valvec<char>* encoded) {
+	encoded->erase_all();
+	using terark::db::ColumnType;
+	const size_t colnum = indexSchema.m_columnsMeta.end_i();
+	const size_t prefixLen = std::min(size_t(seekPoint.prefixLen), colnum);
+	bool exclusive = false;
+	size_t i = 0;
+	BSONObjIterator iter(seekPoint.keyPrefix);
+	for (; i < prefixLen; ++i) {
+		BSONElement elem(iter.next());
+		if (!encodeIndexKeyElem(indexSchema, i, elem, encoded))
+			return false;
+	}
+	if (seekPoint.prefixExclusive) {
+		invariant(prefixLen > 0);
+		exclusive = true; // suffix is never used
+	}
+	else {
+		const size_t suffixLen = std::min(seekPoint.keySuffix.size(), colnum);
+		for (; i < suffixLen; ++i) {
+			invariant(seekPoint.keySuffix[i]);
+			if (!encodeIndexKeyElem(indexSchema, i, *seekPoint.keySuffix[i], encoded))
+				return false;
+			if (!seekPoint.suffixInclusive[i]) {
+				++i;
+				exclusive = true;
+				break; // fields after an exclusive field never matter
+			}
+		}
+	}
+	if (exclusive) {
+		for (; i < colnum; ++i) {
+			const auto& colmeta = indexSchema.m_columnsMeta.val(i);
+			if (forward)
+				encodeMaxValueField(colmeta, encoded);
+			else
+				encodeMinValueField(colmeta, encoded);
+		}
+	}
+	if (colnum == i && indexSchema.getColumnType(colnum-1) == ColumnType::StrZero) {
+		invariant(0 == encoded->back());
+		encoded->pop_back(); // key data don't include ending '\0'
+	}
+	return exclusive;
+}
+
 void encodeIndexKey(const Schema& indexSchema,
 					const BSONObj& bson,
 					terark::valvec<unsigned char>* encoded) {
@@ -12,7 +12,11 @@
 #include <terark/db/db_conf.hpp>
 #include <terark/db/db_segment.hpp>
 
-namespace mongo { namespace terarkdb {
+namespace mongo {
+
+struct IndexSeekPoint;
+
+namespace terarkdb {
 
 using terark::db::Schema;
 using terark::db::SchemaPtr;
@@ -60,6 +64,10 @@ void encodeIndexKey(const Schema& indexSchema,
 void encodeIndexKey(const Schema& indexSchema,
 					const BSONObj& bson,
 					terark::valvec<unsigned char>* encoded);
+bool encodeIndexSeekPoint(const Schema& indexSchema,
+						  const IndexSeekPoint& seekPoint,
+						  bool forward,
+						  terark::valvec<char>* encoded);
 
 SharedBuffer
 decodeIndexKey(const Schema& indexSchema, const char* data, size_t size);
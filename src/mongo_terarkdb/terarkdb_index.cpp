@@ -297,14 +297,32 @@ TerarkDbIndex::insertIndexKey(const BSONObj& newKey, const RecordId& id, bool du
  */
 class TerarkDbIndexCursorBase : public SortedDataInterface::Cursor, public ICleanOnOwnerDead {
 	IndexIterData* getCursor() const {
-		if (terark_likely(_cursor.get() != nullptr))
+		if (terark_likely(_cursor.get() != nullptr)) {
+			if (terark_unlikely(!_rud))
+				pinCursorSnapshot(); // unpinned by save()
 			return _cursor.get();
-		_cursor = _idx.m_table->allocIndexIter(_idx.m_indexId, _forward);
+		}
+		auto tst = _idx.m_table.get();
+		_cursor = tst->allocIndexIter(_idx.m_indexId, _forward);
+		pinCursorSnapshot();
 		return _cursor.get();
 	}
+	// read the snapshot of the recovery unit, the cursor is reset
+	void pinCursorSnapshot() const {
+		auto tst = _idx.m_table.get();
+		if (_txn && _txn->recoveryUnit() && tst->isRecoveryUnitSnapshotEnabled()) {
+			_snapshotRu = _txn->recoveryUnit();
+			_rud = tst->pinIndexIterSnapshot(_snapshotRu, _cursor.get());
+		}
+	}
+	void unpinCursorSnapshot() {
+		if (_rud)
+			_idx.m_table->unpinIndexIterSnapshot(_snapshotRu, _rud);
+	}
 	void releaseCursor() {
 		if (_cursor)
 			_idx.m_table->releaseIndexIter(_idx.m_indexId, _forward, std::move(_cursor));
+		unpinCursorSnapshot();
 	}
 public:
     TerarkDbIndexCursorBase(const TerarkDbIndex& idx, OperationContext* txn, bool forward)
@@ -320,6 +338,7 @@ public:
 	}
 	void onOwnerPrematureDeath() override final {
 		_cursor = nullptr;
+		_rud = nullptr;
 		m_isOwnerAlive = false;
 	}
     boost::optional<IndexKeyEntry> next(RequestedInfo parts) override {
@@ -392,11 +411,14 @@ public:
 
     boost::optional<IndexKeyEntry> seek(const IndexSeekPoint& seekPoint,
                                         RequestedInfo parts) override {
-        // TODO: don't go to a bson obj then to a KeyString, go straight
-        // makeQueryObject handles the discriminator in the real exclusive cases.
-        BSONObj key = IndexEntryComparison::makeQueryObject(seekPoint, _forward);
-        TRACE_CURSOR << "seek2(): key=" << key.jsonString();
-        seekWTCursor(key, true);
+        // encode seekPoint straight to the index key, without the temporary
+        // bson of makeQueryObject(seekPoint, _forward)
+        auto indexSchema = _idx.getIndexSchema();
+        auto cur = getCursor();
+        bool exclusive = encodeIndexSeekPoint(*indexSchema, seekPoint, _forward, &cur->m_qryKey);
+        TRACE_CURSOR << "seek2(): key=" << indexSchema->toJsonStr(cur->m_qryKey)
+                     << ", exclusive=" << exclusive;
+        seekWTCursor(!exclusive);
         updatePosition();
 		if (!_cursorAtEof)
 			return curr(parts);
@@ -408,8 +430,12 @@ public:
 	seekExact(const BSONObj& bsonKey, RequestedInfo parts) override {
         TRACE_CURSOR << "seekExact(): key=" << bsonKey.jsonString();
 		auto& ttd = _idx.m_table->getMyThreadData();
-		auto& ctx = *ttd.m_dbCtx;
 		auto  indexSchema = _idx.getIndexSchema();
+		terark::db::DbContext* pctx = ttd.m_dbCtx.get();
+		if (_txn && _txn->recoveryUnit() && _idx.m_table->isRecoveryUnitSnapshotEnabled()) {
+			pctx = getCursor()->m_ctx.get(); // pinned to the snapshot
+		}
+		auto& ctx = *pctx;
 		if (_cursor) {
 			_cursor->m_ctx->trySyncSegCtxSpeculativeLock(ctx.m_tab);
 		}
@@ -431,6 +457,9 @@ public:
             // Ignore since this is only called when we are about to kill our transaction
             // anyway.
         }
+        // the snapshot may be abandoned before restore(), which pins the
+        // snapshot of the recovery unit again
+        unpinCursorSnapshot();
         // Our saved position is wherever we were when we last called updatePosition().
         // Any partially completed repositions should not effect our saved position.
     }
@@ -477,11 +506,13 @@ protected:
             return {};
         dassert(!_id.isNull());
 		invariant(nullptr != _cursor);
+        // key is decoded only when it is requested, even in tracing
         BSONObj bson;
-        if (TRACING_ENABLED || (parts & kWantKey)) {
+        if (parts & kWantKey) {
             bson = BSONObj(decodeIndexKey(*_idx.getIndexSchema(), _cursor->m_curKey));
-            TRACE_CURSOR << "curr() returning " << bson << ' ' << _id;
         }
+        TRACE_CURSOR << "curr() returning "
+            << _idx.getIndexSchema()->toJsonStr(_cursor->m_curKey) << ' ' << _id;
         return {{std::move(bson), _id}};
     }
 
@@ -576,6 +607,8 @@ protected:
     OperationContext*  _txn;
     const TerarkDbIndex& _idx;  // not owned
     mutable IndexIterDataPtr  _cursor;
+    mutable RecoveryUnit*        _snapshotRu = nullptr;
+    mutable RecoveryUnitDataPtr  _rud; // non-null if _cursor is pinned
 
     // These are where this cursor instance is. They are not changed in the face of a failing
     // next().
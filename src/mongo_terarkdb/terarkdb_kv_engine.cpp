@@ -124,6 +124,9 @@ ThreadSafeTable::ThreadSafeTable(const fs::path& dbPath) {
 	m_indexForwardIterCache.resize(m_tab->getIndexNum());
 	m_indexBackwardIterCache.resize(m_tab->getIndexNum());
 	m_cacheExpireMillisec = terark::getEnvLong("ThreadSafeTable_cacheExpireMillisec", 5 * 1000);
+	m_ruSnapshot = terark::getEnvBool("ThreadSafeTable_recoveryUnitSnapshot", false);
+	m_writeSeq = 0;
+	m_sharedSnapshotWriteSeq = -1;
 }
 
 ThreadSafeTable::~ThreadSafeTable() {
@@ -210,6 +213,7 @@ void ThreadSafeTable::releaseIndexIter(size_t indexId, bool forward, IndexIterDa
 	assert(indexId < m_indexForwardIterCache.size());
 	assert(m_indexForwardIterCache.size() == m_indexBackwardIterCache.size());
 	llong now = g_profiling.now();
+	m_tab->unpinSnapshot(iter->m_ctx.get());
 	iter->reset(now);
 	std::unique_lock<std::mutex> lock(m_cursorCacheMutex);
 	expiringCacheItems(m_indexForwardIterCache, now);
@@ -235,6 +239,7 @@ void ThreadSafeTable::destroy() {
 		m_dangerSubObjects.clear();
 	}
 	m_ruMap.clear();
+	m_sharedSnapshot = nullptr;
 	m_indexForwardIterCache.clear();
 	m_indexBackwardIterCache.clear();
 	m_cursorCache.clear();
@@ -262,6 +267,10 @@ RecoveryUnitData::RecoveryUnitData(ThreadSafeTable* tst)
 
 RecoveryUnitData::~RecoveryUnitData() {
 	assert(m_ttd.get() != NULL);
+	if (m_sharedSnapshot) {
+		m_snapshotCtx = nullptr; // unpin
+		m_tst->releaseSharedSnapshot(m_sharedSnapshot);
+	}
 	m_tst->releaseTableThreadData(std::move(m_ttd));
 	assert(m_ttd.get() == NULL);
 }
@@ -303,6 +312,83 @@ void ThreadSafeTable::removeRecoveryUnitData(RecoveryUnit* ru) {
 		<< ", ru = " << (void*)ru
 		<< ", dir: " << m_tab->getDir().string();
 }
+// DbTable::pinSnapshot is never called in m_snapshotMutex, a recovery unit
+// which finds no reusable shared snapshot pins its own and publishes it
+void ThreadSafeTable::pinRecoveryUnitSnapshot(RecoveryUnit* ru, RecoveryUnitData* rud) {
+	if (!m_ruSnapshot) {
+		return;
+	}
+	// ru is the WiredTiger recovery unit (TerarkDbRecoveryUnit is compiled
+	// out), its snapshot id changes on commit, abort and abandonSnapshot
+	SnapshotId snapshotId = ru->getSnapshotId();
+	if (rud->m_snapshotCtx) {
+		if (rud->m_snapshotId == snapshotId) {
+			return;
+		}
+		LOG(2) << "ThreadSafeTable::pinRecoveryUnitSnapshot(): snapshot is abandoned"
+			<< ", ru = " << (void*)ru;
+		rud->m_snapshotCtx = nullptr; // unpin
+		releaseSharedSnapshot(rud->m_sharedSnapshot);
+	}
+	llong writeSeq = m_writeSeq.load(std::memory_order_acquire);
+	terark::db::DbContextPtr shared;
+	{
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		if (m_sharedSnapshot && m_sharedSnapshotWriteSeq == writeSeq) {
+			shared = m_sharedSnapshot;
+		}
+	}
+	if (!shared) {
+		shared = m_tab->createDbContext();
+		m_tab->pinSnapshot(shared.get());
+		LOG(2) << "ThreadSafeTable::pinRecoveryUnitSnapshot(): new snapshot, version = "
+			<< shared->m_mySnapshotVersion
+			<< ", dir: " << m_tab->getDir().string();
+		terark::db::DbContextPtr old; // unpinned out of m_snapshotMutex
+		std::lock_guard<std::mutex> lock(m_snapshotMutex);
+		if (!m_sharedSnapshot || m_sharedSnapshotWriteSeq < writeSeq) {
+			old.swap(m_sharedSnapshot);
+			m_sharedSnapshot = shared;
+			m_sharedSnapshotWriteSeq = writeSeq;
+		}
+	}
+	rud->m_sharedSnapshot = shared;
+	rud->m_snapshotCtx = m_tab->createDbContext();
+	rud->m_snapshotId = snapshotId;
+	m_tab->pinSnapshot(rud->m_snapshotCtx.get(), shared.get());
+}
+
+// the shared snapshot is unpinned when no recovery unit uses it, so deleted
+// rows can be purged
+void ThreadSafeTable::releaseSharedSnapshot(terark::db::DbContextPtr& snapshot) {
+	terark::db::DbContextPtr mine, unused; // unpinned out of m_snapshotMutex
+	mine.swap(snapshot);
+	std::lock_guard<std::mutex> lock(m_snapshotMutex);
+	if (mine && m_sharedSnapshot == mine && 2 == mine->get_refcount()) {
+		unused.swap(m_sharedSnapshot);
+	}
+}
+
+RecoveryUnitDataPtr
+ThreadSafeTable::pinIndexIterSnapshot(RecoveryUnit* ru, IndexIterData* iter) {
+	if (!m_ruSnapshot) {
+		return NULL;
+	}
+	RecoveryUnitDataPtr rud = getRecoveryUnitData(ru);
+	rud->m_iterNum++;
+	pinRecoveryUnitSnapshot(ru, rud.get());
+	m_tab->pinSnapshot(iter->m_ctx.get(), rud->m_snapshotCtx.get());
+	iter->m_cursor->reset();
+	return rud;
+}
+
+void ThreadSafeTable::unpinIndexIterSnapshot(RecoveryUnit* ru, RecoveryUnitDataPtr& rud) {
+	if (0 == --rud->m_iterNum && rud->m_records.size() == 0) {
+		removeRecoveryUnitData(ru);
+	}
+	rud = nullptr;
+}
+
 void ThreadSafeTable::removeRegisterEntry(RecoveryUnit* ru, RecoveryUnitData* rud, size_t f) {
 	invariant(rud->m_records.size() > 0);
 	if (rud->m_records.size() == 1 && 0 == rud->m_iterNum) {
@@ -373,6 +459,7 @@ void ThreadSafeTable::commitInsert(RecoveryUnit* ru, RecordId id) {
 		<< ", dir: " << m_tab->getDir().string();
 	if (UINT32_MAX == v.deleteTime) {
 		m_tab->delmarkSet0(recIdx); //!!!!
+		bumpWriteSeq();
 		removeRegisterEntry(ru, rud, f);
 	}
 	else {
@@ -438,6 +525,7 @@ void ThreadSafeTable::commitDelete(RecoveryUnit* ru, RecordId id) {
 			// do nothing
 		}
 	}
+	bumpWriteSeq();
 	removeRegisterEntry(ru, rud, f);
 }
 
@@ -479,12 +567,20 @@ RuStoreIteratorBase::RuStoreIteratorBase(RecoveryUnit* ru, ThreadSafeTable* tst)
 	m_rud = tst->getRecoveryUnitData(ru);
 	m_rud->m_iterNum++;
 	m_store = tst->m_tab.get();
+	tst->pinRecoveryUnitSnapshot(ru, m_rud.get());
 }
 RuStoreIteratorBase::~RuStoreIteratorBase() {
 	if (0 == --m_rud->m_iterNum && m_rud->m_records.size() == 0) {
 		m_tst->removeRecoveryUnitData(m_ru);
 	}
 }
+terark::db::DbContext* RuStoreIteratorBase::getReadCtx() const {
+	auto rud = m_rud.get();
+	if (rud->m_snapshotCtx)
+		return rud->m_snapshotCtx.get();
+	return rud->m_ttd->m_dbCtx.get();
+}
+
 bool RuStoreIteratorBase::getVal(llong id, valvec<unsigned char>* val) const {
 	auto tab = static_cast<DbTable*>(m_store.get());
 	auto rud = m_rud.get();
@@ -499,6 +595,14 @@ bool RuStoreIteratorBase::getVal(llong id, valvec<unsigned char>* val) const {
 			<< ", ru = " << (void*)m_ru;
 		return false;
 	}
+	if (auto snapshot = rud->m_snapshotCtx.get()) {
+		// rows written by others after the snapshot are invisible
+		if (snapshot->isVisibleInSnapshot(id)) {
+			tab->getValue(id, val, snapshot);
+			return true;
+		}
+		return false;
+	}
 	if (tab->exists(id)) {
 		tab->getValue(id, val, rud->m_ttd->m_dbCtx.get());
 		return true;
@@ -574,6 +678,110 @@ public:
 	}
 };
 
+// a part of a parallel scan
+class RuStoreIterRange : public RuStoreIteratorBase {
+	llong m_beginId;
+	llong m_endId;
+public:
+	RuStoreIterRange(RecoveryUnit* ru, ThreadSafeTable* tst, llong beginId, llong endId)
+		: RuStoreIteratorBase(ru, tst) {
+		m_beginId = beginId;
+		m_endId = endId;
+		m_id = beginId;
+		traceFunc("RuStoreIterRange::RuStoreIterRange()");
+	}
+	~RuStoreIterRange() {
+		traceFunc("RuStoreIterRange::~RuStoreIterRange()");
+	}
+	bool increment(llong* id, valvec<unsigned char>* val) override {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		llong endId = std::min(m_endId, tab->inlineGetRowNum());
+		while (m_id < endId) {
+			if (getVal(*id = m_id++, val))
+				return true;
+		}
+		return false;
+	}
+	bool seekExact(llong id, valvec<unsigned char>* val) {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		if (terark_unlikely(id < m_beginId || id >= m_endId ||
+							id >= tab->inlineGetRowNum())) {
+			return false;
+		}
+		m_id = id + 1;
+		return getVal(id, val);
+	}
+	llong seekLowerBound(llong id, valvec<unsigned char>* val) override {
+		m_id = std::max(id, m_beginId);
+		llong id2 = -1;
+		if (increment(&id2, val))
+			return id2;
+		return -1;
+	}
+	void reset() override {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		m_rud->m_ttd->m_dbCtx->trySyncSegCtxSpeculativeLock(tab);
+		m_id = m_beginId;
+	}
+};
+
+// random sample, rows deleted by this recovery unit are skipped, rows
+// inserted by it are delmarked in the table until commit, so they are
+// not sampled
+class RuStoreIterRandom : public RuStoreIteratorBase {
+	terark::db::StoreIteratorPtr m_iter;
+public:
+	RuStoreIterRandom(RecoveryUnit* ru, ThreadSafeTable* tst)
+		: RuStoreIteratorBase(ru, tst) {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		m_iter = tab->createRandomIter(getReadCtx());
+		traceFunc("RuStoreIterRandom::RuStoreIterRandom()");
+	}
+	~RuStoreIterRandom() {
+		traceFunc("RuStoreIterRandom::~RuStoreIterRandom()");
+	}
+	bool isDeletedByMe(llong id) const {
+		auto rud = m_rud.get();
+		size_t f = rud->m_records.find_i(id);
+		return f < rud->m_records.end_i() &&
+			   rud->m_records.val(f).deleteTime != UINT32_MAX;
+	}
+	bool increment(llong* id, valvec<unsigned char>* val) override {
+		const size_t MaxRetry = 64;
+		for (size_t i = 0; i < MaxRetry; ++i) {
+			if (!m_iter->increment(id, val))
+				return false;
+			if (!isDeletedByMe(*id))
+				return true;
+		}
+		// most samples are deleted by this recovery unit, take the first
+		// row after the last sample which is not, EOF only if none is left
+		auto tab = static_cast<DbTable*>(m_store.get());
+		llong rows = tab->inlineGetRowNum();
+		llong start = *id;
+		for (llong n = 1; n < rows; ++n) {
+			llong x = (start + n) % rows;
+			if (!isDeletedByMe(x) && m_iter->seekExact(x, val)) {
+				*id = x;
+				return true;
+			}
+		}
+		return false;
+	}
+	bool seekExact(llong id, valvec<unsigned char>* val) {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		if (terark_unlikely(id >= tab->inlineGetRowNum())) {
+			return false;
+		}
+		return getVal(id, val);
+	}
+	void reset() override {
+		auto tab = static_cast<DbTable*>(m_store.get());
+		m_rud->m_ttd->m_dbCtx->trySyncSegCtxSpeculativeLock(tab);
+		m_iter->reset();
+	}
+};
+
 RuStoreIteratorBase*
 ThreadSafeTable::createStoreIter(RecoveryUnit* ru, bool forward) {
 	if (forward)
@@ -582,6 +790,16 @@ ThreadSafeTable::createStoreIter(RecoveryUnit* ru, bool forward) {
 		return new RuStoreIterBackward(ru, this);
 }
 
+RuStoreIteratorBase*
+ThreadSafeTable::createStoreIterRange(RecoveryUnit* ru, llong beginId, llong endId) {
+	return new RuStoreIterRange(ru, this, beginId, endId);
+}
+
+RuStoreIteratorBase*
+ThreadSafeTable::createRandomIter(RecoveryUnit* ru) {
+	return new RuStoreIterRandom(ru, this);
+}
+
 void ThreadSafeTable::registerCleanOnOwnerDead(ICleanOnOwnerDead* p) {
 	std::lock_guard<std::mutex> lock(m_dangerSubObjectsMutex);
 	auto ib = m_dangerSubObjects.insert_i(p);
@@ -0,0 +1,169 @@
+// terarkdb_record_codec_test.cpp
+
+/**
+ *    Copyright (C) 2016 Terark Inc.
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *    As a special exception, the copyright holders give permission to link the
+ *    code of portions of this program with the OpenSSL library under certain
+ *    conditions as described in each individual source file and distribute
+ *    linked combinations including the program with the OpenSSL library. You
+ *    must comply with the GNU Affero General Public License in all respects for
+ *    all of the code used other than as permitted herein. If you modify file(s)
+ *    with this exception, you may extend this exception to your version of the
+ *    file(s), but you are not obligated to do so. If you do not wish to do so,
+ *    delete this exception statement from your version. If you delete this
+ *    exception statement from all source files in the program, then also delete
+ *    it in the license file.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include <climits>
+
+#include "mongo/bson/bsonobjbuilder.h"
+#include "mongo/db/storage/index_entry_comparison.h"
+#include "record_codec.h"
+#include "mongo/unittest/unittest.h"
+
+namespace mongo { namespace terarkdb {
+
+using terark::db::ColumnMeta;
+using terark::db::ColumnType;
+
+namespace {
+
+// index {a:1, b:1, c:1}, all fields are NumberLong
+SchemaPtr makeIndexSchema() {
+    SchemaPtr schema(new Schema());
+    const char* names[] = { "a", "b", "c" };
+    for (const char* name : names) {
+        ColumnMeta colmeta(ColumnType::Sint64);
+        colmeta.mongoType = NumberLong;
+        schema->m_columnsMeta.insert_i(name, colmeta);
+    }
+    schema->compile();
+    return schema;
+}
+
+terark::valvec<char> indexKey(const Schema& schema, long long a, long long b, long long c) {
+    terark::valvec<char> key;
+    encodeIndexKey(schema, BSON("" << a << "" << b << "" << c), &key);
+    return key;
+}
+
+int compareKey(const Schema& schema, const terark::valvec<char>& x,
+                                     const terark::valvec<char>& y) {
+    return schema.compareData(terark::fstring(x.data(), x.size()),
+                              terark::fstring(y.data(), y.size()));
+}
+
+}  // namespace
+
+TEST(TerarkDbRecordCodecTest, SeekPointInclusiveMatchesIndexKey) {
+    SchemaPtr schema = makeIndexSchema();
+    BSONObj prefix = BSON("" << 5LL);
+    BSONObj suffix = BSON("" << 0LL << "" << 7LL << "" << 9LL);
+    BSONObjIterator it(suffix);
+    BSONElement e0 = it.next(), e1 = it.next(), e2 = it.next();
+    IndexSeekPoint seekPoint;
+    seekPoint.keyPrefix = prefix;
+    seekPoint.prefixLen = 1;
+    seekPoint.prefixExclusive = false;
+    seekPoint.keySuffix = {&e0, &e1, &e2};
+    seekPoint.suffixInclusive = {true, true, true};
+
+    for (bool forward : {true, false}) {
+        terark::valvec<char> encoded;
+        ASSERT_FALSE(encodeIndexSeekPoint(*schema, seekPoint, forward, &encoded));
+        ASSERT_EQUALS(0, compareKey(*schema, encoded, indexKey(*schema, 5, 7, 9)));
+    }
+}
+
+TEST(TerarkDbRecordCodecTest, SeekPointPrefixExclusiveForward) {
+    SchemaPtr schema = makeIndexSchema();
+    IndexSeekPoint seekPoint;
+    seekPoint.keyPrefix = BSON("" << 5LL);
+    seekPoint.prefixLen = 1;
+    seekPoint.prefixExclusive = true;
+
+    terark::valvec<char> encoded;
+    ASSERT_TRUE(encodeIndexSeekPoint(*schema, seekPoint, true, &encoded));
+    // seekUpperBound must skip every key with a == 5
+    ASSERT_LTE(compareKey(*schema, indexKey(*schema, 5, LLONG_MIN, LLONG_MIN), encoded), 0);
+    ASSERT_LTE(compareKey(*schema, indexKey(*schema, 5, LLONG_MAX, LLONG_MAX), encoded), 0);
+    ASSERT_GT(compareKey(*schema, indexKey(*schema, 6, LLONG_MIN, LLONG_MIN), encoded), 0);
+}
+
+TEST(TerarkDbRecordCodecTest, SeekPointPrefixExclusiveBackward) {
+    SchemaPtr schema = makeIndexSchema();
+    IndexSeekPoint seekPoint;
+    seekPoint.keyPrefix = BSON("" << 5LL);
+    seekPoint.prefixLen = 1;
+    seekPoint.prefixExclusive = true;
+
+    terark::valvec<char> encoded;
+    ASSERT_TRUE(encodeIndexSeekPoint(*schema, seekPoint, false, &encoded));
+    // a reverse cursor must skip every key with a == 5
+    ASSERT_GTE(compareKey(*schema, indexKey(*schema, 5, LLONG_MIN, LLONG_MIN), encoded), 0);
+    ASSERT_GTE(compareKey(*schema, indexKey(*schema, 5, LLONG_MAX, LLONG_MAX), encoded), 0);
+    ASSERT_LT(compareKey(*schema, indexKey(*schema, 4, LLONG_MAX, LLONG_MAX), encoded), 0);
+}
+
+TEST(TerarkDbRecordCodecTest, SeekPointSuffixExclusivePadsRemainingFields) {
+    SchemaPtr schema = makeIndexSchema();
+    BSONObj suffix = BSON("" << 0LL << "" << 7LL << "" << 9LL);
+    BSONObjIterator it(suffix);
+    BSONElement e0 = it.next(), e1 = it.next(), e2 = it.next();
+    IndexSeekPoint seekPoint;
+    seekPoint.keyPrefix = BSON("" << 5LL);
+    seekPoint.prefixLen = 1;
+    seekPoint.prefixExclusive = false;
+    seekPoint.keySuffix = {&e0, &e1, &e2};
+    seekPoint.suffixInclusive = {true, false, true}; // c is never used
+
+    terark::valvec<char> forward, backward;
+    ASSERT_TRUE(encodeIndexSeekPoint(*schema, seekPoint, true, &forward));
+    ASSERT_EQUALS(0, compareKey(*schema, forward, indexKey(*schema, 5, 7, LLONG_MAX)));
+    ASSERT_GT(compareKey(*schema, indexKey(*schema, 5, 8, LLONG_MIN), forward), 0);
+
+    ASSERT_TRUE(encodeIndexSeekPoint(*schema, seekPoint, false, &backward));
+    ASSERT_EQUALS(0, compareKey(*schema, backward, indexKey(*schema, 5, 7, LLONG_MIN)));
+    ASSERT_LT(compareKey(*schema, indexKey(*schema, 5, 6, LLONG_MAX), backward), 0);
+}
+
+TEST(TerarkDbRecordCodecTest, SeekPointExclusiveLastFieldKeepsValue) {
+    SchemaPtr schema = makeIndexSchema();
+    BSONObj suffix = BSON("" << 0LL << "" << 7LL << "" << 9LL);
+    BSONObjIterator it(suffix);
+    BSONElement e0 = it.next(), e1 = it.next(), e2 = it.next();
+    IndexSeekPoint seekPoint;
+    seekPoint.keyPrefix = BSON("" << 5LL);
+    seekPoint.prefixLen = 1;
+    seekPoint.prefixExclusive = false;
+    seekPoint.keySuffix = {&e0, &e1, &e2};
+    seekPoint.suffixInclusive = {true, true, false};
+
+    // nothing is padded, the exclusive value itself is the seek key
+    terark::valvec<char> forward, backward;
+    ASSERT_TRUE(encodeIndexSeekPoint(*schema, seekPoint, true, &forward));
+    ASSERT_EQUALS(0, compareKey(*schema, forward, indexKey(*schema, 5, 7, 9)));
+    ASSERT_GT(compareKey(*schema, indexKey(*schema, 5, 7, 10), forward), 0);
+
+    ASSERT_TRUE(encodeIndexSeekPoint(*schema, seekPoint, false, &backward));
+    ASSERT_EQUALS(0, compareKey(*schema, backward, indexKey(*schema, 5, 7, 9)));
+    ASSERT_LT(compareKey(*schema, indexKey(*schema, 5, 7, 8), backward), 0);
+}
+
+} } // namespace mongo::terarkdb
@@ -62,6 +62,9 @@
 #include "mongo/util/scopeguard.h"
 #include "mongo/util/time_support.h"
 #include <boost/none.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <thread>
 
 //#define RS_ITERATOR_TRACE(x) log() << "TerarkDbRS::Iterator " << x
 #define RS_ITERATOR_TRACE(x)
@@ -95,11 +98,23 @@ public:
 		rs.m_table->registerCleanOnOwnerDead(this);
     }
 
+	// forward cursor of a part of parallel scan, record ids in [beginId, endId)
+    Cursor(OperationContext* txn, const TerarkDbRecordStore& rs, llong beginId, llong endId)
+        : _rs(rs),
+          _txn(txn), _forward(true), m_beginId(beginId), m_endId(endId) {
+		LOG(1) << "TerarkDbRecordStore::Cursor::Cursor(): beginId = " << beginId
+			<< ", endId = " << endId;
+		init(txn);
+		rs.m_table->registerCleanOnOwnerDead(this);
+    }
+
 	void init(OperationContext* txn) {
 		ThreadSafeTable* tst = _rs.m_table.get();
 		DbTable* tab = tst->m_tab.get();
 		if (txn && txn->recoveryUnit()) {
-			auto iter = tst->createStoreIter(txn->recoveryUnit(), _forward);
+			auto iter = m_endId >= 0
+				? tst->createStoreIterRange(txn->recoveryUnit(), m_beginId, m_endId)
+				: tst->createStoreIter(txn->recoveryUnit(), _forward);
 			_cursor = iter;
 			m_ttd = iter->m_rud->m_ttd;
 			m_hasRecoveryUnit = true;
@@ -107,7 +122,9 @@ public:
 		else {
 			m_hasRecoveryUnit = false;
 	    	m_ttd = tst->allocTableThreadData();
-    		if (_forward)
+			if (m_endId >= 0)
+				_cursor = tab->createStoreIterRange(m_beginId, m_endId, m_ttd->m_dbCtx.get());
+    		else if (_forward)
     			_cursor = tab->createStoreIterForward(m_ttd->m_dbCtx.get());
     		else
     			_cursor = tab->createStoreIterBackward(m_ttd->m_dbCtx.get());
@@ -301,11 +318,113 @@ private:
 	bool m_hasRecoveryUnit = false;
 	bool m_isOwnerAlive = true;
 	const bool _forward;
+	const llong m_beginId = 0;
+	const llong m_endId = -1; // -1 for whole table
 	TableThreadDataPtr m_ttd;
     terark::db::StoreIteratorPtr _cursor;
     RecordId _lastReturnedId;  // If null, need to seek to first/last record.
 };
 
+// each next() returns a random record, records are picked with replacement
+class TerarkDbRecordStore::RandomCursor final : public RecordCursor, public ICleanOnOwnerDead {
+public:
+    RandomCursor(OperationContext* txn, const TerarkDbRecordStore& rs)
+        : _rs(rs), _txn(txn) {
+		LOG(1) << "TerarkDbRecordStore::RandomCursor::RandomCursor()";
+		init(txn);
+		rs.m_table->registerCleanOnOwnerDead(this);
+    }
+
+	void init(OperationContext* txn) {
+		ThreadSafeTable* tst = _rs.m_table.get();
+		DbTable* tab = tst->m_tab.get();
+		if (txn && txn->recoveryUnit()) {
+			auto iter = tst->createRandomIter(txn->recoveryUnit());
+			_cursor = iter;
+			m_ttd = iter->m_rud->m_ttd;
+			m_hasRecoveryUnit = true;
+		}
+		else {
+			m_hasRecoveryUnit = false;
+	    	m_ttd = tst->allocTableThreadData();
+			_cursor = tab->createRandomIter(m_ttd->m_dbCtx.get());
+		}
+	}
+
+	~RandomCursor() {
+		LOG(1) << "TerarkDbRecordStore::RandomCursor::~RandomCursor(): m_isOwnerAlive = " << m_isOwnerAlive
+			<< ", m_hasRecoveryUnit = " << m_hasRecoveryUnit;
+		if (!m_isOwnerAlive) {
+			return;
+		}
+		ThreadSafeTable* tst = _rs.m_table.get();
+		if (m_ttd && !m_hasRecoveryUnit) {
+			tst->releaseTableThreadData(m_ttd);
+		}
+		m_ttd = nullptr;
+		_cursor = nullptr;
+		tst->unregisterCleanOnOwnerDead(this);
+	}
+
+	void onOwnerPrematureDeath() override final {
+		ThreadSafeTable* tst = _rs.m_table.get();
+		if (m_ttd && !m_hasRecoveryUnit) {
+			tst->releaseTableThreadData(m_ttd);
+		}
+		m_ttd = nullptr;
+		_cursor = nullptr;
+		m_isOwnerAlive = false;
+	}
+
+    boost::optional<Record> next() final {
+        llong recIdx = -1;
+        if (!_cursor->increment(&recIdx, &m_ttd->m_buf)) {
+            return {};
+        }
+		DbTable* tab = _rs.m_table->m_tab.get();
+        SharedBuffer sbuf = m_ttd->m_coder.decode(&tab->rowSchema(), m_ttd->m_buf);
+		int len = ConstDataView(sbuf.get()).read<LittleEndian<int>>();
+		const RecordId id(recIdx + 1);
+		LOG(2) << "TerarkDbRecordStore::RandomCursor::next(): id = " << id;
+		return {{id, {sbuf, len}}};
+    }
+
+    void save() final {
+        try {
+        	_cursor->reset();
+        } catch (const WriteConflictException&) {
+            // Ignore since this is only called when we are about to kill our transaction
+            // anyway.
+        }
+    }
+
+    bool restore() final {
+        return true;
+    }
+
+    void detachFromOperationContext() final {
+		if (m_ttd && !m_hasRecoveryUnit) {
+			_rs.m_table->releaseTableThreadData(m_ttd);
+		}
+		m_ttd = nullptr;
+        _txn = nullptr;
+		_cursor = nullptr;
+    }
+
+    void reattachToOperationContext(OperationContext* txn) final {
+        _txn = txn;
+		init(txn);
+    }
+
+private:
+    const TerarkDbRecordStore& _rs;
+    OperationContext* _txn;
+	bool m_hasRecoveryUnit = false;
+	bool m_isOwnerAlive = true;
+	TableThreadDataPtr m_ttd;
+    terark::db::StoreIteratorPtr _cursor;
+};
+
 StatusWith<std::string> parseOptionsField(const BSONObj options) {
     StringBuilder ss;
     BSONForEach(elem, options) {
@@ -423,40 +542,143 @@ void TerarkDbRecordStore::deleteRecord(OperationContext* txn, const RecordId& id
 		m_table->registerDelete(txn->recoveryUnit(), id);
 	}
 	else {
-		bool ok = tab->removeRow(id.repr()-1, &*td.m_dbCtx);
+		bool ok;
+		try {
+			ok = tab->removeRow(id.repr()-1, &*td.m_dbCtx);
+		} catch (const terark::db::NeedRetryException&) {
+			// the row is in a pinned snapshot, and other writers are running
+			throw WriteConflictException();
+		}
+		m_table->bumpWriteSeq();
 		LOG(2) << "TerarkDbRecordStore::deleteRecord(): id = " << id
 			<< ", dir: " << tab->getDir().string() << ", return = " << ok;
 	}
 }
 
-Status TerarkDbRecordStore::insertRecords(OperationContext* txn,
-										std::vector<Record>* records,
-										bool enforceQuota) {
-	DbTable* tab = m_table->m_tab.get();
-    auto& td = m_table->getMyThreadData();
-	if (0 == records->size()) {
-	    LOG(1) << "TerarkDbRecordStore::insertRecords(): records->size() = 0";
-	}
-    for (size_t i = 0; i < records->size(); ++i) {
-		Record& rec = (*records)[i];
-    	BSONObj bson(rec.data.data());
+// encoded rows of a chunk of documents, each chunk is filled by one task
+struct EncodedRowsChunk {
+	terark::valvec<char>   buf;
+	terark::valvec<size_t> offsets;
+	std::string            errMsg;
+};
+static const size_t kEncodeChunkDocs = 64;
+static const size_t kEncodeParallelMinDocs = 4 * kEncodeChunkDocs;
+
+struct EncodeRowsWorker {
+	SchemaRecordCoder    coder;
+	terark::valvec<char> row;
+};
+
+// encode bsons[0,n) to rows of rowSchema, large batches are encoded by tasks
+// of the tbb worker pool, each worker thread uses its own SchemaRecordCoder
+static Status
+encodeRowsParallel(const Schema& rowSchema, const BSONObj* bsons, size_t n,
+				   std::vector<EncodedRowsChunk>* chunks,
+				   terark::valvec<fstring>* rows) {
+	const size_t nChunks = (n + kEncodeChunkDocs - 1) / kEncodeChunkDocs;
+	chunks->resize(nChunks);
+	tbb::enumerable_thread_specific<EncodeRowsWorker> workers;
+	auto encodeChunk = [&](size_t c) {
+		EncodeRowsWorker& w = workers.local();
+		EncodedRowsChunk& chunk = (*chunks)[c];
+		size_t lo = c * kEncodeChunkDocs;
+		size_t hi = std::min(lo + kEncodeChunkDocs, n);
+		chunk.offsets.push_back(0);
 		try {
-			td.m_coder.encode(&tab->rowSchema(), nullptr, bson, &td.m_buf);
+			for (size_t i = lo; i < hi; ++i) {
+				w.coder.encode(&rowSchema, nullptr, bsons[i], &w.row);
+				chunk.buf.append(w.row.data(), w.row.size());
+				chunk.offsets.push_back(chunk.buf.size());
+			}
 		} catch (const std::exception& ex) {
-			return Status(ErrorCodes::InvalidBSON, ex.what());
+			chunk.errMsg = ex.what();
 		}
-		try {
-			rec.id = RecordId(1 + tab->insertRow(td.m_buf, &*td.m_dbCtx));
-		} catch (const std::exception& ex) {
-			return Status(ErrorCodes::InternalError, ex.what());
+	};
+	if (n >= kEncodeParallelMinDocs) {
+		tbb::parallel_for(size_t(0), nChunks, encodeChunk);
+	}
+	else {
+		for (size_t c = 0; c < nChunks; ++c)
+			encodeChunk(c);
+	}
+	rows->erase_all();
+	rows->reserve(n);
+	for (auto& chunk : *chunks) {
+		if (!chunk.errMsg.empty()) {
+			return Status(ErrorCodes::InvalidBSON, chunk.errMsg);
+		}
+		for (size_t i = 0; i < chunk.offsets.size() - 1; ++i) {
+			size_t off = chunk.offsets[i];
+			rows->push_back(fstring(chunk.buf.data() + off, chunk.offsets[i+1] - off));
+		}
+	}
+	return Status::OK();
+}
+
+// shared by insertRecords and insertRecordsWithDocWriter: rows are encoded in
+// parallel, then appended by one BatchWriter, which allocates their ids in
+// one table lock and inserts index keys in one sorted pass on commit
+static Status
+insertBsonBatch(OperationContext* txn, ThreadSafeTable* tst,
+				const BSONObj* bsons, size_t n, RecordId* idsOut) {
+	DbTable* tab = tst->m_tab.get();
+    auto& td = tst->getMyThreadData();
+	std::vector<EncodedRowsChunk> chunks;
+	terark::valvec<fstring> rows;
+	Status status = encodeRowsParallel(tab->rowSchema(), bsons, n, &chunks, &rows);
+	if (!status.isOK()) {
+		return status;
+	}
+	terark::valvec<llong> recIds(n);
+	try {
+		terark::db::BatchWriter batch(tab, td.m_dbCtx.get());
+		size_t num = batch.insertRows(rows.data(), n, recIds.data());
+		if (num < n) {
+			batch.rollback();
+			return Status(ErrorCodes::DuplicateKey, batch.strError());
 		}
+		if (!batch.commit()) {
+			return Status(ErrorCodes::OperationFailed,
+				"TerarkDbRecordStore::insertBsonBatch: terark::db::BatchWriter::commit failed: "
+				+ batch.strError());
+		}
+		tst->bumpWriteSeq();
+	} catch (const terark::db::NeedRetryException&) {
+		throw WriteConflictException();
+	} catch (const std::exception& ex) {
+		return Status(ErrorCodes::InternalError, ex.what());
+	}
+	for (size_t i = 0; i < n; ++i) {
+		idsOut[i] = RecordId(recIds[i] + 1);
 		if (txn && txn->recoveryUnit()) {
-			m_table->registerInsert(txn->recoveryUnit(), rec.id);
+			tst->registerInsert(txn->recoveryUnit(), idsOut[i]);
 		}
-	    LOG(2) << "TerarkDbRecordStore::insertRecords(): i = " << i
-			<< ", bson = " << bson.toString() << ", id = " << rec.id;
+	    LOG(2) << "TerarkDbRecordStore::insertBsonBatch(): i = " << i
+			<< ", id = " << idsOut[i] << ", bson = " << bsons[i].toString();
+	}
+	return Status::OK();
+}
+
+Status TerarkDbRecordStore::insertRecords(OperationContext* txn,
+										std::vector<Record>* records,
+										bool enforceQuota) {
+	if (0 == records->size()) {
+	    LOG(1) << "TerarkDbRecordStore::insertRecords(): records->size() = 0";
+		return Status::OK();
+	}
+	const size_t n = records->size();
+	std::unique_ptr<BSONObj[]> bsons(new BSONObj[n]);
+	std::unique_ptr<RecordId[]> ids(new RecordId[n]);
+    for (size_t i = 0; i < n; ++i) {
+		bsons[i] = BSONObj((*records)[i].data.data());
     }
-    return Status::OK();
+	Status status = insertBsonBatch(txn, m_table.get(), bsons.get(), n, ids.get());
+	if (status.isOK()) {
+		for (size_t i = 0; i < n; ++i) {
+			(*records)[i].id = ids[i];
+		}
+	}
+    return status;
 }
 
 StatusWith<RecordId> TerarkDbRecordStore::insertRecord(OperationContext* txn,
@@ -478,6 +700,7 @@ StatusWith<RecordId> TerarkDbRecordStore::insertRecord(OperationContext* txn,
 		if (txn && txn->recoveryUnit()) {
 			m_table->registerInsert(txn->recoveryUnit(), RecordId(recIdx + 1));
 		}
+		m_table->bumpWriteSeq();
 		return {RecordId(recIdx + 1)};
 	} catch (const std::exception& ex) {
 		return Status(ErrorCodes::InternalError, ex.what());
@@ -493,61 +716,28 @@ TerarkDbRecordStore::insertRecordsWithDocWriter(OperationContext* txn,
 	    LOG(1) << "TerarkDbRecordStore::insertRecordsWithDocWriter(): nDocs = 0";
 		return Status::OK();
 	}
-	DbTable* tab = m_table->m_tab.get();
-    auto& td = m_table->getMyThreadData();
-    std::unique_ptr<Record[]> records(new Record[nDocs]);
-
-    // First get all the sizes so we can allocate a single buffer for all documents. Eventually it
-    // would be nice if we could either hand off the buffers to WT without copying or write them
-    // in-place as we do with MMAPv1, but for now this is the best we can do.
+    // write all documents into a single buffer, they are encoded from it
     size_t totalSize = 0;
     for (size_t i = 0; i < nDocs; i++) {
-        const size_t docSize = docs[i]->documentSize();
-        records[i].data = RecordData(nullptr, docSize);  // We fill in the real ptr in next loop.
-        totalSize += docSize;
+        totalSize += docs[i]->documentSize();
     }
-
     std::unique_ptr<char[]> buffer(new char[totalSize]);
+    std::unique_ptr<BSONObj[]> bsons(new BSONObj[nDocs]);
+    std::unique_ptr<RecordId[]> ids(new RecordId[nDocs]);
     char* pos = buffer.get();
     for (size_t i = 0; i < nDocs; i++) {
         docs[i]->writeDocument(pos);
-        const size_t size = records[i].data.size();
-        records[i].data = RecordData(pos, size);
-        pos += size;
+        bsons[i] = BSONObj(pos);
+        pos += docs[i]->documentSize();
     }
     invariant(pos == (buffer.get() + totalSize));
-	terark::db::BatchWriter batch(tab, td.m_dbCtx.get());
-    for (size_t i = 0; i < nDocs; i++) {
-        docs[i]->writeDocument(pos);
-        BSONObj bson = records[i].data.releaseToBson();
-		try {
-			td.m_coder.encode(&tab->rowSchema(), nullptr, bson, &td.m_buf);
-		} catch (const std::exception& ex) {
-			return Status(ErrorCodes::InvalidBSON, ex.what());
-		}
-		try {
-			llong recIdx = batch.upsertRow(td.m_buf);
-			records[i].id = RecordId(recIdx + 1);
-			if (txn && txn->recoveryUnit()) {
-				m_table->registerInsert(txn->recoveryUnit(), RecordId(recIdx + 1));
-			}
-			LOG(2) << "TerarkDbRecordStore::insertRecordsWithDocWriter(): i = " << i
-				<< ", id = " << RecordId(recIdx + 1) << ", bson = " << bson.toString();
-		} catch (const std::exception& ex) {
-			return Status(ErrorCodes::InternalError, ex.what());
-		}
-    }
-	if (!batch.commit()) {
-		return Status(ErrorCodes::OperationFailed, "TerarkDbRecordStore::insertRecordsWithDocWriter: terark::db::BatchWriter::commit failed");
-	}
-
-    if (idsOut) {
+	Status status = insertBsonBatch(txn, m_table.get(), bsons.get(), nDocs, ids.get());
+    if (status.isOK() && idsOut) {
         for (size_t i = 0; i < nDocs; i++) {
-            idsOut[i] = records[i].id;
+            idsOut[i] = ids[i];
         }
     }
-
-    return Status::OK();
+    return status;
 }
 
 Status
@@ -576,6 +766,11 @@ TerarkDbRecordStore::updateRecord(OperationContext* txn,
 				<< ", id = " << id << ", NeedsDocumentMove because segment of record is frozen";
 			return {ErrorCodes::NeedsDocumentMove, "segment of record is frozen"};
 		}
+		if (tab->isSnapshotPinnedNoLock(recId)) {
+			LOG(2) << "TerarkDbRecordStore::updateRecord(): bson = " << bson.toString()
+				<< ", id = " << id << ", NeedsDocumentMove because record is in a pinned snapshot";
+			return {ErrorCodes::NeedsDocumentMove, "record is in a pinned snapshot"};
+		}
 		if (txn && txn->recoveryUnit()) {
 			LOG(2) << "TerarkDbRecordStore::updateRecord(): bson = " << bson.toString()
 				<< ", id = " << id << ", NeedsDocumentMove because is in recovery unit";
@@ -593,12 +788,18 @@ TerarkDbRecordStore::updateRecord(OperationContext* txn,
 	try {
 		llong newRecId = tab->updateRow(recId, td.m_buf, &*td.m_dbCtx);
 		invariant(newRecId == recId);
+		m_table->bumpWriteSeq();
 		return Status::OK();
+	} catch (const terark::db::NeedRetryException&) {
+		throw WriteConflictException();
 	} catch (const std::exception& ex) {
 		return Status(ErrorCodes::InternalError, ex.what());
 	}
 }
 
+// in place updates can not be rolled back and rows of frozen segments or
+// pinned snapshots are never changed, mongod always runs updates in a
+// recovery unit, so updateWithDamages could only ever need a document move
 bool TerarkDbRecordStore::updateWithDamagesSupported() const {
     return false;
 }
@@ -620,13 +821,23 @@ TerarkDbRecordStore::getCursor(OperationContext* txn, bool forward) const {
 
 std::unique_ptr<RecordCursor>
 TerarkDbRecordStore::getRandomCursor(OperationContext* txn) const {
-    return nullptr;
+    return stdx::make_unique<RandomCursor>(txn, *this);
 }
 
+// one cursor per core, ids of each cursor are a range of the table, ids
+// inserted after this call are not returned by any cursor
 std::vector<std::unique_ptr<RecordCursor>>
 TerarkDbRecordStore::getManyCursors(OperationContext* txn) const {
-    std::vector<std::unique_ptr<RecordCursor>> cursors(1);
-    cursors[0] = stdx::make_unique<Cursor>(txn, *this, /*forward=*/true);
+	DbTable* tab = m_table->m_tab.get();
+	size_t nParts = std::max(std::thread::hardware_concurrency(), 1u);
+	valvec<llong> bounds;
+	tab->getParallelScanBounds(nParts, &bounds);
+	LOG(2) << "TerarkDbRecordStore::getManyCursors(): cursors = " << bounds.size() - 1
+		<< ", rows = " << bounds.back();
+    std::vector<std::unique_ptr<RecordCursor>> cursors(bounds.size() - 1);
+	for (size_t i = 0; i < cursors.size(); ++i) {
+		cursors[i] = stdx::make_unique<Cursor>(txn, *this, bounds[i], bounds[i+1]);
+	}
     return cursors;
 }
 
@@ -634,6 +845,7 @@ Status TerarkDbRecordStore::truncate(OperationContext* txn) {
 	DbTable* tab = m_table->m_tab.get();
 	LOG(2) << "TerarkDbRecordStore::truncate()";
 	tab->clear();
+	m_table->bumpWriteSeq();
     return Status::OK();
 }
 
@@ -160,6 +160,7 @@ public:
 
 private:
     class Cursor;
+    class RandomCursor;
     const std::string _ident;
     bool _shuttingDown;
 };
@@ -0,0 +1,211 @@
+// terarkdb_record_store_engine_test.cpp
+
+/**
+ *    Copyright (C) 2016 Terark Inc.
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *    As a special exception, the copyright holders give permission to link the
+ *    code of portions of this program with the OpenSSL library under certain
+ *    conditions as described in each individual source file and distribute
+ *    linked combinations including the program with the OpenSSL library. You
+ *    must comply with the GNU Affero General Public License in all respects for
+ *    all of the code used other than as permitted herein. If you modify file(s)
+ *    with this exception, you may extend this exception to your version of the
+ *    file(s), but you are not obligated to do so. If you do not wish to do so,
+ *    delete this exception statement from your version. If you delete this
+ *    exception statement from all source files in the program, then also delete
+ *    it in the license file.
+ */
+
+#include "mongo/platform/basic.h"
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "mongo/bson/bsonobjbuilder.h"
+#include "mongo/db/catalog/collection_options.h"
+#include "mongo/db/operation_context_noop.h"
+#include "mongo/db/storage/record_store.h"
+#include "terarkdb_kv_engine.h"
+#include "terarkdb_record_store.h"
+#include "mongo/unittest/temp_dir.h"
+#include "mongo/unittest/unittest.h"
+
+namespace mongo { namespace terarkdb {
+
+using std::unique_ptr;
+using std::string;
+
+namespace {
+
+// record stores of TerarkDbKVEngine, collections are created with a
+// schema less row schema, the same as MongoTerarkDB_DynamicCreateCollection
+class TerarkDbEngineHarness {
+public:
+    TerarkDbEngineHarness() : _dbpath("terarkdb-rs-harness") {
+        _engine.reset(new TerarkDbKVEngine(
+            kTerarkDbEngineName, _dbpath.path(), "", 1, false, false, false));
+    }
+
+    unique_ptr<OperationContext> newOperationContext() {
+        return unique_ptr<OperationContext>(
+            new OperationContextNoop(_engine->newRecoveryUnit()));
+    }
+
+    unique_ptr<RecordStore> newRecordStore(const string& ns, const string& ident) {
+        CollectionOptions options;
+        options.storageEngine = BSON(kTerarkDbEngineName << BSON(
+            "CheckMongoType" << true <<
+            "RowSchema" << BSON("columns" << BSON("$$" << BSON("type" << "carbin")))));
+        unique_ptr<OperationContext> opCtx(newOperationContext());
+        ASSERT_OK(_engine->createRecordStore(opCtx.get(), ns, ident, options));
+        unique_ptr<RecordStore> rs(_engine->getRecordStore(opCtx.get(), ns, ident, options));
+        ASSERT(rs);
+        return rs;
+    }
+
+private:
+    unittest::TempDir _dbpath;
+    unique_ptr<TerarkDbKVEngine> _engine;
+};
+
+RecordId insertDoc(OperationContext* opCtx, RecordStore* rs, const BSONObj& doc) {
+    WriteUnitOfWork uow(opCtx);
+    StatusWith<RecordId> res = rs->insertRecord(opCtx, doc.objdata(), doc.objsize(), false);
+    ASSERT_OK(res.getStatus());
+    uow.commit();
+    return res.getValue();
+}
+
+}  // namespace
+
+TEST(TerarkDbRecordStoreEngineTest, UpdateWithDamagesNotSupported) {
+    TerarkDbEngineHarness harness;
+    unique_ptr<RecordStore> rs(harness.newRecordStore("test.damages", "collection-damages"));
+    ASSERT_FALSE(rs->updateWithDamagesSupported());
+
+    unique_ptr<OperationContext> opCtx(harness.newOperationContext());
+    RecordId id = insertDoc(opCtx.get(), rs.get(), BSON("a" << 1 << "b" << "x"));
+
+    // mongod updates in a recovery unit, which always needs a document move
+    BSONObj newDoc = BSON("a" << 2 << "b" << "x");
+    WriteUnitOfWork uow(opCtx.get());
+    Status status = rs->updateRecord(
+        opCtx.get(), id, newDoc.objdata(), newDoc.objsize(), false, NULL);
+    ASSERT_EQUALS(ErrorCodes::NeedsDocumentMove, status);
+    ASSERT_EQUALS(1, rs->dataFor(opCtx.get(), id).releaseToBson()["a"].numberInt());
+}
+
+TEST(TerarkDbRecordStoreEngineTest, RandomCursorReturnsAppendedRows) {
+    TerarkDbEngineHarness harness;
+    unique_ptr<RecordStore> rs(harness.newRecordStore("test.random1", "collection-random1"));
+    unique_ptr<OperationContext> opCtx(harness.newOperationContext());
+    RecordId first = insertDoc(opCtx.get(), rs.get(), BSON("i" << 0));
+
+    unique_ptr<RecordCursor> cursor = rs->getRandomCursor(opCtx.get());
+    {
+        unique_ptr<OperationContext> writer(harness.newOperationContext());
+        for (int i = 1; i < 100; ++i) {
+            insertDoc(writer.get(), rs.get(), BSON("i" << i));
+        }
+    }
+    // the cursor must not stop at the row count it was created with
+    int appended = 0;
+    for (int i = 0; i < 200; ++i) {
+        auto record = cursor->next();
+        ASSERT(record);
+        if (record->id != first) {
+            ASSERT_GT(record->id, first);
+            appended++;
+        }
+    }
+    ASSERT_GT(appended, 0);
+}
+
+TEST(TerarkDbRecordStoreEngineTest, RandomCursorSkipsRowsDeletedByMe) {
+    TerarkDbEngineHarness harness;
+    unique_ptr<RecordStore> rs(harness.newRecordStore("test.random2", "collection-random2"));
+    unique_ptr<OperationContext> opCtx(harness.newOperationContext());
+    const int n = 1000;
+    std::vector<RecordId> ids;
+    for (int i = 0; i < n; ++i) {
+        ids.push_back(insertDoc(opCtx.get(), rs.get(), BSON("i" << i)));
+    }
+    const RecordId survivor = ids[n / 3];
+
+    WriteUnitOfWork uow(opCtx.get());
+    for (const RecordId& id : ids) {
+        if (id != survivor)
+            rs->deleteRecord(opCtx.get(), id);
+    }
+    // almost every sample is deleted by this unit, the survivor must
+    // still be found instead of returning EOF
+    unique_ptr<RecordCursor> cursor = rs->getRandomCursor(opCtx.get());
+    for (int i = 0; i < 10; ++i) {
+        auto record = cursor->next();
+        ASSERT(record);
+        ASSERT_EQUALS(survivor, record->id);
+        ASSERT_EQUALS(n / 3, record->data.releaseToBson()["i"].numberInt());
+    }
+}
+
+TEST(TerarkDbRecordStoreEngineTest, RecoveryUnitSnapshotHidesLaterInserts) {
+    // read before ThreadSafeTable is created by getRecordStore
+    setenv("ThreadSafeTable_recoveryUnitSnapshot", "1", 1);
+    TerarkDbEngineHarness harness;
+    unique_ptr<RecordStore> rs(harness.newRecordStore("test.snapshot", "collection-snapshot"));
+    unique_ptr<OperationContext> writer(harness.newOperationContext());
+    unique_ptr<OperationContext> reader(harness.newOperationContext());
+    RecordId id1 = insertDoc(writer.get(), rs.get(), BSON("i" << 1));
+
+    unique_ptr<SeekableRecordCursor> c1 = rs->getCursor(reader.get(), true);
+    auto record = c1->next(); // pins the snapshot of reader
+    ASSERT(record);
+    ASSERT_EQUALS(id1, record->id);
+
+    RecordId id2 = insertDoc(writer.get(), rs.get(), BSON("i" << 2));
+    ASSERT_FALSE(c1->seekExact(id2));
+    {
+        // a new cursor of the same unit reads the same snapshot
+        unique_ptr<SeekableRecordCursor> c2 = rs->getCursor(reader.get(), true);
+        ASSERT_FALSE(c2->seekExact(id2));
+        ASSERT(c2->seekExact(id1));
+        int rows = 0;
+        for (c2 = rs->getCursor(reader.get(), true); c2->next(); ++rows) {}
+        ASSERT_EQUALS(1, rows);
+    }
+    {
+        // rows written by the unit itself are visible to it
+        WriteUnitOfWork uow(reader.get());
+        BSONObj doc = BSON("i" << 3);
+        StatusWith<RecordId> res =
+            rs->insertRecord(reader.get(), doc.objdata(), doc.objsize(), false);
+        ASSERT_OK(res.getStatus());
+        unique_ptr<SeekableRecordCursor> c2 = rs->getCursor(reader.get(), true);
+        ASSERT(c2->seekExact(res.getValue()));
+        ASSERT_FALSE(c2->seekExact(id2));
+    } // rolled back
+
+    c1.reset();
+    reader->recoveryUnit()->abandonSnapshot();
+    c1 = rs->getCursor(reader.get(), true);
+    record = c1->seekExact(id2);
+    ASSERT(record);
+    ASSERT_EQUALS(2, record->data.releaseToBson()["i"].numberInt());
+    c1.reset();
+    unsetenv("ThreadSafeTable_recoveryUnitSnapshot");
+}
+
+} } // namespace mongo::terarkdb
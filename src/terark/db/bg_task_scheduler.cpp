@@ -0,0 +1,297 @@
+#include "bg_task_scheduler.hpp"
+#include <algorithm>
+#include <stdio.h>
+
+namespace terark { namespace db {
+
+BgTask::BgTask(Priority prio, const void* owner)
+  : m_priority(prio), m_owner(owner) {
+	assert(prio < PriorityNum);
+	m_enqueueTime = 0;
+}
+BgTask::~BgTask() {
+}
+void BgTask::cancel() {
+}
+
+BgTaskStats::BgTaskStats() {
+	memset(this, 0, sizeof(*this));
+}
+
+static thread_local void* tls_bgWorker = NULL;
+
+BgTaskScheduler::BgTaskScheduler(size_t workerNum) {
+	assert(workerNum >= 2);
+	workerNum = std::max<size_t>(workerNum, 2);
+	m_lowestToRun = BgTask::PriorityNum - 1;
+	m_stopping = false;
+	m_stopped = false;
+	m_stolen = 0;
+	for (int p = 0; p < BgTask::PriorityNum; ++p) {
+		m_queued[p] = 0;
+		m_running[p] = 0;
+		m_finished[p] = 0;
+		m_cancelled[p] = 0;
+		m_sumWait[p] = 0;
+		m_maxWait[p] = 0;
+	}
+	m_workers.resize(workerNum);
+	for (size_t i = 0; i < workerNum; ++i) {
+		Worker* w = new Worker();
+		w->sched = this;
+		w->id = i;
+		m_workers[i] = w;
+	}
+	for (Worker* w : m_workers) {
+		w->thread = std::thread(&BgTaskScheduler::workerProc, this, w);
+	}
+}
+
+BgTaskScheduler::~BgTaskScheduler() {
+	if (!m_stopped) {
+		stopAndWait(BgTask::Flush);
+	}
+	for (Worker* w : m_workers) {
+		delete w;
+	}
+}
+
+bool BgTaskScheduler::submit(BgTask* task) {
+	assert(NULL != task);
+	BgTaskPtr t(task);
+	int prio = t->m_priority;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_stopped || (m_stopping && prio > m_lowestToRun)) {
+		m_cancelled[prio]++;
+		lock.unlock();
+		t.reset(); // may release the owner, do it out of lock
+		return false;
+	}
+	t->m_enqueueTime = m_pf.now();
+	Worker* w = (Worker*)tls_bgWorker;
+	if (w && w->sched == this && BgTask::Flush != prio) {
+		// follow up work of the running task, such as compressing after
+		// flushing, prefer to run on the same worker
+		w->local[prio].push_back(std::move(t));
+	}
+	else {
+		OwnerQueue& oq = m_owners[t->m_owner];
+		oq.tasks[prio].push_back(std::move(t));
+		if (!oq.inRing[prio]) {
+			oq.inRing[prio] = true;
+			m_ring[prio].push_back(&oq);
+		}
+	}
+	m_queued[prio]++;
+	m_cond.notify_all();
+	return true;
+}
+
+BgTaskPtr BgTaskScheduler::popRingInLock(int prio) {
+	auto& ring = m_ring[prio];
+	for (size_t i = 0, n = ring.size(); i < n; ++i) {
+		OwnerQueue* oq = ring.front();
+		ring.pop_front();
+		assert(oq->inRing[prio]);
+		assert(!oq->tasks[prio].empty());
+		if (BgTask::Flush == prio && oq->runningFlush) {
+			ring.push_back(oq); // keep flushing order of the owner
+			continue;
+		}
+		BgTaskPtr t(std::move(oq->tasks[prio].front()));
+		oq->tasks[prio].pop_front();
+		if (oq->tasks[prio].empty())
+			oq->inRing[prio] = false;
+		else
+			ring.push_back(oq); // round robin between owners
+		if (BgTask::Flush == prio)
+			oq->runningFlush++;
+		else
+			releaseOwnerInLock(t->m_owner);
+		return t;
+	}
+	return NULL;
+}
+
+BgTaskPtr BgTaskScheduler::pickInLock(Worker* w) {
+	int lowest = 0 == w->id ? int(BgTask::Flush) : m_lowestToRun;
+	for (int prio = 0; prio <= lowest; ++prio) {
+		if (!w->local[prio].empty()) {
+			BgTaskPtr t(std::move(w->local[prio].front()));
+			w->local[prio].pop_front();
+			return t;
+		}
+		if (BgTaskPtr t = popRingInLock(prio)) {
+			return t;
+		}
+		for (size_t i = 1, n = m_workers.size(); i < n; ++i) {
+			Worker* victim = m_workers[(w->id + i) % n];
+			if (!victim->local[prio].empty()) {
+				BgTaskPtr t(std::move(victim->local[prio].front()));
+				victim->local[prio].pop_front();
+				m_stolen++;
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+void BgTaskScheduler::releaseOwnerInLock(const void* owner) {
+	auto iter = m_owners.find(owner);
+	if (m_owners.end() == iter)
+		return;
+	OwnerQueue& oq = iter->second;
+	if (oq.runningFlush)
+		return;
+	for (int prio = 0; prio < BgTask::PriorityNum; ++prio) {
+		if (!oq.tasks[prio].empty())
+			return;
+		assert(!oq.inRing[prio]);
+	}
+	m_owners.erase(iter);
+}
+
+void BgTaskScheduler::workerProc(Worker* w) {
+	tls_bgWorker = w;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		BgTaskPtr t = pickInLock(w);
+		if (t) {
+			int prio = t->m_priority;
+			const void* owner = t->m_owner;
+			llong wait = m_pf.now() - t->m_enqueueTime;
+			m_queued[prio]--;
+			m_running[prio]++;
+			m_sumWait[prio] += wait;
+			m_maxWait[prio] = std::max(m_maxWait[prio], wait);
+			lock.unlock();
+			try {
+				t->execute();
+			}
+			catch (const std::exception& ex) {
+				fprintf(stderr, "ERROR: BgTaskScheduler: task(priority = %d) failed: %s\n"
+					, prio, ex.what());
+			}
+			t.reset(); // may destroy the owner, do it out of lock
+			lock.lock();
+			m_running[prio]--;
+			m_finished[prio]++;
+			if (BgTask::Flush == prio) {
+				auto iter = m_owners.find(owner);
+				assert(m_owners.end() != iter);
+				iter->second.runningFlush--;
+				releaseOwnerInLock(owner);
+			}
+			m_cond.notify_all();
+			continue;
+		}
+		if (m_stopping) {
+			size_t busy = 0;
+			for (int prio = 0; prio < BgTask::PriorityNum; ++prio)
+				busy += m_queued[prio] + m_running[prio];
+			if (0 == busy)
+				break;
+		}
+		m_cond.wait(lock);
+	}
+	tls_bgWorker = NULL;
+}
+
+void BgTaskScheduler::takeCanceledInLock(int lowestToKeep, const void* owner,
+										 std::vector<BgTaskPtr>* canceled) {
+	auto take = [&](std::deque<BgTaskPtr>& q) {
+		auto beg = std::stable_partition(q.begin(), q.end(),
+			[&](const BgTaskPtr& t) {
+				return t->m_priority <= lowestToKeep &&
+					   (NULL == owner || t->m_owner != owner);
+			});
+		for (auto iter = beg; iter != q.end(); ++iter) {
+			int prio = (*iter)->m_priority;
+			m_queued[prio]--;
+			m_cancelled[prio]++;
+			canceled->push_back(std::move(*iter));
+		}
+		q.erase(beg, q.end());
+	};
+	for (Worker* w : m_workers) {
+		for (auto& q : w->local) take(q);
+	}
+	for (auto& kv : m_owners) {
+		for (auto& q : kv.second.tasks) take(q);
+	}
+	for (int prio = 0; prio < BgTask::PriorityNum; ++prio) {
+		auto& ring = m_ring[prio];
+		auto end = std::remove_if(ring.begin(), ring.end(),
+			[prio](OwnerQueue* oq) {
+				if (oq->tasks[prio].empty()) {
+					oq->inRing[prio] = false;
+					return true;
+				}
+				return false;
+			});
+		ring.erase(end, ring.end());
+	}
+	if (owner)
+		releaseOwnerInLock(owner);
+}
+
+void BgTaskScheduler::doCancel(std::vector<BgTaskPtr>& canceled) {
+	for (auto& t : canceled) {
+		t->cancel();
+		t.reset();
+	}
+}
+
+size_t BgTaskScheduler::cancel(const void* owner) {
+	assert(NULL != owner);
+	std::vector<BgTaskPtr> canceled;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		takeCanceledInLock(BgTask::PriorityNum - 1, owner, &canceled);
+	}
+	doCancel(canceled);
+	return canceled.size();
+}
+
+void BgTaskScheduler::stopAndWait(BgTask::Priority lowestToRun) {
+	std::vector<BgTaskPtr> canceled;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		assert(!m_stopping);
+		if (m_stopping)
+			return;
+		m_stopping = true;
+		m_lowestToRun = lowestToRun;
+		takeCanceledInLock(lowestToRun, NULL, &canceled);
+		m_cond.notify_all();
+	}
+	doCancel(canceled);
+	for (Worker* w : m_workers) {
+		w->thread.join();
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (int prio = 0; prio < BgTask::PriorityNum; ++prio) {
+		assert(0 == m_queued[prio]);
+		assert(0 == m_running[prio]);
+		assert(m_ring[prio].empty());
+	}
+	m_stopped = true;
+	fprintf(stderr, "INFO: background task threads(%zd) completed!\n", m_workers.size());
+}
+
+void BgTaskScheduler::getStats(BgTaskStats* st) const {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	st->workerNum = m_workers.size();
+	st->stolen = m_stolen;
+	for (int prio = 0; prio < BgTask::PriorityNum; ++prio) {
+		st->queued[prio] = m_queued[prio];
+		st->running[prio] = m_running[prio];
+		st->finished[prio] = m_finished[prio];
+		st->cancelled[prio] = m_cancelled[prio];
+		st->sumWaitSec[prio] = m_pf.sf(0, m_sumWait[prio]);
+		st->maxWaitSec[prio] = m_pf.sf(0, m_maxWait[prio]);
+	}
+}
+
+} } // namespace terark::db
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "db_dll_decl.hpp"
+#include <terark/stdtypes.hpp>
+#include <terark/util/refcount.hpp>
+#include <terark/util/profiling.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace terark { namespace db {
+
+/// A background job, such as flushing or compressing a segment of a table.
+/// m_owner is the table, tasks of different owners in the same priority
+/// class are picked round robin
+class TERARK_DB_DLL BgTask : public RefCounter {
+public:
+	/// smaller is more urgent
+	enum Priority { Flush, Compress, Purge, Merge, PriorityNum };
+
+	BgTask(Priority prio, const void* owner);
+	virtual ~BgTask();
+	virtual void execute() = 0;
+
+	/// called instead of execute() when a queued task is dropped
+	virtual void cancel();
+
+	const Priority    m_priority;
+	const void* const m_owner;
+private:
+	friend class BgTaskScheduler;
+	llong m_enqueueTime;
+};
+typedef boost::intrusive_ptr<BgTask> BgTaskPtr;
+
+struct TERARK_DB_DLL BgTaskStats {
+	size_t workerNum;
+	ullong stolen; ///< tasks taken from local queue of another worker
+	size_t queued   [BgTask::PriorityNum];
+	size_t running  [BgTask::PriorityNum];
+	ullong finished [BgTask::PriorityNum];
+	ullong cancelled[BgTask::PriorityNum];
+	double sumWaitSec[BgTask::PriorityNum]; ///< time from submit to start
+	double maxWaitSec[BgTask::PriorityNum];
+	BgTaskStats();
+};
+
+/// Thread pool for background tasks of all tables in the process.
+///
+/// Each worker runs the most urgent task available: first from its own
+/// local queue(tasks submitted by tasks running on it), then from the
+/// shared per owner queues, then stealing from local queues of other
+/// workers. Worker 0 only runs Flush tasks, so a flush never waits for a
+/// long merge or compression. At most one Flush task of an owner runs at
+/// the same time, to keep flushing order of an owner.
+class TERARK_DB_DLL BgTaskScheduler {
+	BgTaskScheduler(const BgTaskScheduler&) = delete;
+	BgTaskScheduler& operator=(const BgTaskScheduler&) = delete;
+public:
+	///@param workerNum include the dedicated flush worker, at least 2
+	explicit BgTaskScheduler(size_t workerNum);
+	virtual ~BgTaskScheduler();
+
+	/// if the task's priority is stopped, the task is dropped without
+	/// calling its cancel(), because the caller may hold locks which
+	/// cancel() needs, the caller should undo the submission itself
+	///@returns false if the task is dropped
+	bool submit(BgTask*);
+
+	/// cancel all queued tasks of owner, running tasks are not affected
+	///@returns number of canceled tasks
+	size_t cancel(const void* owner);
+
+	/// Tasks less urgent than lowestToRun are canceled, include queued
+	/// and later submitted ones, then wait until all other tasks are done
+	/// and all workers have exited. Can only be called once.
+	void stopAndWait(BgTask::Priority lowestToRun);
+	bool isStopped() const { return m_stopped; }
+
+	void getStats(BgTaskStats*) const;
+	size_t workerNum() const { return m_workers.size(); }
+
+private:
+	struct OwnerQueue {
+		std::deque<BgTaskPtr> tasks[BgTask::PriorityNum];
+		size_t runningFlush = 0;
+		bool   inRing[BgTask::PriorityNum] = {};
+	};
+	struct Worker {
+		BgTaskScheduler* sched;
+		size_t id;
+		std::thread thread;
+		std::deque<BgTaskPtr> local[BgTask::PriorityNum];
+	};
+	void workerProc(Worker*);
+	BgTaskPtr pickInLock(Worker*);
+	BgTaskPtr popRingInLock(int prio);
+	void releaseOwnerInLock(const void* owner);
+	void takeCanceledInLock(int lowestToKeep, const void* owner,
+							std::vector<BgTaskPtr>* canceled);
+	static void doCancel(std::vector<BgTaskPtr>& canceled);
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::unordered_map<const void*, OwnerQueue> m_owners;
+	std::deque<OwnerQueue*> m_ring[BgTask::PriorityNum];
+	std::vector<Worker*> m_workers;
+	int  m_lowestToRun;
+	bool m_stopping;
+	bool m_stopped;
+	profiling m_pf;
+	ullong m_stolen;
+	size_t m_queued   [BgTask::PriorityNum];
+	size_t m_running  [BgTask::PriorityNum];
+	ullong m_finished [BgTask::PriorityNum];
+	ullong m_cancelled[BgTask::PriorityNum];
+	llong  m_sumWait  [BgTask::PriorityNum];
+	llong  m_maxWait  [BgTask::PriorityNum];
+};
+
+} } // namespace terark::db
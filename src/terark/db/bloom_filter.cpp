@@ -0,0 +1,150 @@
+#include "bloom_filter.hpp"
+#include <terark/io/FileStream.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/bits_rotate.hpp>
+#include <terark/util/mmap.hpp>
+#include <terark/util/sortable_strvec.hpp>
+
+namespace terark { namespace db {
+
+struct BloomFilter::Header {
+	char     magic[8];
+	uint64_t numBlocks;
+	uint32_t numProbes;
+	uint32_t padding;
+	uint64_t reserved[5];
+};
+
+static const char g_bloomMagic[8] = { 't','b','l','o','o','m','0','1' };
+
+static inline uint64_t BloomMix64(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+BloomFilter::BloomFilter() {
+	BOOST_STATIC_ASSERT(sizeof(Header) == BlockBytes);
+	m_blocks = nullptr;
+	m_mmapBase = nullptr;
+	m_mmapSize = 0;
+	m_numBlocks = 0;
+	m_numProbes = 0;
+}
+BloomFilter::~BloomFilter() {
+	if (m_mmapBase) {
+		mmap_close(m_mmapBase, m_mmapSize);
+	}
+}
+
+uint64_t BloomFilter::hashKey(fstring key) {
+	const byte_t* p = key.udata();
+	size_t n = key.size();
+	uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+	for (; n >= 8; n -= 8, p += 8) {
+		uint64_t w;
+		memcpy(&w, p, 8);
+		h = BitsRotateLeft(h ^ BloomMix64(w), 27) * 0x9E3779B97F4A7C15ULL;
+	}
+	if (n) {
+		uint64_t w = 0;
+		memcpy(&w, p, n);
+		h = BitsRotateLeft(h ^ BloomMix64(w), 27) * 0x9E3779B97F4A7C15ULL;
+	}
+	return BloomMix64(h);
+}
+
+// high 32 bits select the block, an independent remix gives the
+// double hashing sequence for the bit positions inside the block
+#define BLOOM_PROBE_INIT(h) \
+	uint64_t g_ = BloomMix64(h ^ 0x6A09E667F3BCC909ULL); \
+	uint32_t h1 = uint32_t(g_); \
+	uint32_t h2 = uint32_t(g_ >> 32) | 1
+
+void BloomFilter::addHash(uint64_t h) {
+	uint64_t* b = m_mem.data() + (h >> 32) % m_numBlocks * (BlockBits/64);
+	BLOOM_PROBE_INIT(h);
+	for (size_t i = 0; i < m_numProbes; ++i) {
+		uint32_t bit = h1 % BlockBits;
+		b[bit / 64] |= uint64_t(1) << (bit % 64);
+		h1 += h2;
+	}
+}
+
+bool BloomFilter::mayContain(fstring key) const {
+	assert(NULL != m_blocks);
+	uint64_t h = hashKey(key);
+	const uint64_t* b = m_blocks + (h >> 32) % m_numBlocks * (BlockBits/64);
+	BLOOM_PROBE_INIT(h);
+	for (size_t i = 0; i < m_numProbes; ++i) {
+		uint32_t bit = h1 % BlockBits;
+		if (!((b[bit / 64] >> (bit % 64)) & 1))
+			return false;
+		h1 += h2;
+	}
+	return true;
+}
+
+void
+BloomFilter::build(const SortableStrVec& keys, size_t fixlen, size_t bitsPerKey) {
+	assert(NULL == m_mmapBase);
+	assert(bitsPerKey > 0);
+	size_t numKeys = keys.m_index.size();
+	if (0 == numKeys && fixlen) {
+		assert(keys.m_strpool.size() % fixlen == 0);
+		numKeys = keys.m_strpool.size() / fixlen;
+	}
+	// ln(2) * bitsPerKey is the optimal probe number for a standard bloom
+	// filter, blocked filter does not benefit from more than 16 probes
+	size_t numProbes = size_t(bitsPerKey * 0.69 + 0.5);
+	m_numProbes = std::min<size_t>(std::max<size_t>(numProbes, 1), 16);
+	m_numBlocks = std::max<size_t>((numKeys * bitsPerKey + BlockBits-1) / BlockBits, 1);
+	m_mem.resize_fill(m_numBlocks * (BlockBits/64), 0);
+	if (keys.m_index.size() || 0 == fixlen) {
+		for (size_t i = 0; i < numKeys; ++i)
+			addHash(hashKey(keys[i]));
+	}
+	else {
+		const byte_t* p = keys.m_strpool.data();
+		for (size_t i = 0; i < numKeys; ++i)
+			addHash(hashKey(fstring(p + fixlen * i, fixlen)));
+	}
+	m_blocks = m_mem.data();
+}
+
+void BloomFilter::load(PathRef fpath) {
+	assert(NULL == m_mmapBase);
+	m_mmapBase = (byte_t*)mmap_load(fpath.string(), &m_mmapSize);
+	auto h = (const Header*)m_mmapBase;
+	if (m_mmapSize < sizeof(Header) ||
+		memcmp(h->magic, g_bloomMagic, sizeof(g_bloomMagic)) != 0 ||
+		sizeof(Header) + h->numBlocks * BlockBytes != m_mmapSize ||
+		h->numBlocks == 0 || h->numProbes == 0)
+	{
+		mmap_close(m_mmapBase, m_mmapSize);
+		m_mmapBase = nullptr;
+		m_mmapSize = 0;
+		THROW_STD(invalid_argument, "bad bloom filter file: %s"
+			, fpath.string().c_str());
+	}
+	m_numBlocks = size_t(h->numBlocks);
+	m_numProbes = h->numProbes;
+	m_blocks = (const uint64_t*)(h + 1);
+}
+
+void BloomFilter::save(PathRef fpath) const {
+	NativeDataOutput<FileStream> dio;
+	dio.open(fpath.string().c_str(), "wb");
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, g_bloomMagic, sizeof(g_bloomMagic));
+	h.numBlocks = m_numBlocks;
+	h.numProbes = uint32_t(m_numProbes);
+	dio.ensureWrite(&h, sizeof(h));
+	dio.ensureWrite(m_blocks, m_numBlocks * BlockBytes);
+}
+
+} } // namespace terark::db
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <terark/db/db_store.hpp>
+
+namespace terark {
+	class SortableStrVec;
+}
+
+namespace terark { namespace db {
+
+// Cache line blocked bloom filter, all probes of a key are in one block,
+// so a negative lookup costs at most one cache miss.
+// Used by ReadonlySegment to skip unique index search on absent keys.
+class TERARK_DB_DLL BloomFilter : public RefCounter {
+	TERARK_DB_NON_COPYABLE_CLASS(BloomFilter);
+public:
+	BloomFilter();
+	~BloomFilter();
+
+	///@param keys if keys.size() == 0, keys are fixlen in keys.m_strpool
+	void build(const SortableStrVec& keys, size_t fixlen, size_t bitsPerKey);
+
+	bool mayContain(fstring key) const;
+
+	size_t mem_size() const { return m_numBlocks * BlockBytes; }
+
+	void load(PathRef fpath);
+	void save(PathRef fpath) const;
+
+	static const size_t BlockBits  = 512;
+	static const size_t BlockBytes = BlockBits / 8;
+
+protected:
+	struct Header;
+	static uint64_t hashKey(fstring key);
+	void addHash(uint64_t h);
+
+	const uint64_t* m_blocks;
+	byte_t*   m_mmapBase;
+	size_t    m_mmapSize;
+	size_t    m_numBlocks;
+	size_t    m_numProbes;
+	valvec<uint64_t> m_mem; // used when not mmap
+};
+typedef boost::intrusive_ptr<BloomFilter> BloomFilterPtr;
+
+} } // namespace terark::db
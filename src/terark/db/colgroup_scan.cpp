@@ -0,0 +1,505 @@
+#include "colgroup_scan.hpp"
+#include "db_segment.hpp"
+#include "fixed_len_store.hpp"
+#include "zip_int_store.hpp"
+#include "intkey_index.hpp"
+#include <terark/bitmanip.hpp>
+#include <algorithm>
+#include <limits>
+
+namespace terark { namespace db {
+
+ColumnPredicate ColumnPredicate::equal(size_t columnId, llong val) {
+	ColumnPredicate pred;
+	pred.columnId = columnId;
+	pred.op = Equal;
+	pred.lo = val;
+	pred.hi = val;
+	return pred;
+}
+
+ColumnPredicate ColumnPredicate::range(size_t columnId, llong lo, llong hi) {
+	ColumnPredicate pred;
+	pred.columnId = columnId;
+	pred.op = Range;
+	pred.lo = lo;
+	pred.hi = hi;
+	return pred;
+}
+
+ColumnPredicate
+ColumnPredicate::in(size_t columnId, const llong* vals, size_t n) {
+	ColumnPredicate pred;
+	pred.columnId = columnId;
+	pred.op = InList;
+	pred.lo = 0;
+	pred.hi = 0;
+	pred.inList.assign(vals, n);
+	return pred;
+}
+
+ColgroupBatch::ColgroupBatch() {
+	baseId = 0;
+	rows = 0;
+	selCount = 0;
+	memset(sel, 0, sizeof(sel));
+}
+ColgroupBatch::~ColgroupBatch() {
+}
+
+namespace {
+
+const size_t WordBits = TERARK_WORD_BITS;
+
+/// dst[0, MaxRows) = ~src[pos, pos+n), bits after n are 0
+void copyNotBits(const bm_uint_t* src, size_t pos, size_t n, bm_uint_t* dst) {
+	for (size_t w = 0; w < ColgroupBatch::MaxRows / WordBits; ++w) {
+		size_t k = w * WordBits;
+		if (k >= n) {
+			dst[w] = 0;
+			continue;
+		}
+		size_t need = std::min(WordBits, n - k);
+		size_t bitpos = pos + k;
+		size_t shift = bitpos % WordBits;
+		bm_uint_t x = src[bitpos / WordBits] >> shift;
+		if (shift && shift + need > WordBits)
+			x |= src[bitpos / WordBits + 1] << (WordBits - shift);
+		x = ~x;
+		if (need < WordBits)
+			x &= (bm_uint_t(1) << need) - 1;
+		dst[w] = x;
+	}
+}
+
+size_t countBits(const bm_uint_t* sel, size_t rows) {
+	size_t cnt = 0;
+	for (size_t w = 0; w * WordBits < rows; ++w)
+		cnt += fast_popcount(sel[w]);
+	return cnt;
+}
+
+/// sel &= match, one byte of match per row
+size_t andMatchBits(const byte* match, size_t rows, bm_uint_t* sel) {
+	size_t cnt = 0;
+	for (size_t w = 0; w * WordBits < rows; ++w) {
+		const byte* m = match + w * WordBits;
+		size_t n = std::min(WordBits, rows - w * WordBits);
+		bm_uint_t bits = 0;
+		for (size_t i = 0; i < n; ++i)
+			bits |= bm_uint_t(m[i]) << i;
+		sel[w] &= bits;
+		cnt += fast_popcount(sel[w]);
+	}
+	return cnt;
+}
+
+/// loops are branch free, so they are vectorized by the compiler
+template<class Int, class Wide>
+void matchColumn(const ColumnPredicate& pred, const Int* v, size_t n, byte* m) {
+	const Wide tmin = Wide(std::numeric_limits<Int>::min());
+	const Wide tmax = Wide(std::numeric_limits<Int>::max());
+	if (ColumnPredicate::InList == pred.op) {
+		valvec<Int> list(pred.inList.size(), valvec_reserve());
+		for (size_t j = 0; j < pred.inList.size(); ++j) {
+			Wide x = Wide(pred.inList[j]);
+			if (tmin <= x && x <= tmax)
+				list.push_back(Int(x));
+		}
+		std::fill_n(m, n, byte(0));
+		if (list.size() <= 8) {
+			for (size_t j = 0; j < list.size(); ++j) {
+				const Int x = list[j];
+				for (size_t i = 0; i < n; ++i)
+					m[i] |= byte(v[i] == x);
+			}
+		} else {
+			std::sort(list.begin(), list.end());
+			for (size_t i = 0; i < n; ++i)
+				m[i] = byte(std::binary_search(list.begin(), list.end(), v[i]));
+		}
+		return;
+	}
+	Wide lo = Wide(pred.lo);
+	Wide hi = ColumnPredicate::Equal == pred.op ? lo : Wide(pred.hi);
+	if (lo > hi || lo > tmax || hi < tmin) {
+		std::fill_n(m, n, byte(0));
+		return;
+	}
+	const Int ilo = Int(std::max(lo, tmin));
+	const Int ihi = Int(std::min(hi, tmax));
+	for (size_t i = 0; i < n; ++i)
+		m[i] = byte(v[i] >= ilo) & byte(v[i] <= ihi);
+}
+
+template<class Store>
+void getIntValues(const Store* store, ColumnType type,
+				  size_t beginId, size_t n, byte* out) {
+	switch (type) {
+	default:
+		THROW_STD(invalid_argument, "column type = %d is not an integer", int(type));
+	case ColumnType::Uint08: store->getValuesBatch(beginId, n, (uint8_t *)out); break;
+	case ColumnType::Sint08: store->getValuesBatch(beginId, n, ( int8_t *)out); break;
+	case ColumnType::Uint16: store->getValuesBatch(beginId, n, (uint16_t*)out); break;
+	case ColumnType::Sint16: store->getValuesBatch(beginId, n, ( int16_t*)out); break;
+	case ColumnType::Uint32: store->getValuesBatch(beginId, n, (uint32_t*)out); break;
+	case ColumnType::Sint32: store->getValuesBatch(beginId, n, ( int32_t*)out); break;
+	case ColumnType::Uint64: store->getValuesBatch(beginId, n, (uint64_t*)out); break;
+	case ColumnType::Sint64: store->getValuesBatch(beginId, n, ( int64_t*)out); break;
+	}
+}
+
+template<size_t Len>
+void stridedCopy(const byte* src, size_t stride, size_t n, byte* dst) {
+	for (size_t i = 0; i < n; ++i)
+		memcpy(dst + Len * i, src + stride * i, Len);
+}
+
+bool isScanableInt(ColumnType type) {
+	switch (type) {
+	default:
+		return false;
+	case ColumnType::Uint08:
+	case ColumnType::Sint08:
+	case ColumnType::Uint16:
+	case ColumnType::Sint16:
+	case ColumnType::Uint32:
+	case ColumnType::Sint32:
+	case ColumnType::Uint64:
+	case ColumnType::Sint64:
+		return true;
+	}
+}
+
+} // namespace
+
+ColgroupScanner::ColgroupScanner(const DbTable* tab, size_t cgId, DbContext* ctx) {
+	const SchemaConfig& sconf = tab->getSchemaConfig();
+	if (cgId >= sconf.getColgroupNum()) {
+		THROW_STD(out_of_range, "cgId = %zd, cgNum = %zd"
+			, cgId, sconf.getColgroupNum());
+	}
+	m_ctx.reset(ctx ? ctx : tab->createDbContext());
+	m_schema = &sconf.getColgroupSchema(cgId);
+	m_cgId = cgId;
+	{
+		SegArrayReadGuard segArray(tab);
+		m_segs.assign(segArray->m_segments);
+		m_rowNumVec.assign(segArray->m_rowNumVec);
+		assert(m_rowNumVec.size() == m_segs.size() + 1);
+		m_rowNumVec.back() = std::max(m_rowNumVec.ende(2), tab->inlineGetRowNum());
+	}
+	m_segIdx = 0;
+	m_subId = 0;
+	m_colBuf.resize(m_schema->columnNum());
+	m_fetched.resize(m_schema->columnNum());
+	for (size_t i = 0; i < m_schema->columnNum(); ++i) {
+		if (m_schema->getColumnMeta(i).fixedLen)
+			m_proj.push_back(i);
+	}
+	updateNeed();
+}
+
+ColgroupScanner::~ColgroupScanner() {
+}
+
+void ColgroupScanner::setProjection(const size_t* colIds, size_t n) {
+	for (size_t j = 0; j < n; ++j) {
+		if (colIds[j] >= m_schema->columnNum()) {
+			THROW_STD(out_of_range, "columnId = %zd, columnNum = %zd"
+				, colIds[j], m_schema->columnNum());
+		}
+		if (0 == m_schema->getColumnMeta(colIds[j]).fixedLen) {
+			fstring colname = m_schema->getColumnName(colIds[j]);
+			THROW_STD(invalid_argument, "column %.*s is not fixed length"
+				, colname.ilen(), colname.data());
+		}
+	}
+	m_proj.assign(colIds, n);
+	updateNeed();
+}
+
+void ColgroupScanner::addPredicate(const ColumnPredicate& pred) {
+	if (pred.columnId >= m_schema->columnNum()) {
+		THROW_STD(out_of_range, "columnId = %zd, columnNum = %zd"
+			, pred.columnId, m_schema->columnNum());
+	}
+	if (!isScanableInt(m_schema->getColumnType(pred.columnId))) {
+		fstring colname = m_schema->getColumnName(pred.columnId);
+		THROW_STD(invalid_argument, "column %.*s is not an integer"
+			, colname.ilen(), colname.data());
+	}
+	m_preds.push_back(pred);
+	updateNeed();
+}
+
+void ColgroupScanner::updateNeed() {
+	m_need.erase_all();
+	for (size_t j = 0; j < m_preds.size(); ++j)
+		m_need.push_back(m_preds[j].columnId);
+	m_need.append(m_proj);
+	std::sort(m_need.begin(), m_need.end());
+	m_need.trim(std::unique(m_need.begin(), m_need.end()));
+}
+
+void ColgroupScanner::reset() {
+	m_segIdx = 0;
+	m_subId = 0;
+}
+
+bool ColgroupScanner::next(ColgroupBatch* batch) {
+	while (m_segIdx < m_segs.size()) {
+		size_t segRows = size_t(m_rowNumVec[m_segIdx+1] - m_rowNumVec[m_segIdx]);
+		if (m_subId >= segRows) {
+			m_segIdx++;
+			m_subId = 0;
+			continue;
+		}
+		size_t rows = std::min(segRows - m_subId, ColgroupBatch::MaxRows);
+		scanBatch(m_segs[m_segIdx].get(), m_subId, rows, batch);
+		m_subId += rows;
+		if (batch->selCount)
+			return true;
+	}
+	return false;
+}
+
+void ColgroupScanner::scanBatch(const ReadableSegment* seg,
+								size_t lo, size_t rows,
+								ColgroupBatch* batch) {
+	llong baseId = m_rowNumVec[m_segIdx];
+	batch->baseId = baseId + lo;
+	batch->rows = rows;
+	liveBits(seg, baseId, lo, rows, batch->sel);
+	batch->selCount = countBits(batch->sel, rows);
+	if (0 == batch->selCount)
+		return;
+	StoreKind kind = storeKind(seg);
+	if (RowByRow == kind) {
+		fetchRows(seg, lo, batch);
+		for (size_t j = 0; j < m_preds.size() && batch->selCount; ++j)
+			evalPredicate(m_preds[j], batch);
+	}
+	else {
+		// late materialization: projected columns are fetched only if
+		// there are rows passed the predicates
+		m_fetched.fill(0);
+		for (size_t j = 0; j < m_preds.size(); ++j) {
+			size_t columnId = m_preds[j].columnId;
+			if (!m_fetched[columnId]) {
+				fetchColumn(seg, kind, columnId, lo, rows);
+				m_fetched[columnId] = 1;
+			}
+			evalPredicate(m_preds[j], batch);
+			if (0 == batch->selCount)
+				return;
+		}
+		for (size_t j = 0; j < m_proj.size(); ++j) {
+			size_t columnId = m_proj[j];
+			if (!m_fetched[columnId]) {
+				fetchColumn(seg, kind, columnId, lo, rows);
+				m_fetched[columnId] = 1;
+			}
+		}
+	}
+	if (0 == batch->selCount)
+		return;
+	batch->columns.resize(m_proj.size());
+	for (size_t j = 0; j < m_proj.size(); ++j) {
+		batch->columns[j].assign(m_colBuf[m_proj[j]]);
+	}
+}
+
+/// same visibility as ReadonlySegment::selectOneColgroupBatch and
+/// DbContext::isVisibleInSnapshot
+void ColgroupScanner::liveBits(const ReadableSegment* seg, llong baseId,
+							   size_t lo, size_t rows, bm_uint_t* sel)
+const {
+	const DbContext* ctx = m_ctx.get();
+	if (ctx->m_isUserDefineSnapshot) {
+		const SnapshotDelMarks& marks = *ctx->m_snapshotDelMarks;
+		llong id = baseId + llong(lo);
+		llong end = ctx->m_mySnapshotVersion + 1;
+		size_t n = id < end ? std::min(rows, size_t(end - id)) : 0;
+		if (0 == n) {
+			copyNotBits(NULL, 0, 0, sel);
+			return;
+		}
+		// segments of the snapshot may be merged into seg
+		size_t upp = upper_bound_a(marks.m_rowNumVec, id);
+		llong markBase = marks.m_rowNumVec[upp-1];
+		const febitvec& isDel = marks.m_segMarks[upp-1]->m_isDel;
+		if (id + llong(n) <= markBase + llong(isDel.size())) {
+			copyNotBits(isDel.bldata(), size_t(id - markBase), n, sel);
+		}
+		else {
+			copyNotBits(NULL, 0, 0, sel);
+			for (size_t i = 0; i < n; ++i) {
+				if (!marks.isDel(id + llong(i)))
+					sel[i / WordBits] |= bm_uint_t(1) << (i % WordBits);
+			}
+		}
+	}
+	else if (seg->m_isFreezed) {
+		size_t n = std::min(rows, seg->m_isDel.size() - lo);
+		copyNotBits(seg->m_isDel.bldata(), lo, n, sel);
+	}
+	else {
+		SpinRwLock lock(seg->m_segMutex, false);
+		size_t segRows = seg->m_isDel.size();
+		size_t n = lo < segRows ? std::min(rows, segRows - lo) : 0;
+		copyNotBits(seg->m_isDel.bldata(), lo, n, sel);
+	}
+}
+
+/// stores of frozen segments are not appended, so they can be read without
+/// lock, colgroup data of writing segments are read by selectColgroups
+ColgroupScanner::StoreKind
+ColgroupScanner::storeKind(const ReadableSegment* seg) const {
+	if (!seg->m_isFreezed || m_cgId >= seg->m_colgroups.size())
+		return RowByRow;
+	const ReadableStore* store = seg->m_colgroups[m_cgId].get();
+	if (dynamic_cast<const ZipIntKeyIndex*>(store))
+		return ZipIntKey;
+	if (dynamic_cast<const ZipIntStore*>(store))
+		return ZipInt;
+	if (dynamic_cast<const FixedLenStore*>(store))
+		return FixedLen;
+	return RowByRow;
+}
+
+void ColgroupScanner::fetchColumn(const ReadableSegment* seg, StoreKind kind,
+								  size_t columnId, size_t lo, size_t rows) {
+	const ColumnMeta& colmeta = m_schema->getColumnMeta(columnId);
+	const size_t len = colmeta.fixedLen;
+	const size_t physicLo = seg->getPhysicId(lo);
+	const size_t physicHi = lo + rows < seg->m_isDel.size()
+						  ? seg->getPhysicId(lo + rows)
+						  : seg->getPhysicRows();
+	const size_t n = physicHi - physicLo;
+	assert(n <= rows);
+	valvec<byte>& col = m_colBuf[columnId];
+	col.resize_no_init(len * rows);
+	const ReadableStore* store = seg->m_colgroups[m_cgId].get();
+	switch (kind) {
+	default:
+		assert(false);
+		break;
+	case FixedLen: {
+		const size_t rowLen = m_schema->getFixedRowLen();
+		const byte* src = store->getRecordsBasePtr()
+						+ rowLen * physicLo + colmeta.fixedOffset;
+		switch (len) {
+		case 1: stridedCopy<1>(src, rowLen, n, col.data()); break;
+		case 2: stridedCopy<2>(src, rowLen, n, col.data()); break;
+		case 4: stridedCopy<4>(src, rowLen, n, col.data()); break;
+		case 8: stridedCopy<8>(src, rowLen, n, col.data()); break;
+		default:
+			for (size_t i = 0; i < n; ++i)
+				memcpy(col.data() + len * i, src + rowLen * i, len);
+			break;
+		}
+		break; }
+	case ZipInt:
+		assert(1 == m_schema->columnNum());
+		getIntValues(static_cast<const ZipIntStore*>(store),
+					 colmeta.type, physicLo, n, col.data());
+		break;
+	case ZipIntKey:
+		assert(1 == m_schema->columnNum());
+		getIntValues(dynamic_cast<const ZipIntKeyIndex*>(store),
+					 colmeta.type, physicLo, n, col.data());
+		break;
+	}
+	if (n < rows) {
+		// move values to their logic positions, purged rows are zero
+		byte* data = col.data();
+		size_t k = n;
+		for (size_t i = rows; i-- > 0; ) {
+			if (seg->m_isPurged[lo + i]) {
+				memset(data + len * i, 0, len);
+			} else {
+				--k;
+				if (k != i)
+					memcpy(data + len * i, data + len * k, len);
+			}
+		}
+		assert(0 == k);
+	}
+}
+
+/// read selected rows by selectOneColgroupBatch, then split m_need columns
+void ColgroupScanner::fetchRows(const ReadableSegment* seg, size_t lo,
+								ColgroupBatch* batch) {
+	const size_t rows = batch->rows;
+	m_subIds.erase_all();
+	for (size_t i = 0; i < rows; ++i) {
+		if (batch->isSelected(i))
+			m_subIds.push_back(lo + i);
+	}
+	const size_t n = m_subIds.size();
+	m_rowBufs.resize(n);
+	m_rowVals.resize_no_init(n);
+	m_found.resize_no_init(n);
+	seg->selectOneColgroupBatch(m_subIds.data(), n, m_cgId,
+			m_rowBufs.data(), m_found.data(), m_rowVals.data(), m_ctx.get());
+	for (size_t j = 0; j < m_need.size(); ++j) {
+		size_t len = m_schema->getColumnMeta(m_need[j]).fixedLen;
+		m_colBuf[m_need[j]].resize(0);
+		m_colBuf[m_need[j]].resize(len * rows, 0);
+	}
+	const size_t fixedRowLen = m_schema->getFixedRowLen();
+	for (size_t k = 0; k < n; ++k) {
+		size_t i = size_t(m_subIds[k]) - lo;
+		if (!m_found[k]) {
+			terark_bit_set0(batch->sel, i);
+			batch->selCount--;
+			continue;
+		}
+		fstring row = m_rowVals[k].p ? m_rowVals[k] : fstring(m_rowBufs[k]);
+		if (fixedRowLen) {
+			if (row.size() != fixedRowLen) {
+				THROW_STD(logic_error, "row size = %zd, fixedRowLen = %zd"
+					, row.size(), fixedRowLen);
+			}
+			for (size_t j = 0; j < m_need.size(); ++j) {
+				const ColumnMeta& colmeta = m_schema->getColumnMeta(m_need[j]);
+				memcpy(m_colBuf[m_need[j]].data() + colmeta.fixedLen * i,
+					   row.data() + colmeta.fixedOffset, colmeta.fixedLen);
+			}
+		}
+		else {
+			m_schema->parseRow(row, &m_cols);
+			for (size_t j = 0; j < m_need.size(); ++j) {
+				size_t len = m_schema->getColumnMeta(m_need[j]).fixedLen;
+				fstring col = m_cols[m_need[j]];
+				assert(col.size() == len);
+				memcpy(m_colBuf[m_need[j]].data() + len * i, col.data(), len);
+			}
+		}
+	}
+}
+
+void ColgroupScanner::evalPredicate(const ColumnPredicate& pred,
+									ColgroupBatch* batch) {
+	const size_t rows = batch->rows;
+	const byte* col = m_colBuf[pred.columnId].data();
+	m_match.resize_no_init(rows);
+	byte* m = m_match.data();
+	switch (m_schema->getColumnType(pred.columnId)) {
+	default:
+		assert(false);
+		break;
+	case ColumnType::Uint08: matchColumn<uint8_t , llong >(pred, (const uint8_t *)col, rows, m); break;
+	case ColumnType::Sint08: matchColumn< int8_t , llong >(pred, (const  int8_t *)col, rows, m); break;
+	case ColumnType::Uint16: matchColumn<uint16_t, llong >(pred, (const uint16_t*)col, rows, m); break;
+	case ColumnType::Sint16: matchColumn< int16_t, llong >(pred, (const  int16_t*)col, rows, m); break;
+	case ColumnType::Uint32: matchColumn<uint32_t, llong >(pred, (const uint32_t*)col, rows, m); break;
+	case ColumnType::Sint32: matchColumn< int32_t, llong >(pred, (const  int32_t*)col, rows, m); break;
+	case ColumnType::Uint64: matchColumn<uint64_t, ullong>(pred, (const uint64_t*)col, rows, m); break;
+	case ColumnType::Sint64: matchColumn< int64_t, llong >(pred, (const  int64_t*)col, rows, m); break;
+	}
+	batch->selCount = andMatchBits(m, rows, batch->sel);
+}
+
+}} // namespace terark::db
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "db_table.hpp"
+
+namespace terark { namespace db {
+
+/// a predicate on an integer column of the scanned colgroup, for Uint64
+/// columns lo, hi and inList are reinterpreted as ullong
+struct TERARK_DB_DLL ColumnPredicate {
+	enum Op {
+		Equal,
+		Range,  // lo <= x && x <= hi
+		InList,
+	};
+	size_t columnId; // column id in the colgroup schema
+	Op     op;
+	llong  lo;
+	llong  hi;
+	valvec<llong> inList;
+
+	static ColumnPredicate equal(size_t columnId, llong val);
+	static ColumnPredicate range(size_t columnId, llong lo, llong hi);
+	static ColumnPredicate in(size_t columnId, const llong* vals, size_t n);
+};
+
+/// rows [baseId, baseId+rows) of one segment, columns[j] is the dense vector
+/// of projected column j, with fixedLen bytes per row, values of rows whose
+/// bit in sel is 0 are undefined
+class TERARK_DB_DLL ColgroupBatch {
+public:
+	static const size_t MaxRows = 1024;
+	llong  baseId;
+	size_t rows;
+	size_t selCount;
+	bm_uint_t sel[MaxRows / TERARK_WORD_BITS];
+	valvec<valvec<byte> > columns;
+
+	ColgroupBatch();
+	~ColgroupBatch();
+
+	bool isSelected(size_t i) const {
+		assert(i < rows);
+		return terark_bit_test(sel, i);
+	}
+	template<class T>
+	const T* column(size_t j) const {
+		assert(j < columns.size());
+		assert(columns[j].size() == sizeof(T) * rows);
+		return (const T*)columns[j].data();
+	}
+};
+
+/// scans one colgroup of a table by batches of up to MaxRows rows, rows
+/// which are deleted or not visible to the snapshot of ctx are unselected,
+/// then predicates are evaluated on column vectors and only the projected
+/// columns of batches which have selected rows are materialized
+///
+/// colgroups stored by FixedLenStore, ZipIntStore or ZipIntKeyIndex in
+/// frozen segments are decoded directly from the store, other colgroups
+/// are read row by row
+///
+/// segments are taken when the scanner is created, rows added later are
+/// not scanned
+class TERARK_DB_DLL ColgroupScanner : public RefCounter {
+public:
+	ColgroupScanner(const DbTable* tab, size_t cgId, DbContext* ctx);
+	~ColgroupScanner();
+
+	/// projected columns must be fixed length, default are all fixed
+	/// length columns
+	void setProjection(const size_t* colIds, size_t n);
+	/// predicate columns must be integers, predicates are and'ed
+	void addPredicate(const ColumnPredicate&);
+
+	/// skips batches in which no row is selected
+	///@returns false at the end
+	bool next(ColgroupBatch* batch);
+	void reset();
+
+	size_t colgroupId() const { return m_cgId; }
+	const Schema& schema() const { return *m_schema; }
+
+protected:
+	enum StoreKind {
+		RowByRow,
+		FixedLen,
+		ZipInt,
+		ZipIntKey,
+	};
+	DbContextPtr     m_ctx;
+	const Schema*    m_schema;
+	size_t           m_cgId;
+	valvec<ReadableSegmentPtr> m_segs;
+	valvec<llong>    m_rowNumVec;
+	size_t           m_segIdx;
+	size_t           m_subId;
+	valvec<size_t>   m_proj;
+	valvec<ColumnPredicate> m_preds;
+	valvec<size_t>   m_need; // columns of m_proj and m_preds
+	valvec<valvec<byte> > m_colBuf; // [columnId], m_need columns of batch
+	valvec<byte>     m_fetched; // [columnId]
+	valvec<byte>     m_match;
+	valvec<llong>    m_subIds;
+	valvec<valvec<byte> > m_rowBufs;
+	valvec<fstring>  m_rowVals;
+	valvec<byte_t>   m_found;
+	ColumnVec        m_cols;
+
+	void updateNeed();
+	void scanBatch(const ReadableSegment*, size_t lo, size_t rows,
+				   ColgroupBatch*);
+	void liveBits(const ReadableSegment*, llong baseId, size_t lo,
+				  size_t rows, bm_uint_t* sel) const;
+	StoreKind storeKind(const ReadableSegment*) const;
+	void fetchColumn(const ReadableSegment*, StoreKind, size_t columnId,
+					 size_t lo, size_t rows);
+	void fetchRows(const ReadableSegment*, size_t lo, ColgroupBatch*);
+	void evalPredicate(const ColumnPredicate&, ColgroupBatch*);
+};
+typedef boost::intrusive_ptr<ColgroupScanner> ColgroupScannerPtr;
+
+}} // namespace terark::db
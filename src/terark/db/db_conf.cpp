@@ -190,6 +190,7 @@ ColumnVec& ColumnVec::operator=(ColumnVec&&) = default;
 /////////////////////////////////////////////////////////////////////////////
 
 const unsigned int DEFAULT_nltNestLevel = 4;
+const unsigned int DEFAULT_learnedIndexEpsilon = 32;
 
 Schema::Schema() {
 	m_fixedLen = size_t(-1);
@@ -209,6 +210,7 @@ Schema::Schema() {
 	m_isInplaceUpdatable = false;
 	m_enableLinearScan = false;
 	m_mmapPopulate = false;
+	m_enableStoreCache = true;
 	m_keepCols.fill(true);
 	m_minFragLen = 0;
 	m_maxFragLen = 0;
@@ -216,6 +218,8 @@ Schema::Schema() {
 	m_rankSelectClass = 512;
 	m_checksumLevel = 2; // checksum all
 	m_nltNestLevel = DEFAULT_nltNestLevel;
+	m_bloomBitsPerKey = 0;
+	m_learnedIndexEpsilon = 0;
 	m_lastVarLenCol = 0;
 	m_restFixLenSum = 0;
 }
@@ -2009,6 +2013,9 @@ SchemaConfig::SchemaConfig() {
 	m_purgeDeleteThreshold = DEFAULT_purgeDeleteThreshold;
 	m_usePermanentRecordId = false;
 	m_enableSnapshot = false;
+	m_enableGroupCommit = false;
+	m_storeCacheBytes = 0;
+	m_rowCacheBytes = 0;
 }
 SchemaConfig::~SchemaConfig() {
 }
@@ -2231,6 +2238,7 @@ parseJsonColgroup(Schema& schema, const terark::json& js, int sufarrMinFreq) {
 	schema.m_minFragLen = getJsonValue(js, "minFragLen", 0);
 	schema.m_sufarrMinFreq = getJsonValue(js, "sufarrMinFreq", sufarrMinFreq);
 	schema.m_mmapPopulate = getJsonValue(js, "mmapPopulate", false);
+	schema.m_enableStoreCache = getJsonValue(js, "storeCache", true);
 	//  512: rank_select_se_512
 	//  256: rank_select_se_256
 	// -256: rank_select_il_256
@@ -2731,6 +2739,9 @@ if (colgroupsIter != meta.end()) {
 		meta, "WriteThrottleBytesPerSecond", 0);
 	m_purgeDeleteThreshold = getJsonValue(
 		meta, "PurgeDeleteThreshold", DEFAULT_purgeDeleteThreshold);
+	m_enableGroupCommit = getJsonValue(meta, "EnableGroupCommit", false);
+	m_storeCacheBytes = getJsonSizeValue(meta, "StoreCacheBytes", 0);
+	m_rowCacheBytes = getJsonSizeValue(meta, "RowCacheBytes", 0);
 
 	m_enableSnapshot = getJsonValue(meta, "EnableSnapshot", false);
 {
@@ -2804,6 +2815,12 @@ if (tableIndex != meta.end()) {
 		indexSchema->m_rankSelectClass = getJsonValue(index, "rs", 512);
 		indexSchema->m_nltNestLevel = (byte)limitInBound(
 			getJsonValue(index, "nltNestLevel", DEFAULT_nltNestLevel), 1u, 20u);
+		indexSchema->m_bloomBitsPerKey = (byte)limitInBound(
+			getJsonValue(index, "bloomBitsPerKey", 0u), 0u, 32u);
+		if (getJsonValue(index, "learnedIndex", false)) {
+			indexSchema->m_learnedIndexEpsilon = (byte)limitInBound(
+				getJsonValue(index, "learnedIndexEpsilon", DEFAULT_learnedIndexEpsilon), 1u, 255u);
+		}
 
 		// default mmapPopulate for index is true
 		indexSchema->m_mmapPopulate = getJsonValue(index, "mmapPopulate", true);
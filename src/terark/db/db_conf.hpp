@@ -279,6 +279,8 @@ namespace terark { namespace db {
 		int    m_checksumLevel;
 		float  m_dictZipSampleRatio;
 		byte   m_nltNestLevel;
+		byte   m_bloomBitsPerKey; // 0 means no bloom filter, just for unique index
+		byte   m_learnedIndexEpsilon; // 0 means no LearnedIntKeyIndex
 		byte   m_dictZipEntropyType; // DictBlobStore::EntropyAlgo
 		bool   m_isCompiled: 1;
 		bool   m_isOrdered : 1; // just for index schema
@@ -291,6 +293,7 @@ namespace terark { namespace db {
 		bool   m_isInplaceUpdatable: 1;
 		bool   m_enableLinearScan  : 1;
 		bool   m_mmapPopulate : 1;
+		bool   m_enableStoreCache : 1; // use RecordCache::global()
 		static_bitmap<MaxProjColumns> m_keepCols;
 
 		// used for ordered index, m_indexOrder.is1(i) means i'th column
@@ -547,6 +550,9 @@ namespace terark { namespace db {
 		std::string m_readonlySegmentClass;
 		bool     m_usePermanentRecordId;
 		bool     m_enableSnapshot;
+		bool     m_enableGroupCommit; // batch concurrent insert/upsert
+		size_t   m_storeCacheBytes; // min capacity of RecordCache::global()
+		size_t   m_rowCacheBytes; // 0 disables the row cache of DbTable
 
 		SchemaConfig();
 		~SchemaConfig();
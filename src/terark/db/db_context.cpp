@@ -105,6 +105,9 @@ DbContext::DbContext(const DbTable* tab)
 
 DbContext::~DbContext() {
 //	m_tab->unregisterDbContext(this);
+	if (m_isUserDefineSnapshot) {
+		m_tab->unpinSnapshot(this);
+	}
 	this->m_transaction.reset(); // destory before m_segCtx
 	size_t indexNum = m_tab->getIndexNum();
 	for (auto& x : m_segCtx) {
@@ -120,23 +123,56 @@ void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	if (!m_isUserDefineSnapshot) {
 		m_mySnapshotVersion = tab->m_rowNum - 1;
 	}
-	size_t indexNum = tab->getIndexNum();
 	size_t oldtab_segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
+	doSyncSegCtxImpl(tab, tab->m_segments.data(), tab->m_segments.size(),
+					 tab->m_rowNumVec, tab->m_wrSeg.get());
+	TERARK_RT_assert(tab->getSegArrayUpdateSeq() == oldtab_segArrayUpdateSeq,
+					 std::logic_error);
+	segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
+}
+
+/// sync with a published snapshot, does not need tab->m_rwMutex
+void
+DbContext::doSyncSegCtx(const DbTable* tab, const SegArraySnapshot& segArray) {
+	assert(tab == m_tab);
+	if (segArray.m_updateSeq == this->segArrayUpdateSeq) {
+		// tab->m_segArrayUpdateSeq was increased in write lock, but the
+		// new snapshot has not been published yet
+		return;
+	}
+	assert(this->segArrayUpdateSeq < segArray.m_updateSeq);
+	doSyncSegCtxImpl(tab, segArray.m_segments.data(), segArray.m_segments.size(),
+					 segArray.m_rowNumVec, segArray.m_wrSeg);
+	segArrayUpdateSeq = segArray.m_updateSeq;
+	llong rowNum = tab->m_rowNum;
+	if (segArray.m_updateSeq == tab->m_segArrayUpdateSeq) {
+		// rows appended to m_wrSeg after the snapshot was published
+		m_rowNumVec.back() = std::max(m_rowNumVec.back(), rowNum);
+	}
+	if (!m_isUserDefineSnapshot) {
+		m_mySnapshotVersion = m_rowNumVec.back() - 1;
+	}
+}
+
+void DbContext::doSyncSegCtxImpl(const DbTable* tab,
+								 const ReadableSegmentPtr* segArray,
+								 size_t segNum, const valvec<llong>& rowNumVec,
+								 const WritableSegment* wrSeg) {
+	size_t indexNum = tab->getIndexNum();
 	size_t oldSegNum = m_segCtx.size();
-	size_t segNum = tab->getSegNum();
 	if (m_segCtx.size() < segNum) {
 		m_segCtx.resize(segNum, NULL);
 		for (size_t i = oldSegNum; i < segNum; ++i)
-			m_segCtx[i] = SegCtx::create(tab->getSegmentPtr(i), indexNum);
+			m_segCtx[i] = SegCtx::create(segArray[i].get(), indexNum);
 	}
-	if (m_transaction && tab->m_wrSeg.get() != m_wrSegPtr) {
+	if (m_transaction && wrSeg != m_wrSegPtr) {
 		// m_transaction is useless, reset it!
 		m_transaction.reset();
 		m_wrSegPtr = NULL;
 	}
 	SegCtx** sctx = m_segCtx.data();
 	for (size_t i = 0; i < segNum; ++i) {
-		ReadableSegment* seg = tab->getSegmentPtr(i);
+		ReadableSegment* seg = segArray[i].get();
 		if (NULL == sctx[i]) {
 			sctx[i] = SegCtx::create(seg, indexNum);
 			continue;
@@ -171,14 +207,11 @@ void DbContext::doSyncSegCtxNoLock(const DbTable* tab) {
 	for (size_t i = 0; i < segNum; ++i) {
 		TERARK_RT_assert(NULL != sctx[i], std::logic_error);
 		TERARK_RT_assert(NULL != sctx[i]->seg, std::logic_error);
-		TERARK_RT_assert(tab->getSegmentPtr(i) == sctx[i]->seg, std::logic_error);
+		TERARK_RT_assert(segArray[i].get() == sctx[i]->seg, std::logic_error);
 	}
 	m_segCtx.risk_set_size(segNum);
-	m_rowNumVec.assign(tab->m_rowNumVec);
+	m_rowNumVec.assign(rowNumVec);
 	TERARK_RT_assert(m_rowNumVec.size() == segNum + 1, std::logic_error);
-	TERARK_RT_assert(tab->getSegArrayUpdateSeq() == oldtab_segArrayUpdateSeq,
-					 std::logic_error);
-	segArrayUpdateSeq = tab->getSegArrayUpdateSeq();
 }
 
 StoreIterator* DbContext::getWrtStoreIterNoLock(size_t segIdx) {
@@ -12,6 +12,30 @@ namespace terark { namespace db {
 typedef boost::intrusive_ptr<class DbTable> DbTablePtr;
 typedef boost::intrusive_ptr<class StoreIterator> StoreIteratorPtr;
 
+/// a copy of delete marks of a segment, the copy of a frozen segment is
+/// shared by snapshots until delete marks of the segment are changed
+class TERARK_DB_DLL SegDelMarks : public RefCounter {
+public:
+	febitvec m_isDel;
+	size_t   m_delcnt;
+};
+typedef boost::intrusive_ptr<SegDelMarks> SegDelMarksPtr;
+
+/// delete marks of all rows when a snapshot is pinned, shared by all
+/// DbContext objects which are pinned to the same snapshot
+class TERARK_DB_DLL SnapshotDelMarks : public RefCounter {
+public:
+	valvec<llong> m_rowNumVec; // m_rowNumVec[i] is baseId of m_segMarks[i]
+	valvec<SegDelMarksPtr> m_segMarks;
+
+	bool isDel(llong recId) const {
+		size_t upp = upper_bound_a(m_rowNumVec, recId);
+		assert(upp > 0 && upp < m_rowNumVec.size());
+		return m_segMarks[upp-1]->m_isDel[size_t(recId - m_rowNumVec[upp-1])];
+	}
+};
+typedef boost::intrusive_ptr<SnapshotDelMarks> SnapshotDelMarksPtr;
+
 class TERARK_DB_DLL DbContextLink : public RefCounter {
 	friend class DbTable;
 protected:
@@ -26,6 +50,7 @@ public:
 	~DbContext();
 
 	void doSyncSegCtxNoLock(const DbTable* tab);
+	void doSyncSegCtx(const DbTable* tab, const struct SegArraySnapshot&);
 	void trySyncSegCtxNoLock(const DbTable* tab);
 	void trySyncSegCtxSpeculativeLock(const DbTable* tab);
 	class StoreIterator* getWrtStoreIterNoLock(size_t segIdx);
@@ -57,6 +82,11 @@ public:
 	void indexSearchExactNoLock(size_t indexId, fstring key, valvec<llong>* recIdvec);
 	bool indexKeyExistsNoLock(size_t indexId, fstring key);
 
+	void indexSearchExactBatch(size_t indexId, const fstring* keys, size_t n,
+							   valvec<llong>* recIdvec, valvec<size_t>* keyOffsets);
+	void indexSearchExactBatchNoLock(size_t indexId, const fstring* keys, size_t n,
+							   valvec<llong>* recIdvec, valvec<size_t>* keyOffsets);
+
 	bool indexMatchRegex(size_t indexId, class RegexForIndex*, valvec<llong>* recIdvec);
 
 	void selectColumns(llong id, const valvec<size_t>& cols, valvec<byte>* colsData);
@@ -67,6 +97,10 @@ public:
 	void selectColgroups(llong id, const size_t* cgIdvec, size_t cgIdvecSize, valvec<byte>* cgDataVec);
 
 	void selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData);
+	void selectOneColgroupBatch(const llong* recIds, size_t n, size_t cgId,
+								valvec<byte>* bufs, byte_t* found,
+								fstring* vals = NULL,
+								boost::intrusive_ptr<class ReadableSegment>* pins = NULL);
 
 	void selectColumnsNoLock(llong id, const valvec<size_t>& cols, valvec<byte>* colsData);
 	void selectColumnsNoLock(llong id, const size_t* colsId, size_t colsNum, valvec<byte>* colsData);
@@ -80,9 +114,21 @@ public:
 
 	class ReadableSegment* getSegmentPtr(size_t segIdx) const;
 
+	/// valid only when m_isUserDefineSnapshot
+	bool isVisibleInSnapshot(llong recId) const {
+		assert(m_isUserDefineSnapshot);
+		return recId <= m_mySnapshotVersion && !m_snapshotDelMarks->isDel(recId);
+	}
+
 	void ensureTransactionNoLock();
 	void freeWritableSegmentResources();
 
+protected:
+	void doSyncSegCtxImpl(const DbTable* tab,
+						  const boost::intrusive_ptr<class ReadableSegment>* segArray,
+						  size_t segNum, const valvec<llong>& rowNumVec,
+						  const class WritableSegment* wrSeg);
+
 public:
 	struct SegCtx {
 		class ReadableSegment* seg;
@@ -104,6 +150,7 @@ public:
 	valvec<SegCtx*> m_segCtx;
 	valvec<llong>   m_rowNumVec; // copy of DbTable::m_rowNumVec
 	llong           m_mySnapshotVersion;
+	SnapshotDelMarksPtr m_snapshotDelMarks;
 	std::string  errMsg;
 	valvec<byte> buf1;
 	valvec<byte> buf2;
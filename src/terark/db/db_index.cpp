@@ -56,6 +56,17 @@ IndexIterator* ReadableIndex::createIndexIterBackward(DbContext*) const {
 	return nullptr;
 }
 
+void ReadableIndex::searchExactBatchAppend(const fstring* keys, size_t n,
+									 valvec<llong>* recIdvec, size_t* hitCnt,
+									 DbContext* ctx)
+const {
+	for (size_t i = 0; i < n; ++i) {
+		size_t oldsize = recIdvec->size();
+		searchExactAppend(keys[i], recIdvec, ctx);
+		hitCnt[i] = recIdvec->size() - oldsize;
+	}
+}
+
 bool ReadableIndex::matchRegexAppend(RegexForIndex* regex,
 									 valvec<llong>* recIdvec, DbContext*)
 const {
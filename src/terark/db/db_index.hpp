@@ -84,6 +84,13 @@ public:
 		searchExactAppend(key, recIdvec, ctx);
 	}
 	virtual void searchExactAppend(fstring key, valvec<llong>* recIdvec, DbContext*) const = 0;
+
+	///@param keys   searching is fastest when keys are sorted in index order,
+	///              unsorted keys are also allowed
+	///@param hitCnt hitCnt[i] is the number of recId appended for keys[i]
+	virtual void searchExactBatchAppend(const fstring* keys, size_t n,
+										valvec<llong>* recIdvec, size_t* hitCnt,
+										DbContext*) const;
 	///@}
 
 	virtual bool matchRegexAppend(RegexForIndex* regex, valvec<llong>* recIdvec, DbContext*) const;
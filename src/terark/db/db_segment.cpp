@@ -1,6 +1,7 @@
 #include "db_table.hpp"
 #include "db_segment.hpp"
 #include "intkey_index.hpp"
+#include "learned_int_index.hpp"
 #include "zip_int_store.hpp"
 #include "fixed_len_key_index.hpp"
 #include "fixed_len_store.hpp"
@@ -15,6 +16,7 @@
 #include <terark/util/mmap.hpp>
 #include <terark/util/sortable_strvec.hpp>
 #include <terark/util/truncate_file.hpp>
+#include <terark/thread/pipeline.hpp>
 //#include <boost/dll.hpp>
 
 //#define TERARK_DB_ENABLE_DFA_META
@@ -34,6 +36,9 @@
 #include "json.hpp"
 
 #include <boost/scope_exit.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 //#define SLOW_DEBUG_CHECK
 
@@ -142,6 +147,9 @@ ReadableSegment::ReadableSegment() {
 	m_bookUpdates = false;
 	m_withPurgeBits = false;
 	m_isPurgedMmap = nullptr;
+	m_rowCache = nullptr;
+	m_rowCacheOwner = RecordCache::newOwnerId();
+	m_rowCacheVersion = 0;
 }
 ReadableSegment::~ReadableSegment() {
 	if (m_isDelMmap) {
@@ -151,6 +159,7 @@ ReadableSegment::~ReadableSegment() {
 		saveIsDel(m_segDir);
 	}
 	m_indices.clear(); // destroy index objects
+	m_indexFilters.clear();
 	m_colgroups.clear();
 	m_deletionTime = nullptr;
 	assert(!m_segDir.empty());
@@ -245,15 +254,51 @@ void ReadableSegment::closeIsDel() {
 	}
 }
 
+void
+ReadableSegment::indexSearchExactBatchAppend(size_t mySegIdx, size_t indexId,
+										const fstring* keys, size_t n,
+										valvec<llong>* recIdvec, size_t* hitCnt,
+										DbContext* ctx) const {
+	for (size_t k = 0; k < n; ++k) {
+		size_t oldsize = recIdvec->size();
+		indexSearchExactAppend(mySegIdx, indexId, keys[k], recIdvec, ctx);
+		hitCnt[k] = recIdvec->size() - oldsize;
+	}
+}
+
+void
+ReadableSegment::selectOneColgroupBatch(const llong* subIds, size_t n,
+								size_t cgId, valvec<byte>* bufs, byte_t* found,
+								fstring* vals, DbContext* ctx) const {
+	for (size_t i = 0; i < n; ++i) {
+		if (vals)
+			vals[i] = fstring();
+		try {
+			selectColgroups(subIds[i], &cgId, 1, &bufs[i], ctx);
+			found[i] = 1;
+		}
+		catch (const ReadRecordException&) {
+			found[i] = 0;
+		}
+	}
+}
+
 void ReadableSegment::openIndices(PathRef segDir) {
 	if (!m_indices.empty()) {
 		THROW_STD(invalid_argument, "m_indices must be empty");
 	}
 	m_indices.resize(m_schema->getIndexNum());
+	m_indexFilters.erase_all();
+	m_indexFilters.resize(m_schema->getIndexNum());
 	for (size_t i = 0; i < m_schema->getIndexNum(); ++i) {
 		const Schema& schema = m_schema->getIndexSchema(i);
 		fs::path path = segDir / ("index-" + schema.m_name);
 		m_indices[i] = this->openIndex(schema, path.string());
+		fs::path bloomPath = path.string() + ".bloom";
+		if (fs::exists(bloomPath)) {
+			m_indexFilters[i] = new BloomFilter();
+			m_indexFilters[i]->load(bloomPath);
+		}
 	}
 }
 
@@ -263,6 +308,9 @@ void ReadableSegment::saveIndices(PathRef segDir) const {
 		const Schema& schema = m_schema->getIndexSchema(i);
 		fs::path path = segDir / ("index-" + schema.m_name);
 		m_indices[i]->save(path.string());
+		if (i < m_indexFilters.size() && m_indexFilters[i]) {
+			m_indexFilters[i]->save(path.string() + ".bloom");
+		}
 	}
 }
 
@@ -342,8 +390,28 @@ size_t ReadableSegment::getLogicId(size_t physicId) const {
 	}
 }
 
+/// delete marks only change by set1 which increments m_delcnt, except
+/// DbTable::delmarkSet0, which drops m_pinnedDelMarks, so the copy of a
+/// frozen segment is reused while m_delcnt is not changed
+SegDelMarksPtr ReadableSegment::snapshotDelMarks() {
+	SpinRwLock segLock(m_segMutex, false);
+	if (m_isFreezed && m_pinnedDelMarks &&
+			m_pinnedDelMarks->m_delcnt == m_delcnt &&
+			m_pinnedDelMarks->m_isDel.size() == m_isDel.size()) {
+		return m_pinnedDelMarks;
+	}
+	SegDelMarksPtr marks(new SegDelMarks());
+	marks->m_isDel.append(m_isDel);
+	marks->m_delcnt = m_delcnt;
+	if (m_isFreezed) {
+		m_pinnedDelMarks = marks;
+	}
+	return marks;
+}
+
 void ReadableSegment::addtoUpdateList(size_t logicId) {
 	assert(m_isFreezed);
+	invalidateRowCache(logicId);
 	if (!m_bookUpdates) {
 		return;
 	}
@@ -421,7 +489,20 @@ void ReadonlySegment::getValueAppend(llong id, valvec<byte>* val, DbContext* ctx
 	if (terark_unlikely(id < 0 || id >= rows)) {
 		THROW_STD(out_of_range, "invalid id=%lld, rows=%lld", id, rows);
 	}
+	if (!m_rowCache) {
+		getValueByPhysicId(getPhysicId(id), val, ctx);
+		return;
+	}
+	// keyed by logicId, so a hit need not to compute physicId
+	if (m_rowCache->getAppend(m_rowCacheOwner, id, val)) {
+		return;
+	}
+	uint64_t version = m_rowCacheVersion.load(std::memory_order_acquire);
+	size_t oldsize = val->size();
 	getValueByPhysicId(getPhysicId(id), val, ctx);
+	m_rowCache->put(m_rowCacheOwner, id,
+		fstring(val->data() + oldsize, val->size() - oldsize),
+		&m_rowCacheVersion, version);
 }
 
 void
@@ -510,6 +591,10 @@ ColgroupWritableSegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 				recIdvecData[newsize++] = logicId;
 		}
 	}
+	else if (ctx->m_isUserDefineSnapshot) {
+		// deleted rows are filtered by DbTable with snapshot marks
+		newsize = recIdvecSize;
+	}
 	else {
 		auto isDel = m_isDel.bldata();
 		for(size_t k = oldsize; k < recIdvecSize; ++k) {
@@ -525,19 +610,88 @@ void
 ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 										fstring key, valvec<llong>* recIdvec,
 										DbContext* ctx) const {
+	if (indexId < m_indexFilters.size()) {
+		auto filter = m_indexFilters[indexId].get();
+		if (filter && !filter->mayContain(key))
+			return;
+	}
 	size_t oldsize = recIdvec->size();
 	auto index = m_indices[indexId].get();
 	index->searchExactAppend(key, recIdvec, ctx);
 	if (recIdvec->size() == oldsize) {
 		return;
 	}
-	size_t newsize = oldsize;
+	llong*  recIdvecData = recIdvec->data() + oldsize;
+	size_t  len = recIdvec->size() - oldsize;
+	recIdvec->risk_set_size(oldsize + filterIndexHits(recIdvecData, len, ctx));
+}
+
+void
+ReadonlySegment::indexSearchExactBatchAppend(size_t mySegIdx, size_t indexId,
+										const fstring* keys, size_t n,
+										valvec<llong>* recIdvec, size_t* hitCnt,
+										DbContext* ctx) const {
+	size_t oldsize = recIdvec->size();
+	auto index = m_indices[indexId].get();
+	auto filter = indexId < m_indexFilters.size()
+				? m_indexFilters[indexId].get() : NULL;
+	if (filter) {
+		// only search the keys which pass the bloom filter, then scatter
+		// hitCnt back to the original key positions
+		valvec<size_t> passed(n, valvec_reserve());
+		valvec<fstring> passedKeys(n, valvec_reserve());
+		for (size_t k = 0; k < n; ++k) {
+			hitCnt[k] = 0;
+			if (filter->mayContain(keys[k])) {
+				passed.unchecked_push_back(k);
+				passedKeys.unchecked_push_back(keys[k]);
+			}
+		}
+		if (passed.empty()) {
+			return;
+		}
+		valvec<size_t> passedCnt(passed.size());
+		index->searchExactBatchAppend(passedKeys.data(), passedKeys.size(),
+									  recIdvec, passedCnt.data(), ctx);
+		for (size_t j = 0; j < passed.size(); ++j) {
+			hitCnt[passed[j]] = passedCnt[j];
+		}
+	}
+	else {
+		index->searchExactBatchAppend(keys, n, recIdvec, hitCnt, ctx);
+	}
+	if (recIdvec->size() == oldsize) {
+		return;
+	}
 	llong* recIdvecData = recIdvec->data();
+	size_t rpos = oldsize, wpos = oldsize;
+	for (size_t k = 0; k < n; ++k) {
+		size_t len = hitCnt[k];
+		if (len) {
+			size_t hits = filterIndexHits(recIdvecData + rpos, len, ctx);
+			if (wpos != rpos) {
+				std::copy_n(recIdvecData + rpos, hits, recIdvecData + wpos);
+			}
+			rpos += len;
+			wpos += hits;
+			hitCnt[k] = hits;
+		}
+	}
+	assert(recIdvec->size() == rpos);
+	recIdvec->risk_set_size(wpos);
+}
+
+/// convert index result physicId to logicId, and remove deleted records
+///@returns number of remained records, which are compacted to the front
+size_t
+ReadonlySegment::filterIndexHits(llong* recIdvecData, size_t len,
+								 const DbContext* ctx) const {
+	size_t newsize = 0;
 	if (m_deletionTime) {
 		auto deltime = (const llong*)m_deletionTime->getRecordsBasePtr();
 		auto snapshotVersion = ctx->m_mySnapshotVersion;
 		if (m_isPurged.empty()) {
-			for(size_t k = oldsize; k < recIdvec->size(); ++k) {
+			for(size_t k = 0; k < len; ++k) {
 				llong logicId = recIdvecData[k];
 				if (deltime[logicId] > snapshotVersion)
 					recIdvecData[newsize++] = logicId;
@@ -546,7 +700,7 @@ ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 		else {
 			assert(m_isPurged.size() == m_isDel.size());
 			assert(this->getReadonlySegment() != NULL);
-			for(size_t k = oldsize; k < recIdvec->size(); ++k) {
+			for(size_t k = 0; k < len; ++k) {
 				size_t physicId = (size_t)recIdvecData[k];
 				assert(physicId < m_isPurged.max_rank0());
 				size_t logicId = m_isPurged.select0(physicId);
@@ -555,9 +709,22 @@ ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 			}
 		}
 	}
+	else if (ctx->m_isUserDefineSnapshot) {
+		// deleted rows are filtered by DbTable with snapshot marks,
+		// rows deleted after the snapshot are never purged
+		if (m_isPurged.empty()) {
+			newsize = len;
+		}
+		else {
+			for(size_t k = 0; k < len; ++k) {
+				size_t physicId = (size_t)recIdvecData[k];
+				recIdvecData[newsize++] = m_isPurged.select0(physicId);
+			}
+		}
+	}
 	else {
 		if (m_isPurged.empty()) {
-			for(size_t k = oldsize; k < recIdvec->size(); ++k) {
+			for(size_t k = 0; k < len; ++k) {
 				llong logicId = recIdvecData[k];
 				if (!m_isDel[logicId])
 					recIdvecData[newsize++] = logicId;
@@ -566,7 +733,7 @@ ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 		else {
 			assert(m_isPurged.size() == m_isDel.size());
 			assert(this->getReadonlySegment() != NULL);
-			for(size_t k = oldsize; k < recIdvec->size(); ++k) {
+			for(size_t k = 0; k < len; ++k) {
 				size_t physicId = (size_t)recIdvecData[k];
 				assert(physicId < m_isPurged.max_rank0());
 				size_t logicId = m_isPurged.select0(physicId);
@@ -575,7 +742,7 @@ ReadonlySegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 			}
 		}
 	}
-	recIdvec->risk_set_size(newsize);
+	return newsize;
 }
 
 void
@@ -685,6 +852,38 @@ void ReadonlySegment::selectColgroups(llong recId,
 	selectColgroupsByPhysicId(physicId, cgIdvec, cgIdvecSize, cgDataVec, ctx);
 }
 
+/// subIds are in ascending order when called by DbTable, so the store is
+/// accessed sequentially
+void
+ReadonlySegment::selectOneColgroupBatch(const llong* subIds, size_t n,
+						size_t cgId, valvec<byte>* bufs, byte_t* found,
+						fstring* vals, DbContext* ctx) const {
+	if (cgId >= m_schema->getColgroupNum()) {
+		THROW_STD(out_of_range, "cgId = %zd, cgNum = %zd"
+			, cgId, m_schema->getColgroupNum());
+	}
+	const ReadableStore* store = m_colgroups[cgId].get();
+	for (size_t i = 0; i < n; ++i) {
+		size_t subId = size_t(subIds[i]);
+		assert(subId < m_isDel.size());
+		if (vals)
+			vals[i] = fstring();
+		if (m_isDel[subId]) {
+			// a pinned snapshot may still see a deleted but unpurged row
+			bool purged = !m_isPurged.empty() && m_isPurged[subId];
+			if (!ctx->m_isUserDefineSnapshot || purged) {
+				found[i] = 0;
+				continue;
+			}
+		}
+		llong physicId = getPhysicId(subId);
+		if (!vals || !store->getValueRef(physicId, &vals[i], ctx)) {
+			store->getValue(physicId, &bufs[i], ctx);
+		}
+		found[i] = 1;
+	}
+}
+
 void ColgroupWritableSegment::selectColgroups(llong recId,
 						const size_t* cgIdvec, size_t cgIdvecSize,
 						valvec<byte>* cgDataVec, DbContext* ctx) const {
@@ -839,6 +1038,9 @@ public:
 			m_appenders[i]->append(m_projRowBuf, NULL);
 		}
 	}
+	void writeOneColgroup(size_t cgId, fstring projRow) {
+		m_appenders[cgId]->append(projRow, NULL);
+	}
 	void completeWrite() {
 		size_t colgroupNum = m_readers.size();
 		for (size_t i = 0; i < colgroupNum; ++i) {
@@ -876,6 +1078,128 @@ public:
 	}
 };
 
+// Threads used by compressions, including the compression threads and the
+// threads borrowed for parallel building, the total number of borrowed
+// threads is capped by DbTable::getCompressionThreadsNum()
+static std::atomic<size_t> g_compressBusyThreads(0);
+
+class CompressThreadsLease {
+	size_t m_num; // including current thread
+public:
+	///@param want max number of extra threads
+	explicit CompressThreadsLease(size_t want) {
+		const size_t limit = DbTable::getCompressionThreadsNum();
+		size_t busy = g_compressBusyThreads.load();
+		size_t grant;
+		do {
+			grant = busy + 1 < limit ? std::min(want, limit - busy - 1) : 0;
+		} while (!g_compressBusyThreads.compare_exchange_weak(busy, busy + 1 + grant));
+		m_num = 1 + grant;
+	}
+	~CompressThreadsLease() {
+		assert(g_compressBusyThreads.load() >= m_num);
+		g_compressBusyThreads -= m_num;
+	}
+	size_t extra() const { return m_num - 1; }
+};
+
+/// Run independent build tasks by current thread plus borrowed threads,
+/// tasks are started largest first, and running tasks' estimated memory
+/// is capped by memLimit, a task larger than memLimit runs alone
+class ParallelBuildTasks {
+	struct Task {
+		size_t memSize;
+		std::function<void()> func;
+	};
+	std::vector<Task> m_tasks;
+	size_t m_next = 0;
+	size_t m_running = 0;
+	size_t m_usedMem = 0;
+	size_t m_memLimit;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::exception_ptr m_error;
+
+	bool fetch(Task** pt) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for (;;) {
+			if (m_error || m_next == m_tasks.size())
+				return false;
+			Task* t = &m_tasks[m_next];
+			if (0 == m_running || m_usedMem + t->memSize <= m_memLimit) {
+				m_next++;
+				m_running++;
+				m_usedMem += t->memSize;
+				*pt = t;
+				return true;
+			}
+			m_cond.wait(lock);
+		}
+	}
+	void done(Task* t, std::exception_ptr err) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (err && !m_error)
+			m_error = err;
+		m_running--;
+		m_usedMem -= t->memSize;
+		m_cond.notify_all();
+	}
+	void worker() {
+		Task* t;
+		while (fetch(&t)) {
+			std::exception_ptr err;
+			try { t->func(); }
+			catch (...) { err = std::current_exception(); }
+			done(t, err);
+		}
+	}
+
+public:
+	explicit ParallelBuildTasks(size_t memLimit) : m_memLimit(memLimit) {}
+
+	void add(size_t memSize, std::function<void()> func) {
+		m_tasks.emplace_back();
+		m_tasks.back().memSize = memSize;
+		m_tasks.back().func.swap(func);
+	}
+
+	void run() {
+		std::stable_sort(m_tasks.begin(), m_tasks.end(),
+			[](const Task& x, const Task& y) { return x.memSize > y.memSize; });
+		CompressThreadsLease lease(m_tasks.size() > 1 ? m_tasks.size()-1 : 0);
+		size_t extra = lease.extra();
+		std::vector<std::thread> threads;
+		threads.reserve(extra);
+		try {
+			for (size_t i = 0; i < extra; ++i)
+				threads.emplace_back(&ParallelBuildTasks::worker, this);
+		}
+		catch (...) {
+			// can not create more threads, run with fewer threads
+		}
+		worker();
+		for (auto& th : threads)
+			th.join();
+		if (m_error)
+			std::rethrow_exception(m_error);
+	}
+};
+
+/// A chunk of input rows for parallel parsing, projected colgroup rows
+/// are appended to temp files in the original order by the serial stage
+class CompressRowsTask : public PipelineTask {
+public:
+	valvec<byte>   rows;
+	valvec<size_t> offsets;
+	valvec<valvec<byte> >   cgRows;
+	valvec<valvec<size_t> > cgOffsets;
+	CompressRowsTask() { offsets.push_back(0); }
+	size_t size() const { return offsets.size() - 1; }
+};
+
+const size_t CompressRowsChunkBytes = 1024 * 1024;
+const size_t CompressRowsParallelMinRows = 64 * 1024;
+
 ///@param iter record id from iter is physical id
 ///@param isDel new logical deletion mark
 ///@param isPurged physical deletion mark
@@ -934,20 +1258,131 @@ ReadonlySegment::compressMultipleColgroups(ReadableSegment* input, DbContext* ct
 	auto tmpDir = m_segDir + ".tmp";
 	TempFileList colgroupTempFiles(tmpDir, *m_schema->m_colgroupSchemaSet);
 {
-	ColumnVec columns(m_schema->columnNum(), valvec_reserve());
 	valvec<byte> buf;
 	StoreIteratorPtr iter(input->createStoreIterForward(ctx));
 	llong prevId = -1, id = -1;
-	while (iter->increment(&id, &buf) && id < logicRowNum) {
-		assert(id >= 0);
-		assert(id < logicRowNum);
-		assert(prevId < id);
-		if (!m_isDel[id]) {
-			m_schema->m_rowSchema->parseRow(buf, &columns);
-			colgroupTempFiles.writeColgroups(columns);
-			newRowNum++;
-			m_isDel.beg_end_set1(prevId + 1, id);
-			prevId = id;
+	CompressThreadsLease lease(logicRowNum >= llong(CompressRowsParallelMinRows)
+							 ? DbTable::getCompressionThreadsNum() : 0);
+	size_t parseThreads = lease.extra();
+	if (parseThreads) {
+		// reading rows(this thread) -> parsing rows(parseThreads)
+		//   -> writing colgroup temp files(serial, keep row order)
+		const SchemaConfig& sconf = *m_schema;
+		const size_t colgroupNum = sconf.getColgroupNum();
+		valvec<ColumnVec> threadCols(parseThreads);
+		valvec<valvec<byte> > threadBufs(parseThreads);
+		std::atomic<bool> failed(false);
+		std::string errMsg;
+		std::mutex errMutex;
+		auto setError = [&](const std::exception& ex) {
+			std::lock_guard<std::mutex> lock(errMutex);
+			if (!failed) {
+				errMsg = ex.what();
+				failed = true;
+			}
+		};
+		auto parseRows = [&](PipelineStage*, int tno, PipelineQueueItem* item) {
+			auto t = static_cast<CompressRowsTask*>(item->task);
+			if (failed)
+				return;
+			try {
+				ColumnVec& cols = threadCols[tno];
+				valvec<byte>& rec = threadBufs[tno];
+				t->cgRows.resize(colgroupNum);
+				t->cgOffsets.resize(colgroupNum);
+				for (size_t cg = 0; cg < colgroupNum; ++cg) {
+					t->cgRows[cg].reserve(t->rows.size() / colgroupNum + 64);
+					t->cgOffsets[cg].reserve(t->offsets.size());
+					t->cgOffsets[cg].push_back(0);
+				}
+				for (size_t j = 0; j < t->size(); ++j) {
+					size_t beg = t->offsets[j], len = t->offsets[j+1] - beg;
+					sconf.m_rowSchema->parseRow(fstring(t->rows.data() + beg, len), &cols);
+					for (size_t cg = 0; cg < colgroupNum; ++cg) {
+						sconf.getColgroupSchema(cg).selectParent(cols, &rec);
+						t->cgRows[cg].append(rec);
+						t->cgOffsets[cg].push_back(t->cgRows[cg].size());
+					}
+				}
+				t->rows.clear(); // free memory early
+			}
+			catch (const std::exception& ex) {
+				setError(ex);
+			}
+		};
+		auto writeRows = [&](PipelineStage*, int, PipelineQueueItem* item) {
+			auto t = static_cast<CompressRowsTask*>(item->task);
+			if (failed)
+				return;
+			try {
+				for (size_t cg = 0; cg < colgroupNum; ++cg) {
+					const byte*   data = t->cgRows[cg].data();
+					const size_t* offs = t->cgOffsets[cg].data();
+					for (size_t j = 0, n = t->cgOffsets[cg].size()-1; j < n; ++j) {
+						colgroupTempFiles.writeOneColgroup(cg,
+							fstring(data + offs[j], offs[j+1] - offs[j]));
+					}
+				}
+			}
+			catch (const std::exception& ex) {
+				setError(ex);
+			}
+		};
+		PipelineProcessor pipeline;
+		pipeline.m_silent = true;
+		pipeline.setQueueSize(int(4 * parseThreads));
+		pipeline | new FunPipelineStage(int(parseThreads), parseRows, "parseRows")
+				 | new FunPipelineStage(0, writeRows, "writeColgroups");
+		pipeline.compile();
+		CompressRowsTask* task = new CompressRowsTask();
+		try {
+			while (!failed && iter->increment(&id, &buf) && id < logicRowNum) {
+				assert(id >= 0);
+				assert(id < logicRowNum);
+				assert(prevId < id);
+				if (!m_isDel[id]) {
+					task->rows.append(buf);
+					task->offsets.push_back(task->rows.size());
+					newRowNum++;
+					m_isDel.beg_end_set1(prevId + 1, id);
+					prevId = id;
+					if (task->rows.size() >= CompressRowsChunkBytes) {
+						pipeline.inqueue(task);
+						task = new CompressRowsTask();
+					}
+				}
+			}
+		}
+		catch (...) {
+			delete task;
+			pipeline.stop();
+			pipeline.wait();
+			throw;
+		}
+		if (task->size())
+			pipeline.inqueue(task);
+		else
+			delete task;
+		pipeline.stop();
+		pipeline.wait();
+		if (failed) {
+			THROW_STD(runtime_error, "parse rows of %s failed: %s"
+				, input->m_segDir.string().c_str(), errMsg.c_str());
+		}
+	}
+	else {
+		ColumnVec columns(m_schema->columnNum(), valvec_reserve());
+		while (iter->increment(&id, &buf) && id < logicRowNum) {
+			assert(id >= 0);
+			assert(id < logicRowNum);
+			assert(prevId < id);
+			if (!m_isDel[id]) {
+				m_schema->m_rowSchema->parseRow(buf, &columns);
+				colgroupTempFiles.writeColgroups(columns);
+				newRowNum++;
+				m_isDel.beg_end_set1(prevId + 1, id);
+				prevId = id;
+			}
 		}
 	}
 	if (prevId != id) {
@@ -968,20 +1403,34 @@ ReadonlySegment::compressMultipleColgroups(ReadableSegment* input, DbContext* ct
 	assert(newRowNum <= inputRowNum);
 	assert(size_t(logicRowNum - newRowNum) == m_delcnt);
 }
-	// build index from temporary index files
+	buildFromTempFiles(colgroupTempFiles, newRowNum, tmpDir);
+}
+
+// build indices and colgroups from temporary files, each index and
+// each colgroup is an independent task, they are run in parallel
+void
+ReadonlySegment::buildFromTempFiles(TempFileList& colgroupTempFiles,
+									llong newRowNum, PathRef tmpDir) {
+	size_t indexNum = m_schema->getIndexNum();
 	colgroupTempFiles.completeWrite();
+	const size_t maxMem = m_schema->m_compressingWorkMemSize;
+	ParallelBuildTasks tasks(maxMem);
+	m_indexFilters.resize(indexNum); // buildIndexFilter must not realloc
 	for (size_t i = 0; i < indexNum; ++i) {
-		SortableStrVec strVec;
-		const Schema& schema = m_schema->getIndexSchema(i);
 		auto tmpStore = colgroupTempFiles.getStore(i);
-		StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
-		colgroupTempFiles.collectData(i, iter.get(), strVec);
-		m_indices[i] = this->buildIndex(schema, strVec);
-		m_colgroups[i] = m_indices[i]->getReadableStore();
-		if (!schema.m_enableLinearScan) {
-			iter.reset();
-			tmpStore->deleteFiles();
-		}
+		tasks.add(size_t(tmpStore->dataInflateSize()), [&,i,tmpStore]() {
+			SortableStrVec strVec;
+			const Schema& schema = m_schema->getIndexSchema(i);
+			StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
+			colgroupTempFiles.collectData(i, iter.get(), strVec);
+			buildIndexFilter(i, strVec);
+			m_indices[i] = this->buildIndex(schema, strVec);
+			m_colgroups[i] = m_indices[i]->getReadableStore();
+			if (!schema.m_enableLinearScan) {
+				iter.reset();
+				tmpStore->deleteFiles();
+			}
+		});
 	}
 	for (size_t i = indexNum; i < colgroupTempFiles.size(); ++i) {
 		if (0 == newRowNum) {
@@ -994,31 +1443,38 @@ ReadonlySegment::compressMultipleColgroups(ReadableSegment* input, DbContext* ct
 			m_colgroups[i] = tmpStore;
 			continue;
 		}
+		size_t inflateSize = size_t(tmpStore->dataInflateSize());
 		// dictZipSampleRatio < 0 indicate don't use dictZip
 		if (schema.m_dictZipSampleRatio >= 0.0) {
 			double sRatio = schema.m_dictZipSampleRatio;
-			double avgLen = double(tmpStore->dataInflateSize()) / newRowNum;
+			double avgLen = double(inflateSize) / newRowNum;
 			if (sRatio > 0 || (sRatio < FLT_EPSILON && avgLen > 100)) {
-				StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
-				m_colgroups[i] = buildDictZipStore(schema, tmpDir, *iter, NULL, NULL);
-				iter.reset();
-				tmpStore->deleteFiles();
+				tasks.add(inflateSize, [&,i,tmpStore]() {
+					const Schema& schema = m_schema->getColgroupSchema(i);
+					StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
+					m_colgroups[i] = buildDictZipStore(schema, tmpDir, *iter, NULL, NULL);
+					iter.reset();
+					tmpStore->deleteFiles();
+				});
 				continue;
 			}
 		}
-		size_t maxMem = m_schema->m_compressingWorkMemSize;
-		llong rows = 0;
-		MultiPartStorePtr parts = new MultiPartStore();
-		StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
-		while (rows < newRowNum) {
-			SortableStrVec strVec;
-			rows += colgroupTempFiles.collectData(i, iter.get(), strVec, maxMem);
-			parts->addpart(this->buildStore(schema, strVec));
-		}
-		m_colgroups[i] = parts->finishParts();
-		iter.reset();
-		tmpStore->deleteFiles();
+		tasks.add(std::min(inflateSize, maxMem), [&,i,tmpStore]() {
+			const Schema& schema = m_schema->getColgroupSchema(i);
+			llong rows = 0;
+			MultiPartStorePtr parts = new MultiPartStore();
+			StoreIteratorPtr iter = tmpStore->ensureStoreIterForward(NULL);
+			while (rows < newRowNum) {
+				SortableStrVec strVec;
+				rows += colgroupTempFiles.collectData(i, iter.get(), strVec, maxMem);
+				parts->addpart(this->buildStore(schema, strVec));
+			}
+			m_colgroups[i] = parts->finishParts();
+			iter.reset();
+			tmpStore->deleteFiles();
+		});
 	}
+	tasks.run();
 }
 
 void
@@ -1063,6 +1519,7 @@ ReadonlySegment::compressSingleKeyIndex(ReadableSegment* input, DbContext* ctx)
 		this->m_isDel.beg_end_set1(inputRowNum, logicRowNum);
 	}
 	m_delcnt = m_isDel.popcnt(); // recompute delcnt
+	buildIndexFilter(0, keyVec);
 	m_indices[0] = buildIndex(keySchema, keyVec); // memory heavy
 	m_colgroups[0] = m_indices[0]->getReadableStore();
 }
@@ -1083,18 +1540,25 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx) {
 
 	DbContextPtr ctx;
 	ReadableSegmentPtr input;
+	febitvec pinnedDel; // deleted rows which may be visible to snapshots
 	{
 		MyRwLock lock(tab->m_rwMutex, false);
 		ctx.reset(tab->createDbContextNoLock());
 		input = tab->m_segments[segIdx];
+		assert(input->getWritableStore() != nullptr);
+		assert(input->m_isFreezed);
+		assert(input->m_updateList.empty());
+		assert(input->m_bookUpdates == false);
+		input->m_updateList.reserve(1024);
+		input->m_bookUpdates = true;
+		m_isDel = input->m_isDel; // make a copy, input->m_isDel[*] may be changed
+		if (tab->isSnapshotPinnedNoLock(tab->m_rowNumVec[segIdx])) {
+			// rows which have data will be kept, delete marks are restored
+			// by completeAndReload
+			pinnedDel.swap(m_isDel);
+			m_isDel.resize(pinnedDel.size(), false);
+		}
 	}
-	assert(input->getWritableStore() != nullptr);
-	assert(input->m_isFreezed);
-	assert(input->m_updateList.empty());
-	assert(input->m_bookUpdates == false);
-	input->m_updateList.reserve(1024);
-	input->m_bookUpdates = true;
-	m_isDel = input->m_isDel; // make a copy, input->m_isDel[*] may be changed
 
 	const size_t indexNum = m_schema->getIndexNum();
 	const size_t colgroupNum = m_schema->getColgroupNum();
@@ -1117,15 +1581,59 @@ ReadonlySegment::convFrom(DbTable* tab, size_t segIdx) {
 	else {
 		compressMultipleColgroups(input.get(), ctx.get());
 	}
-	completeAndReload(tab, segIdx, &*input);
+	completeAndReload(tab, segIdx, &*input, pinnedDel);
 
 	fs::rename(tmpDir, m_segDir);
 	input->deleteSegment();
 }
 
-void
-ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
-								   ReadableSegment* input) {
+/// Build a new segment directly from rows of a StoreIterator, the rows are
+/// read until the inflated size reaches maxInflateSize or iter is exhausted.
+/// Index keys are not checked for uniqueness, it is the caller's duty.
+/// The segment is saved to m_segDir and reloaded as mmap.
+///@returns number of rows in the new segment, 0 if iter has no more rows
+llong
+ReadonlySegment::bulkBuildFrom(StoreIterator& iter, llong maxInflateSize,
+							   valvec<SortableStrVec>* uniqKeys) {
+	llong  id = -1;
+	valvec<byte> buf;
+	if (!iter.increment(&id, &buf)) {
+		return 0;
+	}
+	const size_t indexNum = m_schema->getIndexNum();
+	const size_t colgroupNum = m_schema->getColgroupNum();
+	m_indices.resize(indexNum);
+	m_colgroups.resize(colgroupNum);
+	auto tmpDir = m_segDir + ".tmp";
+	fs::create_directories(tmpDir);
+	llong newRowNum = 0;
+	llong inflateSize = 0;
+	{
+		TempFileList colgroupTempFiles(tmpDir, *m_schema->m_colgroupSchemaSet);
+		ColumnVec columns(m_schema->columnNum(), valvec_reserve());
+		valvec<byte> key;
+		do {
+			m_schema->m_rowSchema->parseRow(buf, &columns);
+			colgroupTempFiles.writeColgroups(columns);
+			for (size_t i = 0; uniqKeys && i < uniqKeys->size(); ++i) {
+				size_t indexId = m_schema->m_uniqIndices[i];
+				m_schema->getIndexSchema(indexId).selectParent(columns, &key);
+				(*uniqKeys)[i].push_back(key);
+			}
+			inflateSize += buf.size();
+			newRowNum++;
+		} while (inflateSize < maxInflateSize && iter.increment(&id, &buf));
+		m_isDel.resize(size_t(newRowNum), false);
+		m_delcnt = 0;
+		buildFromTempFiles(colgroupTempFiles, newRowNum, tmpDir);
+	}
+	saveAndReload(tmpDir);
+	assert(m_isDel.size() == size_t(newRowNum));
+	fs::rename(tmpDir, m_segDir);
+	return newRowNum;
+}
+
+void ReadonlySegment::saveAndReload(PathRef tmpDir) {
 	m_dataMemSize = 0;
 	m_dataInflateSize = 0;
 	for (size_t i = 0; i < m_colgroups.size(); ++i) {
@@ -1146,7 +1654,6 @@ ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
 		assert(physicRows1 == physicRows2);
 	}
 #endif
-	auto tmpDir = m_segDir + ".tmp";
 	this->save(tmpDir);
 
 	// reload as mmap
@@ -1155,9 +1662,24 @@ ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
 	m_indices.erase_all();
 	m_colgroups.erase_all();
 	this->load(tmpDir);
+}
+
+void
+ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
+								   ReadableSegment* input,
+								   const febitvec& pinnedDel) {
+	saveAndReload(m_segDir + ".tmp");
 	assert(this->m_isDel.size() == input->m_isDel.size());
 	assert(this->m_isDel.popcnt() == this->m_delcnt);
 	assert(this->m_isPurged.max_rank1() == this->m_delcnt);
+	if (!pinnedDel.empty()) {
+		assert(pinnedDel.size() == m_isDel.size());
+		size_t nWords = pinnedDel.num_words();
+		const bm_uint_t* src = pinnedDel.bldata();
+		bm_uint_t* dst = m_isDel.bldata();
+		for (size_t i = 0; i < nWords; ++i)
+			dst[i] |= src[i];
+	}
 
 	valvec<uint32_t> updateList;
 	febitvec         updateBits;
@@ -1255,6 +1777,7 @@ ReadonlySegment::completeAndReload(DbTable* tab, size_t segIdx,
 	assert(tab->m_segments[segIdx].get() == input);
 	tab->m_segments[segIdx] = this;
 	tab->m_segArrayUpdateSeq++;
+	tab->publishSegArrayInLock();
 }
 
 // dstBaseId is for merge update
@@ -1428,9 +1951,27 @@ ReadonlySegment::purgeIndex(size_t indexId, ColgroupSegment* input, DbContext* c
 			}
 		}
 	}
+	buildIndexFilter(indexId, strVec);
 	return this->buildIndex(schema, strVec);
 }
 
+/// build bloom filter for unique index if bloomBitsPerKey is configured,
+/// must be called before buildIndex, which may reorder indexData
+void
+ReadonlySegment::buildIndexFilter(size_t indexId, const SortableStrVec& indexData) {
+	const Schema& schema = m_schema->getIndexSchema(indexId);
+	if (m_indexFilters.size() < m_schema->getIndexNum()) {
+		m_indexFilters.resize(m_schema->getIndexNum());
+	}
+	m_indexFilters[indexId] = nullptr;
+	if (!schema.m_isUnique || 0 == schema.m_bloomBitsPerKey) {
+		return;
+	}
+	BloomFilterPtr filter = new BloomFilter();
+	filter->build(indexData, schema.getFixedRowLen(), schema.m_bloomBitsPerKey);
+	m_indexFilters[indexId] = filter;
+}
+
 ReadableStorePtr
 ReadonlySegment::purgeColgroup(size_t colgroupId, ColgroupSegment* input, DbContext* ctx, PathRef tmpSegDir) {
 	assert(m_isDel.size() == input->m_isDel.size());
@@ -1723,6 +2264,7 @@ void ColgroupSegment::closeFiles() {
 		m_isDel.risk_release_ownership();
 	}
 	m_indices.clear();
+	m_indexFilters.clear();
 	m_colgroups.clear();
 }
 
@@ -1733,6 +2275,11 @@ ReadonlySegment::openIndex(const Schema& schema, PathRef path) const {
 		store->load(path);
 		return store.release();
 	}
+	if (boost::filesystem::exists(path + ".lint")) {
+		std::unique_ptr<LearnedIntKeyIndex> store(new LearnedIntKeyIndex(schema));
+		store->load(path);
+		return store.release();
+	}
 	if (boost::filesystem::exists(path + ".fixlen")) {
 		std::unique_ptr<FixedLenKeyIndex> store(new FixedLenKeyIndex(schema));
 		store->load(path);
@@ -1755,6 +2302,11 @@ const {
 	const size_t fixlen = schema.getFixedRowLen();
 	if (schema.columnNum() == 1 && schema.getColumnMeta(0).isInteger()) {
 		try {
+			if (schema.m_learnedIndexEpsilon) {
+				std::unique_ptr<LearnedIntKeyIndex> index(new LearnedIntKeyIndex(schema));
+				index->build(schema.getColumnMeta(0).type, indexData);
+				return index.release();
+			}
 			std::unique_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(schema));
 			index->build(schema.getColumnMeta(0).type, indexData);
 			return index.release();
@@ -1977,7 +2529,14 @@ WritableSegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 		// use lock if m_isDel.unused() is less than ProtectCnt
 		const size_t ProtectCnt = 10;
 		assert(iter->isUniqueInSchema() == m_schema->getIndexSchema(indexId).m_isUnique);
-		if (iter->isUniqueInSchema()) {
+		if (ctx->m_isUserDefineSnapshot) {
+			// deleted rows are filtered by DbTable with snapshot marks
+			do {
+				recIdvec->push_back(recId);
+			} while (!iter->isUniqueInSchema() &&
+					 iter->increment(&recId, &ctx->key2) && key == ctx->key2);
+		}
+		else if (iter->isUniqueInSchema()) {
 			if (this->m_isFreezed || m_isDel.unused() >= ProtectCnt) {
 				if (!m_isDel[recId])
 					recIdvec->push_back(recId);
@@ -2205,6 +2764,9 @@ void WritableSegment::flushSegment() {
 	}
 }
 
+void WritableSegment::commitLog() {
+}
+
 void PlainWritableSegment::saveRecordStore(PathRef segDir) const {
 	for (size_t colgroupId : m_schema->m_updatableColgroups) {
 		const Schema& schema = m_schema->getColgroupSchema(colgroupId);
@@ -3,6 +3,8 @@
 
 #include "db_index.hpp"
 #include "db_store.hpp"
+#include "bloom_filter.hpp"
+#include "record_cache.hpp"
 #include <terark/bitmap.hpp>
 #include <terark/rank_select.hpp>
 #include <tbb/spin_rw_mutex.h>
@@ -63,6 +65,12 @@ public:
 										fstring key, valvec<llong>* recIdvec,
 										DbContext*) const = 0;
 
+	///@param hitCnt hitCnt[i] is the number of recId appended for keys[i]
+	virtual void indexSearchExactBatchAppend(size_t mySegIdx, size_t indexId,
+										const fstring* keys, size_t n,
+										valvec<llong>* recIdvec, size_t* hitCnt,
+										DbContext*) const;
+
 	virtual void selectColumns(llong recId, const size_t* colsId, size_t colsNum,
 							   valvec<byte>* colsData, DbContext*) const = 0;
 	virtual void selectOneColumn(llong recId, size_t columnId,
@@ -71,6 +79,15 @@ public:
 	virtual void selectColgroups(llong id, const size_t* cgIdvec, size_t cgIdvecSize,
 								 valvec<byte>* cgDataVec, DbContext*) const = 0;
 
+	/// read colgroup cgId of records subIds[0, n)
+	///@param found found[i] is 0 if record subIds[i] is deleted
+	///@param vals  if not NULL, a value can be referenced in place is set to
+	///             vals[i] without copy, otherwise vals[i].p is NULL and the
+	///             value is copied to bufs[i]
+	virtual void selectOneColgroupBatch(const llong* subIds, size_t n,
+								 size_t cgId, valvec<byte>* bufs, byte_t* found,
+								 fstring* vals, DbContext*) const;
+
 	void openIndices(PathRef dir);
 	void saveIndices(PathRef dir) const;
 	llong totalIndexSize() const;
@@ -90,14 +107,24 @@ public:
 	size_t getLogicId(size_t physicId) const;
 
 	void addtoUpdateList(size_t logicId);
+	void invalidateRowCache(size_t logicId) {
+		if (m_rowCache) {
+			m_rowCacheVersion.fetch_add(1, std::memory_order_release);
+			m_rowCache->erase(m_rowCacheOwner, logicId);
+		}
+	}
 
 	bool locked_testIsDel(size_t logicId) const {
 		SpinRwLock wsLock(m_segMutex, false);
 		return m_isDel[logicId];
 	}
 
+	/// caller must hold the write lock of DbTable::m_rwMutex
+	SegDelMarksPtr snapshotDelMarks();
+
 	SchemaConfigPtr         m_schema;
 	valvec<ReadableIndexPtr> m_indices; // parallel with m_indexSchemaSet
+	valvec<BloomFilterPtr> m_indexFilters; // parallel with m_indices, may be null
 	valvec<ReadableStorePtr> m_colgroups; // indices + pure_colgroups
 	size_t      m_delcnt;
 	febitvec    m_isDel;
@@ -109,6 +136,10 @@ public:
 	valvec<uint32_t> m_updateList; // including deletions
 	febitvec    m_updateBits; // if m_updateList is too large, use updateBits
 	ReadableStorePtr m_deletionTime; // for snapshot, an uint64 array
+	RecordCache* m_rowCache; // DbTable::m_rowCache, just for ReadonlySegment
+	uint64_t     m_rowCacheOwner;
+	std::atomic<uint64_t> m_rowCacheVersion; // incremented on update/delete
+	SegDelMarksPtr m_pinnedDelMarks; // see snapshotDelMarks
 	bool        m_tobeDel;
 	bool        m_isDirty;
 	bool        m_isFreezed;
@@ -180,6 +211,11 @@ public:
 	void indexSearchExactAppend(size_t mySegIdx, size_t indexId,
 								fstring key, valvec<llong>* recIdvec,
 								DbContext*) const override;
+	void indexSearchExactBatchAppend(size_t mySegIdx, size_t indexId,
+								const fstring* keys, size_t n,
+								valvec<llong>* recIdvec, size_t* hitCnt,
+								DbContext*) const override;
+	size_t filterIndexHits(llong* recIdvecData, size_t len, const DbContext*) const;
 
 	void selectColumns(llong recId, const size_t* colsId, size_t colsNum,
 					   valvec<byte>* colsData, DbContext*) const override;
@@ -189,6 +225,10 @@ public:
 	void selectColgroups(llong id, const size_t* cgIdvec, size_t cgIdvecSize,
 						 valvec<byte>* cgDataVec, DbContext*) const override;
 
+	void selectOneColgroupBatch(const llong* subIds, size_t n,
+						 size_t cgId, valvec<byte>* bufs, byte_t* found,
+						 fstring* vals, DbContext*) const override;
+
 	void load(PathRef segDir) override;
 	void save(PathRef segDir) const override;
 
@@ -214,12 +254,21 @@ public:
 	virtual
 	void compressSingleKeyValue(ReadableSegment* input, DbContext* ctx);
 
+	void buildFromTempFiles(class TempFileList&, llong newRowNum, PathRef tmpDir);
+	///@param uniqKeys if not NULL, keys of the i'th unique index of the
+	///       built rows are appended to (*uniqKeys)[i]
+	llong bulkBuildFrom(StoreIterator& rows, llong maxInflateSize,
+						valvec<SortableStrVec>* uniqKeys = NULL);
+	void saveAndReload(PathRef tmpDir);
+	///@param pinnedDel delete marks of rows kept for pinned snapshots
 	void completeAndReload(class DbTable*, size_t segIdx,
-						   class ReadableSegment* input);
+						   class ReadableSegment* input,
+						   const febitvec& pinnedDel = febitvec());
 	void syncUpdateRecordNoLock(size_t dstBaseId, size_t logicId,
 								const ReadableSegment* input);
 
 	ReadableIndexPtr purgeIndex(size_t indexId, ColgroupSegment* input, DbContext* ctx);
+	void buildIndexFilter(size_t indexId, const SortableStrVec& indexData);
 	ReadableStorePtr purgeColgroup(size_t colgroupId, ColgroupSegment* input, DbContext* ctx, PathRef tmpSegDir);
 	ReadableStorePtr purgeColgroup_s(size_t colgroupId,
 			const febitvec& newIsDel, size_t newDelcnt,
@@ -342,6 +391,10 @@ public:
 
 	void flushSegment();
 
+	/// make writes which are done directly to the indices durable, as
+	/// append/update/remove and transactions do on their own
+	virtual void commitLog();
+
 	void delmarkSet0(llong subId);
 
 	valvec<uint32_t>  m_deletedWrIdSet;
@@ -99,6 +99,10 @@ UpdatableStore* ReadableStore::getUpdatableStore() {
 	return nullptr;
 }
 
+bool ReadableStore::getValueRef(llong, fstring*, DbContext*) const {
+	return false;
+}
+
 void ReadableStore::deleteFiles() {
 	THROW_STD(invalid_argument, "Unsupportted Method");
 }
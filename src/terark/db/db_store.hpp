@@ -76,6 +76,14 @@ public:
 	virtual llong dataInflateSize() const = 0;
 	virtual llong numDataRows() const = 0;
 	virtual void getValueAppend(llong id, valvec<byte>* val, DbContext*) const = 0;
+
+	/// reference the value in place if it is stored uncompressed in memory,
+	/// val is valid as long as the store is alive. Only FixedLenStore and
+	/// MockReadonlyStore support it, compressed stores(NestLoudsTrieStore,
+	/// ZipIntStore) and writable stores must decode or lock for a value
+	///@returns false if not supported, the value should be read by getValue
+	virtual bool getValueRef(llong id, fstring* val, DbContext*) const;
+
 	virtual void deleteFiles();
 	virtual StoreIterator* createStoreIterForward(DbContext*) const = 0;
 	virtual StoreIterator* createStoreIterBackward(DbContext*) const = 0;
@@ -1,6 +1,8 @@
 #include "db_table.hpp"
 #include "db_segment.hpp"
 #include "appendonly.hpp"
+#include "colgroup_scan.hpp"
+#include "record_cache.hpp"
 #include <terark/db/fixed_len_store.hpp>
 #include <terark/util/autoclose.hpp>
 #include <terark/util/linebuf.hpp>
@@ -14,9 +16,10 @@
 #include <terark/util/sortable_strvec.hpp>
 #include <boost/scope_exit.hpp>
 #include <thread> // for std::this_thread::sleep_for
+#include <condition_variable>
 #include <tbb/tbb_thread.h>
-#include <terark/util/concurrent_queue.hpp>
 #include <float.h>
+#include <random>
 #include <terark/util/profiling.hpp>
 
 #undef min
@@ -62,6 +65,7 @@ DbTable::DbTable() {
 	m_tableScanningRefCount = 0;
 	m_tobeDrop = false;
 	m_isMerging = false;
+	m_wrSegFreezeRequested = false;
 	m_purgeStatus = PurgeStatus::none;
 	m_segments.reserve(DEFAULT_maxSegNum);
 	m_rowNumVec.reserve(DEFAULT_maxSegNum+1);
@@ -69,13 +73,28 @@ DbTable::DbTable() {
 	m_newWrSegNum = 0;
 	m_bgTaskNum = 0;
 	m_rowNum = 0;
-	m_oldestSnapshotVersion = 0;
+	m_oldestSnapshotVersion = LLONG_MAX;
 	m_segArrayUpdateSeq = 1;
+	m_segArraySnapshot = nullptr;
+	m_segArrayEpoch = 0;
+	m_hasRetiredSegArrays = false;
+	for (auto& stripes : m_segArrayReaders) {
+		for (auto& r : stripes)
+			r.cnt = 0;
+	}
 	m_throwOnThrottle = false; // if true, auto delay/sleep on throttle
 //	m_ctxListHead = new DbContextLink();
 }
 
 DbTable::~DbTable() {
+	delete m_segArraySnapshot.exchange(nullptr);
+	for (auto& retired : m_retiredSegArrays) {
+		for (SegArraySnapshot* x : retired)
+			delete x;
+		retired.clear();
+	}
+	m_hasRetiredSegArrays = false;
+	m_groupCommitCtx = nullptr;
 	m_wrSeg = nullptr;
 //	fprintf(stderr, "INFO: DbTable::~DbTable(): m_dir = %s\n", m_dir.string().c_str());
 //	fprintf(stderr, "INFO: DbTable::~DbTable(): m_segments.size = %zd\n", m_segments.size());
@@ -296,6 +315,10 @@ void DbTable::load(PathRef dir) {
 
 void DbTable::doLoad(PathRef dir) {
 	assert(m_schema.get() != nullptr);
+	RecordCache::global().ensureCapacity(m_schema->m_storeCacheBytes);
+	if (m_schema->m_rowCacheBytes) {
+		m_rowCache.reset(new RecordCache(m_schema->m_rowCacheBytes));
+	}
 	fs::path runLockFpath = dir / "run.lock";
 	if (fs::exists(runLockFpath)) {
 		THROW_STD(invalid_argument
@@ -389,6 +412,7 @@ void DbTable::doLoad(PathRef dir) {
 	}
 	m_rowNumVec.back() = baseId; // the end guard
 	m_rowNum = baseId;
+	publishSegArrayInLock();
 	runLockFile.close(); // notify DO NOT delete in BOOST_SCOPE_EXIT
 }
 
@@ -418,6 +442,87 @@ size_t DbTable::getSegmentIndexOfRecordIdNoLock(llong recId) const {
 	return segIdx-1;
 }
 
+/// must be called in write lock after m_segments/m_rowNumVec are changed,
+/// the old snapshot is retired and never waited for here (epoch based RCU),
+/// it is deleted by reclaimSegArrays() out of the lock
+void DbTable::publishSegArrayInLock() {
+	SegArraySnapshot* snapshot = new SegArraySnapshot();
+	snapshot->m_segments.assign(m_segments);
+	snapshot->m_rowNumVec.assign(m_rowNumVec);
+	snapshot->m_wrSeg = m_wrSeg.get();
+	snapshot->m_updateSeq = m_segArrayUpdateSeq;
+	SegArraySnapshot* old = m_segArraySnapshot.exchange(snapshot);
+	if (old) {
+		std::lock_guard<std::mutex> lock(m_retiredSegArraysMutex);
+		m_retiredSegArrays[1].push_back(old);
+		m_hasRetiredSegArrays = true;
+	}
+}
+
+/// called in m_retiredSegArraysMutex, moves the snapshots whose grace period
+/// has elapsed to freeList and flips the epoch, returns false if readers of
+/// the previous epoch are alive or there is nothing more to retire.
+/// A reader validates the epoch after entering its counter, so when the
+/// counters of the previous parity are all zero, the readers which may
+/// see snapshots retired before the last flip have all left
+bool DbTable::advanceSegArrayEpochNoLock(valvec<SegArraySnapshot*>* freeList) {
+	size_t epoch = m_segArrayEpoch.load();
+	for (auto& r : m_segArrayReaders[(epoch + 1) & 1]) {
+		if (r.cnt.load() != 0)
+			return false;
+	}
+	freeList->append(m_retiredSegArrays[0]);
+	m_retiredSegArrays[0].erase_all();
+	if (m_retiredSegArrays[1].empty()) {
+		return false;
+	}
+	m_retiredSegArrays[0].swap(m_retiredSegArrays[1]);
+	m_segArrayEpoch.store(epoch + 1);
+	return true;
+}
+
+/// delete retired snapshots which are no longer visible to any reader,
+/// called without m_rwMutex, because the last ref of a segment may be
+/// released here. SegArrayReadGuard calls it with tryLock when it is
+/// released, so the grace period ends without waiting for a later publish
+void DbTable::reclaimSegArrays(bool tryLock) {
+	valvec<SegArraySnapshot*> freeList;
+	{
+		std::unique_lock<std::mutex> lock(m_retiredSegArraysMutex, std::defer_lock);
+		if (tryLock) {
+			if (!lock.try_lock())
+				return; // the owner reclaims, or the next guard retries
+		} else {
+			lock.lock();
+		}
+		// a flip moves all retired snapshots to the older generation,
+		// the second call frees them if their readers have left
+		if (advanceSegArrayEpochNoLock(&freeList))
+			advanceSegArrayEpochNoLock(&freeList);
+		m_hasRetiredSegArrays = !m_retiredSegArrays[0].empty()
+							 || !m_retiredSegArrays[1].empty();
+	}
+	for (SegArraySnapshot* x : freeList) {
+		delete x;
+	}
+}
+
+SegArrayReadGuard::SegArrayReadGuard(const DbTable* tab) {
+	m_tab = tab;
+	size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id())
+				  % DbTable::SegArrayReaderStripes;
+	for (;;) {
+		size_t epoch = tab->m_segArrayEpoch.load();
+		m_readers = &tab->m_segArrayReaders[epoch & 1][stripe].cnt;
+		m_readers->fetch_add(1);
+		if (tab->m_segArrayEpoch.load() == epoch)
+			break;
+		m_readers->fetch_sub(1, std::memory_order_release);
+	}
+	m_snapshot = tab->m_segArraySnapshot.load();
+	assert(NULL != m_snapshot);
+}
+
 namespace {
 	struct By_seg_get {
 		template<class OneSeg>
@@ -641,11 +746,282 @@ public:
 	}
 };
 
+/// each part has its own store iterator per segment, it is positioned by
+/// seekExact on entering the segment and then incremented, so parts of a
+/// parallel scan do not share any iterator state. Segments are re-synced
+/// when the segment array is changed, because record ids are not changed
+/// by merge and purge
+class DbTable::MyStoreIterRange : public StoreIterator {
+	DbContextPtr m_ctx;
+	llong  m_beginId;
+	llong  m_endId;
+	llong  m_id;
+	llong  m_iterNextId; // next id of m_segs[m_segIdx].iter, -1 if unknown
+	size_t m_segIdx;
+	size_t m_segArrayUpdateSeq;
+	struct OneSeg {
+		ReadableSegmentPtr seg;
+		StoreIteratorPtr   iter;
+	};
+	valvec<OneSeg> m_segs;
+	valvec<llong>  m_rowNumVec;
+
+	void syncTabSegs() {
+		auto tab = static_cast<const DbTable*>(m_store.get());
+		SegArrayReadGuard segArray(tab);
+		if (!m_segs.empty() && segArray->m_updateSeq == m_segArrayUpdateSeq)
+			return;
+		// keep iterators of segments which are not changed
+		OneSeg* segA = m_segs.data();
+		size_t  segN = m_segs.size();
+		sort_0(segA, segN, By_seg_get());
+		valvec<OneSeg> tmp(segArray->m_segments.size());
+		for (size_t i = 0; i < tmp.size(); ++i) {
+			auto seg = segArray->m_segments[i].get();
+			tmp[i].seg = seg;
+			size_t lo = lower_bound_ex_0(segA, segN, seg, By_seg_get());
+			if (lo < segN && segA[lo].seg.get() == seg) {
+				tmp[i].iter = std::move(segA[lo].iter);
+			}
+		}
+		m_segs.swap(tmp);
+		m_rowNumVec.assign(segArray->m_rowNumVec);
+		m_rowNumVec.back() = std::max(m_rowNumVec.back(), m_endId);
+		m_segArrayUpdateSeq = segArray->m_updateSeq;
+		m_segIdx = 0;
+		m_iterNextId = -1;
+	}
+	bool isVisible(const ReadableSegment* seg, llong id, size_t subId) const {
+		if (m_ctx->m_isUserDefineSnapshot) {
+			return m_ctx->isVisibleInSnapshot(id);
+		}
+		if (seg->m_isFreezed) {
+			return !seg->m_isDel[subId];
+		}
+		SpinRwLock lock(seg->m_segMutex, false);
+		return subId < seg->m_isDel.size() && !seg->m_isDel[subId];
+	}
+	// reads the first visible row in [m_id, limit), rows deleted in the
+	// segment are skipped by increment of the segment iterator, except for
+	// a pinned snapshot which may still see them
+	bool readNextVisible(llong limit, llong* id, valvec<byte>* val) {
+		const bool snapshot = m_ctx->m_isUserDefineSnapshot;
+		while (m_id < limit) {
+			if (m_id < m_rowNumVec[m_segIdx] || m_id >= m_rowNumVec[m_segIdx+1]) {
+				syncTabSegs();
+				m_segIdx = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size()-1, m_id) - 1;
+				m_iterNextId = -1;
+			}
+			auto cur = &m_segs[m_segIdx];
+			auto seg = cur->seg.get();
+			llong baseId = m_rowNumVec[m_segIdx];
+			llong subId = m_id - baseId;
+			if (seg->m_isFreezed && size_t(subId) >= seg->m_isDel.size()) {
+				m_id = m_rowNumVec[m_segIdx+1]; // row num of a newer segment array
+				continue;
+			}
+			if (!cur->iter) {
+				cur->iter = seg->createStoreIterForward(m_ctx.get());
+			}
+			const bool incr = !snapshot && m_iterNextId == m_id;
+			bool ok;
+			try {
+				ok = incr ? cur->iter->increment(&subId, val)
+						  : cur->iter->seekExact(subId, val);
+			}
+			catch (const ReadRecordException&) {
+				ok = false; // deleted during read
+			}
+			if (!ok) {
+				m_iterNextId = -1;
+				if (incr && seg->m_isFreezed)
+					m_id = m_rowNumVec[m_segIdx+1]; // no more rows in seg
+				else
+					m_id++;
+				continue;
+			}
+			llong curId = baseId + subId;
+			if (curId >= limit) {
+				m_id = limit;
+				m_iterNextId = -1; // curId is consumed
+				break;
+			}
+			m_id = m_iterNextId = curId + 1;
+			if (isVisible(seg, curId, size_t(subId))) {
+				*id = curId;
+				return true;
+			}
+		}
+		return false;
+	}
+public:
+	MyStoreIterRange(const DbTable* tab, llong beginId, llong endId, DbContext* ctx)
+	  : m_ctx(ctx) {
+		assert(beginId <= endId);
+		m_store.reset(const_cast<DbTable*>(tab));
+		m_beginId = beginId;
+		m_endId = endId;
+		m_id = beginId;
+		m_iterNextId = -1;
+		m_segIdx = 0;
+		m_segArrayUpdateSeq = 0;
+		syncTabSegs();
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		return readNextVisible(m_endId, id, val);
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		if (id < m_beginId || id >= m_endId) {
+			return false;
+		}
+		m_id = id;
+		m_iterNextId = -1; // seekExact the segment iterator
+		llong id2 = -1;
+		return readNextVisible(id + 1, &id2, val);
+	}
+	llong seekLowerBound(llong id, valvec<byte>* val) override {
+		m_id = std::max(id, m_beginId);
+		m_iterNextId = -1;
+		llong id2 = -1;
+		if (increment(&id2, val)) {
+			return id2;
+		}
+		return -1;
+	}
+	void reset() override {
+		m_id = m_beginId;
+		m_iterNextId = -1;
+		syncTabSegs();
+	}
+};
+
+/// a random id is picked and rejected if the row is not visible, after
+/// MaxRejects rejections the first visible row after a random id is taken,
+/// which is not uniform, but bounded for tables which are mostly deleted
+class DbTable::MyStoreIterRandom : public StoreIterator {
+	DbContextPtr m_ctx;
+	llong  m_endId;
+	size_t m_segArrayUpdateSeq;
+	valvec<ReadableSegmentPtr> m_segs;
+	valvec<llong>  m_rowNumVec;
+	std::mt19937_64 m_rand;
+
+	void syncTabSegs() {
+		auto tab = static_cast<const DbTable*>(m_store.get());
+		{
+			SegArrayReadGuard segArray(tab);
+			if (m_segs.empty() || segArray->m_updateSeq != m_segArrayUpdateSeq) {
+				m_segs.assign(segArray->m_segments);
+				m_rowNumVec.assign(segArray->m_rowNumVec);
+				m_segArrayUpdateSeq = segArray->m_updateSeq;
+			}
+		}
+		// rows appended to the writable segment do not publish a new
+		// snapshot, same as ColgroupScanner
+		m_rowNumVec.back() = std::max(m_rowNumVec.ende(2), tab->inlineGetRowNum());
+		m_endId = m_ctx->m_isUserDefineSnapshot
+				? std::min(m_ctx->m_mySnapshotVersion + 1, m_rowNumVec.back())
+				: m_rowNumVec.back();
+	}
+	bool isVisible(const ReadableSegment* seg, llong id, size_t subId) const {
+		if (m_ctx->m_isUserDefineSnapshot) {
+			return m_ctx->isVisibleInSnapshot(id);
+		}
+		if (seg->m_isFreezed) {
+			// the row num may be of a newer segment array
+			return subId < seg->m_isDel.size() && !seg->m_isDel[subId];
+		}
+		SpinRwLock lock(seg->m_segMutex, false);
+		return subId < seg->m_isDel.size() && !seg->m_isDel[subId];
+	}
+	bool readVisible(size_t segIdx, llong id, valvec<byte>* val) {
+		auto seg = m_segs[segIdx].get();
+		size_t subId = size_t(id - m_rowNumVec[segIdx]);
+		if (!isVisible(seg, id, subId)) {
+			return false;
+		}
+		try {
+			seg->getValue(subId, val, m_ctx.get());
+		}
+		catch (const ReadRecordException&) {
+			return false; // deleted after isVisible
+		}
+		return true;
+	}
+	size_t segIndexOf(llong id) const {
+		return upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size()-1, id) - 1;
+	}
+	// scan from id to the end and wrap around to id
+	bool readNextVisible(llong id, llong* resId, valvec<byte>* val) {
+		const bool snapshot = m_ctx->m_isUserDefineSnapshot;
+		for (llong n = 0; n < m_endId; ) {
+			size_t segIdx = segIndexOf(id);
+			auto seg = m_segs[segIdx].get();
+			size_t subId = size_t(id - m_rowNumVec[segIdx]);
+			llong skip = 0;
+			if (!snapshot && seg->m_isFreezed &&
+				subId < seg->m_isDel.size() && seg->m_isDel[subId]) {
+				skip = seg->m_isDel.one_seq_len(subId);
+			}
+			else if (readVisible(segIdx, id, val)) {
+				*resId = id;
+				return true;
+			}
+			else {
+				skip = 1;
+			}
+			skip = std::min(skip, m_rowNumVec[segIdx+1] - id);
+			n += skip;
+			id += skip;
+			if (id >= m_endId)
+				id = 0;
+		}
+		return false;
+	}
+public:
+	static const size_t MaxRejects = 64;
+
+	MyStoreIterRandom(const DbTable* tab, DbContext* ctx)
+	  : m_ctx(ctx), m_rand(std::random_device()()) {
+		m_store.reset(const_cast<DbTable*>(tab));
+		m_endId = 0;
+		m_segArrayUpdateSeq = 0;
+		syncTabSegs();
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		syncTabSegs();
+		if (m_endId <= 0) {
+			return false;
+		}
+		std::uniform_int_distribution<llong> dist(0, m_endId - 1);
+		for (size_t i = 0; i < MaxRejects; ++i) {
+			llong x = dist(m_rand);
+			if (readVisible(segIndexOf(x), x, val)) {
+				*id = x;
+				return true;
+			}
+		}
+		return readNextVisible(dist(m_rand), id, val);
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		syncTabSegs();
+		if (id < 0 || id >= m_endId) {
+			return false;
+		}
+		return readVisible(segIndexOf(id), id, val);
+	}
+	void reset() override {
+		syncTabSegs();
+	}
+};
+
 const std::string& BatchWriter::strError() const {
+	if (!m_errMsg.empty())
+		return m_errMsg;
 	return m_ctx->m_transaction->strError();
 }
 const char* BatchWriter::szError() const {
-	return m_ctx->m_transaction->strError().c_str();
+	return strError().c_str();
 }
 
 // if ctx is NULL, will create a new DbContext for m_ctx
@@ -658,12 +1034,6 @@ BatchWriter::BatchWriter(DbTable* tab, DbContext* ctx)
 			, tab->m_dir.string().c_str());
 	}
 	const SchemaConfig& sconf = *tab->m_schema;
-	if (sconf.m_uniqIndices.size() > 1) {
-		THROW_STD(invalid_argument
-			, "this table has %zd unique indices, "
-				"must have at most one unique index for calling this method"
-			, sconf.m_uniqIndices.size());
-	}
 	bool inprogressWritingCountInced = false;
 	try {
 		MyRwLock lock(tab->m_rwMutex, false);
@@ -672,6 +1042,8 @@ BatchWriter::BatchWriter(DbTable* tab, DbContext* ctx)
 		if (ctx == nullptr) {
 			ctx = tab->createDbContextNoLock();
 		}
+		// m_inprogressWritingCount > 1 prevents creating new segment,
+		// so m_wrSeg is not changed during the life time of BatchWriter
 		tab->m_inprogressWritingCount += 2;
 		inprogressWritingCountInced = true;
 		m_wrSeg = tab->m_wrSeg.get();
@@ -692,6 +1064,8 @@ BatchWriter::BatchWriter(DbTable* tab, DbContext* ctx)
 		}
 		throw;
 	}
+	m_pendingKeys.resize(sconf.getIndexNum());
+	m_minInPlaceSubId = LLONG_MAX;
 }
 
 BatchWriter::~BatchWriter() {
@@ -709,46 +1083,61 @@ BatchWriter::~BatchWriter() {
 	txn->m_appearOnCommit.erase_all();
 }
 
-llong BatchWriter::overwriteExisting(fstring row) {
+static void
+makePendingUniqKey(size_t uniqIdx, fstring key, valvec<byte>* buf) {
+	assert(uniqIdx < 256);
+	buf->erase_all();
+	buf->push_back(byte(uniqIdx));
+	buf->append(key.udata(), key.size());
+}
+
+// returns true if the new key(m_pendingKeys[indexId].back()) of the
+// uniqIdx'th unique index is used by a live row other than replacedRecId
+bool BatchWriter::checkUniqueDup(size_t uniqIdx, llong replacedRecId) {
 	auto ctx = m_ctx.get();
 	auto tab = ctx->m_tab;
+	auto txn = ctx->m_transaction.get();
 	const SchemaConfig& sconf = *tab->m_schema;
-	llong subId = ctx->exactMatchRecIdvec[0];
-	llong baseId = tab->m_rowNumVec.ende(2);
-	assert(ctx->exactMatchRecIdvec.size() == 1);
-	DbTransaction* txn(ctx->m_transaction.get());
-	assert(tab->m_wrSeg.get() == m_wrSeg);
-	assert(txn == m_txn);
-	if (!sconf.m_multIndices.empty()) {
-		try {
-			txn->storeGetRow(subId, &ctx->row2);
-		}
-		catch (const ReadRecordException&) {
-			fprintf(stderr
-				, "ERROR: upsertRow(baseId=%lld, subId=%lld): read old row data failed: %s\n"
-				, baseId, subId, tab->m_wrSeg->m_segDir.string().c_str());
-			throw ReadRecordException("pre updateSyncMultIndex",
-						tab->m_wrSeg->m_segDir.string(), baseId, subId);
+	const size_t indexId = sconf.m_uniqIndices[uniqIdx];
+	const Schema& iSchema = sconf.getIndexSchema(indexId);
+	const fstring key = m_pendingKeys[indexId].back();
+	const llong wrBaseId = ctx->m_rowNumVec.ende(2);
+	auto isRemovedInBatch = [this](llong recId) {
+		return m_removedInBatch.exists(recId);
+	};
+	auto setDupError = [&](fstring where) {
+		m_errMsg = "DupKey=" + iSchema.toJsonStr(key) + ", " + where.str();
+		return true;
+	};
+	makePendingUniqKey(uniqIdx, key, &ctx->key2);
+	size_t found = m_pendingUniq.find_i(ctx->key2);
+	if (m_pendingUniq.end_i() != found) {
+		size_t ver = m_pendingUniq.val(found);
+		if (wrBaseId + m_pendingSubId[ver] != replacedRecId)
+			return setDupError("in batch");
+	}
+	{
+		MyRwLock lock(tab->m_rwMutex, false);
+		txn->indexSearch(indexId, key, &ctx->exactMatchRecIdvec);
+	}
+	for (llong subId : ctx->exactMatchRecIdvec) {
+		llong recId = wrBaseId + subId;
+		if (recId != replacedRecId && !isRemovedInBatch(recId))
+			return setDupError("in writing seg: " + m_wrSeg->m_segDir.string());
+	}
+	for (size_t segIdx = 0; segIdx < ctx->m_segCtx.size()-1; ++segIdx) {
+		auto seg = ctx->m_segCtx[segIdx]->seg;
+		seg->indexSearchExact(segIdx, indexId, key, &ctx->exactMatchRecIdvec, ctx);
+		for (llong subId : ctx->exactMatchRecIdvec) {
+			llong recId = ctx->m_rowNumVec[segIdx] + subId;
+			if (!seg->m_isDel[subId] && recId != replacedRecId && !isRemovedInBatch(recId))
+				return setDupError("in frozen seg: " + seg->m_segDir.string());
 		}
-		sconf.m_rowSchema->parseRow(ctx->row2, &ctx->cols2); // old
-		tab->updateSyncMultIndex(subId, txn, ctx);
 	}
-	txn->storeUpsert(subId, row);
-	return baseId + subId;
+	return false;
 }
 
 llong BatchWriter::upsertRow(fstring row) {
-	for (size_t retry = 0; retry < 3; ++retry) {
-		llong recId = upsertRowImpl(row);
-		if (recId >= 0)
-			return recId;
-	//	std::this_thread::yield();
-		tbb::this_tbb_thread::yield();
-	}
-	TERARK_THROW(NeedRetryException, "Concurrent transaction conflict, retry again");
-}
-
-llong BatchWriter::upsertRowImpl(fstring row) {
 	auto ctx = m_ctx.get();
 	auto tab = ctx->m_tab;
 	auto txn = ctx->m_transaction.get();
@@ -760,73 +1149,228 @@ llong BatchWriter::upsertRowImpl(fstring row) {
 			, "syncFinishWriting('%s') was called, now writing is not allowed"
 			, tab->m_dir.string().c_str());
 	}
-	assert(sconf.m_uniqIndices.size() <= 1);
-	size_t uniqueIndexId = sconf.m_uniqIndices[0];
-	llong  newRecId;
+	m_errMsg.clear();
+	ctx->isUpsertOverwritten = 0;
 	// parseRow doesn't need lock
 	sconf.m_rowSchema->parseRow(row, &ctx->cols1);
-	const Schema& indexSchema = sconf.getIndexSchema(uniqueIndexId);
-	indexSchema.selectParent(ctx->cols1, &ctx->key1);
-{
-	MyRwLock lock(tab->m_rwMutex, false);
-	ctx->trySyncSegCtxNoLock(tab);
-	ctx->ensureTransactionNoLock();
-	txn->indexSearch(uniqueIndexId, ctx->key1, &ctx->exactMatchRecIdvec);
-	if (!ctx->exactMatchRecIdvec.empty()) {
-		return overwriteExisting(row);
+	for (size_t indexId = 0; indexId < m_pendingKeys.size(); ++indexId) {
+		const Schema& iSchema = sconf.getIndexSchema(indexId);
+		iSchema.selectParent(ctx->cols1, &ctx->key1);
+		m_pendingKeys[indexId].push_back(ctx->key1);
 	}
-	llong wrBaseId = tab->m_rowNumVec.ende(2);
-	llong wrSubId = tab->allocInvisibleWrSubId_NoTabLock();
-	if (ctx->syncIndex) {
-		if (tab->insertSyncIndex(wrSubId, txn, ctx)) {
-			txn->storeUpsert(wrSubId, row);
-			tab->m_accumulateWrittenBytes += row.size();
-		} else {
-			return -1; // fail
+	ctx->trySyncSegCtxSpeculativeLock(tab);
+	const llong wrBaseId = ctx->m_rowNumVec.ende(2);
+	// find the existing row with same key of the first unique index
+	size_t replacedVer = size_t(-1); // in this batch
+	llong  replacedRecId = -1;
+	if (!sconf.m_uniqIndices.empty()) {
+		size_t uniqueIndexId = sconf.m_uniqIndices[0];
+		fstring key = m_pendingKeys[uniqueIndexId].back();
+		makePendingUniqKey(0, key, &ctx->key2);
+		size_t found = m_pendingUniq.find_i(ctx->key2);
+		if (m_pendingUniq.end_i() != found) {
+			replacedVer = m_pendingUniq.val(found);
+			replacedRecId = wrBaseId + m_pendingSubId[replacedVer];
 		}
-	} else {
-		txn->storeUpsert(wrSubId, row);
-		tab->m_accumulateWrittenBytes += row.size();
-	}
-	newRecId = wrBaseId + wrSubId;
-	assert(tab->m_wrSeg->m_isDel[wrSubId]); // unvisible
-	txn->m_appearOnCommit.push_back(uint32_t(wrSubId));
-}
-// Find and put existing row with same unique key to txn->m_removeOnCommit
-	for (size_t segIdx = 0; segIdx < ctx->m_segCtx.size()-1; ++segIdx) {
-		auto seg = ctx->m_segCtx[segIdx]->seg;
-		assert(seg->m_isFreezed);
-		seg->indexSearchExact(segIdx, uniqueIndexId, ctx->key1, &ctx->exactMatchRecIdvec, ctx);
-		if (!ctx->exactMatchRecIdvec.empty()) {
-			llong subId = ctx->exactMatchRecIdvec[0];
-			llong baseId = ctx->m_rowNumVec[segIdx];
-			llong recId = baseId + subId;
-			assert(ctx->exactMatchRecIdvec.size() == 1);
-			MyRwLock lock(tab->m_rwMutex, false);
-			if (ctx->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
-				ctx->doSyncSegCtxNoLock(tab);
-				size_t upp = upper_bound_a(ctx->m_rowNumVec, recId);
-#if !defined(NDEBUG)
-				if (seg != ctx->m_segCtx[upp-1]->seg) {
-					seg = ctx->m_segCtx[upp-1]->seg; // for set break point
-				}
-#endif
-				segIdx = upp - 1;
-				seg = ctx->m_segCtx[segIdx]->seg;
-				baseId = ctx->m_rowNumVec[segIdx];
-				subId = recId - baseId;
+		else {
+			{
+				MyRwLock lock(tab->m_rwMutex, false);
+				txn->indexSearch(uniqueIndexId, key, &ctx->exactMatchRecIdvec);
 			}
-			else {
-				ctx->m_rowNumVec.back() = tab->m_rowNum;
+			if (!ctx->exactMatchRecIdvec.empty()) {
+				assert(ctx->exactMatchRecIdvec.size() == 1);
+				replacedRecId = wrBaseId + ctx->exactMatchRecIdvec[0];
 			}
-			if (seg->m_isDel[subId]) { // should be very rare
-				//break;
-			} else {
-				txn->m_removeOnCommit.push_back(recId);
+			for (size_t segIdx = 0; replacedRecId < 0 && segIdx < ctx->m_segCtx.size()-1; ++segIdx) {
+				auto seg = ctx->m_segCtx[segIdx]->seg;
+				assert(seg->m_isFreezed);
+				seg->indexSearchExact(segIdx, uniqueIndexId, key, &ctx->exactMatchRecIdvec, ctx);
+				if (!ctx->exactMatchRecIdvec.empty()) {
+					llong subId = ctx->exactMatchRecIdvec[0];
+					assert(ctx->exactMatchRecIdvec.size() == 1);
+					if (!seg->m_isDel[subId]) // if deleted, should be very rare
+						replacedRecId = ctx->m_rowNumVec[segIdx] + subId;
+				}
 			}
 		}
 	}
-	return newRecId;
+	for (size_t k = 1; k < sconf.m_uniqIndices.size(); ++k) {
+		if (checkUniqueDup(k, replacedRecId)) {
+			for (auto& keys : m_pendingKeys) keys.pop_back();
+			return -1;
+		}
+	}
+	llong wrSubId;
+	if (size_t(-1) != replacedVer) {
+		// overwrite the row in this batch, keep its record id
+		wrSubId = m_pendingSubId[replacedVer];
+		m_pendingDead.set1(replacedVer);
+		for (size_t k = 0; k < sconf.m_uniqIndices.size(); ++k) {
+			size_t indexId = sconf.m_uniqIndices[k];
+			makePendingUniqKey(k, m_pendingKeys[indexId][replacedVer], &ctx->key2);
+			m_pendingUniq.erase(ctx->key2);
+		}
+	}
+	else if (replacedRecId >= wrBaseId) {
+		// overwrite the live row in writing seg, keep its record id, the
+		// keys of the new row are inserted on commit
+		wrSubId = replacedRecId - wrBaseId;
+		m_minInPlaceSubId = std::min(m_minInPlaceSubId, wrSubId);
+		if (!removeWrSegIndices(wrSubId)) {
+			throw ReadRecordException("BatchWriter::upsertRow: pre overwrite",
+						m_wrSeg->m_segDir.string(), wrBaseId, wrSubId);
+		}
+	}
+	else {
+		if (replacedRecId >= 0) {
+			this->removeRow(replacedRecId);
+		}
+		MyRwLock lock(tab->m_rwMutex, false);
+		assert(tab->m_rowNumVec.ende(2) == wrBaseId);
+		wrSubId = tab->allocInvisibleWrSubId_NoTabLock();
+		txn->m_appearOnCommit.push_back(uint32_t(wrSubId));
+		assert(tab->m_wrSeg->m_isDel[wrSubId]); // unvisible
+	}
+	txn->storeUpsert(wrSubId, row);
+	tab->m_accumulateWrittenBytes += row.size();
+	if (replacedRecId >= 0) // same as DbTable::upsertRow
+		ctx->isUpsertOverwritten = replacedRecId >= wrBaseId ? 1 : 2;
+	size_t newVer = m_pendingSubId.size();
+	m_pendingSubId.push_back(uint32_t(wrSubId));
+	m_pendingDead.push_back(false);
+	for (size_t k = 0; k < sconf.m_uniqIndices.size(); ++k) {
+		size_t indexId = sconf.m_uniqIndices[k];
+		makePendingUniqKey(k, m_pendingKeys[indexId][newVer], &ctx->key2);
+		m_pendingUniq[ctx->key2] = newVer;
+	}
+	return wrBaseId + wrSubId;
+}
+
+size_t BatchWriter::insertRows(const fstring* rows, size_t n, llong* recIds) {
+	auto ctx = m_ctx.get();
+	auto tab = ctx->m_tab;
+	auto txn = ctx->m_transaction.get();
+	const SchemaConfig& sconf = *tab->m_schema;
+	assert(tab->m_wrSeg.get() == m_wrSeg);
+	assert(txn == m_txn);
+	if (!tab->m_wrSeg) {
+		THROW_STD(invalid_argument
+			, "syncFinishWriting('%s') was called, now writing is not allowed"
+			, tab->m_dir.string().c_str());
+	}
+	m_errMsg.clear();
+	ctx->trySyncSegCtxSpeculativeLock(tab);
+	const llong wrBaseId = ctx->m_rowNumVec.ende(2);
+	const size_t firstVer = m_pendingSubId.size();
+	size_t num = 0;
+	for (; num < n; ++num) {
+		sconf.m_rowSchema->parseRow(rows[num], &ctx->cols1);
+		for (size_t indexId = 0; indexId < m_pendingKeys.size(); ++indexId) {
+			const Schema& iSchema = sconf.getIndexSchema(indexId);
+			iSchema.selectParent(ctx->cols1, &ctx->key1);
+			m_pendingKeys[indexId].push_back(ctx->key1);
+		}
+		size_t k = 0;
+		while (k < sconf.m_uniqIndices.size() && !checkUniqueDup(k, -1))
+			++k;
+		if (k < sconf.m_uniqIndices.size()) {
+			for (auto& keys : m_pendingKeys) keys.pop_back();
+			break;
+		}
+		size_t newVer = m_pendingSubId.size();
+		m_pendingSubId.push_back(UINT32_MAX); // allocated below
+		m_pendingDead.push_back(false);
+		for (k = 0; k < sconf.m_uniqIndices.size(); ++k) {
+			size_t indexId = sconf.m_uniqIndices[k];
+			makePendingUniqKey(k, m_pendingKeys[indexId][newVer], &ctx->key2);
+			m_pendingUniq[ctx->key2] = newVer;
+		}
+	}
+	{
+		MyRwLock lock(tab->m_rwMutex, false);
+		assert(tab->m_rowNumVec.ende(2) == wrBaseId);
+		for (size_t i = 0; i < num; ++i) {
+			llong wrSubId = tab->allocInvisibleWrSubId_NoTabLock();
+			m_pendingSubId[firstVer + i] = uint32_t(wrSubId);
+			txn->m_appearOnCommit.push_back(uint32_t(wrSubId));
+		}
+	}
+	for (size_t i = 0; i < num; ++i) {
+		llong wrSubId = m_pendingSubId[firstVer + i];
+		assert(tab->m_wrSeg->m_isDel[wrSubId]); // unvisible
+		txn->storeUpsert(wrSubId, rows[i]);
+		tab->m_accumulateWrittenBytes += rows[i].size();
+		recIds[i] = wrBaseId + wrSubId;
+	}
+	return num;
+}
+
+// insert index keys of the batch, sorted by key for each index, for better
+// locality in writable indices, byte order is the key order for lex byte
+// comparable keys
+bool BatchWriter::insertPendingIndices() {
+	auto ctx = m_ctx.get();
+	auto tab = ctx->m_tab;
+	auto txn = ctx->m_transaction.get();
+	const SchemaConfig& sconf = *tab->m_schema;
+	if (!ctx->syncIndex) {
+		return true;
+	}
+	for (size_t indexId = 0; indexId < m_pendingKeys.size(); ++indexId) {
+		const Schema& iSchema = sconf.getIndexSchema(indexId);
+		SortableStrVec& keys = m_pendingKeys[indexId];
+		keys.sort();
+		for (size_t i = 0; i < keys.size(); ++i) {
+			size_t ver = keys.m_index[i].seq_id;
+			if (m_pendingDead[ver])
+				continue;
+			fstring key = keys[i];
+			llong subId = m_pendingSubId[ver];
+			if (!txn->indexInsert(indexId, key, subId) && iSchema.m_isUnique) {
+				m_errMsg = "DupKey=" + iSchema.toJsonStr(key)
+						 + ", in writing seg: " + m_wrSeg->m_segDir.string();
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void BatchWriter::clearPending() {
+	m_pendingSubId.erase_all();
+	m_pendingDead.erase_all();
+	for (auto& keys : m_pendingKeys) keys.clear();
+	m_pendingUniq.clear();
+	m_removedInBatch.clear();
+	m_minInPlaceSubId = LLONG_MAX;
+}
+
+// remove index keys of the row wrSubId in writing seg, the row is read
+// from the store of the transaction
+bool BatchWriter::removeWrSegIndices(llong subId) {
+	auto ctx = m_ctx.get();
+	auto tab = ctx->m_tab;
+	auto txn = ctx->m_transaction.get();
+	auto& sconf = *tab->m_schema;
+	valvec<byte> &row = ctx->row1, &key = ctx->key1;
+	ColumnVec& columns = ctx->cols1;
+	try {
+		txn->storeGetRow(subId, &row);
+	}
+	catch (const ReadRecordException& ex) {
+		fprintf(stderr
+			, "ERROR: BatchWriter: read row(subId=%lld) of writing seg failed: %s\n"
+			, subId, ex.what());
+		return false;
+	}
+	sconf.m_rowSchema->parseRow(row, &columns);
+	MyRwLock lock(tab->m_rwMutex, false);
+	for (size_t i = 0; i < m_wrSeg->m_indices.size(); ++i) {
+		const Schema& iSchema = sconf.getIndexSchema(i);
+		iSchema.selectParent(columns, &key);
+		txn->indexRemove(i, key, subId);
+	}
+	return true;
 }
 
 void BatchWriter::removeRow(llong recId) {
@@ -846,6 +1390,9 @@ void BatchWriter::removeRow(llong recId) {
 //	fprintf(stderr
 //		, "TRACE: BatchWriter::removeRow: recId = %lld, subId = %lld, segIdx = %zd, segNum = %zd\n"
 //		, recId, subId, upp-1, tab->m_segments.size());
+	if (m_removedInBatch.exists(recId)) {
+		return;
+	}
 	auto seg = ctx->m_segCtx[upp-1]->seg;
 	if (upp == ctx->m_rowNumVec.size()-1) {
 		auto wrseg = tab->m_wrSeg.get();
@@ -855,33 +1402,24 @@ void BatchWriter::removeRow(llong recId) {
 		{
 			if (wrseg->locked_testIsDel(subId))
 				return;
-			else
+			else {
 				txn->m_removeOnCommit.push_back(recId);
+				m_removedInBatch.insert_i(recId);
+				m_minInPlaceSubId = std::min(m_minInPlaceSubId, subId);
+			}
 		}
-		valvec<byte> &row = ctx->row1, &key = ctx->key1;
-		ColumnVec& columns = ctx->cols1;
-		try {
-			txn->storeGetRow(subId, &row);
-		}
-		catch (const ReadRecordException& ex) {
-			fprintf(stderr
-				, "ERROR: removeRow(id=%lld): read row data failed: %s\n"
-				, recId, ex.what());
+		if (!removeWrSegIndices(subId)) {
 		//	throw ReadRecordException("removeRow: pre remove index",
 		//		wrseg->m_segDir.string(), baseId, subId);
 			return;
 		}
-		sconf.m_rowSchema->parseRow(row, &columns);
-		for (size_t i = 0; i < wrseg->m_indices.size(); ++i) {
-			const Schema& iSchema = sconf.getIndexSchema(i);
-			iSchema.selectParent(columns, &key);
-			txn->indexRemove(i, key, subId);
-		}
 		txn->storeRemove(subId);
 	}
 	else {
-		if (!seg->m_isDel[subId])
+		if (!seg->m_isDel[subId]) {
 			txn->m_removeOnCommit.push_back(recId);
+			m_removedInBatch.insert_i(recId);
+		}
 	}
 }
 
@@ -892,16 +1430,37 @@ bool BatchWriter::commit() {
 	assert(&ws == m_wrSeg);
 	assert(txn == m_txn);
 	assert(DbTransaction::started == txn->m_status);
-	if (!txn->commit()) {
-		return false;
-	}
-	const size_t batchCnt = 100; // don't lock too long time
 	sort_a(txn->m_removeOnCommit);
 	sort_a(txn->m_appearOnCommit);
 //	fprintf(stderr, "TRACE: BatchWriter::commit: txn->m_removeOnCommit.size = %zd\n", txn->m_removeOnCommit.size());
 	ws.m_deletedWrIdSet.grow_capacity(txn->m_appearOnCommit.size());
+	// the batch is applied in one read lock, so a snapshot which is pinned
+	// by pinSnapshot sees all or none of the batch
+	MyRwLock lock(tab->m_rwMutex, false);
+	if (LLONG_MAX != m_minInPlaceSubId &&
+			tab->isSnapshotPinnedNoLock(tab->m_rowNumVec.ende(2) + m_minInPlaceSubId)) {
+		// m_wrSeg can not be frozen during the life time of BatchWriter,
+		// it will be frozen by a later writer
+		llong subId = m_minInPlaceSubId;
+		tab->m_wrSegFreezeRequested = true;
+		lock.release();
+		this->rollback();
+		TERARK_THROW(NeedRetryException
+			, "Row of writing seg is pinned by a snapshot, retry again: subId = %lld", subId);
+	}
+	if (!insertPendingIndices()) {
+		// keys were checked by upsertRow/insertRows, so the duplicate
+		// key was inserted by a concurrent transaction after the check
+		lock.release();
+		this->rollback();
+		TERARK_THROW(NeedRetryException
+			, "Concurrent transaction conflict, retry again: %s", szError());
+	}
+	if (!txn->commit()) {
+		return false;
+	}
+	clearPending();
 	{
-		MyRwLock lock(tab->m_rwMutex, false);
 		SpinRwLock segLock(ws.m_segMutex, true);
 		auto bits = ws.m_isDel.bldata();
 		for (llong wrSubId : txn->m_appearOnCommit) {
@@ -909,33 +1468,29 @@ bool BatchWriter::commit() {
 		}
 		ws.m_delcnt -= txn->m_appearOnCommit.size();
 	}
-	for(size_t i = 0; i < txn->m_removeOnCommit.size(); ) {
-		size_t upper = std::min(i + batchCnt, txn->m_removeOnCommit.size());
-		MyRwLock lock(tab->m_rwMutex, false);
-		for(; i < upper; ++i) {
-			llong recId = txn->m_removeOnCommit[i];
-			size_t upp = upper_bound_a(tab->m_rowNumVec, recId);
-			llong baseId = tab->m_rowNumVec[upp-1];
-			size_t subId = size_t(recId - baseId);
-			auto seg = tab->m_segments[upp-1].get();
-			SpinRwLock segLock(seg->m_segMutex, true);
-		//	fprintf(stderr
-		//		, "TRACE: BatchWriter::commit: remove: recId = %lld, subId = %zd, segIdx = %zd, segNum = %zd, seg[del = %zd, all = %zd], delratio = %f\n"
-		//		, recId, subId, upp-1, tab->m_segments.size(), seg->m_delcnt, seg->m_isDel.size(), double(seg->m_delcnt) / seg->m_isDel.size());
-			if (seg->m_isDel[subId]) {
-				continue;
-			}
-			seg->m_isDel.set1(subId);
-			seg->m_delcnt++;
-			if (&ws == seg) {
-				ws.m_deletedWrIdSet.push_back(uint32_t(subId));
-			} else {
-				seg->addtoUpdateList(subId);
-			}
+	for(size_t i = 0; i < txn->m_removeOnCommit.size(); ++i) {
+		llong recId = txn->m_removeOnCommit[i];
+		size_t upp = upper_bound_a(tab->m_rowNumVec, recId);
+		llong baseId = tab->m_rowNumVec[upp-1];
+		size_t subId = size_t(recId - baseId);
+		auto seg = tab->m_segments[upp-1].get();
+		SpinRwLock segLock(seg->m_segMutex, true);
+	//	fprintf(stderr
+	//		, "TRACE: BatchWriter::commit: remove: recId = %lld, subId = %zd, segIdx = %zd, segNum = %zd, seg[del = %zd, all = %zd], delratio = %f\n"
+	//		, recId, subId, upp-1, tab->m_segments.size(), seg->m_delcnt, seg->m_isDel.size(), double(seg->m_delcnt) / seg->m_isDel.size());
+		if (seg->m_isDel[subId]) {
+			continue;
+		}
+		seg->m_isDel.set1(subId);
+		seg->m_delcnt++;
+		if (&ws == seg) {
+			ws.m_deletedWrIdSet.push_back(uint32_t(subId));
+		} else {
+			seg->addtoUpdateList(subId);
 		}
 	}
 	if (txn->m_removeOnCommit.size() > 0) {
-		MyRwLock lock(tab->m_rwMutex, true);
+		lock.upgrade_to_writer();
 		const size_t segNum = tab->m_segments.size();
 		for(size_t i = 0; i < segNum-1; ++i) {
 			auto seg = tab->m_segments[i].get();
@@ -959,6 +1514,7 @@ void BatchWriter::rollback() {
 	txn->rollback();
 	auto& ws = *tab->m_wrSeg;
 	ws.m_deletedWrIdSet.append(txn->m_appearOnCommit);
+	clearPending();
 }
 
 StoreIterator* DbTable::createStoreIterForward(DbContext* ctx) const {
@@ -971,6 +1527,74 @@ StoreIterator* DbTable::createStoreIterBackward(DbContext* ctx) const {
 	return new MyStoreIterBackward(this, ctx);
 }
 
+ColgroupScanner*
+DbTable::createColgroupScanner(size_t cgId, DbContext* ctx) const {
+	assert(m_schema);
+	return new ColgroupScanner(this, cgId, ctx);
+}
+
+StoreIterator*
+DbTable::createStoreIterRange(llong beginId, llong endId, DbContext* ctx) const {
+	assert(m_schema);
+	if (beginId < 0 || beginId > endId) {
+		THROW_STD(invalid_argument, "invalid range: [%lld, %lld)", beginId, endId);
+	}
+	return new MyStoreIterRange(this, beginId, endId, ctx);
+}
+
+void
+DbTable::getParallelScanBounds(size_t nParts, valvec<llong>* bounds,
+							   DbContext* ctx) const {
+	const llong MinPartRows = 4096;
+	llong endId = ctx && ctx->m_isUserDefineSnapshot
+				? ctx->m_mySnapshotVersion + 1
+				: inlineGetRowNum();
+	nParts = size_t(std::max(std::min(llong(nParts), endId / MinPartRows), 1LL));
+	bounds->erase_all();
+	bounds->push_back(0);
+	if (nParts > 1) {
+		valvec<llong> rowNumVec;
+		{
+			SegArrayReadGuard segArray(this);
+			rowNumVec.assign(segArray->m_rowNumVec);
+		}
+		llong partRows = endId / nParts;
+		for (size_t k = 1; k < nParts; ++k) {
+			llong x = endId / llong(nParts) * llong(k);
+			// a part in one segment is cheaper, snap x to a near segment end
+			size_t upp = upper_bound_a(rowNumVec, x);
+			if (upp < rowNumVec.size() && rowNumVec[upp] - x <= partRows / 4)
+				x = rowNumVec[upp];
+			else if (upp > 0 && x - rowNumVec[upp-1] <= partRows / 4)
+				x = rowNumVec[upp-1];
+			if (x > bounds->back() && x < endId)
+				bounds->push_back(x);
+		}
+	}
+	bounds->push_back(endId);
+}
+
+valvec<StoreIteratorPtr>
+DbTable::createParallelScan(size_t nParts, DbContext* ctx) const {
+	valvec<llong> bounds;
+	getParallelScanBounds(nParts, &bounds, ctx);
+	valvec<StoreIteratorPtr> parts(bounds.size() - 1, valvec_reserve());
+	for (size_t i = 0; i < bounds.size() - 1; ++i) {
+		DbContextPtr partCtx(createDbContext());
+		if (ctx && ctx->m_isUserDefineSnapshot) {
+			const_cast<DbTable*>(this)->pinSnapshot(partCtx.get(), ctx);
+		}
+		parts.push_back(new MyStoreIterRange(this, bounds[i], bounds[i+1], partCtx.get()));
+	}
+	return parts;
+}
+
+StoreIterator*
+DbTable::createRandomIter(DbContext* ctx) const {
+	assert(m_schema);
+	return new MyStoreIterRandom(this, ctx);
+}
+
 DbContext* DbTable::createDbContext() const {
 	MyRwLock lock(m_rwMutex, false);
 	return this->createDbContextNoLock();
@@ -981,10 +1605,10 @@ DbContext* DbTable::createDbContextNoLock() const {
 }
 
 llong DbTable::existingRows(DbContext* ctx) const {
-	MyRwLock lock(m_rwMutex, false);
+	SegArrayReadGuard segArray(this);
 	llong delcnt = 0;
-	auto segA = m_segments.data();
-	auto segN = m_segments.size();
+	auto segA = segArray->m_segments.data();
+	auto segN = segArray->m_segments.size();
 	for (size_t i = 0; i < segN; ++i) {
 		auto seg = segA[i].get();
 		delcnt += seg->m_delcnt;
@@ -1052,7 +1676,7 @@ bool DbTable::maybeCreateNewSegment(MyRwLock& lock) {
 	if (m_inprogressWritingCount > 1) {
 		return false;
 	}
-	if (m_wrSeg->dataStorageSize() < m_schema->m_maxWritingSegmentSize) {
+	if (!wrSegNeedFreezeNoLock()) {
 		return false;
 	}
 	if (!lock.upgrade_to_writer()) {
@@ -1065,7 +1689,7 @@ bool DbTable::maybeCreateNewSegment(MyRwLock& lock) {
 		if (m_inprogressWritingCount > 1) {
 			return false;
 		}
-		if (m_wrSeg->dataStorageSize() < m_schema->m_maxWritingSegmentSize) {
+		if (!wrSegNeedFreezeNoLock()) {
 			return false;
 		}
 	}
@@ -1082,21 +1706,64 @@ void DbTable::maybeCreateNewSegmentInWriteLock() {
 	if (m_inprogressWritingCount > 1) {
 		return;
 	}
-	if (m_wrSeg->dataStorageSize() >= m_schema->m_maxWritingSegmentSize) {
+	if (wrSegNeedFreezeNoLock()) {
 		doCreateNewSegmentInLock();
 	}
 }
 
+bool DbTable::wrSegNeedFreezeNoLock() const {
+	if (m_wrSeg->dataStorageSize() >= m_schema->m_maxWritingSegmentSize) {
+		return true;
+	}
+	// see tryFreezePinnedWrSegInLock
+	return m_wrSegFreezeRequested && isSnapshotPinnedNoLock(m_rowNumVec.ende(2));
+}
+
+/// rows of m_wrSeg which are visible to a pinned snapshot must not be changed
+/// in place, m_wrSeg is frozen before changing them, as if it was frozen when
+/// the snapshot was pinned, caller must hold the write lock
+/// @returns false if m_wrSeg can not be frozen now, it will be frozen by a
+///          later writer, the caller should throw NeedRetryException
+bool DbTable::tryFreezePinnedWrSegInLock() {
+	if (!isSnapshotPinnedNoLock(m_rowNumVec.ende(2))) {
+		return true; // frozen by other threads or snapshots are unpinned
+	}
+	if (m_isMerging || m_inprogressWritingCount > 1) {
+		m_wrSegFreezeRequested = true;
+		return false;
+	}
+	doCreateNewSegmentInLock();
+	return true;
+}
+
 void DbTable::doCreateNewSegmentInLock() {
 	assert(!m_isMerging);
 	if (m_segments.size() == m_segments.capacity()) {
 		THROW_STD(invalid_argument,
 			"Reaching maxSegNum=%d", int(m_segments.capacity()));
 	}
+	freezeWritableSegmentInLock();
+	// createWritableSegment should be fast, other wise the lock time
+	// may be too long
+	size_t newSegIdx = m_segments.size();
+	m_wrSeg = myCreateWritableSegment(getSegPath("wr", newSegIdx));
+	m_segments.push_back(m_wrSeg);
+	llong newMaxRowNum = m_rowNumVec.back();
+	m_rowNumVec.push_back(newMaxRowNum);
+	m_newWrSegNum++;
+	m_segArrayUpdateSeq++;
+	publishSegArrayInLock();
+}
+
+/// m_wrSeg is frozen and put to flush queue, the caller replaces m_wrSeg
+void DbTable::freezeWritableSegmentInLock() {
 	auto oldwrseg = m_wrSeg.get();
 	{
 		SpinRwLock wrsegLock(oldwrseg->m_segMutex, true);
-		while (oldwrseg->m_isDel.size() && oldwrseg->m_isDel.back()) {
+		// ids of deleted tail rows are reused by the new m_wrSeg, unless
+		// they are under a pinned snapshot
+		while (oldwrseg->m_isDel.size() && oldwrseg->m_isDel.back() &&
+			   !isSnapshotPinnedNoLock(m_rowNumVec.ende(2) + llong(oldwrseg->m_isDel.size()) - 1)) {
 			assert(oldwrseg->m_delcnt > 0);
 			oldwrseg->popIsDel();
 			oldwrseg->m_delcnt--;
@@ -1104,19 +1771,11 @@ void DbTable::doCreateNewSegmentInLock() {
 		m_rowNum = m_rowNumVec.back()
 				 = m_rowNumVec.ende(2) + oldwrseg->m_isDel.size();
 	}
-	// createWritableSegment should be fast, other wise the lock time
-	// may be too long
 	putToFlushQueue(m_segments.size() - 1);
-	size_t newSegIdx = m_segments.size();
-	m_wrSeg = myCreateWritableSegment(getSegPath("wr", newSegIdx));
 	oldwrseg->markFrozen();
 	assert(oldwrseg->m_isFreezed);
-	m_segments.push_back(m_wrSeg);
-	llong newMaxRowNum = m_rowNumVec.back();
-	m_rowNumVec.push_back(newMaxRowNum);
-	m_newWrSegNum++;
-	m_segArrayUpdateSeq++;
 	oldwrseg->m_deletedWrIdSet.clear(); // free memory
+	m_wrSegFreezeRequested = false;
 	// freeze oldwrseg, this may be too slow
 	// auto& oldwrseg = m_segments.ende(2);
 	// oldwrseg->saveIsDel(oldwrseg->m_segDir);
@@ -1130,6 +1789,7 @@ DbTable::myCreateReadonlySegment(PathRef segDir) const {
 	seg(ReadableSegment::createSegment(clazz, segDir, m_schema.get()));
 	if (auto rdseg = seg->getReadonlySegment()) {
 		seg.release();
+		rdseg->m_rowCache = m_rowCache.get();
 		return rdseg;
 	}
 	THROW_STD(invalid_argument, "bad ReadonlySegmentClass: %s", clazz.c_str());
@@ -1172,14 +1832,18 @@ bool DbTable::exists(llong id) const {
 	if (terark_unlikely(id >= llong(m_rowNum))) {
 		return false;
 	}
-	MyRwLock lock(m_rwMutex, false);
-	size_t upp = upper_bound_a(m_rowNumVec, id);
-	assert(upp < m_rowNumVec.size());
-	llong baseId = m_rowNumVec[upp-1];
+	SegArrayReadGuard segArray(this);
+	const valvec<llong>& rowNumVec = segArray->m_rowNumVec;
+	size_t upp = upper_bound_a(rowNumVec, id);
+	if (upp == rowNumVec.size()) {
+		// id is appended to m_wrSeg after the snapshot was published
+		upp--;
+	}
+	llong baseId = rowNumVec[upp-1];
 	size_t subId = size_t(id - baseId);
-	auto seg = m_segments[upp-1].get();
+	auto seg = segArray->m_segments[upp-1].get();
 #if !defined(NDEBUG)
-	size_t upperId = m_rowNumVec[upp];
+	size_t upperId = upp + 1 < rowNumVec.size() ? rowNumVec[upp] : m_rowNum;
 //	assert(subId < seg->m_isDel.size());
 	if (terark_unlikely(seg->m_isDel.size() != upperId - baseId)) {
 		fprintf(stderr, "INFO: DbTable::exists(id=%lld): "
@@ -1208,6 +1872,9 @@ llong DbTable::insertRow(fstring row, DbContext* txn) {
 	if (txn->syncIndex) { // parseRow doesn't need lock
 		m_schema->m_rowSchema->parseRow(row, &txn->cols1);
 	}
+	if (m_schema->m_enableGroupCommit && txn->syncIndex) {
+		return groupCommitWrite(row, txn, false);
+	}
 	IncrementGuard_size_t guard(m_inprogressWritingCount);
 	MyRwLock lock(m_rwMutex, false);
 	assert(m_rowNumVec.size() == m_segments.size()+1);
@@ -1217,6 +1884,10 @@ llong DbTable::insertRow(fstring row, DbContext* txn) {
 llong DbTable::insertRowImpl(fstring row, DbContext* ctx, MyRwLock& lock) {
 	DebugCheckRowNumVecNoLock(this);
 	maybeCreateNewSegment(lock);
+	return insertRowInLock(row, ctx);
+}
+
+llong DbTable::insertRowInLock(fstring row, DbContext* ctx) {
 	ctx->trySyncSegCtxNoLock(this);
 	ctx->ensureTransactionNoLock();
 	if (!ctx->syncIndex) {
@@ -1400,7 +2071,6 @@ llong DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 		return insertRow(row, ctx); // should always success
 	}
 	this->throttleWrite();
-	IncrementGuard_size_t guard(m_inprogressWritingCount);
 	assert(sconf.m_uniqIndices.size() == 1);
 	if (!ctx->syncIndex) {
 		THROW_STD(invalid_argument,
@@ -1416,6 +2086,10 @@ llong DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 	sconf.m_rowSchema->parseRow(row, &ctx->cols1);
 	const Schema& indexSchema = sconf.getIndexSchema(uniqueIndexId);
 	indexSchema.selectParent(ctx->cols1, &ctx->key1);
+	if (sconf.m_enableGroupCommit) {
+		return groupCommitWrite(row, ctx, true);
+	}
+	IncrementGuard_size_t guard(m_inprogressWritingCount);
 	{
 		MyRwLock lock(m_rwMutex, false);
 		ctx->trySyncSegCtxNoLock(this);
@@ -1450,16 +2124,8 @@ llong DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 			if (seg->m_isDel[subId]) { // should be very rare
 				break;
 			}
-			llong newRecId = insertRowDoInsert(row, ctx);
+			llong newRecId = upsertOverwriteFrozenRow(seg, subId, row, ctx);
 			if (newRecId >= 0) {
-				{
-					SpinRwLock segLock(seg->m_segMutex, true);
-					seg->m_delcnt++;
-					seg->m_isDel.set1(subId);
-					seg->addtoUpdateList(subId);
-				}
-				TERARK_IF_DEBUG(ctx->debugCheckUnique(row, uniqueIndexId),;);
-				ctx->isUpsertOverwritten = 2;
 				if (checkPurgeDeleteNoLock(seg)) {
 					lock.upgrade_to_writer();
 					asyncPurgeDeleteInLock();
@@ -1475,17 +2141,68 @@ llong DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 	MyRwLock lock(m_rwMutex, false);
 	ctx->trySyncSegCtxNoLock(this);
 	ctx->ensureTransactionNoLock();
+	bool needFreeze = false;
+	llong recId = upsertInWrSegInLock(row, ctx, &needFreeze);
+	if (needFreeze) {
+		// the row is overwritten as a frozen row after m_wrSeg is frozen
+		lock.upgrade_to_writer();
+		if (!tryFreezePinnedWrSegInLock()) {
+			TERARK_THROW(NeedRetryException,
+				"upsertRow: the row is pinned by a snapshot, retry later");
+		}
+		bool needPurge = false;
+		needFreeze = false;
+		recId = doUpsertRowInLock(row, ctx, &needPurge, &needFreeze);
+		assert(!needFreeze);
+		if (needPurge) {
+			asyncPurgeDeleteInLock();
+		}
+		return recId;
+	}
+	maybeCreateNewSegment(lock);
+	return recId;
+}
+
+/// insert row and delete the old row with same unique key in frozen seg,
+/// caller must hold m_rwMutex and do the purge check
+llong
+DbTable::upsertOverwriteFrozenRow(ReadableSegment* seg, llong subId,
+								  fstring row, DbContext* ctx) {
+	llong newRecId = insertRowDoInsert(row, ctx);
+	if (newRecId >= 0) {
+		{
+			SpinRwLock segLock(seg->m_segMutex, true);
+			seg->m_delcnt++;
+			seg->m_isDel.set1(subId);
+			seg->addtoUpdateList(subId);
+		}
+		TERARK_IF_DEBUG(ctx->debugCheckUnique(row, m_schema->m_uniqIndices[0]),;);
+		ctx->isUpsertOverwritten = 2;
+	}
+	return newRecId;
+}
+
+/// caller must hold m_rwMutex and have synced ctx
+/// @param needFreeze set to true if the row to be overwritten is visible to
+///                   a pinned snapshot, the row is not changed and -1 returned
+llong
+DbTable::upsertInWrSegInLock(fstring row, DbContext* ctx, bool* needFreeze) {
+	const SchemaConfig& sconf = *m_schema;
+	size_t uniqueIndexId = sconf.m_uniqIndices[0];
 	m_wrSeg->indexSearchExact(m_segments.size()-1, uniqueIndexId,
 		ctx->key1, &ctx->exactMatchRecIdvec, ctx);
 	if (ctx->exactMatchRecIdvec.empty()) {
 		llong recId = insertRowDoInsert(row, ctx);
 		TERARK_IF_DEBUG(ctx->debugCheckUnique(row, uniqueIndexId),;);
-		maybeCreateNewSegment(lock);
 		return recId;
 	}
 	llong subId = ctx->exactMatchRecIdvec[0];
 	llong baseId = m_rowNumVec.ende(2);
 	assert(ctx->exactMatchRecIdvec.size() == 1);
+	if (isSnapshotPinnedNoLock(baseId + subId)) {
+		*needFreeze = true;
+		return -1;
+	}
 	TransactionGuard txn(ctx->m_transaction.get());
 	if (!sconf.m_multIndices.empty()) {
 		try {
@@ -1499,18 +2216,154 @@ llong DbTable::doUpsertRow(fstring row, DbContext* ctx) {
 			throw ReadRecordException("pre updateSyncMultIndex",
 						m_wrSeg->m_segDir.string(), baseId, subId);
 		}
-		sconf.m_rowSchema->parseRow(ctx->row2, &ctx->cols2); // old
-		updateSyncMultIndex(subId, txn.getTxn(), ctx);
+		sconf.m_rowSchema->parseRow(ctx->row2, &ctx->cols2); // old
+		updateSyncMultIndex(subId, txn.getTxn(), ctx);
+	}
+	txn.storeUpsert(subId, row);
+	if (!txn.commit()) {
+		TERARK_THROW(CommitException
+			, "commit failed: %s, baseId=%lld, subId=%lld, seg = %s, caller should retry"
+			, txn.szError(), baseId, subId, m_wrSeg->m_segDir.string().c_str());
+	}
+	ctx->isUpsertOverwritten = 1;
+	return baseId + subId;
+}
+
+struct DbTable::GroupCommitWriter {
+	fstring    row;
+	DbContext* ctx;
+	bool       isUpsert;
+	bool       done;
+	llong      recId;
+	std::exception_ptr error;
+	std::condition_variable cond;
+};
+
+const size_t GroupCommitMaxRows  = 256;
+const size_t GroupCommitMaxBytes = 1024 * 1024;
+
+/// Concurrent writers are queued, the writer at queue front is the leader,
+/// it applies rows of itself and the writers following it in one
+/// transaction, then wakes them up, the first writer after the group
+/// becomes the next leader. ctx->syncIndex must be true
+llong DbTable::groupCommitWrite(fstring row, DbContext* ctx, bool isUpsert) {
+	GroupCommitWriter w;
+	w.row = row;
+	w.ctx = ctx;
+	w.isUpsert = isUpsert;
+	w.done = false;
+	w.recId = -1;
+	std::unique_lock<std::mutex> qlock(m_groupCommitMutex);
+	auto& queue = m_groupCommitQueue;
+	queue.push_back(&w);
+	while (!w.done && queue.front() != &w) {
+		w.cond.wait(qlock);
+	}
+	if (!w.done) { // I'm the leader
+		GroupCommitWriter* group[GroupCommitMaxRows];
+		size_t num = 0, bytes = 0;
+		while (num < queue.size()) {
+			if (num >= GroupCommitMaxRows || bytes >= GroupCommitMaxBytes)
+				break;
+			group[num] = queue[num];
+			bytes += group[num]->row.size();
+			num++;
+		}
+		// followers wait for the leader, they must always be released,
+		// even if the leader failed
+		BOOST_SCOPE_EXIT(&qlock, &m_groupCommitQueue, &num) {
+			if (!qlock.owns_lock())
+				qlock.lock();
+			for (size_t i = 0; i < num; ++i) {
+				GroupCommitWriter* x = m_groupCommitQueue.front();
+				m_groupCommitQueue.pop_front();
+				x->done = true;
+				if (i) // followers will wake up after qlock is released
+					x->cond.notify_one();
+			}
+			if (!m_groupCommitQueue.empty())
+				m_groupCommitQueue.front()->cond.notify_one(); // next leader
+		} BOOST_SCOPE_EXIT_END;
+		qlock.unlock();
+		try {
+			groupCommitApply(group, num);
+		}
+		catch (...) {
+			std::exception_ptr ex = std::current_exception();
+			for (size_t i = 0; i < num; ++i) {
+				group[i]->error = ex;
+			}
+		}
+	}
+	if (qlock.owns_lock())
+		qlock.unlock();
+	if (w.error) {
+		std::rethrow_exception(w.error);
+	}
+	return w.recId;
+}
+
+/// the group is one BatchWriter on m_groupCommitCtx, so it is one
+/// transaction with one commit and one log flush, a failed commit fails
+/// all writers of the group, rows with duplicate keys only fail themselves
+void DbTable::groupCommitApply(GroupCommitWriter** group, size_t num) {
+	if (!m_groupCommitCtx) { // only the leader is here
+		m_groupCommitCtx.reset(createDbContext());
+	}
+	DbContext* gctx = m_groupCommitCtx.get();
+	BatchWriter batch(this, gctx);
+	try {
+		for (size_t i = 0; i < num; ++i) {
+			GroupCommitWriter* w = group[i];
+			if (w->isUpsert) {
+				w->recId = batch.upsertRow(w->row);
+				w->ctx->isUpsertOverwritten = gctx->isUpsertOverwritten;
+			}
+			else if (batch.insertRows(&w->row, 1, &w->recId) == 0) {
+				w->recId = -1;
+			}
+			if (w->recId < 0) {
+				w->ctx->errMsg = batch.strError();
+			}
+		}
 	}
-	txn.storeUpsert(subId, row);
-	if (!txn.commit()) {
+	catch (...) {
+		batch.rollback();
+		throw;
+	}
+	if (!batch.commit()) { // NeedRetryException has rolled back
 		TERARK_THROW(CommitException
-			, "commit failed: %s, baseId=%lld, subId=%lld, seg = %s, caller should retry"
-			, txn.szError(), baseId, subId, m_wrSeg->m_segDir.string().c_str());
+			, "group commit of %zd rows failed: %s, caller should retry"
+			, num, batch.szError());
 	}
-	ctx->isUpsertOverwritten = 1;
-	maybeCreateNewSegment(lock);
-	return baseId + subId;
+}
+
+/// same as doUpsertRow, but the caller holds m_rwMutex for a whole group
+llong
+DbTable::doUpsertRowInLock(fstring row, DbContext* ctx, bool* needPurge,
+						   bool* needFreeze) {
+	size_t uniqueIndexId = m_schema->m_uniqIndices[0];
+	ctx->isUpsertOverwritten = 0;
+	ctx->trySyncSegCtxNoLock(this);
+	ctx->ensureTransactionNoLock();
+	for (size_t segIdx = 0; segIdx < m_segments.size()-1; ++segIdx) {
+		auto seg = m_segments[segIdx].get();
+		assert(seg->m_isFreezed);
+		seg->indexSearchExact(segIdx, uniqueIndexId, ctx->key1, &ctx->exactMatchRecIdvec, ctx);
+		if (!ctx->exactMatchRecIdvec.empty()) {
+			llong subId = ctx->exactMatchRecIdvec[0];
+			assert(ctx->exactMatchRecIdvec.size() == 1);
+			if (seg->m_isDel[subId]) { // should be very rare
+				break;
+			}
+			llong newRecId = upsertOverwriteFrozenRow(seg, subId, row, ctx);
+			if (newRecId >= 0 && !*needPurge) {
+				*needPurge = checkPurgeDeleteNoLock(seg);
+			}
+			return newRecId;
+		}
+	}
+	return upsertInWrSegInLock(row, ctx, needFreeze);
 }
 
 void
@@ -1578,6 +2431,13 @@ DbTable::updateRow(llong id, fstring row, DbContext* ctx) {
 		subId = id - baseId;
 		seg = &*m_segments[j-1];
 	}
+	if (j == m_rowNumVec.size()-1 && isSnapshotPinnedNoLock(id)) {
+		// the row is updated as a frozen row after m_wrSeg is frozen
+		if (!tryFreezePinnedWrSegInLock()) {
+			TERARK_THROW(NeedRetryException,
+				"updateRow: id = %lld is pinned by a snapshot, retry later", id);
+		}
+	}
 	if (j == m_rowNumVec.size()-1) { // id is in m_wrSeg
 		if (ctx->syncIndex) {
 			updateWithSyncIndex(subId, row, ctx);
@@ -1784,6 +2644,21 @@ bool DbTable::removeRow(llong id, DbContext* ctx) {
 	llong baseId = m_rowNumVec[j-1];
 	llong subId = id - baseId;
 	auto seg = m_segments[j-1].get();
+	bool isWriter = false;
+	if (!seg->m_isFreezed && isSnapshotPinnedNoLock(id)) {
+		// the row and its index keys can not be removed from m_wrSeg, it is
+		// deleted as a frozen row after m_wrSeg is frozen
+		lock.upgrade_to_writer();
+		isWriter = true;
+		if (!tryFreezePinnedWrSegInLock()) {
+			TERARK_THROW(NeedRetryException,
+				"removeRow: id = %lld is pinned by a snapshot, retry later", id);
+		}
+		j = upper_bound_0(m_rowNumVec.data(), m_rowNumVec.size(), id);
+		baseId = m_rowNumVec[j-1];
+		subId = id - baseId;
+		seg = m_segments[j-1].get();
+	}
 	if (!seg->m_isFreezed) {
 		auto wrseg = m_wrSeg.get();
 		assert(wrseg == seg);
@@ -1792,7 +2667,6 @@ bool DbTable::removeRow(llong id, DbContext* ctx) {
 			SpinRwLock wsLock(wrseg->m_segMutex);
 		//	assert(!seg->m_isDel[subId]);
 			if (!wrseg->m_isDel[subId]) {
-				wrseg->m_deletedWrIdSet.push_back(uint32_t(subId));
 				wrseg->m_delcnt++;
 				wrseg->m_isDel.set1(subId); // always set delmark
 				wrseg->m_isDirty = true;
@@ -1800,12 +2674,27 @@ bool DbTable::removeRow(llong id, DbContext* ctx) {
 				size_t delcnt = wrseg->m_isDel.popcnt();
 				assert(delcnt == wrseg->m_delcnt);
 		#endif
+				if (!ctx->syncIndex)
+					wrseg->m_deletedWrIdSet.push_back(uint32_t(subId));
 			}
 			else {
 				return false;
 			}
 		}
-		if (ctx->syncIndex) {
+		// the delmark is set, but keys left in the indices are still hit
+		// by unique checks, commit fails only if another transaction has
+		// changed the row, so read the row again and retry. subId can be
+		// reused only after the commit, on give up the delmark is cleared
+		const int MaxRemoveRetry = 8;
+		for (int retry = 0; ctx->syncIndex; ++retry) {
+			if (retry >= MaxRemoveRetry) {
+				SpinRwLock wsLock(wrseg->m_segMutex);
+				wrseg->m_isDel.set0(subId);
+				wrseg->m_delcnt--;
+				TERARK_THROW(NeedRetryException,
+					"removeRow: id = %lld, commit failed %d times, retry later",
+					id, retry);
+			}
 			TransactionGuard txn(ctx->m_transaction.get());
 			valvec<byte> &row = ctx->row1, &key = ctx->key1;
 			ColumnVec& columns = ctx->cols1;
@@ -1827,13 +2716,10 @@ bool DbTable::removeRow(llong id, DbContext* ctx) {
 				txn.indexRemove(i, key, subId);
 			}
 			txn.storeRemove(subId);
-			if (!txn.commit()) {
-				// this fail should be ignored, because the deletion bit
-				// have always be set, remove index is just an optimization
-				// for future search
-				fprintf(stderr
-					, "WARN: removeRow: commit failed: recId=%lld, baseId=%lld, subId=%lld, seg = %s"
-					, id, baseId, subId, wrseg->m_segDir.string().c_str());
+			if (txn.commit()) {
+				SpinRwLock wsLock(wrseg->m_segMutex);
+				wrseg->m_deletedWrIdSet.push_back(uint32_t(subId));
+				break;
 			}
 		}
 		return true;
@@ -1866,7 +2752,8 @@ bool DbTable::removeRow(llong id, DbContext* ctx) {
 			}
 		}
 		if (checkPurgeDeleteNoLock(seg)) {
-			lock.upgrade_to_writer();
+			if (!isWriter)
+				lock.upgrade_to_writer();
 			asyncPurgeDeleteInLock();
 		}
 		return success;
@@ -1889,6 +2776,7 @@ void DbTable::delmarkSet0(llong id) {
 	assert(seg->m_isDel[subId]);
 	seg->m_isDel.set0(subId);
 	seg->m_delcnt--;
+	seg->m_pinnedDelMarks.reset(); // see ReadableSegment::snapshotDelMarks
 }
 
 void DbTable::delmarkSet1(llong id) {
@@ -1914,6 +2802,9 @@ void DbTable::delmarkSet1(llong id) {
 			success = true;
 		}
 	}
+	if (success) {
+		seg->invalidateRowCache(subId);
+	}
 	if (success && seg->getReadonlySegment()) {
 		if (checkPurgeDeleteNoLock(seg)) {
 			lock.upgrade_to_writer();
@@ -2139,6 +3030,20 @@ DbTable::incrementColumnValue(llong recordId, fstring colname,
 	incrementColumnValue(recordId, colname, incVal, ctx);
 }
 
+/// keep only subIds which are visible to the pinned snapshot of ctx,
+/// segments keep deleted rows in index hits for snapshot contexts
+///@returns number of remained subIds, which are compacted to the front
+static size_t
+filterSnapshotHits(llong* subIds, size_t len, llong baseId,
+				   const DbContext* ctx) {
+	size_t newsize = 0;
+	for (size_t k = 0; k < len; ++k) {
+		if (ctx->isVisibleInSnapshot(baseId + subIds[k]))
+			subIds[newsize++] = subIds[k];
+	}
+	return newsize;
+}
+
 bool
 DbTable::indexKeyExists(size_t indexId, fstring key, DbContext* ctx)
 const {
@@ -2153,12 +3058,17 @@ const {
 		THROW_STD(invalid_argument, "invalid indexId = %zd, indexNum = %zd"
 			, indexId, m_schema->getIndexNum());
 	}
-	ctx->exactMatchRecIdvec.erase_all();
+	auto& hits = ctx->exactMatchRecIdvec;
+	hits.erase_all();
 	size_t segNum = ctx->m_segCtx.size();
 	for (size_t i = 0; i < segNum; ++i) {
 		auto seg = ctx->m_segCtx[i]->seg;
-		seg->indexSearchExactAppend(i, indexId, key, &ctx->exactMatchRecIdvec, ctx);
-		if (ctx->exactMatchRecIdvec.size()) {
+		seg->indexSearchExactAppend(i, indexId, key, &hits, ctx);
+		if (hits.size() && ctx->m_isUserDefineSnapshot) {
+			llong baseId = ctx->m_rowNumVec[i];
+			hits.risk_set_size(filterSnapshotHits(hits.data(), hits.size(), baseId, ctx));
+		}
+		if (hits.size()) {
 			return true;
 		}
 	}
@@ -2210,17 +3120,26 @@ const {
 //	std::reverse(recIdvec->begin(), recIdvec->end()); // make descending
 #else
 	// search newer segments first
+	const bool isSnapshot = ctx->m_isUserDefineSnapshot;
 	for (size_t i = segNum; i > 0; ) {
 		auto seg = ctx->m_segCtx[--i]->seg;
-		if (seg->m_isDel.size() == seg->m_delcnt)
+		if (isSnapshot) {
+			if (ctx->m_rowNumVec[i] > ctx->m_mySnapshotVersion)
+				continue;
+		}
+		else if (seg->m_isDel.size() == seg->m_delcnt)
 			continue;
 		size_t oldsize = recIdvec->size();
 		seg->indexSearchExactAppend(i, indexId, key, recIdvec, ctx);
 		size_t newsize = recIdvec->size();
 		size_t len = newsize - oldsize;
+		llong* p = recIdvec->data() + oldsize;
+		llong baseId = ctx->m_rowNumVec[i];
+		if (isSnapshot && len) {
+			len = filterSnapshotHits(p, len, baseId, ctx);
+			recIdvec->risk_set_size(oldsize + len);
+		}
 		if (len) {
-			llong* p = recIdvec->data() + oldsize;
-			llong baseId = ctx->m_rowNumVec[i];
 			for (size_t j = 0; j < len; ++j) {
 				p[j] += baseId;
 			}
@@ -2237,6 +3156,103 @@ const {
 #endif
 }
 
+void
+DbTable::indexSearchExactBatch(size_t indexId, const fstring* keys, size_t n,
+							   valvec<llong>* recIdvec, valvec<size_t>* keyOffsets,
+							   DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	indexSearchExactBatchNoLock(indexId, keys, n, recIdvec, keyOffsets, ctx);
+}
+
+/// keys are sorted once and each segment is searched with the whole batch,
+/// recId of each key are in the same order as indexSearchExactNoLock
+void
+DbTable::indexSearchExactBatchNoLock(size_t indexId, const fstring* keys, size_t n,
+							   valvec<llong>* recIdvec, valvec<size_t>* keyOffsets,
+							   DbContext* ctx)
+const {
+	if (indexId >= m_schema->getIndexNum()) {
+		THROW_STD(invalid_argument, "invalid indexId = %zd, indexNum = %zd"
+			, indexId, m_schema->getIndexNum());
+	}
+	recIdvec->erase_all();
+	keyOffsets->resize_fill(n + 1, 0);
+	if (0 == n) {
+		return;
+	}
+	const Schema& schema = m_schema->getIndexSchema(indexId);
+	const bool isUnique = schema.m_isUnique;
+	valvec<size_t> pending(n, valvec_no_init());
+	for (size_t k = 0; k < n; ++k) {
+		pending[k] = k;
+	}
+	std::sort(pending.begin(), pending.end(), [&](size_t x, size_t y) {
+		return schema.compareData(keys[x], keys[y]) < 0;
+	});
+	valvec<fstring> segKeys(n, valvec_no_init());
+	valvec<size_t>  hitCnt(n, valvec_no_init());
+	valvec<llong>   segHits;
+	valvec<std::pair<size_t, llong> > hits; // (keyIdx, recId)
+	// search newer segments first
+	const bool isSnapshot = ctx->m_isUserDefineSnapshot;
+	size_t segNum = ctx->m_segCtx.size();
+	for (size_t i = segNum; i > 0 && !pending.empty(); ) {
+		auto seg = ctx->m_segCtx[--i]->seg;
+		if (isSnapshot) {
+			if (ctx->m_rowNumVec[i] > ctx->m_mySnapshotVersion)
+				continue;
+		}
+		else if (seg->m_isDel.size() == seg->m_delcnt)
+			continue;
+		size_t np = pending.size();
+		for (size_t k = 0; k < np; ++k) {
+			segKeys[k] = keys[pending[k]];
+		}
+		segHits.erase_all();
+		seg->indexSearchExactBatchAppend(i, indexId, segKeys.data(), np,
+										 &segHits, hitCnt.data(), ctx);
+		if (segHits.empty())
+			continue;
+		llong  baseId = ctx->m_rowNumVec[i];
+		llong* p = segHits.data();
+		size_t remain = 0;
+		for (size_t k = 0; k < np; ++k) {
+			size_t len = hitCnt[k];
+			llong* q = p;
+			p += len;
+			if (isSnapshot && len) {
+				len = filterSnapshotHits(q, len, baseId, ctx);
+			}
+			if (len >= 2) {
+				std::sort(q, q + len); // don't use std::greater
+				std::reverse(q, q + len); // in descending order
+			}
+			for (size_t j = 0; j < len; ++j) {
+				hits.emplace_back(pending[k], baseId + q[j]);
+			}
+			// unique index hits need not to search older segments
+			if (!isUnique || 0 == len)
+				pending[remain++] = pending[k];
+		}
+		assert(p == segHits.end());
+		pending.risk_set_size(remain);
+	}
+	size_t* offsets = keyOffsets->data();
+	for (auto& x : hits) {
+		offsets[x.first + 1]++;
+	}
+	for (size_t k = 0; k < n; ++k) {
+		offsets[k + 1] += offsets[k];
+	}
+	// pending is reused as insert cursors, hits of same key keep the order
+	pending.assign(offsets, n);
+	recIdvec->resize_no_init(hits.size());
+	for (auto& x : hits) {
+		(*recIdvec)[pending[x.first]++] = x.second;
+	}
+}
+
 // implemented in DfaDbTable
 ///@params recIdvec result of matched record id list
 bool
@@ -2372,7 +3388,22 @@ DbTable::indexInsert(size_t indexId, fstring indexKey, llong id,
 	assert(id >= wrBaseId);
 	llong subId = id - wrBaseId;
 	seg->m_isDirty = true;
-	return wrIndex->insert(indexKey, subId, txn);
+	if (seg == m_wrSeg.get()) {
+		// validated and locked with other writers of m_wrSeg
+		txn->ensureTransactionNoLock();
+		TransactionGuard wrTxn(txn->m_transaction.get());
+		if (!wrTxn.indexInsert(indexId, indexKey, subId)) {
+			wrTxn.rollback();
+			return false;
+		}
+		return wrTxn.commit();
+	}
+	bool ret = wrIndex->insert(indexKey, subId, txn);
+	WritableSegmentPtr wrseg = seg->getWritableSegment();
+	lock.release();
+	if (wrseg)
+		wrseg->commitLog(); // may fdatasync, out of table lock
+	return ret;
 }
 
 bool
@@ -2400,7 +3431,18 @@ DbTable::indexRemove(size_t indexId, fstring indexKey, llong id,
 	assert(id >= wrBaseId);
 	llong subId = id - wrBaseId;
 	seg->m_isDirty = true;
-	return wrIndex->remove(indexKey, subId, ctx);
+	if (seg == m_wrSeg.get()) {
+		ctx->ensureTransactionNoLock();
+		TransactionGuard txn(ctx->m_transaction.get());
+		txn.indexRemove(indexId, indexKey, subId);
+		return txn.commit();
+	}
+	bool ret = wrIndex->remove(indexKey, subId, ctx);
+	WritableSegmentPtr wrseg = seg->getWritableSegment();
+	lock.release();
+	if (wrseg)
+		wrseg->commitLog();
+	return ret;
 }
 
 bool
@@ -2435,7 +3477,22 @@ DbTable::indexUpdate(size_t indexId, fstring indexKey,
 		}
 		lock.upgrade_to_writer();
 		seg->m_isDirty = true;
-		return wrIndex->replace(indexKey, oldSubId, newSubId, ctx);
+		if (seg == m_wrSeg.get()) {
+			ctx->ensureTransactionNoLock();
+			TransactionGuard txn(ctx->m_transaction.get());
+			txn.indexRemove(indexId, indexKey, oldSubId);
+			if (!txn.indexInsert(indexId, indexKey, newSubId)) {
+				txn.rollback();
+				return false;
+			}
+			return txn.commit();
+		}
+		bool ret = wrIndex->replace(indexKey, oldSubId, newSubId, ctx);
+		WritableSegmentPtr wrseg = seg->getWritableSegment();
+		lock.release();
+		if (wrseg)
+			wrseg->commitLog();
+		return ret;
 	}
 	else {
 		auto oldseg = m_segments[oldupp-1].get();
@@ -2449,9 +3506,16 @@ DbTable::indexUpdate(size_t indexId, fstring indexKey,
 			oldseg->m_isDirty = true;
 		}
 		if (newIndex) {
-			ret = oldIndex->insert(indexKey, newSubId, ctx);
+			ret = newIndex->insert(indexKey, newSubId, ctx);
 			newseg->m_isDirty = true;
 		}
+		WritableSegmentPtr oldwrseg = oldIndex ? oldseg->getWritableSegment() : NULL;
+		WritableSegmentPtr newwrseg = newIndex ? newseg->getWritableSegment() : NULL;
+		lock.release();
+		if (oldwrseg)
+			oldwrseg->commitLog();
+		if (newwrseg)
+			newwrseg->commitLog();
 		return ret;
 	}
 }
@@ -2723,6 +3787,9 @@ public:
 		return segIdx;
 	}
 	bool isDeleted(size_t segIdx, llong subId) {
+		if (m_ctx->m_isUserDefineSnapshot) {
+			return !m_ctx->isVisibleInSnapshot(m_segs[segIdx].baseId + subId);
+		}
 		auto seg = m_segs[segIdx].seg.get();
 		if (seg->m_isFreezed) {
 			return seg->m_isDel[subId];
@@ -3004,6 +4071,71 @@ void DbTable::selectOneColgroupNoLock(llong recId, size_t cgId,
 	selectColgroupsNoLock(recId, &cgId, 1, cgData, ctx);
 }
 
+void
+DbTable::selectOneColgroupBatch(const llong* recIds, size_t n, size_t cgId,
+						valvec<byte>* bufs, byte_t* found,
+						fstring* vals, ReadableSegmentPtr* pins,
+						DbContext* ctx)
+const {
+	ctx->trySyncSegCtxSpeculativeLock(this);
+	selectOneColgroupBatchNoLock(recIds, n, cgId, bufs, found, vals, pins, ctx);
+}
+
+void
+DbTable::selectOneColgroupBatchNoLock(const llong* recIds, size_t n, size_t cgId,
+						valvec<byte>* bufs, byte_t* found,
+						fstring* vals, ReadableSegmentPtr* pins,
+						DbContext* ctx)
+const {
+	assert((NULL == vals) == (NULL == pins));
+	if (cgId >= m_schema->getColgroupNum()) {
+		THROW_STD(out_of_range, "cgId = %zd, cgNum = %zd"
+			, cgId, m_schema->getColgroupNum());
+	}
+	valvec<std::pair<llong, size_t> > order(n, valvec_no_init());
+	for (size_t k = 0; k < n; ++k) {
+		order[k] = std::make_pair(recIds[k], k);
+		found[k] = 0;
+		if (vals) {
+			vals[k] = fstring();
+			pins[k] = NULL;
+		}
+	}
+	std::sort(order.begin(), order.end());
+	valvec<llong>   subIds(n, valvec_no_init());
+	valvec<byte_t>  segFound(n, valvec_no_init());
+	valvec<fstring> segVals(vals ? n : 0, valvec_no_init());
+	valvec<valvec<byte> > segBufs(n);
+	const llong rows = ctx->m_rowNumVec.back();
+	size_t i = 0;
+	while (i < n && order[i].first < 0) ++i;
+	while (i < n && order[i].first < rows) {
+		size_t upp = upper_bound_a(ctx->m_rowNumVec, order[i].first);
+		llong baseId = ctx->m_rowNumVec[upp-1];
+		llong endId  = ctx->m_rowNumVec[upp];
+		size_t j = i;
+		for (; j < n && order[j].first < endId; ++j) {
+			subIds[j-i] = order[j].first - baseId;
+		}
+		auto seg = ctx->m_segCtx[upp-1]->seg;
+		size_t np = j - i;
+		seg->selectOneColgroupBatch(subIds.data(), np, cgId, segBufs.data(),
+				segFound.data(), vals ? segVals.data() : NULL, ctx);
+		for (size_t k = 0; k < np; ++k) {
+			size_t idx = order[i+k].second;
+			found[idx] = segFound[k];
+			if (vals && segVals[k].p) {
+				vals[idx] = segVals[k];
+				pins[idx] = seg;
+			}
+			else {
+				bufs[idx].swap(segBufs[k]);
+			}
+		}
+		i = j;
+	}
+}
+
 #if 0
 StoreIteratorPtr
 DbTable::createProjectIterForward(const valvec<size_t>& cols, DbContext* ctx)
@@ -3109,6 +4241,7 @@ class DbTable::MergeParam {
 public:
 	valvec<SegEntry> m_segs;
 	bool   m_forcePurgeAndMerge = false;
+	bool   m_keepDeleted = false; // deleted rows are needed by snapshots
 	size_t m_tabSegNum = 0;
 	size_t m_newSegRows = 0;
 	size_t m_old_segArrayUpdateSeq = 0;
@@ -3238,6 +4371,11 @@ bool DbTable::MergeParam::canMerge(DbTable* tab) {
 		tab->m_isMerging = false;
 		return false;
 	}
+	{
+		// tab->m_isMerging prevents new snapshots from being pinned
+		MyRwLock lock(tab->m_rwMutex, false);
+		m_keepDeleted = tab->isSnapshotPinnedNoLock(tab->m_rowNumVec[m_segs[0].idx]);
+	}
 	m_newSegRows = 0;
 	for (size_t j = 0; j < rngLen; ++j) {
 		m_newSegRows += m_segs[j].seg->m_isDel.size();
@@ -3266,7 +4404,17 @@ void DbTable::MergeParam::syncPurgeBits(double purgeThresholdRatio) {
 		, newSumDelcnt, newIncDelcnt
 		, oldPhysicRows, m_newSegRows
 		, purgeThresholdRatio, purgeThresholdRows);
-	if (m_forcePurgeAndMerge || newIncDelcnt >= purgeThresholdRows) {
+	if (m_keepDeleted) {
+		// don't purge, same as newMarkDelRatio <= purgeThresholdRatio
+		for (auto& e : m_segs) {
+			ColgroupSegment* seg = e.seg;
+			seg->m_updateList.reserve(1024);
+			seg->m_bookUpdates = true;
+			e.newIsPurged = seg->m_isPurged;
+			e.newNumPurged = e.oldNumPurged = seg->m_isPurged.max_rank1();
+		}
+	}
+	else if (m_forcePurgeAndMerge || newIncDelcnt >= purgeThresholdRows) {
 		// all colgroups need purge
 		assert(m_oldpurgeBits.empty());
 		assert(m_newpurgeBits.empty());
@@ -3361,6 +4509,7 @@ mergeIndex(ReadonlySegment* dseg, size_t indexId, DbContext* ctx) {
 	if (strVec.str_size() == 0 && strVec.size() == 0) {
 		return new EmptyIndexStore();
 	}
+	dseg->buildIndexFilter(indexId, strVec);
 	ReadableIndex* index = dseg->buildIndex(schema, strVec);
 #if defined(SLOW_DEBUG_CHECK)
 	valvec<byte> rec2;
@@ -3940,6 +5089,7 @@ try{
 		m_rowNumVec.back() = newRowNumVec.back();
 		m_mergeSeqNum++;
 		m_segArrayUpdateSeq++;
+		publishSegArrayInLock();
 		m_isMerging = false;
 #if defined(SLOW_DEBUG_CHECK)
 		valvec<byte> r1, r2;
@@ -3981,6 +5131,7 @@ try{
 	for (auto& tobeDel : toMerge.m_segs) {
 		tobeDel.seg->deleteSegment();
 	}
+	reclaimSegArrays();
 	fprintf(stderr, "INFO: merge segments:\n%sTo\t%s done!\n"
 		, segPathList.c_str(), destSegDir.string().c_str());
 #if defined(NDEBUG)
@@ -4019,6 +5170,7 @@ void DbTable::checkRowNumVecNoLock() const {
 }
 
 void DbTable::clear() {
+  {
 	MyRwLock lock(m_rwMutex, true);
 	for (size_t i = 0; i < m_segments.size(); ++i) {
 		m_segments[i]->deleteSegment();
@@ -4029,13 +5181,21 @@ void DbTable::clear() {
 	m_wrSeg = nullptr;
 	m_mergeSeqNum++;
 	m_segArrayUpdateSeq++;
-
+	// old segments are deleted when their retired snapshots are reclaimed,
+	// and a running merge writes to the next merge dir, so the new wr
+	// segment must be in a merge dir which no one else uses
+	while (fs::exists(getMergePath(m_dir, m_mergeSeqNum + 1))) {
+		m_mergeSeqNum++;
+	}
 	const size_t segIdx = 0;
 	m_wrSeg = myCreateWritableSegment(getSegPath("wr", segIdx));
 	m_segments.push_back(m_wrSeg);
 	m_rowNumVec.push_back(0);
 	m_rowNumVec.push_back(0);
 	m_rowNum = 0;
+	publishSegArrayInLock();
+  }
+	reclaimSegArrays();
 }
 
 void DbTable::flush() {
@@ -4130,6 +5290,207 @@ void DbTable::compact() {
 	}
 }
 
+/// Rows of iter are built into new readonly segments directly, bypassing
+/// the writable segment, each new segment holds about
+/// m_maxWritingSegmentSize bytes of rows. The segments are built without
+/// lock, and are attached to the table in one write lock.
+/// Keys of unique indices are checked against each other and against live
+/// rows of the table, a duplicate key fails the whole load.
+///@returns number of loaded rows
+llong DbTable::bulkLoad(StoreIterator& iter) {
+	if (!m_wrSeg) {
+		THROW_STD(invalid_argument, "writing was finished: %s"
+			, m_dir.string().c_str());
+	}
+	fs::path stageDir = fs::unique_path(m_dir / "bulkload-%%%%-%%%%");
+	fs::create_directories(stageDir);
+	BOOST_SCOPE_EXIT(&stageDir) {
+		try { fs::remove_all(stageDir); }
+		catch (const std::exception& ex) {
+			fprintf(stderr, "ERROR: remove %s: ex.what = %s\n"
+				, stageDir.string().c_str(), ex.what());
+		}
+	} BOOST_SCOPE_EXIT_END;
+	valvec<ReadonlySegmentPtr> newSegs;
+	valvec<SortableStrVec> uniqKeys(m_schema->m_uniqIndices.size());
+	llong rows = 0;
+	for (;;) {
+		char szBuf[32];
+		snprintf(szBuf, sizeof(szBuf), "rd-%04zd", newSegs.size());
+		ReadonlySegmentPtr seg = myCreateReadonlySegment(stageDir / szBuf);
+		llong n = seg->bulkBuildFrom(iter, m_schema->m_maxWritingSegmentSize, &uniqKeys);
+		if (0 == n)
+			break;
+		rows += n;
+		newSegs.push_back(seg);
+	}
+	if (newSegs.empty()) {
+		return 0;
+	}
+	valvec<fstring> keys;
+	for (size_t i = 0; i < uniqKeys.size(); ++i) {
+		const Schema& schema = m_schema->getIndexSchema(m_schema->m_uniqIndices[i]);
+		SortableStrVec& sv = uniqKeys[i];
+		sv.sort();
+		for (size_t j = 1; j < sv.size(); ++j) {
+			if (sv[j-1] == sv[j])
+				THROW_STD(invalid_argument, "bulkLoad: DupKey=%s in loaded rows: %s"
+					, schema.toJsonStr(sv[j]).c_str(), m_dir.string().c_str());
+		}
+	}
+	profiling pf;
+	llong t0 = pf.now();
+	llong t1 = t0;
+	MyRwLock lock(m_rwMutex, true);
+	// merging and in progress writing rely on current segment indices
+	while (m_isMerging || m_inprogressWritingCount > 0) {
+		lock.release();
+		tbb::this_tbb_thread::sleep(tbb::tick_count::interval_t(0.05));
+		llong t2 = pf.now();
+		if (pf.ms(t1, t2) > 10000) { // 10 seconds
+			fprintf(stderr, "INFO: bulkLoad wait for merging or writing: %s, %f seconds\n"
+				, m_dir.string().c_str(), pf.sf(t0, t2));
+			t1 = t2;
+		}
+		lock.acquire(m_rwMutex, true);
+	}
+	DebugCheckRowNumVecNoLock(this);
+	if (!m_wrSeg) {
+		THROW_STD(invalid_argument, "writing was finished: %s"
+			, m_dir.string().c_str());
+	}
+	// no writer is in progress, so the check is not raced
+	if (!uniqKeys.empty()) {
+		DbContextPtr ctx(createDbContextNoLock());
+		ctx->trySyncSegCtxNoLock(this);
+		valvec<llong>  recIdvec;
+		valvec<size_t> keyOffsets;
+		for (size_t i = 0; i < uniqKeys.size(); ++i) {
+			size_t indexId = m_schema->m_uniqIndices[i];
+			SortableStrVec& sv = uniqKeys[i];
+			keys.resize_no_init(sv.size());
+			for (size_t j = 0; j < sv.size(); ++j)
+				keys[j] = sv[j];
+			indexSearchExactBatchNoLock(indexId, keys.data(), keys.size(),
+										&recIdvec, &keyOffsets, ctx.get());
+			for (size_t j = 0; j < keys.size(); ++j) {
+				if (keyOffsets[j] != keyOffsets[j+1])
+					THROW_STD(invalid_argument, "bulkLoad: DupKey=%s in table: %s"
+						, m_schema->getIndexSchema(indexId).toJsonStr(keys[j]).c_str()
+						, m_dir.string().c_str());
+			}
+		}
+	}
+	// the new segments are put after the frozen or removed empty m_wrSeg,
+	// then a new m_wrSeg follows them
+	const bool wrSegIsEmpty = m_wrSeg->m_isDel.size() == 0;
+	if (m_segments.size() + newSegs.size() + !wrSegIsEmpty > m_segments.capacity()) {
+		THROW_STD(invalid_argument,
+			"Reaching maxSegNum=%d", int(m_segments.capacity()));
+	}
+	assert(m_segments.back() == m_wrSeg);
+	if (wrSegIsEmpty) {
+		m_wrSeg->deleteSegment();
+		m_segments.pop_back();
+		m_rowNumVec.pop_back();
+	}
+	else {
+		freezeWritableSegmentInLock();
+	}
+	m_wrSeg = nullptr;
+	for (auto& seg : newSegs) {
+		auto segDir = getSegPath("rd", m_segments.size());
+		fs::rename(seg->m_segDir, segDir);
+		seg->m_segDir = segDir;
+		m_segments.push_back(seg.get());
+		m_rowNumVec.push_back(m_rowNumVec.back() + seg->m_isDel.size());
+	}
+	m_rowNum = m_rowNumVec.back();
+	m_wrSeg = myCreateWritableSegment(getSegPath("wr", m_segments.size()));
+	m_segments.push_back(m_wrSeg);
+	m_rowNumVec.push_back(m_rowNum);
+	m_segArrayUpdateSeq++;
+	publishSegArrayInLock();
+	DebugCheckRowNumVecNoLock(this);
+	if (!m_isMerging && 0 == m_bgTaskNum) {
+		inLockPutMergeTaskToQueue();
+	}
+	return rows;
+}
+
+/// rows visible to ctx are kept by the segments until unpinSnapshot, see
+/// isSnapshotPinnedNoLock, merging and purging keep rows which are live when
+/// they start, so they need not be waited. m_wrSeg is not frozen here, it is
+/// frozen before its pinned rows are changed, see tryFreezePinnedWrSegInLock
+void DbTable::pinSnapshot(DbContext* ctx) {
+	if (ctx->m_isUserDefineSnapshot) {
+		THROW_STD(invalid_argument, "ctx is already pinned to a snapshot");
+	}
+	SnapshotDelMarksPtr marks(new SnapshotDelMarks());
+	MyRwLock lock(m_rwMutex, true);
+	// writers apply a row change in one read lock, so no change is
+	// partially visible, marks of frozen segments are mostly shared
+	marks->m_rowNumVec.assign(m_rowNumVec);
+	marks->m_segMarks.resize(m_segments.size());
+	for (size_t i = 0; i < m_segments.size(); ++i) {
+		marks->m_segMarks[i] = m_segments[i]->snapshotDelMarks();
+	}
+	assert(marks->m_rowNumVec.back() == m_rowNum);
+	ctx->trySyncSegCtxNoLock(this);
+	ctx->m_snapshotDelMarks.swap(marks);
+	ctx->m_mySnapshotVersion = m_rowNum - 1;
+	ctx->m_isUserDefineSnapshot = true;
+	auto& vers = m_snapshotVersions;
+	vers.insert(upper_bound_a(vers, ctx->m_mySnapshotVersion),
+				ctx->m_mySnapshotVersion);
+	m_oldestSnapshotVersion = vers[0];
+}
+
+/// DbContext is not thread safe, readers of a snapshot in different threads
+/// should use different DbContext objects which share the delete marks
+void DbTable::pinSnapshot(DbContext* ctx, const DbContext* pinned) {
+	if (ctx->m_isUserDefineSnapshot) {
+		THROW_STD(invalid_argument, "ctx is already pinned to a snapshot");
+	}
+	if (!pinned->m_isUserDefineSnapshot) {
+		THROW_STD(invalid_argument, "pinned is not pinned to a snapshot");
+	}
+	MyRwLock lock(m_rwMutex, true);
+	ctx->trySyncSegCtxNoLock(this);
+	ctx->m_snapshotDelMarks = pinned->m_snapshotDelMarks;
+	ctx->m_mySnapshotVersion = pinned->m_mySnapshotVersion;
+	ctx->m_isUserDefineSnapshot = true;
+	auto& vers = m_snapshotVersions;
+	vers.insert(upper_bound_a(vers, ctx->m_mySnapshotVersion),
+				ctx->m_mySnapshotVersion);
+	m_oldestSnapshotVersion = vers[0];
+}
+
+void DbTable::unpinSnapshot(DbContext* ctx) {
+	if (!ctx->m_isUserDefineSnapshot) {
+		return;
+	}
+	MyRwLock lock(m_rwMutex, true);
+	auto& vers = m_snapshotVersions;
+	size_t idx = lower_bound_a(vers, ctx->m_mySnapshotVersion);
+	assert(idx < vers.size());
+	assert(vers[idx] == ctx->m_mySnapshotVersion);
+	vers.erase_i(idx, 1);
+	m_oldestSnapshotVersion = vers.empty() ? LLONG_MAX : vers[0];
+	ctx->m_isUserDefineSnapshot = false;
+	ctx->m_snapshotDelMarks.reset();
+	ctx->m_mySnapshotVersion = m_rowNum - 1;
+}
+
+/// deleted rows of segment which start at baseId must not be purged when
+/// returns true, because they may be visible to a pinned snapshot
+bool DbTable::isSnapshotPinnedNoLock(llong baseId) const {
+	if (LLONG_MAX == m_oldestSnapshotVersion) {
+		return false;
+	}
+	return m_snapshotVersions.back() >= baseId;
+}
+
 void DbTable::syncFinishWriting() {
 	m_wrSeg = nullptr; // can't write anymore
 	waitForBackgroundTasks(m_rwMutex, m_bgTaskNum);
@@ -4155,6 +5516,7 @@ void DbTable::asyncPurgeDelete() {
 
 void DbTable::dropTable() {
 	assert(!m_dir.empty());
+	cancelBgTasks();
 	for (auto& seg : m_segments) {
 		seg->deleteSegment();
 	}
@@ -4246,6 +5608,7 @@ void DbTable::convWritableSegmentToReadonly(size_t segIdx) {
 	fprintf(stderr, "INFO: convWritableSegmentToReadonly: %s\n", segDir.string().c_str());
 	ReadonlySegmentPtr newSeg = myCreateReadonlySegment(segDir);
 	newSeg->convFrom(this, segIdx);
+	reclaimSegArrays();
 	fprintf(stderr, "INFO: convWritableSegmentToReadonly: %s done!\n", segDir.string().c_str());
 #if 0
 	fs::path wrSegPath = getSegPath("wr", segIdx);
@@ -4279,10 +5642,10 @@ void DbTable::convWritableSegmentToReadonly(size_t segIdx) {
 		return;
 	}
   }
-  MergeParam toMerge;
-  if (toMerge.canMerge(this)) {
-	  assert(this->m_isMerging);
-	  this->merge(toMerge);
+  // merge is the least urgent, run it as a separated task
+  MyRwLock lock(m_rwMutex, true);
+  if (!this->m_isMerging && 1 == m_bgTaskNum) {
+	  inLockPutMergeTaskToQueue();
   }
 }
 
@@ -4341,6 +5704,8 @@ void DbTable::runPurgeDelete() {
 		MyRwLock lock(m_rwMutex, false);
 		auto segs = m_segments.data();
 		for (size_t i = 0, n = m_segments.size(); i < n; ++i) {
+			if (isSnapshotPinnedNoLock(m_rowNumVec[i]))
+				continue;
 			if (auto r = segs[i]->getReadonlySegment()) {
 				size_t newDelcnt = r->m_delcnt - r->m_isPurged.max_rank1();
 				size_t physicNum = r->getPhysicRows();
@@ -4358,6 +5723,7 @@ void DbTable::runPurgeDelete() {
 	try {
 		ReadonlySegmentPtr dest = myCreateReadonlySegment(srcSeg->m_segDir);
 		dest->purgeDeletedRecords(this, segIdx);
+		reclaimSegArrays();
 	}
 	catch (const std::exception&) {
 		//break; // would try in merge()
@@ -4368,113 +5734,110 @@ void DbTable::runPurgeDelete() {
 
 namespace anonymousForDebugMSVC {
 
-class MyTask : public RefCounter {
-public:
-	virtual void execute() = 0;
-};
-typedef boost::intrusive_ptr<MyTask> MyTaskPtr;
 std::mutex g_mutexForStop;
-terark::util::concurrent_queue<std::deque<MyTaskPtr> > g_flushQueue;
-terark::util::concurrent_queue<std::deque<MyTaskPtr> > g_compressQueue;
 
 volatile bool g_stopPutToFlushQueue = false;
 volatile bool g_stopCompress = false;
-volatile bool g_flushStopped = false;
-
-void FlushThreadFunc() {
-	while (true) {
-		MyTaskPtr t;
-		while (g_flushQueue.pop_front(t, 100)) {
-			if (t)
-				t->execute();
-			else // must only one flush thread
-				goto Done; // nullptr is stop notifier
-		}
-	}
-Done:
-	assert(g_flushQueue.empty());
-	g_flushStopped = true;
-	fprintf(stderr, "INFO: flushing thread completed!\n");
-}
-
-void CompressThreadFunc() {
-	while (!g_flushStopped && !g_stopCompress) {
-		MyTaskPtr t;
-		while (!g_stopCompress && g_compressQueue.pop_front(t, 100)) {
-			if (g_stopCompress)
-				break;
-			t->execute();
-		}
-	}
-}
 
-class CompressionThreadsList : private std::vector<tbb::tbb_thread*> {
+class TableBgTaskScheduler : public BgTaskScheduler {
 public:
-	CompressionThreadsList() {
-		size_t cpu = tbb::tbb_thread::hardware_concurrency();
-		size_t cfg = getEnvLong("TerarkDB_CompressionThreadsNum", 0);
-		size_t num = cfg ? min(cpu, cfg) : min<size_t>(cpu, 4);
-		this->resize(num);
-		for (size_t i = 0; i < num; ++i) {
-			(*this)[i] = new tbb::tbb_thread(&CompressThreadFunc);
-		}
-	}
-	~CompressionThreadsList() {
-		if (!this->empty())
+	// one more worker which only runs flush tasks
+	TableBgTaskScheduler()
+	  : BgTaskScheduler(DbTable::getCompressionThreadsNum() + 1) {}
+	~TableBgTaskScheduler() {
+		if (!this->isStopped())
 			DbTable::safeStopAndWaitForFlush();
 	}
-	void join() {
-		for (auto& th : *this) {
-			th->join();
-			delete th;
-			th = NULL;
-		}
-		fprintf(stderr, "INFO: compression threads(%zd) completed!\n", this->size());
-		this->clear();
-		g_compressQueue.clearQueue();
-	}
 };
-tbb::tbb_thread g_flushThread(&FlushThreadFunc);
-CompressionThreadsList g_compressThreads;
+TableBgTaskScheduler g_bgTaskScheduler;
 
-class SegWrToRdConvTask : public MyTask {
+class TableBgTask : public BgTask {
+protected:
 	DbTablePtr m_tab;
+	TableBgTask(Priority prio, DbTable* tab) : BgTask(prio, tab), m_tab(tab) {}
+	void cancel() override {
+		MyRwLock lock(m_tab->m_rwMutex, true);
+		m_tab->onBgTaskCanceledInLock(m_priority);
+	}
+};
+
+class SegWrToRdConvTask : public TableBgTask {
 	size_t m_segIdx;
 
 public:
-	SegWrToRdConvTask(DbTablePtr tab, size_t segIdx)
-		: m_tab(tab), m_segIdx(segIdx) {}
+	SegWrToRdConvTask(DbTable* tab, size_t segIdx)
+		: TableBgTask(Compress, tab), m_segIdx(segIdx) {}
 
 	void execute() override {
 		m_tab->convWritableSegmentToReadonly(m_segIdx);
 	}
 };
 
-class PurgeDeleteTask : public MyTask {
-	DbTablePtr m_tab;
+class PurgeDeleteTask : public TableBgTask {
 public:
 	void execute() override {
 		m_tab->runPurgeDelete();
 	}
-	PurgeDeleteTask(DbTablePtr tab) : m_tab(tab) {}
+	PurgeDeleteTask(DbTable* tab) : TableBgTask(Purge, tab) {}
 };
 
-class WrSegFreezeFlushTask : public MyTask {
-	DbTablePtr m_tab;
+class MergeTask : public TableBgTask {
+public:
+	void execute() override {
+		m_tab->runMerge();
+	}
+	MergeTask(DbTable* tab) : TableBgTask(Merge, tab) {}
+};
+
+class WrSegFreezeFlushTask : public TableBgTask {
 	size_t m_segIdx;
 public:
-	WrSegFreezeFlushTask(DbTablePtr tab, size_t segIdx)
-		: m_tab(tab), m_segIdx(segIdx) {}
+	WrSegFreezeFlushTask(DbTable* tab, size_t segIdx)
+		: TableBgTask(Flush, tab), m_segIdx(segIdx) {}
 
 	void execute() override {
 		m_tab->freezeFlushWritableSegment(m_segIdx);
-		g_compressQueue.push_back(new SegWrToRdConvTask(m_tab, m_segIdx));
+		// m_bgTaskNum is decreased by SegWrToRdConvTask
+		if (!g_bgTaskScheduler.submit(new SegWrToRdConvTask(m_tab.get(), m_segIdx))) {
+			MyRwLock lock(m_tab->m_rwMutex, true);
+			m_tab->onBgTaskCanceledInLock(Compress);
+		}
 	}
 };
 
 } // namespace
 using namespace anonymousForDebugMSVC;
 
+size_t DbTable::getCompressionThreadsNum() {
+	static const size_t num = []() {
+		size_t cpu = tbb::tbb_thread::hardware_concurrency();
+		size_t cfg = getEnvLong("TerarkDB_CompressionThreadsNum", 0);
+		return cfg ? min(cpu, cfg) : min<size_t>(cpu, 4);
+	}();
+	return num;
+}
+
+void DbTable::getBgTaskStats(BgTaskStats* st) {
+	g_bgTaskScheduler.getStats(st);
+}
+
+bool DbTable::submitBgTask(BgTask* task) {
+	return g_bgTaskScheduler.submit(task);
+}
+
+size_t DbTable::cancelBgTasks() {
+	return g_bgTaskScheduler.cancel(this);
+}
+
+void DbTable::onBgTaskCanceledInLock(BgTask::Priority prio) {
+	if (BgTask::Purge == prio) {
+		assert(PurgeStatus::inqueue == m_purgeStatus);
+		m_purgeStatus = PurgeStatus::none;
+	}
+	assert(m_bgTaskNum > 0);
+	m_bgTaskNum--;
+}
+
 void DbTable::putToFlushQueue(size_t segIdx) {
 	assert(!g_stopPutToFlushQueue);
 	if (g_stopPutToFlushQueue) {
@@ -4483,8 +5846,10 @@ void DbTable::putToFlushQueue(size_t segIdx) {
 	assert(segIdx < m_segments.size());
 	assert(m_segments[segIdx]->m_isDel.size() > 0);
 	assert(m_segments[segIdx]->getWritableStore() != nullptr);
-	g_flushQueue.push_back(new WrSegFreezeFlushTask(this, segIdx));
 	m_bgTaskNum++;
+	// we are in write lock, a dropped task must not call cancel()
+	if (!g_bgTaskScheduler.submit(new WrSegFreezeFlushTask(this, segIdx)))
+		onBgTaskCanceledInLock(BgTask::Flush);
 }
 
 void DbTable::putToCompressionQueue(size_t segIdx) {
@@ -4494,8 +5859,30 @@ void DbTable::putToCompressionQueue(size_t segIdx) {
 	if (g_stopCompress) {
 		return;
 	}
-	g_compressQueue.push_back(new SegWrToRdConvTask(this, segIdx));
 	m_bgTaskNum++;
+	if (!g_bgTaskScheduler.submit(new SegWrToRdConvTask(this, segIdx)))
+		onBgTaskCanceledInLock(BgTask::Compress);
+}
+
+void DbTable::inLockPutMergeTaskToQueue() {
+	if (g_stopCompress) {
+		return;
+	}
+	m_bgTaskNum++;
+	if (!g_bgTaskScheduler.submit(new MergeTask(this)))
+		onBgTaskCanceledInLock(BgTask::Merge);
+}
+
+void DbTable::runMerge() {
+	BOOST_SCOPE_EXIT(&m_rwMutex, &m_bgTaskNum){
+		MyRwLock lock(m_rwMutex, true);
+		m_bgTaskNum--;
+	}BOOST_SCOPE_EXIT_END;
+	MergeParam toMerge;
+	if (toMerge.canMerge(this)) {
+		assert(this->m_isMerging);
+		this->merge(toMerge);
+	}
 }
 
 inline
@@ -4551,8 +5938,9 @@ void DbTable::inLockPutPurgeDeleteTaskToQueue() {
 		return;
 	}
 	m_purgeStatus = PurgeStatus::inqueue;
-	g_compressQueue.push_back(new PurgeDeleteTask(this));
 	m_bgTaskNum++;
+	if (!g_bgTaskScheduler.submit(new PurgeDeleteTask(this)))
+		onBgTaskCanceledInLock(BgTask::Purge);
 }
 
 // flush is the most urgent
@@ -4563,12 +5951,8 @@ void DbTable::safeStopAndWaitForFlush() {
 	}
 	g_stopPutToFlushQueue = true;
 	g_stopCompress = true;
-	g_flushQueue.push_back(nullptr); // notify and stop flag
-	g_flushThread.join();
-	assert(g_flushStopped);
-	g_compressThreads.join();
-	assert(g_flushQueue.empty());
-	assert(g_compressQueue.empty());
+	// queued and later submitted non-flush tasks are canceled
+	g_bgTaskScheduler.stopAndWait(BgTask::Flush);
 }
 
 void DbTable::safeStopAndWaitForCompress() {
@@ -4577,11 +5961,9 @@ void DbTable::safeStopAndWaitForCompress() {
 		return;
 	}
 	g_stopPutToFlushQueue = true;
-	g_flushQueue.push_back(nullptr); // notify and stop flag
-	g_flushThread.join();
-	g_compressThreads.join();
-	assert(g_flushQueue.empty());
-	assert(g_compressQueue.empty());
+	// run all queued tasks and tasks submitted by them, such as
+	// compressions after flushing and merges after compressions
+	g_bgTaskScheduler.stopAndWait(BgTask::Merge);
 }
 
 /*
@@ -3,9 +3,13 @@
 
 #include "db_store.hpp"
 #include "db_index.hpp"
+#include "bg_task_scheduler.hpp"
+#include <terark/util/sortable_strvec.hpp>
 #include <tbb/queuing_rw_mutex.h>
 //#include <tbb/spin_rw_mutex.h>
 #include <atomic>
+#include <deque>
+#include <mutex>
 
 #if defined(TBB_VERSION_MAJOR)
 	#if TBB_VERSION_MAJOR * 1000 + TBB_VERSION_MINOR < 4004
@@ -39,26 +43,59 @@ typedef IncrementGuard<std::atomic_size_t> IncrementGuard_size_t;
 class TERARK_DB_DLL ReadableSegment;
 class TERARK_DB_DLL ReadonlySegment;
 class TERARK_DB_DLL WritableSegment;
+class TERARK_DB_DLL RecordCache;
 typedef boost::intrusive_ptr<ReadableSegment> ReadableSegmentPtr;
 typedef boost::intrusive_ptr<WritableSegment> WritableSegmentPtr;
 
-// Now BatchWriter is supported only when table has at most one unique index
+/// Immutable copy of the segment array, DbTable publishes a new one on each
+/// structural change, readers access it lock free by SegArrayReadGuard
+struct SegArraySnapshot {
+	valvec<ReadableSegmentPtr> m_segments;
+	valvec<llong>    m_rowNumVec;
+	WritableSegment* m_wrSeg;
+	size_t           m_updateSeq;
+};
+
+/// Rows are stored and get their record ids on upsertRow, index keys are
+/// buffered and inserted on commit in sorted key order of each index.
+/// The first unique index is the upsert key, other unique indices are
+/// checked for duplicate keys against the table and rows in the batch.
 class TERARK_DB_DLL BatchWriter {
 	DECLARE_NONE_COPYABLE_CLASS(BatchWriter);
 protected:
 	DbContextPtr     m_ctx;
 	WritableSegment* m_wrSeg; // for debug only
 	DbTransaction*   m_txn; // for debug only
-	llong overwriteExisting(fstring row);
-	llong upsertRowImpl(fstring row);
+	std::string      m_errMsg;
+	// a row version in the batch, an upsert of a key which is already
+	// in the batch makes the previous version dead
+	valvec<uint32_t> m_pendingSubId; // [version]
+	febitvec         m_pendingDead;  // [version]
+	valvec<SortableStrVec> m_pendingKeys; // [indexId][version]
+	hash_strmap<size_t>    m_pendingUniq; // (uniqIdx,key) -> version
+	gold_hash_set<llong>   m_removedInBatch; // same as txn->m_removeOnCommit
+	llong m_minInPlaceSubId; // min subId overwritten or removed in m_wrSeg
+	bool  checkUniqueDup(size_t uniqIdx, llong replacedRecId);
+	bool  removeWrSegIndices(llong subId);
+	bool  insertPendingIndices();
+	void  clearPending();
 public:
 	explicit BatchWriter(DbTable* tab, DbContext* ctx = NULL);
 	~BatchWriter();
 	DbContext* getCtx() const { return m_ctx.get(); }
 	const std::string& strError() const;
 	const char* szError() const;
+	///@returns -1 on duplicate key in a unique index other than the first
 	llong upsertRow(fstring row);
+	/// insert rows[0,n), ids of the rows are allocated in one table lock
+	///@returns number of rows inserted, if it is less than n, rows[ret]
+	///         has a duplicate key in a unique index, see strError()
+	size_t insertRows(const fstring* rows, size_t n, llong* recIds);
 	void  removeRow(llong recId);
+	/// throws NeedRetryException if a concurrent transaction has inserted
+	/// a key which is unique and in this batch, or a row overwritten or
+	/// removed in the writing segment is visible to a pinned snapshot, the
+	/// batch is rolled back
 	bool  commit();
 	void  rollback();
 };
@@ -69,6 +106,8 @@ class TERARK_DB_DLL DbTable : public ReadableStore {
 	class MyStoreIterBase;	    friend class MyStoreIterBase;
 	class MyStoreIterForward;	friend class MyStoreIterForward;
 	class MyStoreIterBackward;	friend class MyStoreIterBackward;
+	class MyStoreIterRange;		friend class MyStoreIterRange;
+	class MyStoreIterRandom;	friend class MyStoreIterRandom;
 public:
 	DbTable();
 	~DbTable();
@@ -80,6 +119,20 @@ public:
 
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
+	/// batch scan of colgroup cgId with pushed down predicates
+	class ColgroupScanner* createColgroupScanner(size_t cgId, DbContext*) const;
+
+	/// iterate rows visible to ctx whose ids are in [beginId, endId)
+	StoreIterator* createStoreIterRange(llong beginId, llong endId, DbContext*) const;
+	/// split ids of rows visible to ctx into at most nParts ranges, part i
+	/// is [bounds[i], bounds[i+1]), bounds are snapped to near segment ends
+	void getParallelScanBounds(size_t nParts, valvec<llong>* bounds, DbContext* = NULL) const;
+	/// range iterators for multi-thread scan, each part has its own context,
+	/// which is pinned to the snapshot of ctx if ctx is pinned
+	valvec<StoreIteratorPtr> createParallelScan(size_t nParts, DbContext* = NULL) const;
+	/// each increment returns a random row visible to ctx, rows are picked
+	/// with replacement, increment returns false only if no row is visible
+	StoreIterator* createRandomIter(DbContext*) const;
 	DbContext* createDbContext() const;
 	virtual DbContext* createDbContextNoLock() const;
 
@@ -158,6 +211,15 @@ public:
 	void indexSearchExactNoLock(size_t indexId, fstring key, valvec<llong>* recIdvec, DbContext*) const;
 	bool indexKeyExistsNoLock(size_t indexId, fstring key, DbContext*) const;
 
+	///@param keyOffsets recId of keys[i] are in
+	///       recIdvec[keyOffsets[i], keyOffsets[i+1]), keyOffsets->size() == n+1
+	void indexSearchExactBatch(size_t indexId, const fstring* keys, size_t n,
+							   valvec<llong>* recIdvec, valvec<size_t>* keyOffsets,
+							   DbContext*) const;
+	void indexSearchExactBatchNoLock(size_t indexId, const fstring* keys, size_t n,
+							   valvec<llong>* recIdvec, valvec<size_t>* keyOffsets,
+							   DbContext*) const;
+
 	bool indexMatchRegex(size_t indexId, RegexForIndex*, valvec<llong>* recIdvec, DbContext*) const;
 
 	bool indexInsert(size_t indexId, fstring indexKey, llong id, DbContext*);
@@ -188,6 +250,18 @@ public:
 
 	void selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData, DbContext*) const;
 
+	/// read colgroup cgId of many records, records are grouped by segment
+	/// and each segment is accessed once with its records in id order
+	///@param found found[i] is 0 if recIds[i] is invalid or deleted
+	///@param vals  if not NULL, values stored uncompressed in memory are
+	///             referenced by vals[i] without copy, and pins[i] is set to
+	///             the segment which holds vals[i], the caller should keep
+	///             pins[i] while using vals[i]. For a copied value, vals[i].p
+	///             is NULL and pins[i] is NULL, the value is in bufs[i]
+	void selectOneColgroupBatch(const llong* recIds, size_t n, size_t cgId,
+						valvec<byte>* bufs, byte_t* found,
+						fstring* vals, ReadableSegmentPtr* pins, DbContext*) const;
+
 protected:
 	void selectColumnsNoLock(llong id, const valvec<size_t>& cols,
 					   valvec<byte>* colsData, DbContext*) const;
@@ -203,6 +277,10 @@ protected:
 
 	void selectOneColgroupNoLock(llong id, size_t cgId, valvec<byte>* cgData, DbContext*) const;
 
+	void selectOneColgroupBatchNoLock(const llong* recIds, size_t n, size_t cgId,
+						valvec<byte>* bufs, byte_t* found,
+						fstring* vals, ReadableSegmentPtr* pins, DbContext*) const;
+
 #if 0
 	StoreIteratorPtr
 	createProjectIterForward(const valvec<size_t>& cols, DbContext*)
@@ -223,6 +301,15 @@ public:
 	void clear();
 	void flush();
 	void compact();
+	llong bulkLoad(StoreIterator& rowIter);
+
+	/// pin ctx to the current table view: rows inserted later are invisible
+	/// to ctx, rows deleted later are still visible to ctx, until unpinned
+	void pinSnapshot(DbContext* ctx);
+	/// pin ctx to the same snapshot as the already pinned one
+	void pinSnapshot(DbContext* ctx, const DbContext* pinned);
+	void unpinSnapshot(DbContext* ctx);
+	bool isSnapshotPinnedNoLock(llong baseId) const;
 	void syncFinishWriting();
 	void asyncPurgeDelete();
 
@@ -246,10 +333,16 @@ public:
 	void convWritableSegmentToReadonly(size_t segIdx);
 	void freezeFlushWritableSegment(size_t segIdx);
 	void runPurgeDelete();
+	void runMerge();
 	void putToFlushQueue(size_t segIdx);
 	void putToCompressionQueue(size_t segIdx);
+	void onBgTaskCanceledInLock(BgTask::Priority);
 	///@}
 
+	/// row cache of ReadonlySegment::getValueAppend, NULL if dbmeta.json
+	/// "RowCacheBytes" is 0 (the default)
+	const RecordCache* getRowCache() const { return m_rowCache.get(); }
+
 	///@{
 	void delmarkSet0(llong id);
 	void delmarkSet1(llong id); ///< set del but do not put to free list
@@ -259,6 +352,21 @@ public:
 	static void safeStopAndWaitForFlush();
 	static void safeStopAndWaitForCompress();
 
+	/// TerarkDB_CompressionThreadsNum, also caps the threads used by
+	/// parallel building inside one segment compression
+	static size_t getCompressionThreadsNum();
+
+	/// stats of background tasks of all tables
+	static void getBgTaskStats(BgTaskStats*);
+	/// run a background task of other components, such as checkpoints of
+	/// writable segments, by the scheduler of tables
+	///@returns false if the task is dropped, see BgTaskScheduler::submit
+	static bool submitBgTask(BgTask*);
+
+	/// cancel queued background tasks of this table
+	///@returns number of canceled tasks
+	size_t cancelBgTasks();
+
 protected:
 	static void registerTableClass(fstring tableClass, std::function<DbTable*()> tableFactory);
 
@@ -271,7 +379,11 @@ protected:
 	bool maybeCreateNewSegment(MyRwLock&);
 	void maybeCreateNewSegmentInWriteLock();
 	void doCreateNewSegmentInLock();
+	void freezeWritableSegmentInLock();
+	bool wrSegNeedFreezeNoLock() const;
+	bool tryFreezePinnedWrSegInLock();
 	llong insertRowImpl(fstring row, DbContext*, MyRwLock&);
+	llong insertRowInLock(fstring row, DbContext*);
 	llong insertRowDoInsert(fstring row, DbContext*);
 	llong insertRowDoInsertNoCommit(fstring row, DbContext*);
 	bool insertSyncIndex(llong subId, DbTransaction*, DbContext*);
@@ -280,6 +392,13 @@ protected:
 	void updateSyncMultIndex(llong newSubId, DbTransaction*, DbContext*);
 
 	llong doUpsertRow(fstring row, DbContext*);
+	llong doUpsertRowInLock(fstring row, DbContext*, bool* needPurge, bool* needFreeze);
+	llong upsertOverwriteFrozenRow(ReadableSegment*, llong subId, fstring row, DbContext*);
+	llong upsertInWrSegInLock(fstring row, DbContext*, bool* needFreeze);
+
+	struct GroupCommitWriter;
+	llong groupCommitWrite(fstring row, DbContext*, bool isUpsert);
+	void  groupCommitApply(GroupCommitWriter** group, size_t num);
 
 	llong allocInvisibleWrSubId_NoTabLock();
 	void freeInvisibleWrSubId_NoTabLock(llong wrSubId);
@@ -299,12 +418,17 @@ protected:
 	bool tryAsyncPurgeDeleteInLock(const ReadableSegment* seg);
 	void asyncPurgeDeleteInLock();
 	void inLockPutPurgeDeleteTaskToQueue();
+	void inLockPutMergeTaskToQueue();
 
 //	void registerDbContext(DbContext* ctx) const;
 //	void unregisterDbContext(DbContext* ctx) const;
 
 	size_t throttleWrite();
 
+	void publishSegArrayInLock();
+	bool advanceSegArrayEpochNoLock(valvec<SegArraySnapshot*>* freeList);
+	void reclaimSegArrays(bool tryLock = false);
+
 public:
 	mutable MyRwMutex m_rwMutex;
 	mutable size_t m_tableScanningRefCount;
@@ -325,28 +449,73 @@ protected:
 	size_t m_newWrSegNum;
 	size_t m_bgTaskNum;
 	size_t m_segArrayUpdateSeq;
+	std::atomic<SegArraySnapshot*> m_segArraySnapshot;
+	struct SegArrayReaderCount {
+		std::atomic_size_t cnt;
+		char padding[64 - sizeof(std::atomic_size_t)]; // avoid false sharing
+	};
+	static const size_t SegArrayReaderStripes = 16;
+	// readers enter the counters of m_segArrayEpoch's parity, a retired
+	// snapshot is freed after two epoch flips, each of which waits for
+	// the readers of the previous parity to be drained
+	std::atomic_size_t m_segArrayEpoch;
+	mutable SegArrayReaderCount m_segArrayReaders[2][SegArrayReaderStripes];
+	std::mutex m_retiredSegArraysMutex;
+	valvec<SegArraySnapshot*> m_retiredSegArrays[2]; // in m_retiredSegArraysMutex
+	std::atomic_bool m_hasRetiredSegArrays;
 	llong  m_rowNum;
-	llong  m_oldestSnapshotVersion;
+	llong  m_oldestSnapshotVersion; // LLONG_MAX if no pinned snapshot
+	valvec<llong> m_snapshotVersions; // pinned, sorted
 	std::atomic<ullong> m_lastWriteThrottleTimePoint;
 	std::atomic<ullong> m_lastWriteThrottleBytes;
 	std::atomic<ullong> m_accumulateWrittenBytes;
 	bool m_throwOnThrottle;
 	bool m_tobeDrop;
 	bool m_isMerging;
+	// a writer could not freeze m_wrSeg which has rows pinned by a snapshot
+	std::atomic_bool m_wrSegFreezeRequested;
 	PurgeStatus m_purgeStatus;
 
+	// writers waiting for group commit, front is the leader
+	std::mutex m_groupCommitMutex;
+	std::deque<GroupCommitWriter*> m_groupCommitQueue;
+	DbContextPtr m_groupCommitCtx; // of the BatchWriter of the leader
+
 	// constant once constructed
 	boost::filesystem::path m_dir;
 	SchemaConfigPtr m_schema;
+	std::unique_ptr<RecordCache> m_rowCache;
 	friend class TableIndexIter;
 	friend class TableIndexIterBackward;
 	friend class DbContext;
 	friend class ReadonlySegment;
+	friend class SegArrayReadGuard;
 };
 typedef boost::intrusive_ptr<DbTable> DbTablePtr;
 typedef DbTable    CompositeTable; // for compatible
 typedef DbTablePtr CompositeTablePtr; // for compatible
 
+/// RCU read side critical section on DbTable's segment array, the snapshot
+/// is valid until the guard is destroyed. Keep guarded code short, because
+/// replaced snapshots are not freed while a guard of their epoch is alive.
+class TERARK_DB_DLL SegArrayReadGuard {
+	DECLARE_NONE_COPYABLE_CLASS(SegArrayReadGuard);
+	const DbTable* m_tab;
+	std::atomic_size_t* m_readers;
+	const SegArraySnapshot* m_snapshot;
+public:
+	explicit SegArrayReadGuard(const DbTable* tab);
+	~SegArrayReadGuard() {
+		m_readers->fetch_sub(1, std::memory_order_release);
+		// the last reader of an epoch ends the grace period of snapshots
+		// retired in it, when no more publish or reclaim follows
+		if (m_tab->m_hasRetiredSegArrays.load(std::memory_order_relaxed))
+			const_cast<DbTable*>(m_tab)->reclaimSegArrays(true);
+	}
+	const SegArraySnapshot* get() const { return m_snapshot; }
+	const SegArraySnapshot* operator->() const { return m_snapshot; }
+};
+
 /////////////////////////////////////////////////////////////////////////////
 
 inline
@@ -424,6 +593,16 @@ inline bool
 DbContext::indexKeyExistsNoLock(size_t indexId, fstring key) {
 	return m_tab->indexKeyExistsNoLock(indexId, key, this);
 }
+inline void
+DbContext::indexSearchExactBatch(size_t indexId, const fstring* keys, size_t n,
+								 valvec<llong>* recIdvec, valvec<size_t>* keyOffsets) {
+	m_tab->indexSearchExactBatch(indexId, keys, n, recIdvec, keyOffsets, this);
+}
+inline void
+DbContext::indexSearchExactBatchNoLock(size_t indexId, const fstring* keys, size_t n,
+								 valvec<llong>* recIdvec, valvec<size_t>* keyOffsets) {
+	m_tab->indexSearchExactBatchNoLock(indexId, keys, n, recIdvec, keyOffsets, this);
+}
 inline bool
 DbContext::indexMatchRegex(size_t indexId, RegexForIndex* regex, valvec<llong>* recIdvec) {
 	return m_tab->indexMatchRegex(indexId, regex, recIdvec, this);
@@ -455,6 +634,12 @@ DbContext::selectOneColgroup(llong id, size_t cgId, valvec<byte>* cgData) {
 	m_tab->selectOneColgroup(id, cgId, cgData, this);
 }
 inline void
+DbContext::selectOneColgroupBatch(const llong* recIds, size_t n, size_t cgId,
+								  valvec<byte>* bufs, byte_t* found,
+								  fstring* vals, ReadableSegmentPtr* pins) {
+	m_tab->selectOneColgroupBatch(recIds, n, cgId, bufs, found, vals, pins, this);
+}
+inline void
 DbContext::selectColumnsNoLock(llong id, const valvec<size_t>& cols, valvec<byte>* colsData) {
 	m_tab->selectColumnsNoLock(id, cols, colsData, this);
 }
@@ -510,11 +695,10 @@ inline
 void DbContext::trySyncSegCtxSpeculativeLock(const DbTable* tab) {
 	if (this->segArrayUpdateSeq != tab->m_segArrayUpdateSeq) {
 		assert(this->segArrayUpdateSeq < tab->m_segArrayUpdateSeq);
-		MyRwLock lock(tab->m_rwMutex, false);
-		this->doSyncSegCtxNoLock(tab);
-		assert(m_segCtx.size() == tab->m_segments.size());
-		assert(m_rowNumVec.size() == tab->m_segments.size()+1);
-		assert(m_rowNumVec.size() == tab->m_rowNumVec.size());
+		SegArrayReadGuard segArray(tab); // lock free
+		this->doSyncSegCtx(tab, *segArray.get());
+		assert(m_segCtx.size() == segArray->m_segments.size());
+		assert(m_rowNumVec.size() == segArray->m_segments.size()+1);
 	}
 	else {
 		llong rowNum = tab->m_rowNum;
@@ -265,6 +265,7 @@ DfaDbReadonlySegment::compressSingleKeyValue(ReadableSegment* input, DbContext*
 	} else {
 		iter = nullptr;
 	}
+	buildIndexFilter(0, keyVec);
 	m_indices[0] = buildIndex(keySchema, keyVec); // memory heavy
 	m_colgroups[0] = m_indices[0]->getReadableStore();
 	keyVec.clear();
@@ -1,4 +1,5 @@
 #include "nlt_index.hpp"
+#include <terark/db/record_cache.hpp>
 #include <terark/io/FileStream.hpp>
 #include <terark/io/DataIO.hpp>
 #include <terark/util/mmap.hpp>
@@ -18,6 +19,7 @@ NestLoudsTrieIndex::NestLoudsTrieIndex(const Schema& schema) : m_schema(schema)
 	m_idmapBase = nullptr;
 	m_idmapSize = 0;
 	m_dataInflateSize = 0;
+	m_cacheOwner = RecordCache::newOwnerId();
 }
 NestLoudsTrieIndex::NestLoudsTrieIndex(const Schema& schema, SortableStrVec& strVec)
   : NestLoudsTrieIndex(schema)
@@ -71,6 +73,51 @@ void NestLoudsTrieIndex::searchExactAppend(fstring key, valvec<llong>* recIdvec,
 		}
 	}
 }
+
+// sorted keys share prefixes with their neighbours, so the trie nodes
+// visited by the previous key are likely still in cache
+void
+NestLoudsTrieIndex::searchExactBatchAppend(const fstring* keys, size_t n,
+										   valvec<llong>* recIdvec, size_t* hitCnt,
+										   DbContext*)
+const {
+	auto dawg = m_dfa->get_dawg();
+	assert(dawg);
+	size_t dawgNum = dawg->num_words();
+	if (m_isUnique) {
+		assert(m_recBits.size() == 0);
+		for (size_t k = 0; k < n; ++k) {
+			size_t dawgIdx = dawg->index(keys[k]);
+			assert(dawgIdx < dawgNum || size_t(-1) == dawgIdx);
+			if (dawgIdx < dawgNum) {
+				recIdvec->push_back(m_keyToId.get(dawgIdx));
+				hitCnt[k] = 1;
+			}
+			else {
+				hitCnt[k] = 0;
+			}
+		}
+	}
+	else {
+		assert(m_recBits.size() >= dawgNum+2);
+		for (size_t k = 0; k < n; ++k) {
+			size_t dawgIdx = dawg->index(keys[k]);
+			assert(dawgIdx < dawgNum || size_t(-1) == dawgIdx);
+			if (dawgIdx < dawgNum) {
+				size_t bitpos = m_recBits.select1(dawgIdx);
+				assert(bitpos < m_recBits.size());
+				size_t dupcnt = m_recBits.zero_seq_len(bitpos+1) + 1;
+				for (size_t i = 0; i < dupcnt; ++i) {
+					recIdvec->push_back(m_keyToId.get(bitpos+i));
+				}
+				hitCnt[k] = dupcnt;
+			}
+			else {
+				hitCnt[k] = 0;
+			}
+		}
+	}
+}
 ///@}
 
 llong NestLoudsTrieIndex::dataStorageSize() const {
@@ -99,6 +146,11 @@ NestLoudsTrieIndex::getValueAppend(llong id, valvec<byte>* val, DbContext* ctx)
 const {
 //	assert(dynamic_cast<DfaDbContext*>(ctx) != nullptr);
 //	DfaDbContext* ctx1 = static_cast<DfaDbContext*>(ctx);
+	RecordCache& cache = RecordCache::global();
+	bool useCache = m_schema.m_enableStoreCache && cache.enabled();
+	if (useCache && cache.getAppend(m_cacheOwner, id, val)) {
+		return;
+	}
 	auto dawg = m_dfa->get_dawg();
 	assert(dawg);
 	std::string buf;
@@ -107,6 +159,9 @@ const {
 	assert(dawgIdx < dawg->num_words());
 	dawg->nth_word(dawgIdx, &buf);
 	val->append(buf);
+	if (useCache) {
+		cache.put(m_cacheOwner, id, buf);
+	}
 }
 
 StoreIterator* NestLoudsTrieIndex::createStoreIterForward(DbContext*) const {
@@ -21,6 +21,9 @@ public:
 	llong indexStorageSize() const override;
 
 	void searchExactAppend(fstring key, valvec<llong>* recIdvec, DbContext*) const override;
+	void searchExactBatchAppend(const fstring* keys, size_t n,
+								valvec<llong>* recIdvec, size_t* hitCnt,
+								DbContext*) const override;
 	///@}
 
 	IndexIterator* createIndexIterForward(DbContext*) const override;
@@ -53,6 +56,7 @@ protected:
 	UintVecMin0 m_idToKey;
 	rank_select_se_512 m_recBits; // only for dupable index
 	const Schema& m_schema;
+	uint64_t m_cacheOwner; // key of records in RecordCache::global()
 
 	class UniqueIndexIterForward;   friend class UniqueIndexIterForward;
 	class UniqueIndexIterBackward;	friend class UniqueIndexIterBackward;
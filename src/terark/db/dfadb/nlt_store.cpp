@@ -1,4 +1,5 @@
 #include "nlt_store.hpp"
+#include <terark/db/record_cache.hpp>
 #include <terark/int_vector.hpp>
 #include <typeinfo>
 #include <float.h>
@@ -10,9 +11,11 @@ namespace terark { namespace db { namespace dfadb {
 TERARK_DB_REGISTER_STORE("nlt", NestLoudsTrieStore);
 
 NestLoudsTrieStore::NestLoudsTrieStore(const Schema& schema) : m_schema(schema) {
+	m_cacheOwner = RecordCache::newOwnerId();
 }
 NestLoudsTrieStore::NestLoudsTrieStore(const Schema& schema, BlobStore* blobStore)
   : m_schema(schema), m_store(blobStore) {
+	m_cacheOwner = RecordCache::newOwnerId();
 }
 
 NestLoudsTrieStore::~NestLoudsTrieStore() {
@@ -31,7 +34,17 @@ llong NestLoudsTrieStore::numDataRows() const {
 }
 
 void NestLoudsTrieStore::getValueAppend(llong id, valvec<byte>* val, DbContext* ctx) const {
+	RecordCache& cache = RecordCache::global();
+	if (!m_schema.m_enableStoreCache || !cache.enabled()) {
+		m_store->get_record_append(size_t(id), val);
+		return;
+	}
+	if (cache.getAppend(m_cacheOwner, id, val)) {
+		return;
+	}
+	size_t oldsize = val->size();
 	m_store->get_record_append(size_t(id), val);
+	cache.put(m_cacheOwner, id, fstring(val->data() + oldsize, val->size() - oldsize));
 }
 
 StoreIterator* NestLoudsTrieStore::createStoreIterForward(DbContext*) const {
@@ -32,6 +32,7 @@ public:
 protected:
 	const Schema& m_schema;
 	std::unique_ptr<BlobStore> m_store;
+	uint64_t m_cacheOwner; // key of records in RecordCache::global()
 };
 
 std::unique_ptr<DictZipBlobStore::ZipBuilder>
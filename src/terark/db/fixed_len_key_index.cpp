@@ -56,6 +56,73 @@ const {
 	}
 }
 
+// keys are searched from the lower bound of the previous key by galloping,
+// so a sorted batch walks m_index once instead of once per key
+void
+FixedLenKeyIndex::searchExactBatchAppend(const fstring* keys, size_t n,
+										 valvec<llong>* recIdvec, size_t* hitCnt,
+										 DbContext*)
+const {
+	auto indexData = m_index.data();
+	auto indexBits = m_index.uintbits();
+	auto indexMask = m_index.uintmask();
+	auto keysData = m_keys.data();
+	const size_t f = m_fixedLen;
+	const size_t size = m_index.size();
+	auto keyAt = [=](size_t pos) -> const byte* {
+		return keysData + f * UintVecMin0::fast_get(indexData, indexBits, indexMask, pos);
+	};
+	byte* cvtbuf = (byte*)alloca(2*f);
+	const byte* prevkey = NULL;
+	size_t lo = 0;
+	for (size_t k = 0; k < n; ++k) {
+		assert(keys[k].size() == f);
+		const byte* key = keys[k].udata();
+		if (m_schema.m_needEncodeToLexByteComparable) {
+			byte* curr = prevkey == cvtbuf ? cvtbuf + f : cvtbuf;
+			memcpy(curr, key, f);
+			m_schema.byteLexEncode(curr, f);
+			key = curr;
+		}
+		if (prevkey && memcmp(key, prevkey, f) < 0) {
+			lo = 0; // keys are not sorted, restart from begin
+		}
+		prevkey = key;
+		size_t i = lo, j = size;
+		if (!m_accel.empty()) {
+			size_t accelLo;
+			m_accel.prefixRange(keyPrefix(key, f), &accelLo, &j);
+			i = std::max(i, accelLo);
+		}
+		else for (size_t step = 1; ; step *= 2) {
+			size_t probe = i + step - 1;
+			if (probe >= j)
+				break;
+			if (memcmp(keyAt(probe), key, f) < 0)
+				i = probe + 1;
+			else {
+				j = probe;
+				break;
+			}
+		}
+		while (i < j) {
+			size_t mid = (i + j) / 2;
+			if (memcmp(keyAt(mid), key, f) < 0)
+				i = mid + 1;
+			else
+				j = mid;
+		}
+		lo = i;
+		for (; i < size; ++i) {
+			size_t id = UintVecMin0::fast_get(indexData, indexBits, indexMask, i);
+			if (memcmp(keysData + f*id, key, f) != 0)
+				break;
+			recIdvec->push_back(id);
+		}
+		hitCnt[k] = i - lo;
+	}
+}
+
 size_t FixedLenKeyIndex::searchLowerBound_cvt(fstring key) const {
 	if (m_schema.m_needEncodeToLexByteComparable) {
 		size_t fixlen = m_fixedLen;
@@ -82,6 +149,16 @@ size_t FixedLenKeyIndex::searchUpperBound_cvt(fstring key) const {
 	}
 }
 
+// first min(8, fixlen) bytes as a big endian integer, left aligned,
+// so integer order of prefixes is consistent with memcmp order of keys
+ullong FixedLenKeyIndex::keyPrefix(const byte* key, size_t fixlen) {
+	size_t n = std::min(fixlen, size_t(8));
+	ullong x = 0;
+	for (size_t i = 0; i < n; ++i)
+		x = x << 8 | key[i];
+	return n < 8 ? x << 8*(8 - n) : x;
+}
+
 size_t FixedLenKeyIndex::searchLowerBound(fstring key) const {
 	assert(key.size() == m_fixedLen);
 	auto indexData = m_index.data();
@@ -90,6 +167,9 @@ size_t FixedLenKeyIndex::searchLowerBound(fstring key) const {
 	auto keysData = m_keys.data();
 	size_t fixlen = m_fixedLen;
 	size_t i = 0, j = m_index.size();
+	if (!m_accel.empty()) {
+		m_accel.prefixRange(keyPrefix(key.udata(), fixlen), &i, &j);
+	}
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -110,6 +190,9 @@ size_t FixedLenKeyIndex::searchUpperBound(fstring key) const {
 	auto keysData = m_keys.data();
 	size_t fixlen = m_fixedLen;
 	size_t i = 0, j = m_index.size();
+	if (!m_accel.empty()) {
+		m_accel.prefixRange(keyPrefix(key.udata(), fixlen), &i, &j);
+	}
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -200,6 +283,10 @@ void FixedLenKeyIndex::build(const Schema& schema, SortableStrVec& strVec) {
 	assert(0 == minIdx);
 	m_keys.clear();
 	m_keys.swap(strVec.m_strpool);
+	const byte* keys = m_keys.data();
+	m_accel.build(rows, [&](size_t pos) {
+		return keyPrefix(keys + fixlen * m_index.get(pos), fixlen);
+	});
 }
 
 namespace {
@@ -207,8 +294,14 @@ namespace {
 		uint32_t rows;
 		uint32_t uniqKeys;
 		uint32_t fixlen;
-		uint32_t padding;
+		uint32_t hasAccel; // was padding, 0 in old files
 	};
+
+	// SearchAccel is at the first cache line boundary after m_index
+	size_t accelOffset(size_t keyMemSize, size_t indexMemSize) {
+		size_t offset = sizeof(Header) + ((keyMemSize + 15) & ~size_t(15));
+		return (offset + indexMemSize + 63) & ~size_t(63);
+	}
 }
 
 void FixedLenKeyIndex::load(PathRef path) {
@@ -223,6 +316,10 @@ void FixedLenKeyIndex::load(PathRef path) {
 	m_keys .risk_set_data((byte*)(h+1) , keyMemSize);
 	keyMemSize = (keyMemSize + 15) & ~15;
 	m_index.risk_set_data((byte*)(h+1) + keyMemSize, h->rows, rbits);
+	if (h->hasAccel) {
+		size_t offset = accelOffset(m_keys.size(), m_index.mem_size());
+		m_accel.risk_set_data(m_mmapBase + offset, m_mmapSize - offset, h->rows);
+	}
 }
 
 void FixedLenKeyIndex::save(PathRef path) const {
@@ -233,15 +330,21 @@ void FixedLenKeyIndex::save(PathRef path) const {
 	h.rows     = uint32_t(m_index.size());
 	h.uniqKeys = m_uniqKeys;
 	h.fixlen   = m_fixedLen;
-	h.padding  = 0;
+	h.hasAccel = !m_accel.empty();
 	dio.ensureWrite(&h, sizeof(h));
-	byte zero[16];
+	byte zero[64];
 	memset(zero, 0, sizeof(zero));
 	dio.ensureWrite(m_keys .data(), m_keys .used_mem_size());
 	if (m_keys.used_mem_size() % 16 != 0) {
 		dio.ensureWrite(zero, 16 - m_keys.used_mem_size() % 16);
 	}
 	dio.ensureWrite(m_index.data(), m_index.mem_size());
+	if (h.hasAccel) {
+		size_t keyMemSize = (m_keys.used_mem_size() + 15) & ~size_t(15);
+		size_t offset = accelOffset(m_keys.used_mem_size(), m_index.mem_size());
+		dio.ensureWrite(zero, offset - (sizeof(h) + keyMemSize + m_index.mem_size()));
+		dio.ensureWrite(m_accel.data(), m_accel.mem_size());
+	}
 }
 
 class FixedLenKeyIndex::MyIndexIterForward : public IndexIterator {
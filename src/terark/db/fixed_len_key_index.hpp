@@ -4,6 +4,7 @@
 #include <terark/int_vector.hpp>
 #include <terark/rank_select.hpp>
 #include <terark/util/sortable_strvec.hpp>
+#include "search_accel.hpp"
 
 namespace terark { namespace db {
 
@@ -16,6 +17,9 @@ public:
 	llong indexStorageSize() const override;
 
 	void searchExactAppend(fstring key, valvec<llong>* recIdvec, DbContext*) const override;
+	void searchExactBatchAppend(const fstring* keys, size_t n,
+								valvec<llong>* recIdvec, size_t* hitCnt,
+								DbContext*) const override;
 	///@}
 
 	IndexIterator* createIndexIterForward(DbContext*) const override;
@@ -38,12 +42,15 @@ public:
 protected:
 	valvec<byte> m_keys;   // key   = m_keys[recId]
 	UintVecMin0  m_index;  // recId = m_index.lower_bound(key)
+	SearchAccel  m_accel;  // sampled keyPrefix(m_keys[m_index[i]])
 	const Schema&m_schema;
 	byte_t*      m_mmapBase;
 	size_t       m_mmapSize;
 	size_t       m_fixedLen;
 	size_t       m_uniqKeys;
 
+	static ullong keyPrefix(const byte* key, size_t fixlen);
+
 	size_t searchLowerBound(fstring binkey) const;
 	size_t searchUpperBound(fstring binkey) const;
 
@@ -82,6 +82,14 @@ void FixedLenStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) cons
 	val->append(dataPtr, m_mmapBase->fixlen);
 }
 
+bool FixedLenStore::getValueRef(llong id, fstring* val, DbContext*) const {
+	assert(id >= 0);
+	assert(id < llong(m_mmapBase->rows));
+	// caller should ensure no concurrent append, which may remap the file
+	*val = fstring(m_mmapBase->get_data(id), m_mmapBase->fixlen);
+	return true;
+}
+
 StoreIterator* FixedLenStore::createStoreIterForward(DbContext*) const {
 	return nullptr; // not needed
 }
@@ -51,6 +51,7 @@ size_t ZipIntKeyIndex::IntVecLowerBound(fstring binkey) const {
 	auto keysMask = m_keys.uintmask();
 	ullong key = ullong(rawkey - Int(m_minKey));
 	size_t i = 0, j = m_index.size();
+	narrowLowerBound(key, &i, &j);
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -104,6 +105,7 @@ size_t ZipIntKeyIndex::IntVecUpperBound(fstring binkey) const {
 	auto keysMask = m_keys.uintmask();
 	size_t key = size_t(rawkey - Int(m_minKey));
 	size_t i = 0, j = m_index.size();
+	narrowUpperBound(key, &i, &j);
 	while (i < j) {
 		size_t mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -152,6 +154,12 @@ ZipIntKeyIndex::IntVecEqualRange(fstring binkey) const {
 	size_t key = size_t(rawkey - Int(m_minKey));
 	size_t i = 0, j = m_index.size();
 	size_t mid = 0;
+	if (!m_model.empty() || !m_accel.empty()) {
+		// [lower bound lo, upper bound hi]
+		size_t lbHi, ubLo;
+		narrowLowerBound(key, &i, &lbHi);
+		narrowUpperBound(key, &ubLo, &j);
+	}
 	while (i < j) {
 		mid = (i + j) / 2;
 		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, mid);
@@ -209,6 +217,93 @@ ZipIntKeyIndex::searchEqualRange(fstring key) const {
 	return {};
 }
 
+// keys are searched from the lower bound of the previous key by galloping,
+// so a sorted batch walks m_index once instead of once per key
+template<class Int>
+void ZipIntKeyIndex::IntVecSearchExactBatch(const fstring* keys, size_t n,
+									valvec<llong>* recIdvec, size_t* hitCnt)
+const {
+	auto indexData = m_index.data();
+	auto indexBits = m_index.uintbits();
+	auto indexMask = m_index.uintmask();
+	auto keysData = m_keys.data();
+	auto keysBits = m_keys.uintbits();
+	auto keysMask = m_keys.uintmask();
+	auto keyAt = [=](size_t pos) -> ullong {
+		size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, pos);
+		return UintVecMin0::fast_get(keysData, keysBits, keysMask, hitPos);
+	};
+	const size_t size = m_index.size();
+	size_t lo = 0;
+	Int prevkey = 0;
+	for (size_t k = 0; k < n; ++k) {
+		assert(keys[k].size() == sizeof(Int));
+		Int rawkey = unaligned_load<Int>(keys[k].data());
+		if (rawkey < prevkey) {
+			lo = 0; // keys are not sorted, restart from begin
+		}
+		prevkey = rawkey;
+		hitCnt[k] = 0;
+		if (rawkey < Int(m_minKey)) {
+			continue;
+		}
+		ullong key = ullong(rawkey - Int(m_minKey));
+		size_t i = lo, j = size;
+		if (!m_model.empty() || !m_accel.empty()) {
+			size_t accelLo;
+			narrowLowerBound(key, &accelLo, &j);
+			i = std::max(i, accelLo);
+		}
+		else for (size_t step = 1; ; step *= 2) {
+			size_t probe = i + step - 1;
+			if (probe >= j)
+				break;
+			if (keyAt(probe) < key)
+				i = probe + 1;
+			else {
+				j = probe;
+				break;
+			}
+		}
+		while (i < j) {
+			size_t mid = (i + j) / 2;
+			if (keyAt(mid) < key)
+				i = mid + 1;
+			else
+				j = mid;
+		}
+		lo = i;
+		for (; i < size; ++i) {
+			size_t hitPos = UintVecMin0::fast_get(indexData, indexBits, indexMask, i);
+			if (UintVecMin0::fast_get(keysData, keysBits, keysMask, hitPos) != key)
+				break;
+			recIdvec->push_back(hitPos);
+		}
+		hitCnt[k] = i - lo;
+	}
+}
+
+void
+ZipIntKeyIndex::searchExactBatchAppend(const fstring* keys, size_t n,
+									   valvec<llong>* recIdvec, size_t* hitCnt,
+									   DbContext*)
+const {
+	switch (m_keyType) {
+	default:
+		THROW_STD(invalid_argument, "Bad m_keyType=%s", Schema::columnTypeStr(m_keyType));
+	case ColumnType::Sint08 : IntVecSearchExactBatch< int8_t >(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Uint08 : IntVecSearchExactBatch<uint8_t >(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Sint16 : IntVecSearchExactBatch< int16_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Uint16 : IntVecSearchExactBatch<uint16_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Sint32 : IntVecSearchExactBatch< int32_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Uint32 : IntVecSearchExactBatch<uint32_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Sint64 : IntVecSearchExactBatch< int64_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::Uint64 : IntVecSearchExactBatch<uint64_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::VarSint: IntVecSearchExactBatch< int64_t>(keys, n, recIdvec, hitCnt); break;
+	case ColumnType::VarUint: IntVecSearchExactBatch<uint64_t>(keys, n, recIdvec, hitCnt); break;
+	}
+}
+
 ///@}
 
 llong ZipIntKeyIndex::dataStorageSize() const {
@@ -269,8 +364,27 @@ void ZipIntKeyIndex::getValueAppend(llong id, valvec<byte>* val, DbContext*) con
 	}
 }
 
+bool ZipIntKeyIndex::getValuesBatchBytes(size_t beginId, size_t count, byte* out) const {
+	switch (m_keyType) {
+	default:
+		return false;
+	case ColumnType::Sint08: getValuesBatch(beginId, count, ( int8_t *)out); break;
+	case ColumnType::Uint08: getValuesBatch(beginId, count, (uint8_t *)out); break;
+	case ColumnType::Sint16: getValuesBatch(beginId, count, ( int16_t*)out); break;
+	case ColumnType::Uint16: getValuesBatch(beginId, count, (uint16_t*)out); break;
+	case ColumnType::Sint32: getValuesBatch(beginId, count, ( int32_t*)out); break;
+	case ColumnType::Uint32: getValuesBatch(beginId, count, (uint32_t*)out); break;
+	case ColumnType::Sint64: getValuesBatch(beginId, count, ( int64_t*)out); break;
+	case ColumnType::Uint64: getValuesBatch(beginId, count, (uint64_t*)out); break;
+	}
+	return true;
+}
+
 StoreIterator* ZipIntKeyIndex::createStoreIterForward(DbContext*) const {
-	return nullptr; // not needed
+	size_t fixlen = m_schema.getFixedRowLen();
+	if (0 == fixlen)
+		return nullptr; // var int, use default iter
+	return new IntBatchStoreIterForward<ZipIntKeyIndex>(this, fixlen);
 }
 
 StoreIterator* ZipIntKeyIndex::createStoreIterBackward(DbContext*) const {
@@ -353,6 +467,9 @@ void ZipIntKeyIndex::build(ColumnType keyType, SortableStrVec& strVec) {
 		assert(xk <= yk);
 	}
 #endif
+	m_accel.build(m_index.size(), [this](size_t pos) {
+		return ullong(m_keys.get(m_index.get(pos)));
+	});
 }
 
 namespace {
@@ -361,16 +478,34 @@ namespace {
 		uint8_t  keyBits;
 		uint8_t  keyType;
 		uint8_t  isUnique;
-		uint8_t  padding;
+		uint8_t  accel; // was padding, 0 in old files
 		 int64_t minKey;
 	};
 	BOOST_STATIC_ASSERT(sizeof(Header) == 16);
+
+	enum AccelType {
+		AccelNone,
+		AccelSearchAccel,
+		AccelPlaIntModel,
+	};
+
+	// SearchAccel or PlaIntModel is at the first cache line boundary after m_index
+	size_t accelOffset(size_t keysMemSize, size_t indexMemSize) {
+		return (sizeof(Header) + keysMemSize + indexMemSize + 63) & ~size_t(63);
+	}
 }
 
 void ZipIntKeyIndex::load(PathRef path) {
-	auto fpath = path + ".zint";
+	loadFile((path + ".zint").string());
+}
+
+void ZipIntKeyIndex::save(PathRef path) const {
+	saveFile((path + ".zint").string());
+}
+
+void ZipIntKeyIndex::loadFile(const std::string& fpath) {
 	bool writable = false;
-	m_mmapBase = (byte_t*)mmap_load(fpath.string(), &m_mmapSize, writable, m_schema.m_mmapPopulate);
+	m_mmapBase = (byte_t*)mmap_load(fpath, &m_mmapSize, writable, m_schema.m_mmapPopulate);
 	auto h = (const Header*)m_mmapBase;
 	m_isUnique   = h->isUnique ? true : false;
 	m_keyType    = ColumnType(h->keyType);
@@ -378,22 +513,44 @@ void ZipIntKeyIndex::load(PathRef path) {
 	size_t indexBits = h->rows <= 1 ? 0 : terark_bsr_u64(h->rows - 1) + 1;
 	m_keys .risk_set_data((byte*)(h+1)                    , h->rows, h->keyBits);
 	m_index.risk_set_data((byte*)(h+1) + m_keys.mem_size(), h->rows,  indexBits);
+	size_t offset = accelOffset(m_keys.mem_size(), m_index.mem_size());
+	switch (h->accel) {
+	default:
+		THROW_STD(invalid_argument, "%s: bad accel type = %d", fpath.c_str(), h->accel);
+	case AccelNone:
+		break;
+	case AccelSearchAccel:
+		m_accel.risk_set_data(m_mmapBase + offset, m_mmapSize - offset, h->rows);
+		break;
+	case AccelPlaIntModel:
+		m_model.risk_set_data(m_mmapBase + offset, m_mmapSize - offset, h->rows);
+		break;
+	}
 }
 
-void ZipIntKeyIndex::save(PathRef path) const {
-	auto fpath = path + ".zint";
+void ZipIntKeyIndex::saveFile(const std::string& fpath) const {
 	NativeDataOutput<FileStream> dio;
-	dio.open(fpath.string().c_str(), "wb");
+	dio.open(fpath.c_str(), "wb");
 	Header h;
 	h.rows     = m_index.size();
 	h.keyBits  = m_keys.uintbits();
 	h.keyType  = uint8_t(m_keyType);
 	h.isUnique = m_isUnique;
-	h.padding  = 0;
+	h.accel    = !m_model.empty() ? AccelPlaIntModel
+			   : !m_accel.empty() ? AccelSearchAccel : AccelNone;
 	h.minKey   = m_minKey;
 	dio.ensureWrite(&h, sizeof(h));
 	dio.ensureWrite(m_keys .data(), m_keys .mem_size());
 	dio.ensureWrite(m_index.data(), m_index.mem_size());
+	if (h.accel != AccelNone) {
+		static const byte zero[64] = {0};
+		size_t offset = accelOffset(m_keys.mem_size(), m_index.mem_size());
+		dio.ensureWrite(zero, offset - (sizeof(h) + m_keys.mem_size() + m_index.mem_size()));
+		if (h.accel == AccelPlaIntModel)
+			dio.ensureWrite(m_model.data(), m_model.mem_size());
+		else
+			dio.ensureWrite(m_accel.data(), m_accel.mem_size());
+	}
 }
 
 class ZipIntKeyIndex::MyIndexIterForward : public IndexIterator {
@@ -4,6 +4,8 @@
 #include <terark/int_vector.hpp>
 #include <terark/rank_select.hpp>
 #include <terark/util/sortable_strvec.hpp>
+#include "search_accel.hpp"
+#include "zip_int_store.hpp"
 
 namespace terark { namespace db {
 
@@ -16,6 +18,9 @@ public:
 	llong indexStorageSize() const override;
 
 	void searchExactAppend(fstring key, valvec<llong>* recIdvec, DbContext*) const override;
+	void searchExactBatchAppend(const fstring* keys, size_t n,
+								valvec<llong>* recIdvec, size_t* hitCnt,
+								DbContext*) const override;
 	///@}
 
 	IndexIterator* createIndexIterForward(DbContext*) const override;
@@ -35,15 +40,48 @@ public:
 	void load(PathRef path) override;
 	void save(PathRef path) const override;
 
+	/// out[i] = key of record beginId + i, for column scans
+	/// Int should be the key type, or a wider one
+	template<class Int>
+	void getValuesBatch(size_t beginId, size_t count, Int* out) const {
+		assert(beginId + count <= m_keys.size());
+		m_keys.bulk_get(beginId, count, out);
+		if (ullong minKey = ullong(m_minKey)) {
+			for (size_t i = 0; i < count; ++i)
+				out[i] = Int(minKey + ullong(out[i]));
+		}
+	}
+	/// out is an array of the key type, return false for var ints
+	bool getValuesBatchBytes(size_t beginId, size_t count, byte* out) const;
+
 protected:
 	UintVecMin0 m_keys;   // key   = m_keys[recId]
 	UintVecMin0 m_index;  // recId = m_index.lower_bound(key)
+	SearchAccel m_accel;  // sampled m_keys[m_index[i]]
+	PlaIntModel m_model;  // just for LearnedIntKeyIndex, used before m_accel
 	byte_t*     m_mmapBase;
 	size_t      m_mmapSize;
 	llong       m_minKey; // may be unsigned
 	ColumnType  m_keyType;
 	const Schema& m_schema;
 
+	void loadFile(const std::string& fpath);
+	void saveFile(const std::string& fpath) const;
+
+	// initial range of binary search on m_index
+	void narrowLowerBound(ullong key, size_t* lo, size_t* hi) const {
+		if (!m_model.empty())
+			m_model.lowerBoundRange(key, lo, hi);
+		else if (!m_accel.empty())
+			m_accel.lowerBoundRange(key, lo, hi);
+	}
+	void narrowUpperBound(ullong key, size_t* lo, size_t* hi) const {
+		if (!m_model.empty())
+			m_model.upperBoundRange(key, lo, hi);
+		else if (!m_accel.empty())
+			m_accel.upperBoundRange(key, lo, hi);
+	}
+
 	template<class Int>
 	size_t IntVecLowerBound(fstring binkey) const;
 	size_t searchLowerBound(fstring binkey) const;
@@ -56,6 +94,10 @@ protected:
 	std::pair<size_t, size_t> IntVecEqualRange(fstring binkey) const;
 	std::pair<size_t, size_t> searchEqualRange(fstring binkey) const;
 
+	template<class Int>
+	void IntVecSearchExactBatch(const fstring* keys, size_t n,
+								valvec<llong>* recIdvec, size_t* hitCnt) const;
+
 	template<class Int>
 	void keyAppend(size_t recIdx, valvec<byte>* res) const;
 
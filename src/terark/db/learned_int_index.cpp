@@ -0,0 +1,28 @@
+#include "learned_int_index.hpp"
+
+namespace terark { namespace db {
+
+TERARK_DB_REGISTER_STORE("lint", LearnedIntKeyIndex);
+
+LearnedIntKeyIndex::LearnedIntKeyIndex(const Schema& schema)
+  : ZipIntKeyIndex(schema) {
+}
+LearnedIntKeyIndex::~LearnedIntKeyIndex() {
+}
+
+void LearnedIntKeyIndex::build(ColumnType keyType, SortableStrVec& strVec) {
+	ZipIntKeyIndex::build(keyType, strVec);
+	size_t eps = std::max<size_t>(m_schema.m_learnedIndexEpsilon, 1);
+	m_accel.clear();
+	m_model.build(m_keys, m_index, eps);
+}
+
+void LearnedIntKeyIndex::load(PathRef path) {
+	loadFile((path + ".lint").string());
+}
+
+void LearnedIntKeyIndex::save(PathRef path) const {
+	saveFile((path + ".lint").string());
+}
+
+}} // namespace terark::db
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "intkey_index.hpp"
+
+namespace terark { namespace db {
+
+/// ZipIntKeyIndex searched by a piecewise linear model instead of plain
+/// binary search, for near monotonic integer keys such as timestamps,
+/// selected by "learnedIndex" of the index in dbmeta.json, the error
+/// bound is "learnedIndexEpsilon"
+class TERARK_DB_DLL LearnedIntKeyIndex : public ZipIntKeyIndex {
+public:
+	explicit LearnedIntKeyIndex(const Schema& schema);
+	~LearnedIntKeyIndex();
+
+	void build(ColumnType keyType, SortableStrVec& strVec);
+	void load(PathRef path) override;
+	void save(PathRef path) const override;
+
+	size_t segNum() const { return m_model.segNum(); }
+};
+
+}} // namespace terark::db
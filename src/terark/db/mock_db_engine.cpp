@@ -39,6 +39,19 @@ const {
 		val->append(m_rows[id]);
 	}
 }
+bool
+MockReadonlyStore::getValueRef(llong id, fstring* val, DbContext*)
+const {
+	assert(id >= 0);
+	if (m_fixedLen) {
+		assert(id < llong(m_rows.strpool.size() / m_fixedLen));
+		*val = fstring(m_rows.strpool.data() + m_fixedLen * id, m_fixedLen);
+	} else {
+		assert(id < llong(m_rows.size()));
+		*val = m_rows[id];
+	}
+	return true;
+}
 StoreIterator* MockReadonlyStore::createStoreIterForward(DbContext*) const {
 	// return nullptr indicate use default iter
 	return nullptr;
@@ -25,6 +25,7 @@ public:
 	llong dataInflateSize() const override;
 	llong numDataRows() const override;
 	void getValueAppend(llong id, valvec<byte>* val, DbContext*) const;
+	bool getValueRef(llong id, fstring* val, DbContext*) const override;
 	StoreIterator* createStoreIterForward(DbContext*) const override;
 	StoreIterator* createStoreIterBackward(DbContext*) const override;
 };
@@ -0,0 +1,192 @@
+#include "record_cache.hpp"
+
+namespace terark { namespace db {
+
+RecordCache::Shard::Shard() {
+	nodes.resize(2);
+	for (uint32_t head = 0; head < 2; ++head) {
+		nodes[head].prev = head;
+		nodes[head].next = head;
+		nodes[head].isProtected = ProtectedHead == head;
+	}
+	usedBytes = 0;
+	protectedBytes = 0;
+}
+
+void RecordCache::Shard::unlink(uint32_t i) {
+	Node& x = nodes[i];
+	nodes[x.prev].next = x.next;
+	nodes[x.next].prev = x.prev;
+}
+
+void RecordCache::Shard::pushFront(uint32_t head, uint32_t i) {
+	Node& x = nodes[i];
+	x.prev = head;
+	x.next = nodes[head].next;
+	nodes[x.next].prev = i;
+	nodes[head].next = i;
+}
+
+void RecordCache::Shard::remove(uint32_t i) {
+	Node& x = nodes[i];
+	unlink(i);
+	usedBytes -= x.data.size();
+	if (x.isProtected)
+		protectedBytes -= x.data.size();
+	map.erase(x.key);
+	x.data.clear();
+	x.data.shrink_to_fit();
+	freeList.push_back(i);
+}
+
+void RecordCache::Shard::evict(size_t cap) {
+	while (usedBytes > cap) {
+		uint32_t tail = nodes[ProbationHead].prev;
+		if (ProbationHead == tail) {
+			tail = nodes[ProtectedHead].prev;
+			if (ProtectedHead == tail)
+				break;
+		}
+		remove(tail);
+	}
+}
+
+size_t RecordCache::KeyHash::operator()(const Key& k) const {
+	uint64_t h = k.owner * 0x9E3779B97F4A7C15ULL ^ uint64_t(k.id);
+	h ^= h >> 29;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 32;
+	return size_t(h);
+}
+
+RecordCache::RecordCache(size_t capacity) {
+	m_capacity = capacity;
+	m_hits = 0;
+	m_misses = 0;
+	m_shards = new Shard[ShardNum];
+}
+
+RecordCache::~RecordCache() {
+	delete[] m_shards;
+}
+
+RecordCache& RecordCache::global() {
+	static RecordCache cache(size_t(getEnvLong("TerarkDB_StoreCacheBytes", 0)));
+	return cache;
+}
+
+uint64_t RecordCache::newOwnerId() {
+	static std::atomic<uint64_t> s_owner(0);
+	return ++s_owner;
+}
+
+void RecordCache::setCapacity(size_t capacity) {
+	m_capacity = capacity;
+	size_t cap = capacity / ShardNum;
+	for (size_t i = 0; i < ShardNum; ++i) {
+		Shard& s = m_shards[i];
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.evict(cap);
+	}
+}
+
+void RecordCache::ensureCapacity(size_t capacity) {
+	size_t old = m_capacity.load(std::memory_order_relaxed);
+	while (old < capacity && !m_capacity.compare_exchange_weak(old, capacity))
+		{}
+}
+
+RecordCache::Shard* RecordCache::getShard(const Key& k) const {
+	size_t h = KeyHash()(k);
+	return &m_shards[(h >> 16) % ShardNum];
+}
+
+bool RecordCache::getAppend(uint64_t owner, llong id, valvec<byte>* val) {
+	Key k = { owner, id };
+	Shard& s = *getShard(k);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	auto iter = s.map.find(k);
+	if (s.map.end() == iter) {
+		m_misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	uint32_t i = iter->second;
+	Node& x = s.nodes[i];
+	val->append(x.data.data(), x.data.size());
+	s.unlink(i);
+	if (!x.isProtected) {
+		// second hit, promote to protected, demote protected tails to
+		// probation when protected exceeds 80% of the shard
+		x.isProtected = true;
+		s.protectedBytes += x.data.size();
+		size_t maxProtected = shardCapacity() / 5 * 4;
+		while (s.protectedBytes > maxProtected) {
+			uint32_t tail = s.nodes[ProtectedHead].prev;
+			if (ProtectedHead == tail)
+				break;
+			Node& t = s.nodes[tail];
+			s.unlink(tail);
+			t.isProtected = false;
+			s.protectedBytes -= t.data.size();
+			s.pushFront(ProbationHead, tail);
+		}
+	}
+	s.pushFront(ProtectedHead, i);
+	m_hits.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void RecordCache::put(uint64_t owner, llong id, fstring val,
+					  const std::atomic<uint64_t>* version, uint64_t expected) {
+	size_t cap = shardCapacity();
+	if (val.size() > cap / 4) {
+		return; // too large, it would flush the shard
+	}
+	Key k = { owner, id };
+	Shard& s = *getShard(k);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	if (version && version->load(std::memory_order_acquire) != expected) {
+		return; // record is changed during decoding
+	}
+	auto ib = s.map.insert(std::make_pair(k, uint32_t(0)));
+	if (!ib.second) {
+		return; // put by another thread
+	}
+	s.evict(cap - val.size());
+	uint32_t i;
+	if (s.freeList.empty()) {
+		i = uint32_t(s.nodes.size());
+		s.nodes.emplace_back();
+	} else {
+		i = s.freeList.pop_val();
+	}
+	Node& x = s.nodes[i];
+	x.key = k;
+	x.isProtected = false;
+	x.data.assign(val.udata(), val.size());
+	ib.first->second = i;
+	s.usedBytes += val.size();
+	s.pushFront(ProbationHead, i);
+}
+
+void RecordCache::erase(uint64_t owner, llong id) {
+	Key k = { owner, id };
+	Shard& s = *getShard(k);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	auto iter = s.map.find(k);
+	if (s.map.end() != iter) {
+		s.remove(iter->second);
+	}
+}
+
+size_t RecordCache::usedBytes() const {
+	size_t sum = 0;
+	for (size_t i = 0; i < ShardNum; ++i) {
+		Shard& s = m_shards[i];
+		std::lock_guard<std::mutex> lock(s.mutex);
+		sum += s.usedBytes;
+	}
+	return sum;
+}
+
+}} // namespace terark::db
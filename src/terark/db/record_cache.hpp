@@ -0,0 +1,95 @@
+#pragma once
+
+#include <terark/db/db_conf.hpp>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace terark { namespace db {
+
+/// Sharded cache of decoded records of readonly stores, records are keyed
+/// by (owner, id), owner is an id taken by newOwnerId() for each store.
+/// Owner ids are never reused, so records of a destroyed store are never
+/// hit again and are left to eviction.
+///
+/// Each shard is a segmented LRU: new records enter the probation list and
+/// are promoted to the protected list on the second hit, eviction takes the
+/// probation tail first, so a full scan can not evict hot records.
+class TERARK_DB_DLL RecordCache {
+	TERARK_DB_NON_COPYABLE_CLASS(RecordCache);
+public:
+	explicit RecordCache(size_t capacity);
+	~RecordCache();
+
+	/// the process wide cache shared by all tables, initial capacity is
+	/// env TerarkDB_StoreCacheBytes, default 0 (disabled)
+	static RecordCache& global();
+	static uint64_t newOwnerId();
+
+	size_t capacity() const { return m_capacity.load(std::memory_order_relaxed); }
+	bool enabled() const { return capacity() != 0; }
+	void setCapacity(size_t capacity);
+	/// grow capacity to at least 'capacity', never shrink
+	void ensureCapacity(size_t capacity);
+
+	///@returns true if found, the record is appended to val
+	bool getAppend(uint64_t owner, llong id, valvec<byte>* val);
+	/// if version is not NULL, val is put only if *version == expected,
+	/// the check is atomic with erase(), so a writer which changes the
+	/// record, increments *version and then calls erase() never leaves
+	/// a stale record in the cache
+	void put(uint64_t owner, llong id, fstring val,
+			 const std::atomic<uint64_t>* version = NULL, uint64_t expected = 0);
+	void erase(uint64_t owner, llong id);
+
+	size_t usedBytes() const;
+	llong  hitCount() const { return m_hits.load(std::memory_order_relaxed); }
+	llong  missCount() const { return m_misses.load(std::memory_order_relaxed); }
+
+	static const size_t ShardNum = 64;
+
+protected:
+	struct Key {
+		uint64_t owner;
+		llong    id;
+		bool operator==(const Key& y) const {
+			return owner == y.owner && id == y.id;
+		}
+	};
+	struct KeyHash {
+		size_t operator()(const Key& k) const;
+	};
+	struct Node {
+		Key      key;
+		uint32_t prev;
+		uint32_t next;
+		bool     isProtected;
+		valvec<byte> data;
+	};
+	enum {
+		ProbationHead = 0,
+		ProtectedHead = 1,
+	};
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<Key, uint32_t, KeyHash> map;
+		valvec<Node>     nodes; // nodes[0,1] are list heads
+		valvec<uint32_t> freeList;
+		size_t usedBytes;
+		size_t protectedBytes;
+		Shard();
+		void unlink(uint32_t i);
+		void pushFront(uint32_t head, uint32_t i);
+		void remove(uint32_t i);
+		void evict(size_t cap);
+	};
+	Shard* getShard(const Key& k) const;
+	size_t shardCapacity() const { return capacity() / ShardNum; }
+
+	std::atomic<size_t> m_capacity;
+	std::atomic<llong>  m_hits;
+	std::atomic<llong>  m_misses;
+	Shard* m_shards;
+};
+
+}} // namespace terark::db
@@ -0,0 +1,283 @@
+#include "search_accel.hpp"
+#include <limits>
+
+namespace terark { namespace db {
+
+namespace {
+	struct AccelHeader {
+		uint64_t num;
+		uint64_t step;
+		uint64_t padding[6];
+	};
+	BOOST_STATIC_ASSERT(sizeof(AccelHeader) == 64);
+}
+
+SearchAccel::SearchAccel() {
+	m_eytz = NULL;
+	m_rank = NULL;
+	m_base = NULL;
+	m_memSize = 0;
+	m_num = 0;
+	m_step = 0;
+	m_rows = 0;
+}
+
+size_t SearchAccel::getStep() {
+	static const size_t step = getEnvLong("TerarkDB_SearchAccelStep", 64);
+	return step;
+}
+
+void SearchAccel::clear() {
+	m_mem.clear();
+	m_eytz = NULL;
+	m_rank = NULL;
+	m_base = NULL;
+	m_memSize = 0;
+	m_num = 0;
+	m_step = 0;
+	m_rows = 0;
+}
+
+void SearchAccel::setPointers(const byte* base) {
+	auto h = (const AccelHeader*)base;
+	m_num  = size_t(h->num);
+	m_step = size_t(h->step);
+	m_eytz = (const ullong*)(h + 1);
+	m_rank = (const uint32_t*)(m_eytz + m_num + 1);
+	m_base = base;
+}
+
+// in-order walk of the implicit tree puts sorted keys in bfs order
+size_t SearchAccel::fillEytz(const valvec<ullong>& sorted, size_t k, size_t i) {
+	if (k <= m_num) {
+		i = fillEytz(sorted, 2*k, i);
+		const_cast<ullong&>(m_eytz[k]) = sorted[i];
+		const_cast<uint32_t&>(m_rank[k]) = uint32_t(i);
+		i = fillEytz(sorted, 2*k+1, i+1);
+	}
+	return i;
+}
+
+void SearchAccel::build(const valvec<ullong>& sorted, size_t step, size_t rows) {
+	clear();
+	size_t num = sorted.size();
+	m_memSize = sizeof(AccelHeader)
+			  + sizeof(ullong) * (num + 1)
+			  + sizeof(uint32_t) * (num + 1);
+	m_memSize = (m_memSize + 63) & ~size_t(63);
+	// valvec memory is not cache line aligned, over allocate and align
+	m_mem.resize(m_memSize + 64, 0);
+	byte* base = (byte*)((size_t(m_mem.data()) + 63) & ~size_t(63));
+	auto h = (AccelHeader*)base;
+	h->num  = num;
+	h->step = step;
+	setPointers(base);
+	m_rows = rows;
+	size_t filled = fillEytz(sorted, 1, 0);
+	assert(filled == num);
+	(void)filled;
+}
+
+void SearchAccel::risk_set_data(const byte* mem, size_t len, size_t rows) {
+	clear();
+	assert(size_t(mem) % 64 == 0);
+	if (len < sizeof(AccelHeader)) {
+		THROW_STD(invalid_argument, "bad search accel size: %zd", len);
+	}
+	setPointers(mem);
+	m_memSize = (sizeof(AccelHeader) + 12 * (m_num + 1) + 63) & ~size_t(63);
+	if (m_memSize > len) {
+		clear();
+		THROW_STD(invalid_argument, "bad search accel size: %zd", len);
+	}
+	m_rows = rows;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+	struct PlaHeader {
+		uint64_t num;
+		uint64_t maxKey;
+		uint64_t rows;
+		uint64_t radixNum;
+		uint32_t eps;
+		uint32_t shift;
+		uint64_t padding[3];
+	};
+	BOOST_STATIC_ASSERT(sizeof(PlaHeader) == 64);
+	BOOST_STATIC_ASSERT(sizeof(PlaIntModel::Segment) == 16);
+
+	size_t plaMemSize(size_t num, size_t radixNum) {
+		size_t size = sizeof(PlaHeader)
+					+ sizeof(ullong) * num
+					+ sizeof(PlaIntModel::Segment) * num
+					+ sizeof(uint32_t) * radixNum;
+		return (size + 63) & ~size_t(63);
+	}
+
+	// shrinking cone, a new segment is started when the slope range of
+	// the current segment is empty
+	class PlaBuilder {
+		double m_eps;
+		ullong m_x0;
+		size_t m_y0;
+		size_t m_lastY;
+		double m_slopeLo;
+		double m_slopeHi;
+		bool   m_started;
+	public:
+		valvec<ullong> segKey;
+		valvec<PlaIntModel::Segment> seg;
+
+		explicit PlaBuilder(size_t eps) : m_eps(double(eps)), m_started(false) {}
+
+		void add(ullong x, size_t y) {
+			if (!m_started) {
+				start(x, y);
+				return;
+			}
+			if (x == m_x0) {
+				// must be the same lower_bound
+				m_lastY = y;
+				return;
+			}
+			double dx = double(x - m_x0);
+			double lo = (double(y) - m_eps - double(m_y0)) / dx;
+			double hi = (double(y) + m_eps - double(m_y0)) / dx;
+			lo = std::max(lo, m_slopeLo);
+			hi = std::min(hi, m_slopeHi);
+			if (lo > hi) {
+				finish();
+				start(x, y);
+				return;
+			}
+			m_slopeLo = lo;
+			m_slopeHi = hi;
+			m_lastY = y;
+		}
+		void start(ullong x, size_t y) {
+			m_x0 = x;
+			m_y0 = y;
+			m_lastY = y;
+			m_slopeLo = 0; // monotone
+			m_slopeHi = std::numeric_limits<double>::infinity();
+			m_started = true;
+		}
+		void finish() {
+			PlaIntModel::Segment s;
+			if (m_slopeHi == std::numeric_limits<double>::infinity())
+				s.slope = m_slopeLo; // single point
+			else
+				s.slope = (m_slopeLo + m_slopeHi) / 2;
+			s.pos = uint32_t(m_y0);
+			s.lastPos = uint32_t(m_lastY);
+			segKey.push_back(m_x0);
+			seg.push_back(s);
+		}
+	};
+}
+
+PlaIntModel::PlaIntModel() {
+	m_segKey = NULL;
+	m_seg = NULL;
+	m_radix = NULL;
+	m_base = NULL;
+	m_memSize = 0;
+	m_num = 0;
+	m_eps = 0;
+	m_shift = 0;
+	m_maxKey = 0;
+	m_rows = 0;
+}
+
+void PlaIntModel::clear() {
+	m_mem.clear();
+	m_segKey = NULL;
+	m_seg = NULL;
+	m_radix = NULL;
+	m_base = NULL;
+	m_memSize = 0;
+	m_num = 0;
+	m_eps = 0;
+	m_shift = 0;
+	m_maxKey = 0;
+	m_rows = 0;
+}
+
+void PlaIntModel::setPointers(const byte* base) {
+	auto h = (const PlaHeader*)base;
+	m_num    = size_t(h->num);
+	m_maxKey = h->maxKey;
+	m_rows   = size_t(h->rows);
+	m_eps    = h->eps;
+	m_shift  = h->shift;
+	m_segKey = (const ullong*)(h + 1);
+	m_seg    = (const Segment*)(m_segKey + m_num);
+	m_radix  = (const uint32_t*)(m_seg + m_num);
+	m_base   = base;
+	m_memSize = plaMemSize(m_num, size_t(h->radixNum));
+}
+
+void PlaIntModel::build(const UintVecMin0& keys, const UintVecMin0& index, size_t eps) {
+	clear();
+	size_t rows = index.size();
+	if (0 == rows) {
+		return;
+	}
+	PlaBuilder pla(eps);
+	for (size_t i = 0; i < rows; ) {
+		ullong key = keys.get(index.get(i));
+		size_t j = i + 1;
+		while (j < rows && keys.get(index.get(j)) == key) ++j;
+		pla.add(key, i);
+		if (key != ullong(-1))
+			pla.add(key + 1, j);
+		i = j;
+	}
+	pla.finish();
+	ullong maxKey = keys.get(index.get(rows - 1));
+	size_t num = pla.seg.size();
+	size_t keyBits = maxKey ? terark_bsr_u64(maxKey) + 1 : 1;
+	size_t radixBits = std::min(keyBits, size_t(terark_bsr_u64(num) + 2));
+	radixBits = std::min(radixBits, size_t(20));
+	size_t shift = keyBits - radixBits;
+	size_t radixNum = size_t(maxKey >> shift) + 2;
+
+	m_mem.resize(plaMemSize(num, radixNum) + 64, 0);
+	byte* base = (byte*)((size_t(m_mem.data()) + 63) & ~size_t(63));
+	auto h = (PlaHeader*)base;
+	h->num = num;
+	h->maxKey = maxKey;
+	h->rows = rows;
+	h->radixNum = radixNum;
+	h->eps = uint32_t(eps);
+	h->shift = uint32_t(shift);
+	setPointers(base);
+	ullong*   segKey = const_cast<ullong*>(m_segKey);
+	Segment*  seg    = const_cast<Segment*>(m_seg);
+	uint32_t* radix  = const_cast<uint32_t*>(m_radix);
+	std::copy(pla.segKey.begin(), pla.segKey.end(), segKey);
+	std::copy(pla.seg.begin(), pla.seg.end(), seg);
+	for (size_t p = 0, k = 0; p < radixNum; ++p) {
+		while (k < num && size_t(segKey[k] >> shift) < p) ++k;
+		radix[p] = uint32_t(k);
+	}
+}
+
+void PlaIntModel::risk_set_data(const byte* mem, size_t len, size_t rows) {
+	clear();
+	assert(size_t(mem) % 64 == 0);
+	if (len < sizeof(PlaHeader)) {
+		THROW_STD(invalid_argument, "bad pla model size: %zd", len);
+	}
+	setPointers(mem);
+	if (m_memSize > len || m_rows != rows) {
+		size_t memSize = m_memSize;
+		clear();
+		THROW_STD(invalid_argument, "bad pla model: size = %zd, expect %zd",
+			len, memSize);
+	}
+}
+
+}} // namespace terark::db
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <terark/db/db_conf.hpp>
+#include <terark/valvec.hpp>
+#include <terark/bitmanip.hpp>
+#include <terark/int_vector.hpp>
+#if defined(_MSC_VER)
+	#include <xmmintrin.h>
+#endif
+
+namespace terark { namespace db {
+
+/// every m_step'th key of a sorted index, in Eytzinger(bfs) layout,
+/// searched before the bit-packed index, so the binary search on it is
+/// narrowed to one sample interval
+///
+/// serialized as |num|step|pad to 64|eytz[num+1]|rank[num+1]|, eytz[0]
+/// and rank[0] are unused, eytz is cache line aligned
+class TERARK_DB_DLL SearchAccel {
+	const ullong*   m_eytz;
+	const uint32_t* m_rank; // m_rank[k] is the sample rank of m_eytz[k]
+	const byte*     m_base;
+	size_t          m_memSize;
+	size_t          m_num;
+	size_t          m_step;
+	size_t          m_rows;
+	valvec<byte>    m_mem; // when built, not mmap'ed
+
+	void setPointers(const byte* base);
+	size_t fillEytz(const valvec<ullong>& sorted, size_t k, size_t i);
+
+public:
+	SearchAccel();
+
+	bool   empty() const { return 0 == m_num; }
+	const byte* data() const { return m_base; }
+	size_t mem_size() const { return m_memSize; }
+
+	/// keyAt(pos) is the key at pos of the sorted index, returns false if
+	/// the index is too small or the accelerator is disabled by env
+	/// TerarkDB_SearchAccelStep=0, default step is 64
+	template<class KeyAt>
+	bool build(size_t rows, KeyAt keyAt) {
+		size_t step = getStep();
+		clear();
+		if (0 == step || rows < 4 * step) {
+			return false;
+		}
+		valvec<ullong> sorted((rows + step - 1) / step, valvec_no_init());
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			sorted[i] = keyAt(i * step);
+		}
+		build(sorted, step, rows);
+		return true;
+	}
+	void build(const valvec<ullong>& sorted, size_t step, size_t rows);
+	void clear();
+
+	/// mem is in mmap and is cache line aligned
+	void risk_set_data(const byte* mem, size_t len, size_t rows);
+
+	/// samples less than key
+	size_t rankLower(ullong key) const {
+		const ullong* eytz = m_eytz;
+		size_t n = m_num, k = 1;
+		while (k <= n) {
+			// 8 keys in a cache line, prefetch the line of 3 levels down
+		#if defined(_MSC_VER)
+			_mm_prefetch((const char*)(eytz + 8*k), _MM_HINT_T0);
+		#else
+			__builtin_prefetch(eytz + 8*k);
+		#endif
+			k = 2*k + (eytz[k] < key);
+		}
+		k >>= fast_ctz64(~ullong(k)) + 1;
+		return k ? m_rank[k] : n;
+	}
+	/// samples less than or equal to key
+	size_t rankUpper(ullong key) const {
+		const ullong* eytz = m_eytz;
+		size_t n = m_num, k = 1;
+		while (k <= n) {
+		#if defined(_MSC_VER)
+			_mm_prefetch((const char*)(eytz + 8*k), _MM_HINT_T0);
+		#else
+			__builtin_prefetch(eytz + 8*k);
+		#endif
+			k = 2*k + (eytz[k] <= key);
+		}
+		k >>= fast_ctz64(~ullong(k)) + 1;
+		return k ? m_rank[k] : n;
+	}
+
+	/// the searched bound is in [*lo, *hi] if samples [0, rankLo) are
+	/// before it and samples [rankHi, num) are not
+	void narrow(size_t rankLo, size_t rankHi, size_t* lo, size_t* hi) const {
+		assert(rankLo <= rankHi);
+		*lo = rankLo ? (rankLo - 1) * m_step + 1 : 0;
+		*hi = rankHi < m_num ? rankHi * m_step : m_rows;
+	}
+
+	/// for exact keys, such as integer keys
+	void lowerBoundRange(ullong key, size_t* lo, size_t* hi) const {
+		size_t r = rankLower(key);
+		narrow(r, r, lo, hi);
+	}
+	void upperBoundRange(ullong key, size_t* lo, size_t* hi) const {
+		size_t r = rankUpper(key);
+		narrow(r, r, lo, hi);
+	}
+	/// for keys sampled by prefix, both bounds of keys with this prefix
+	/// are in the range
+	void prefixRange(ullong prefix, size_t* lo, size_t* hi) const {
+		narrow(rankLower(prefix), rankUpper(prefix), lo, hi);
+	}
+
+	static size_t getStep();
+};
+
+/// piecewise linear model of lower_bound(key) on a sorted integer index,
+/// the prediction is within m_eps of lower_bound for every integer key,
+/// not only for existing keys, segments are located by a radix table on
+/// high bits of the key
+///
+/// built by the shrinking cone on points (key, lower_bound(key)) and
+/// (key+1, upper_bound(key)) of each distinct key, lower_bound is
+/// constant between adjacent points and segments are monotone, so all
+/// keys between points are in the bound too
+///
+/// serialized as |header|segKey[num]|seg[num]|radix[radixNum]|
+class TERARK_DB_DLL PlaIntModel {
+public:
+	struct Segment {
+		double   slope;
+		uint32_t pos;     // lower_bound of segKey
+		uint32_t lastPos; // lower_bound of the last point of the segment
+	};
+private:
+	const ullong*   m_segKey;
+	const Segment*  m_seg;
+	const uint32_t* m_radix; // m_radix[p] is num of segs with key>>m_shift < p
+	const byte*     m_base;
+	size_t          m_memSize;
+	size_t          m_num;
+	size_t          m_eps;
+	size_t          m_shift;
+	ullong          m_maxKey;
+	size_t          m_rows;
+	valvec<byte>    m_mem; // when built, not mmap'ed
+
+	void setPointers(const byte* base);
+
+public:
+	PlaIntModel();
+
+	bool   empty() const { return 0 == m_num; }
+	const byte* data() const { return m_base; }
+	size_t mem_size() const { return m_memSize; }
+	size_t segNum() const { return m_num; }
+
+	/// keys[index[i]] is the i'th key in order
+	void build(const UintVecMin0& keys, const UintVecMin0& index, size_t eps);
+	void clear();
+
+	/// mem is in mmap and is cache line aligned
+	void risk_set_data(const byte* mem, size_t len, size_t rows);
+
+	void lowerBoundRange(ullong key, size_t* lo, size_t* hi) const {
+		if (key > m_maxKey) {
+			*lo = *hi = m_rows;
+			return;
+		}
+		size_t p = size_t(key >> m_shift);
+		size_t i = m_radix[p], j = m_radix[p+1];
+		while (i < j) {
+			size_t mid = (i + j) / 2;
+			if (m_segKey[mid] <= key)
+				i = mid + 1;
+			else
+				j = mid;
+		}
+		if (0 == i) { // key < m_segKey[0]
+			*lo = *hi = 0;
+			return;
+		}
+		const Segment& seg = m_seg[i-1];
+		double pred = seg.pos + seg.slope * double(key - m_segKey[i-1]);
+		pred = std::min(pred, double(seg.lastPos));
+		// 1 more for float rounding
+		size_t ipred = size_t(pred);
+		*lo = ipred > m_eps + 1 ? ipred - m_eps - 1 : 0;
+		*hi = std::min(ipred + m_eps + 2, m_rows);
+	}
+	void upperBoundRange(ullong key, size_t* lo, size_t* hi) const {
+		if (key >= m_maxKey)
+			*lo = *hi = m_rows;
+		else
+			lowerBoundRange(key + 1, lo, hi); // upper_bound(k) == lower_bound(k+1)
+	}
+};
+
+}} // namespace terark::db
@@ -0,0 +1,442 @@
+#include "trb_db_checkpoint.hpp"
+#include <terark/db/db_table.hpp>
+#include <terark/fstring.hpp>
+#include <boost/filesystem.hpp>
+#include <stdio.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace terark { namespace db { namespace trbdb {
+
+static const char g_trbImageMagic[8] = "trb-img";
+static const uint32_t g_trbImageVersion = 1;
+
+static size_t align8(size_t len)
+{
+    return (len + 7) & ~size_t(7);
+}
+
+static void syncFile(FileStream& fp, const std::string& path)
+{
+    fp.flush();
+    int fd = fileno(fp.fp());
+#if defined(_WIN32) || defined(_WIN64)
+    int err = _commit(fd);
+#elif defined(__APPLE__)
+    int err = fsync(fd);
+#else
+    int err = fdatasync(fd);
+#endif
+    if(err != 0)
+    {
+        THROW_STD(runtime_error, "sync trb file: %s = %s"
+            , path.c_str(), strerror(errno));
+    }
+}
+
+// make a rename in dir durable, windows has no directory sync
+static void syncDir(const std::string& dir)
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        THROW_STD(runtime_error, "open dir: %s = %s", dir.c_str(), strerror(errno));
+    }
+    int err = ::fsync(fd);
+    int errnum = errno;
+    ::close(fd);
+    if(err != 0)
+    {
+        THROW_STD(runtime_error, "sync dir: %s = %s", dir.c_str(), strerror(errnum));
+    }
+#endif
+}
+
+TrbImageWriter::TrbImageWriter(fstring imgPath)
+    : m_imgPath(imgPath.str())
+{
+    m_tmpPath = m_imgPath + ".tmp";
+    m_fp.open(m_tmpPath, "wb");
+    TrbImageHeader header;
+    memset(&header, 0, sizeof(header));
+    m_fp.ensureWrite(&header, sizeof(header));
+    m_size = sizeof(header);
+    m_sectionNum = 0;
+}
+
+TrbImageWriter::~TrbImageWriter()
+{
+    if(m_fp.isOpen())
+    {
+        // not committed
+        m_fp.close();
+        ::remove(m_tmpPath.c_str());
+    }
+}
+
+void TrbImageWriter::write(const void* data, size_t len)
+{
+    static const byte zeros[8] = {0};
+    uint64_t len64 = len;
+    m_fp.ensureWrite(&len64, sizeof(len64));
+    m_fp.ensureWrite(data, len);
+    m_fp.ensureWrite(zeros, align8(len) - len);
+    m_size += sizeof(len64) + align8(len);
+    m_sectionNum++;
+}
+
+void TrbImageWriter::commit(uint64_t logOffset)
+{
+    TrbImageHeader header;
+    memcpy(header.magic, g_trbImageMagic, sizeof(header.magic));
+    header.version = g_trbImageVersion;
+    header.sectionNum = m_sectionNum;
+    header.logOffset = logOffset;
+    header.imageSize = m_size;
+    m_fp.flush();
+    m_fp.pwrite(0, &header, sizeof(header));
+    // the log is truncated after commit, so the image must be durable
+    syncFile(m_fp, m_tmpPath);
+    m_fp.close();
+    fs::rename(m_tmpPath, m_imgPath);
+    std::string dir = fs::path(m_imgPath).parent_path().string();
+    syncDir(dir.empty() ? "." : dir);
+}
+
+TrbImageReader::TrbImageReader(fstring imgPath)
+    : m_mmap(imgPath.c_str())
+{
+    auto header = (const TrbImageHeader*)m_mmap.base;
+    if(m_mmap.size < sizeof(TrbImageHeader)
+       || memcmp(header->magic, g_trbImageMagic, sizeof(header->magic)) != 0)
+    {
+        THROW_STD(invalid_argument, "bad trb image: %s", imgPath.c_str());
+    }
+    if(header->version != g_trbImageVersion)
+    {
+        THROW_STD(invalid_argument, "trb image: %s, version = %u, expect %u"
+            , imgPath.c_str(), header->version, g_trbImageVersion);
+    }
+    if(header->imageSize != m_mmap.size)
+    {
+        THROW_STD(invalid_argument, "trb image: %s, size = %zd, expect %lld"
+            , imgPath.c_str(), m_mmap.size, (long long)header->imageSize);
+    }
+    m_pos = sizeof(TrbImageHeader);
+    m_sectionNum = 0;
+}
+
+fstring TrbImageReader::read()
+{
+    auto base = (const char*)m_mmap.base;
+    uint64_t len;
+    if(m_sectionNum >= header().sectionNum || m_pos + sizeof(len) > m_mmap.size)
+    {
+        THROW_STD(invalid_argument, "trb image has no more sections");
+    }
+    memcpy(&len, base + m_pos, sizeof(len));
+    m_pos += sizeof(len);
+    if(m_pos + align8(len) > m_mmap.size)
+    {
+        THROW_STD(invalid_argument, "bad trb image section length: %lld"
+            , (long long)len);
+    }
+    fstring s(base + m_pos, size_t(len));
+    m_pos += align8(len);
+    m_sectionNum++;
+    return s;
+}
+
+TrbCheckpointLog::TrbCheckpointLog(fstring logPath)
+    : m_logPath(logPath.str())
+{
+    m_imgPath = m_logPath + ".img";
+    m_fp.open(m_logPath, "a+b");
+    m_minCheckpointBytes = getEnvLong("TerarkDB_TrbCheckpointLogBytes", 32L << 20);
+}
+
+bool TrbCheckpointLog::hasImage() const
+{
+    return fs::exists(m_imgPath);
+}
+
+void TrbCheckpointLog::seekToReplay(const TrbImageHeader* header)
+{
+    uint64_t logSize = m_fp.size();
+    uint64_t offset = header ? header->logOffset : 0;
+    if(offset > logSize)
+    {
+        // crashed after log was truncated, before logOffset was reset
+        offset = 0;
+        resetImageLogOffset();
+    }
+    m_fp.seek(offset);
+}
+
+void TrbCheckpointLog::seekToAppend()
+{
+    m_fp.seek(0, SEEK_END);
+}
+
+bool TrbCheckpointLog::needsCheckpoint(uint64_t imageBytes) const
+{
+    uint64_t logSize = m_fp.tell();
+    return logSize > m_minCheckpointBytes && logSize > imageBytes;
+}
+
+void TrbCheckpointLog::truncate()
+{
+    m_fp.flush();
+    m_fp.chsize(0);
+    // if logOffset was reset but the truncation was lost, the whole old
+    // log would be replayed on the image
+    syncFile(m_fp, m_logPath);
+    m_fp.seek(0, SEEK_END);
+    resetImageLogOffset();
+}
+
+void TrbCheckpointLog::sync()
+{
+    syncFile(m_fp, m_logPath);
+}
+
+void TrbCheckpointLog::resetImageLogOffset()
+{
+    uint64_t logOffset = 0;
+    FileStream img(m_imgPath, "rb+");
+    img.pwrite(offsetof(TrbImageHeader, logOffset), &logOffset, sizeof(logOffset));
+}
+
+// keeps the owner of the log alive until the checkpoint is done
+class TrbCheckpointTask : public BgTask
+{
+    boost::intrusive_ptr<RefCounter> m_owner;
+    TrbLogWriter* m_writer;
+
+public:
+    explicit TrbCheckpointTask(TrbLogWriter* w)
+        : BgTask(Flush, w->logOwner())
+        , m_owner(w->logOwner())
+        , m_writer(w)
+    {
+    }
+    void execute() override
+    {
+        m_writer->runCheckpoint();
+    }
+    void cancel() override
+    {
+        m_writer->m_checkpointQueued = false;
+    }
+};
+
+TrbLogWriter::TrbLogWriter(fstring logPath, TrbLogGroup* logGroup)
+    : m_logGroup(logGroup)
+    , m_logDirty(false)
+    , m_logBufBytes(0)
+    , m_checkpointQueued(false)
+    , m_logUnsynced(false)
+    , m_log(logPath)
+{
+}
+
+TrbLogWriter::~TrbLogWriter()
+{
+}
+
+// called with m_rwMutex locked, at most one checkpoint of a log is queued
+void TrbLogWriter::maybeCheckpoint()
+{
+    if(!m_log.needsCheckpoint(imageBytes()) || m_checkpointQueued.exchange(true))
+    {
+        return;
+    }
+    if(!DbTable::submitBgTask(new TrbCheckpointTask(this)))
+    {
+        // stopping, the log is replayed on next open
+        m_checkpointQueued = false;
+    }
+}
+
+// writers of this log wait until the log is truncated
+void TrbLogWriter::runCheckpoint()
+{
+    tbb::spin_rw_mutex::scoped_lock lock(m_rwMutex, false);
+    std::lock_guard<std::mutex> logLock(m_logMutex);
+    m_checkpointQueued = false;
+    if(m_log.needsCheckpoint(imageBytes()))
+    {
+        checkpoint();
+        m_logBufBytes.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TrbLogWriter::writeLog()
+{
+    if(m_logGroup == NULL)
+    {
+        m_out.flush();
+        maybeCheckpoint();
+        return;
+    }
+    size_t bufBytes = m_out.bufpos();
+    if(bufBytes < m_logBufBytes.load(std::memory_order_relaxed))
+    {
+        // m_out was flushed because it is full, this is the only flush
+        // when sync mode is none
+        maybeCheckpoint();
+    }
+    m_logBufBytes.store(bufBytes, std::memory_order_relaxed);
+    if(!m_logDirty.exchange(true))
+    {
+        m_logGroup->addDirty(this);
+    }
+}
+
+void TrbLogWriter::flushLog()
+{
+    tbb::spin_rw_mutex::scoped_lock lock(m_rwMutex, false);
+    std::lock_guard<std::mutex> logLock(m_logMutex);
+    m_out.flush();
+    m_logBufBytes.store(0, std::memory_order_relaxed);
+    maybeCheckpoint();
+}
+
+TrbLogGroup::TrbLogGroup()
+{
+    m_flushedSeq = 0;
+    m_syncedSeq = 0;
+    m_syncMode = syncGroup;
+    if(const char* env = getenv("TerarkDB_TrbLogSync"))
+    {
+        if(strcmp(env, "none") == 0)
+            m_syncMode = syncNone;
+        else if(strcmp(env, "group") == 0)
+            m_syncMode = syncGroup;
+        else if(strcmp(env, "commit") == 0)
+            m_syncMode = syncCommit;
+        else
+            fprintf(stderr, "WARN: TerarkDB_TrbLogSync=%s is invalid, use group\n", env);
+    }
+    m_groupBytes = size_t(getEnvLong("TerarkDB_TrbLogGroupBytes", 0));
+    m_groupMicros = std::chrono::microseconds(getEnvLong("TerarkDB_TrbLogGroupMicros", 0));
+    m_lastFlush = std::chrono::steady_clock::now();
+}
+
+TrbLogGroup::~TrbLogGroup()
+{
+    // writers are still alive, they are released by the segment base
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> flushLock(m_flushMutex);
+        seq = flushDirty();
+    }
+    sync(seq);
+}
+
+void TrbLogGroup::addDirty(TrbLogWriter* w)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_dirty.push_back(w);
+}
+
+// m_flushMutex must be held, so a commit whose logs were taken by
+// another flusher waits here until they are written
+uint64_t TrbLogGroup::flushDirty()
+{
+    valvec<TrbLogWriter*> dirty;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        dirty.swap(m_dirty);
+    }
+    if(dirty.empty())
+    {
+        return m_flushedSeq;
+    }
+    for(TrbLogWriter* w : dirty)
+    {
+        w->m_logDirty = false;
+    }
+    for(TrbLogWriter* w : dirty)
+    {
+        w->flushLog();
+    }
+    m_lastFlush = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(TrbLogWriter* w : dirty)
+    {
+        if(!w->m_logUnsynced)
+        {
+            w->m_logUnsynced = true;
+            m_unsynced.push_back(w);
+        }
+    }
+    return ++m_flushedSeq;
+}
+
+uint64_t TrbLogGroup::flush()
+{
+    if(m_syncMode == syncNone)
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> flushLock(m_flushMutex);
+    if(m_syncMode == syncGroup)
+    {
+        size_t bytes = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(TrbLogWriter* w : m_dirty)
+            {
+                bytes += w->m_logBufBytes.load(std::memory_order_relaxed);
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if(bytes < m_groupBytes && now - m_lastFlush < m_groupMicros)
+        {
+            return 0;
+        }
+        flushDirty();
+        return 0;
+    }
+    return flushDirty();
+}
+
+void TrbLogGroup::sync(uint64_t seq)
+{
+    if(m_syncMode != syncCommit || seq == 0)
+    {
+        return;
+    }
+    // the first waiter syncs for all commits flushed before it
+    std::lock_guard<std::mutex> syncLock(m_syncMutex);
+    if(m_syncedSeq >= seq)
+    {
+        return;
+    }
+    valvec<TrbLogWriter*> unsynced;
+    uint64_t flushedSeq;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        unsynced.swap(m_unsynced);
+        for(TrbLogWriter* w : unsynced)
+        {
+            w->m_logUnsynced = false;
+        }
+        flushedSeq = m_flushedSeq;
+    }
+    for(TrbLogWriter* w : unsynced)
+    {
+        w->m_log.sync();
+    }
+    m_syncedSeq = flushedSeq;
+}
+
+}}} // namespace terark::db::trbdb
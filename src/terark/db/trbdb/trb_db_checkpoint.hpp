@@ -0,0 +1,215 @@
+#pragma once
+
+#include <terark/db/db_conf.hpp>
+#include <terark/io/FileStream.hpp>
+#include <terark/io/StreamBuffer.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/util/mmap.hpp>
+#include <tbb/spin_rw_mutex.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace terark { namespace db { namespace trbdb {
+
+// checkpoint image of a trb op log
+//
+// the image is a header followed by sections, each section is
+// |uint64 length|bytes|padding to 8|, so the image can be used by mmap
+//
+// checkpoint steps:
+//   1. write image to "log.img.tmp", header.logOffset = current log size
+//   2. fsync "log.img.tmp", rename it to "log.img", fsync the directory
+//   3. truncate log to 0 and fdatasync it
+//   4. set header.logOffset = 0
+// if crashed between 3 and 4, log size < header.logOffset, the whole log
+// is the tail, and header.logOffset is fixed on open
+struct TrbImageHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t sectionNum;
+    uint64_t logOffset; // replay log from logOffset
+    uint64_t imageSize;
+};
+
+class TERARK_DB_DLL TrbImageWriter
+{
+    FileStream m_fp;
+    uint64_t   m_size;
+    uint32_t   m_sectionNum;
+    std::string m_tmpPath;
+    std::string m_imgPath;
+
+public:
+    explicit TrbImageWriter(fstring imgPath);
+    ~TrbImageWriter();
+
+    void write(const void* data, size_t len);
+    template<class T>
+    void write_pod(const T& x)
+    {
+        write(&x, sizeof(T));
+    }
+    // write header, rename tmp file to image file, the image is durable
+    // when it returns
+    void commit(uint64_t logOffset);
+};
+
+class TERARK_DB_DLL TrbImageReader
+{
+    MmapWholeFile m_mmap;
+    size_t m_pos;
+    uint32_t m_sectionNum;
+
+public:
+    explicit TrbImageReader(fstring imgPath);
+
+    const TrbImageHeader& header() const
+    {
+        return *(const TrbImageHeader*)m_mmap.base;
+    }
+    fstring read();
+    template<class T>
+    void read_pod(T* x)
+    {
+        fstring s = read();
+        if(s.size() != sizeof(T))
+        {
+            THROW_STD(invalid_argument, "bad trb image section size: %zd, expect %zd"
+                , s.size(), sizeof(T));
+        }
+        memcpy(x, s.data(), sizeof(T));
+    }
+};
+
+// op log of TrbWritableStore and TrbWritableIndex, ops before the
+// checkpoint image are truncated from the log
+class TERARK_DB_DLL TrbCheckpointLog
+{
+    FileStream  m_fp;
+    std::string m_logPath;
+    std::string m_imgPath;
+    uint64_t    m_minCheckpointBytes;
+
+    void resetImageLogOffset();
+
+public:
+    explicit TrbCheckpointLog(fstring logPath);
+
+    FileStream& fp() { return m_fp; }
+    const std::string& imagePath() const { return m_imgPath; }
+
+    bool hasImage() const;
+    // fix logOffset of image header if needed, and seek log to it
+    void seekToReplay(const TrbImageHeader* header);
+    // seek log to end after replay for appending
+    void seekToAppend();
+
+    // log should be checkpointed when it is larger than the image
+    bool needsCheckpoint(uint64_t imageBytes) const;
+    // call after image is committed, the truncation is durable
+    void truncate();
+    // fdatasync the log file
+    void sync();
+};
+
+class TrbLogGroup;
+class TrbCheckpointTask;
+
+// owner of a checkpoint log, ops are written to m_out and flushed by
+// the log group of the segment on commit, or flushed immediately if
+// there is no log group
+//
+// ops hold m_rwMutex as writer while changing data and m_out, readers
+// and log flushes hold it as reader, flushes of one log are serialized
+// by m_logMutex
+//
+// checkpoints run in background tasks of DbTable::submitBgTask, so a
+// commit never writes an image
+class TERARK_DB_DLL TrbLogWriter
+{
+    friend class TrbLogGroup;
+    friend class TrbCheckpointTask;
+    TrbLogGroup*        m_logGroup;
+    std::atomic<bool>   m_logDirty;
+    std::atomic<size_t> m_logBufBytes;
+    std::atomic<bool>   m_checkpointQueued;
+    bool                m_logUnsynced; // guarded by TrbLogGroup::m_mutex
+    std::mutex          m_logMutex;
+
+    void maybeCheckpoint();
+    void runCheckpoint();
+
+protected:
+    mutable tbb::spin_rw_mutex m_rwMutex;
+    TrbCheckpointLog m_log;
+    NativeDataOutput<OutputBuffer> m_out;
+
+    // called with m_rwMutex locked as reader and m_logMutex locked
+    virtual void checkpoint() = 0;
+    virtual uint64_t imageBytes() const = 0;
+    // the object which owns this log, it is kept alive by a queued
+    // checkpoint task
+    virtual RefCounter* logOwner() = 0;
+
+    // call with m_rwMutex locked as writer, after an op is written to m_out,
+    // a checkpoint is queued when the log file grows in any sync mode
+    void writeLog();
+    // write buffered ops to log file, queue a checkpoint if needed
+    void flushLog();
+
+public:
+    TrbLogWriter(fstring logPath, TrbLogGroup* logGroup);
+    virtual ~TrbLogWriter();
+};
+
+// logs of a segment, writers in one commit window share one flush and
+// one fdatasync, durability is set by env TerarkDB_TrbLogSync:
+//   none   : logs are flushed when buffers are full
+//   group  : flush on commit when TerarkDB_TrbLogGroupBytes are buffered
+//            or TerarkDB_TrbLogGroupMicros are elapsed, the default
+//            (both are 0) flushes on every commit
+//   commit : flush and fdatasync on commit
+class TERARK_DB_DLL TrbLogGroup
+{
+public:
+    enum SyncMode
+    {
+        syncNone,
+        syncGroup,
+        syncCommit,
+    };
+
+private:
+    friend class TrbLogWriter;
+    valvec<TrbLogWriter*> m_dirty;    // guarded by m_mutex
+    valvec<TrbLogWriter*> m_unsynced; // guarded by m_mutex
+    std::mutex m_mutex;
+    std::mutex m_flushMutex;
+    std::mutex m_syncMutex;
+    uint64_t   m_flushedSeq;
+    uint64_t   m_syncedSeq;
+    SyncMode   m_syncMode;
+    size_t     m_groupBytes;
+    std::chrono::microseconds m_groupMicros;
+    std::chrono::steady_clock::time_point m_lastFlush;
+
+    void addDirty(TrbLogWriter*);
+    uint64_t flushDirty();
+
+public:
+    TrbLogGroup();
+    ~TrbLogGroup();
+
+    SyncMode syncMode() const { return m_syncMode; }
+
+    // flush dirty logs by sync mode, returns the seq to pass to sync(),
+    // logs dirtied by the caller are flushed when it returns
+    uint64_t flush();
+    // fdatasync logs flushed up to seq, need not be serialized
+    void sync(uint64_t seq);
+    void commit() { sync(flush()); }
+};
+
+}}} // namespace terark::db::trbdb
@@ -5,6 +5,7 @@
 #include <terark/io/StreamBuffer.hpp>
 #include <terark/io/DataIO.hpp>
 #include <terark/io/var_int.hpp>
+#include "trb_db_checkpoint.hpp"
 #include <type_traits>
 #include <tbb/mutex.h>
 #include <terark/threaded_rb_tree.h>
@@ -36,7 +37,7 @@ class TrbIndexStoreIterBackward;
 // numeric
 
 template<class Key, class Fixed>
-class TrbWritableIndexTemplate : public TrbWritableIndex
+class TrbWritableIndexTemplate : public TrbWritableIndex, public TrbLogWriter
 {
     friend class TrbIndexIterForward<Key, Fixed>;
     friend class TrbIndexIterBackward<Key, Fixed>;
@@ -379,6 +380,49 @@ class TrbWritableIndexTemplate : public TrbWritableIndex
             index.shrink_to_fit();
             data.shrink_to_fit();
         }
+        // equal keys share one item (see store_cover), they are adjacent
+        // in tree order, so items are compacted by an in order walk
+        void save_image(TrbImageWriter &img) const
+        {
+            valvec<element_type> new_index(index);
+            valvec<byte> new_data(data.size() - data.free_size(), valvec_reserve());
+            for(auto &e : new_index)
+            {
+                e.offset = 0xFFFFFFFFU;
+            }
+            uint32_t old_offset = 0xFFFFFFFFU, new_offset = 0xFFFFFFFFU;
+            for(size_type i = root.get_most_left(const_deref_node(*this))
+                ; i != node_type::nil_sentinel
+                ; i = threaded_rb_tree_move_next(i, const_deref_node(*this)))
+            {
+                if(index[i].offset != old_offset)
+                {
+                    byte const *ptr = data.at<data_object>(index[i].offset).data, *end_ptr;
+                    size_type len = load_var_uint32(ptr, &end_ptr);
+                    old_offset = index[i].offset;
+                    new_offset = uint32_t(new_data.size());
+                    new_data.append(ptr, pool_type::align_to(end_ptr - ptr + len));
+                }
+                new_index[i].offset = new_offset;
+            }
+            img.write_pod(root);
+            img.write_pod(uint64_t(total));
+            img.write(new_index.data(), new_index.used_mem_size());
+            img.write(new_data.data(), new_data.size());
+        }
+        void load_image(TrbImageReader &img)
+        {
+            uint64_t total64;
+            img.read_pod(&root);
+            img.read_pod(&total64);
+            fstring index_image = img.read();
+            fstring data_image = img.read();
+            total = size_type(total64);
+            index.assign((element_type const *)index_image.data(), index_image.size() / sizeof(element_type));
+            data.erase_all();
+            data.resize_no_init(data_image.size());
+            std::memcpy(data.data(), data_image.data(), data_image.size());
+        }
     };
     struct fixed_storage_type
     {
@@ -531,6 +575,28 @@ class TrbWritableIndexTemplate : public TrbWritableIndex
             index.shrink_to_fit();
             data.shrink_to_fit();
         }
+        void save_image(TrbImageWriter &img) const
+        {
+            img.write_pod(root);
+            img.write_pod(uint64_t(key_length));
+            img.write(index.data(), index.used_mem_size());
+            img.write(data.data(), data.size());
+        }
+        void load_image(TrbImageReader &img)
+        {
+            uint64_t length;
+            img.read_pod(&root);
+            img.read_pod(&length);
+            if(length != key_length)
+            {
+                THROW_STD(invalid_argument, "trb image key length = %lld, expect %zd"
+                    , (long long)length, key_length);
+            }
+            fstring index_image = img.read();
+            fstring data_image = img.read();
+            index.assign((node_type const *)index_image.data(), index_image.size() / sizeof(node_type));
+            data.assign((byte const *)data_image.data(), data_image.size());
+        }
     };
     struct aligned_fixed_storage_type
     {
@@ -689,6 +755,25 @@ class TrbWritableIndexTemplate : public TrbWritableIndex
         {
             index.shrink_to_fit();
         }
+        void save_image(TrbImageWriter &img) const
+        {
+            img.write_pod(root);
+            img.write_pod(uint64_t(element_length));
+            img.write(index.data(), index.size());
+        }
+        void load_image(TrbImageReader &img)
+        {
+            uint64_t length;
+            img.read_pod(&root);
+            img.read_pod(&length);
+            if(length != element_length)
+            {
+                THROW_STD(invalid_argument, "trb image element length = %lld, expect %zd"
+                    , (long long)length, element_length);
+            }
+            fstring index_image = img.read();
+            index.assign((byte const *)index_image.data(), index_image.size());
+        }
     };
 
     template<class T, class Unused>
@@ -724,9 +809,6 @@ class TrbWritableIndexTemplate : public TrbWritableIndex
     >::type key_compare_type;
 
     storage_type m_storage;
-    FileStream m_fp;
-    NativeDataOutput<OutputBuffer> m_out;
-    mutable SpinRwMutex m_rwMutex;
 
     static std::string fixFilePath(PathRef fpath)
     {
@@ -736,14 +818,25 @@ class TrbWritableIndexTemplate : public TrbWritableIndex
     }
 
 public:
-    explicit TrbWritableIndexTemplate(PathRef fpath, size_type fixedLen, bool isUnique)
-        : m_storage(fixedLen)
-        , m_fp(fixFilePath(fpath).c_str(), "wb")
+    TrbWritableIndexTemplate(PathRef fpath, size_type fixedLen, bool isUnique, TrbLogGroup* logGroup)
+        : TrbLogWriter(fixFilePath(fpath), logGroup)
+        , m_storage(fixedLen)
     {
         ReadableIndex::m_isUnique = isUnique;
 
-        m_fp.disbuf();
-        NativeDataInput<InputBuffer> in; in.attach(&m_fp);
+        FileStream &fp = m_log.fp();
+        fp.disbuf();
+        if(m_log.hasImage())
+        {
+            TrbImageReader img(m_log.imagePath());
+            m_storage.load_image(img);
+            m_log.seekToReplay(&img.header());
+        }
+        else
+        {
+            m_log.seekToReplay(NULL);
+        }
+        NativeDataInput<InputBuffer> in; in.attach(&fp);
         uint32_t index_remove_replace, replace;
         std::string key;
         try
@@ -790,7 +883,28 @@ public:
         {
             (void)e;//shut up !
         }
-        m_out.attach(&m_fp);
+        m_log.seekToAppend();
+        m_out.attach(&fp);
+    }
+
+    // the image is written by a background task while readers are
+    // searching m_storage, writers are blocked until the log is truncated
+    void checkpoint() override
+    {
+        m_out.flush();
+        uint64_t logOffset = m_log.fp().tell();
+        TrbImageWriter img(m_log.imagePath());
+        m_storage.save_image(img);
+        img.commit(logOffset);
+        m_log.truncate();
+    }
+    uint64_t imageBytes() const override
+    {
+        return m_storage.memory_size();
+    }
+    RefCounter* logOwner() override
+    {
+        return this;
     }
     void save(PathRef) const override
     {
@@ -817,14 +931,16 @@ public:
 
     bool remove(fstring key, llong id, DbContext*) override
     {
+        SpinRwLock lock(m_rwMutex, true);
         assert(m_storage.key(id) == key);
         m_storage.template remove<key_compare_type>(id);
         m_out << (uint32_t(id) | 0x80000000U);
-        m_out.flush();
+        writeLog();
         return true;
     }
     bool insert(fstring key, llong id, DbContext*) override
     {
+        SpinRwLock lock(m_rwMutex, true);
         if(m_isUnique)
         {
             if(!m_storage.template store_check<key_compare_type>(id, key))
@@ -837,26 +953,29 @@ public:
             m_storage.template store_cover<key_compare_type>(id, key);
         }
         m_out << uint32_t(id) << key;
-        m_out.flush();
+        writeLog();
         return true;
     }
     bool replace(fstring key, llong oldId, llong newId, DbContext*) override
     {
+        SpinRwLock lock(m_rwMutex, true);
         assert(key == m_storage.key(oldId));
         m_storage.template store_cover<key_compare_type>(newId, key);
         m_storage.template remove<key_compare_type>(oldId);
         m_out << uint32_t(newId) << uint32_t(oldId);
-        m_out.flush();
+        writeLog();
         return true;
     }
 
     void clear() override
     {
+        SpinRwLock lock(m_rwMutex, true);
         m_storage.clear();
     }
 
     void searchExactAppend(fstring key, valvec<llong>* recIdvec, DbContext*) const override
     {
+        SpinRwLock lock(m_rwMutex, false);
         size_type lower, upper;
         threaded_rb_tree_equal_range(m_storage.root,
                                      const_deref_node(m_storage),
@@ -888,6 +1007,7 @@ public:
     }
     void getValueAppend(llong id, valvec<byte>* val, DbContext*) const override
     {
+        SpinRwLock lock(m_rwMutex, false);
         fstring key = m_storage.key(size_t(id));
         val->append(key.begin(), key.end());
     }
@@ -903,6 +1023,7 @@ public:
 
     llong append(fstring row, DbContext*) override
     {
+        SpinRwLock lock(m_rwMutex, true);
         size_t id = m_storage.max_index();
         if(m_isUnique)
         {
@@ -915,11 +1036,12 @@ public:
             m_storage.template store_cover<key_compare_type>(id, row);
         }
         m_out << uint32_t(id) << row;
-        m_out.flush();
+        writeLog();
         return llong(id);
     }
     void update(llong id, fstring row, DbContext*) override
     {
+        SpinRwLock lock(m_rwMutex, true);
         if(m_isUnique)
         {
             bool success = m_storage.template store_check<key_compare_type>(id, row);
@@ -931,17 +1053,19 @@ public:
             m_storage.template store_cover<key_compare_type>(id, row);
         }
         m_out << uint32_t(id) << row;
-        m_out.flush();
+        writeLog();
     }
     void remove(llong id, DbContext*) override
     {
+        SpinRwLock lock(m_rwMutex, true);
         m_storage.template remove<key_compare_type>(id);
         m_out << (uint32_t(id) | 0x80000000U);
-        m_out.flush();
+        writeLog();
     }
 
     void shrinkToFit() override
     {
+        SpinRwLock lock(m_rwMutex, true);
         m_storage.shrink_to_fit();
     }
 
@@ -983,6 +1107,7 @@ public:
     {
         m_isUniqueInSchema = unique;
         owner.reset(const_cast<owner_t *>(o));
+        SpinRwLock lock(o->m_rwMutex, false);
         where = o->m_storage.root.get_most_left(owner_t::const_deref_node(o->m_storage));
     }
 
@@ -990,11 +1115,13 @@ public:
     void reset() override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         where = o->m_storage.root.get_most_left(owner_t::const_deref_node(o->m_storage));
     }
     bool increment(llong* id, valvec<byte>* key) override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         if(terark_likely(where != owner_t::node_type::nil_sentinel))
         {
             auto storage_key = o->m_storage.key(where);
@@ -1012,6 +1139,7 @@ public:
     int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         where = threaded_rb_tree_lower_bound(o->m_storage.root,
                                              owner_t::const_deref_node(o->m_storage),
                                              key,
@@ -1038,6 +1166,7 @@ public:
     int seekUpperBound(fstring key, llong* id, valvec<byte>* retKey) override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         where = threaded_rb_tree_upper_bound(o->m_storage.root,
                                              owner_t::const_deref_node(o->m_storage),
                                              key,
@@ -1068,6 +1197,7 @@ public:
     {
         m_isUniqueInSchema = unique;
         owner.reset(const_cast<owner_t *>(o));
+        SpinRwLock lock(o->m_rwMutex, false);
         where = o->m_storage.root.get_most_left(owner_t::const_deref_node(o->m_storage));
     }
 
@@ -1075,11 +1205,13 @@ public:
     void reset() override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         where = o->m_storage.root.get_most_left(owner_t::const_deref_node(o->m_storage));
     }
     bool increment(llong* id, valvec<byte>* key) override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         if(terark_likely(where != owner_t::node_type::nil_sentinel))
         {
             auto storage_key = o->m_storage.key(where);
@@ -1097,6 +1229,7 @@ public:
     int seekLowerBound(fstring key, llong* id, valvec<byte>* retKey) override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         where = threaded_rb_tree_reverse_lower_bound(o->m_storage.root,
                                                      owner_t::const_deref_node(o->m_storage),
                                                      key,
@@ -1123,6 +1256,7 @@ public:
     int seekUpperBound(fstring key, llong* id, valvec<byte>* retKey) override
     {
         auto const *o = owner.get();
+        SpinRwLock lock(o->m_rwMutex, false);
         where = threaded_rb_tree_reverse_upper_bound(o->m_storage.root,
                                                      owner_t::const_deref_node(o->m_storage),
                                                      key,
@@ -1155,6 +1289,7 @@ public:
     bool increment(llong* id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         size_t max = o->m_storage.max_index();
         while(m_where < max)
         {
@@ -1172,6 +1307,7 @@ public:
     bool seekExact(llong id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         if(id < 0 || id >= llong(o->m_storage.max_index()))
         {
             THROW_STD(out_of_range, "Invalid id = %lld, rows = %zd"
@@ -1205,6 +1341,7 @@ public:
     bool increment(llong* id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         while(m_where > 0)
         {
             size_t k = --m_where;
@@ -1221,6 +1358,7 @@ public:
     bool seekExact(llong id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         if(id < 0 || id >= llong(o->m_storage.max_index()))
         {
             THROW_STD(out_of_range, "Invalid id = %lld, rows = %zd"
@@ -1240,13 +1378,13 @@ public:
     }
 };
 
-TrbWritableIndex *TrbWritableIndex::createIndex(Schema const &schema, PathRef fpath)
+TrbWritableIndex *TrbWritableIndex::createIndex(Schema const &schema, PathRef fpath, TrbLogGroup* logGroup)
 {
     if(schema.columnNum() == 1)
     {
         ColumnMeta cm = schema.getColumnMeta(0);
 #define CASE_COL_TYPE(Enum, Type) \
-    case ColumnType::Enum: return new TrbWritableIndexTemplate<Type, std::false_type>(fpath, schema.getFixedRowLen(), schema.m_isUnique);
+    case ColumnType::Enum: return new TrbWritableIndexTemplate<Type, std::false_type>(fpath, schema.getFixedRowLen(), schema.m_isUnique, logGroup);
         //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
         switch(cm.type)
         {
@@ -1266,11 +1404,11 @@ TrbWritableIndex *TrbWritableIndex::createIndex(Schema const &schema, PathRef fp
     }
     if(schema.getFixedRowLen() != 0)
     {
-        return new TrbWritableIndexTemplate<void, std::true_type>(fpath, schema.getFixedRowLen(), schema.m_isUnique);
+        return new TrbWritableIndexTemplate<void, std::true_type>(fpath, schema.getFixedRowLen(), schema.m_isUnique, logGroup);
     }
     else
     {
-        return new TrbWritableIndexTemplate<void, std::false_type>(fpath, schema.getFixedRowLen(), schema.m_isUnique);
+        return new TrbWritableIndexTemplate<void, std::false_type>(fpath, schema.getFixedRowLen(), schema.m_isUnique, logGroup);
     }
 }
 
@@ -6,9 +6,11 @@
 
 namespace terark { namespace db { namespace trbdb {
 
+class TrbLogGroup;
+
 class TERARK_DB_DLL TrbWritableIndex : public ReadableIndex, public WritableIndex, public ReadableStore, public WritableStore {
 public:
-    static TrbWritableIndex *createIndex(Schema const &, PathRef);
+    static TrbWritableIndex *createIndex(Schema const &, PathRef, TrbLogGroup* logGroup = NULL);
 };
 typedef boost::intrusive_ptr<TrbWritableIndex> TrbWritableIndexPtr;
 
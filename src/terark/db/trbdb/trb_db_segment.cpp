@@ -5,6 +5,8 @@
 #include <terark/db/fixed_len_store.hpp>
 #include <terark/num_to_str.hpp>
 #include <boost/scope_exit.hpp>
+#include <terark/gold_hash_map.hpp>
+#include <algorithm>
 
 #undef min
 #undef max
@@ -14,84 +16,353 @@ namespace terark { namespace db { namespace trbdb {
 
 TERARK_DB_REGISTER_SEGMENT(TrbColgroupSegment, "trbdb", "trb");
 
-class MutexLockTransaction : public DbTransaction
+// optimistic transaction, ops are kept in a write set, reads in the
+// transaction see its own writes, on commit the rows read and the unique
+// keys inserted are validated, then the write set is applied
+class TrbColgroupSegment::TrbDbTransaction : public DbTransaction
 {
+    enum OpType : byte
+    {
+        opIndexRemove,
+        opIndexInsert,
+        opIndexUpsert,
+        opStoreRemove,
+        opStoreUpsert,
+    };
+    struct WriteOp
+    {
+        OpType   type;
+        uint32_t indexId;
+        uint32_t prevSameKey; // previous op on (indexId, key)
+        llong    recId;
+        size_t   offset;      // key or row in m_opData
+        size_t   length;
+    };
+    struct ReadRow
+    {
+        llong    recId;
+        size_t   offset;      // row in m_opData
+        size_t   length;
+    };
+    static const uint32_t nil = uint32_t(-1);
+
     const SchemaConfig& m_sconf;
     TrbColgroupSegment *m_seg;
     DbContext          *m_ctx;
+    valvec<WriteOp>     m_ops;
+    valvec<ReadRow>     m_reads;
+    valvec<byte>        m_opData;
+    hash_strmap<uint32_t>         m_keyOps; // (indexId, key) -> last op
+    gold_hash_map<llong, uint32_t> m_rowOps; // recId -> last store op
+    valvec<uint32_t>    m_opChain;
+    valvec<size_t>      m_stripes;
+    valvec<llong>       m_hits;
+    valvec<byte>        m_keyBuf;
+    valvec<byte>        m_rowBuf;
+    std::string         m_strError;
+
+    fstring opData(size_t offset, size_t length) const
+    {
+        return fstring(m_opData.data() + offset, length);
+    }
+    fstring makeKeyOpsKey(size_t indexId, fstring key)
+    {
+        uint32_t indexId32 = uint32_t(indexId);
+        m_keyBuf.erase_all();
+        m_keyBuf.append((const byte*)&indexId32, sizeof(indexId32));
+        m_keyBuf.append(key.udata(), key.size());
+        return m_keyBuf;
+    }
+    void pushOp(OpType type, size_t indexId, llong recId, fstring data)
+    {
+        uint32_t opIdx = uint32_t(m_ops.size());
+        WriteOp op;
+        op.type = type;
+        op.indexId = uint32_t(indexId);
+        op.prevSameKey = nil;
+        op.recId = recId;
+        op.offset = m_opData.size();
+        op.length = data.size();
+        m_opData.append(data.udata(), data.size());
+        if(type == opIndexRemove || type == opIndexInsert)
+        {
+            auto ib = m_keyOps.insert_i(makeKeyOpsKey(indexId, data), opIdx);
+            if(!ib.second)
+            {
+                op.prevSameKey = m_keyOps.val(ib.first);
+                m_keyOps.val(ib.first) = opIdx;
+            }
+        }
+        else if(type == opStoreRemove || type == opStoreUpsert)
+        {
+            m_rowOps[recId] = opIdx;
+        }
+        m_ops.push_back(op);
+    }
+    // ops on (indexId, key) in write order
+    void getKeyChain(uint32_t lastOp)
+    {
+        m_opChain.erase_all();
+        for(uint32_t i = lastOp; i != nil; i = m_ops[i].prevSameKey)
+        {
+            m_opChain.push_back(i);
+        }
+        std::reverse(m_opChain.begin(), m_opChain.end());
+    }
+    static void applyKeyOp(const WriteOp& op, valvec<llong>* recIdvec)
+    {
+        if(op.type == opIndexInsert)
+        {
+            recIdvec->push_back(op.recId);
+            return;
+        }
+        for(size_t i = 0; i < recIdvec->size(); ++i)
+        {
+            if((*recIdvec)[i] == op.recId)
+            {
+                (*recIdvec)[i] = recIdvec->back();
+                recIdvec->pop_back();
+                break;
+            }
+        }
+    }
+    // committed hits of key, adjusted by the write set
+    void searchWithOps(size_t indexId, fstring key, valvec<llong>* recIdvec)
+    {
+        m_seg->m_indices[indexId]->searchExact(key, recIdvec, m_ctx);
+        size_t found = m_keyOps.find_i(makeKeyOpsKey(indexId, key));
+        if(found == m_keyOps.end_i())
+        {
+            return;
+        }
+        getKeyChain(m_keyOps.val(found));
+        for(uint32_t i : m_opChain)
+        {
+            applyKeyOp(m_ops[i], recIdvec);
+        }
+    }
+    void clearWriteSet()
+    {
+        m_ops.erase_all();
+        m_reads.erase_all();
+        m_opData.erase_all();
+        m_keyOps.erase_all();
+        m_rowOps.erase_all();
+    }
+
+    void lockStripes()
+    {
+        m_stripes.erase_all();
+        for(const WriteOp& op : m_ops)
+        {
+            m_stripes.push_back(size_t(op.recId) % TxnStripeNum);
+            if(op.type == opIndexInsert && m_sconf.getIndexSchema(op.indexId).m_isUnique)
+            {
+                fstring key = opData(op.offset, op.length);
+                m_stripes.push_back((fstring_func::hash()(key) + op.indexId) % TxnStripeNum);
+            }
+        }
+        for(const ReadRow& r : m_reads)
+        {
+            m_stripes.push_back(size_t(r.recId) % TxnStripeNum);
+        }
+        sort_a(m_stripes);
+        m_stripes.trim(unique_a(m_stripes));
+        for(size_t stripe : m_stripes)
+        {
+            m_seg->m_txnStripes[stripe].lock();
+        }
+    }
+    void unlockStripes()
+    {
+        for(size_t stripe : m_stripes)
+        {
+            m_seg->m_txnStripes[stripe].unlock();
+        }
+        m_stripes.erase_all();
+    }
+    bool validate()
+    {
+        for(const ReadRow& r : m_reads)
+        {
+            m_seg->getValue(r.recId, &m_rowBuf, m_ctx);
+            if(fstring(m_rowBuf) != opData(r.offset, r.length))
+            {
+                char szIdstr[96];
+                snprintf(szIdstr, sizeof(szIdstr), "subId = %lld", r.recId);
+                m_strError = "row is changed by another transaction, ";
+                m_strError += szIdstr;
+                return false;
+            }
+        }
+        for(size_t i = 0; i < m_keyOps.end_i(); ++i)
+        {
+            const WriteOp& last = m_ops[m_keyOps.val(i)];
+            const Schema& iSchema = m_sconf.getIndexSchema(last.indexId);
+            if(!iSchema.m_isUnique)
+            {
+                continue;
+            }
+            fstring key = opData(last.offset, last.length);
+            m_seg->m_indices[last.indexId]->searchExact(key, &m_hits, m_ctx);
+            getKeyChain(m_keyOps.val(i));
+            for(uint32_t j : m_opChain)
+            {
+                if(m_ops[j].type == opIndexInsert && !m_hits.empty())
+                {
+                    m_strError = "DupKey=" + iSchema.toJsonStr(key)
+                               + ", inserted by another transaction";
+                    return false;
+                }
+                applyKeyOp(m_ops[j], &m_hits);
+            }
+        }
+        return true;
+    }
+    void apply()
+    {
+        for(const WriteOp& op : m_ops)
+        {
+            fstring data = opData(op.offset, op.length);
+            auto& index = m_seg->m_indices[op.indexId];
+            switch(op.type)
+            {
+            case opIndexRemove:
+                index->getWritableIndex()->remove(data, op.recId, m_ctx);
+                break;
+            case opIndexInsert:
+                {
+                    bool success = index->getWritableIndex()->insert(data, op.recId, m_ctx);
+                    assert(success);
+                    (void)success;
+                }
+                break;
+            case opIndexUpsert:
+                index->getReadableStore()->getUpdatableStore()->update(op.recId, data, m_ctx);
+                break;
+            case opStoreRemove:
+                m_seg->removeNoCommit(op.recId, m_ctx);
+                break;
+            case opStoreUpsert:
+                m_seg->updateNoCommit(op.recId, data, m_ctx);
+                break;
+            }
+        }
+    }
+
 public:
     explicit
-        MutexLockTransaction(TrbColgroupSegment* seg, DbContext* ctx) : m_sconf(*seg->m_schema)
+        TrbDbTransaction(TrbColgroupSegment* seg, DbContext* ctx) : m_sconf(*seg->m_schema)
     {
         m_seg = seg;
         m_ctx = ctx;
     }
-    ~MutexLockTransaction()
+    ~TrbDbTransaction()
     {
     }
     void indexSearch(size_t indexId, fstring key, valvec<llong>* recIdvec)
         override
     {
         assert(started == m_status);
-        m_seg->m_indices[indexId]->searchExactAppend(key, recIdvec, m_ctx);
+        searchWithOps(indexId, key, recIdvec);
     }
     void indexRemove(size_t indexId, fstring key, llong recId) override
     {
         assert(started == m_status);
-        m_seg->m_indices[indexId]->getWritableIndex()->remove(key, recId, m_ctx);
+        pushOp(opIndexRemove, indexId, recId, key);
     }
     bool indexInsert(size_t indexId, fstring key, llong recId) override
     {
         assert(started == m_status);
-        return m_seg->m_indices[indexId]->getWritableIndex()->insert(key, recId, m_ctx);
+        if(m_sconf.getIndexSchema(indexId).m_isUnique)
+        {
+            // checked again on commit
+            searchWithOps(indexId, key, &m_hits);
+            if(!m_hits.empty())
+            {
+                return false;
+            }
+        }
+        pushOp(opIndexInsert, indexId, recId, key);
+        return true;
     }
     void indexUpsert(size_t indexId, fstring key, llong recId) override
     {
         assert(started == m_status);
-        m_seg->m_indices[indexId]->getReadableStore()->getUpdatableStore()->update(recId, key, m_ctx);
+        pushOp(opIndexUpsert, indexId, recId, key);
     }
     void storeRemove(llong recId) override
     {
         assert(started == m_status);
-        m_seg->remove(recId, m_ctx);
+        pushOp(opStoreRemove, 0, recId, fstring());
     }
     void storeUpsert(llong recId, fstring row) override
     {
         assert(started == m_status);
-        m_seg->update(recId, row, m_ctx);
+        pushOp(opStoreUpsert, 0, recId, row);
     }
     void storeGetRow(llong recId, valvec<byte>* row) override
     {
         assert(started == m_status);
+        size_t found = m_rowOps.find_i(recId);
+        if(found != m_rowOps.end_i())
+        {
+            const WriteOp& op = m_ops[m_rowOps.val(found)];
+            row->assign(opData(op.offset, op.length));
+            return;
+        }
         m_seg->getValue(recId, row, m_ctx);
+        ReadRow r;
+        r.recId = recId;
+        r.offset = m_opData.size();
+        r.length = row->size();
+        m_opData.append(*row);
+        m_reads.push_back(r);
     }
     void do_startTransaction() override
     {
-        m_seg->m_txnMutex.lock();
+        clearWriteSet();
     }
     bool do_commit() override
     {
-        m_seg->m_txnMutex.unlock();
-        return true;
+        bool success = false;
+        lockStripes();
+        try
+        {
+            success = validate();
+            if(success)
+            {
+                apply();
+            }
+        }
+        catch(...)
+        {
+            unlockStripes();
+            clearWriteSet();
+            throw;
+        }
+        unlockStripes();
+        clearWriteSet();
+        if(success)
+        {
+            // fdatasync is shared by transactions committing together
+            m_seg->m_logGroup.commit();
+        }
+        return success;
     }
     void do_rollback() override
     {
-        m_seg->m_txnMutex.unlock();
+        clearWriteSet();
     }
     const std::string& strError() const override
     {
         return m_strError;
     }
-
-    valvec<byte> m_wrtBuf;
-    ColumnVec    m_cols1;
-    ColumnVec    m_cols2;
-    std::string  m_strError;
 };
 
 DbTransaction *TrbColgroupSegment::createTransaction(DbContext* ctx)
 {
-    auto txn = new MutexLockTransaction(this, ctx);
+    auto txn = new TrbDbTransaction(this, ctx);
     return txn;
 }
 
@@ -114,15 +385,15 @@ void TrbColgroupSegment::save(PathRef path) const
 
 ReadableIndex *TrbColgroupSegment::openIndex(const Schema &schema, PathRef segDir) const
 {
-    return TrbWritableIndex::createIndex(schema, segDir / "index-" + schema.m_name);
+    return TrbWritableIndex::createIndex(schema, segDir / "index-" + schema.m_name, &m_logGroup);
 }
 ReadableIndex *TrbColgroupSegment::createIndex(const Schema &schema, PathRef segDir) const
 {
-    return TrbWritableIndex::createIndex(schema, segDir / "index-" + schema.m_name);
+    return TrbWritableIndex::createIndex(schema, segDir / "index-" + schema.m_name, &m_logGroup);
 }
 ReadableStore *TrbColgroupSegment::createStore(const Schema &schema, PathRef segDir) const
 {
-    return new TrbWritableStore(segDir / "colgroup-" + schema.m_name);
+    return new TrbWritableStore(segDir / "colgroup-" + schema.m_name, &m_logGroup);
 }
 
 void TrbColgroupSegment::indexSearchExactAppend(size_t mySegIdx, size_t indexId, fstring key, valvec<llong>* recIdvec, DbContext *ctx) const
@@ -172,10 +443,27 @@ llong TrbColgroupSegment::append(fstring row, DbContext* ctx)
         assert(check == ctx->trbBuf);
     }
 #endif
+    m_logGroup.commit();
     return ret;
 }
 
+void TrbColgroupSegment::commitLog()
+{
+    m_logGroup.commit();
+}
+
+// update and remove lock the stripe of the row, as transactions do on
+// commit, an appended row is new, no transaction can have read it
 void TrbColgroupSegment::update(llong id, fstring row, DbContext* ctx)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_txnStripes[size_t(id) % TxnStripeNum]);
+        updateNoCommit(id, row, ctx);
+    }
+    m_logGroup.commit();
+}
+
+void TrbColgroupSegment::updateNoCommit(llong id, fstring row, DbContext* ctx)
 {
     m_schema->m_rowSchema->parseRow(row, &ctx->trbCols);
     size_t const colgroups_size = m_colgroups.size();
@@ -200,6 +488,15 @@ void TrbColgroupSegment::update(llong id, fstring row, DbContext* ctx)
 }
 
 void TrbColgroupSegment::remove(llong id, DbContext* ctx)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_txnStripes[size_t(id) % TxnStripeNum]);
+        removeNoCommit(id, ctx);
+    }
+    m_logGroup.commit();
+}
+
+void TrbColgroupSegment::removeNoCommit(llong id, DbContext* ctx)
 {
     size_t const colgroups_size = m_colgroups.size();
     for(size_t i = m_indices.size(); i < colgroups_size; ++i)
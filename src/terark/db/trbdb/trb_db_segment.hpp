@@ -2,16 +2,22 @@
 
 #include <mutex>
 #include <terark/db/db_segment.hpp>
+#include "trb_db_checkpoint.hpp"
 
 namespace terark { namespace db { namespace trbdb {
 
-class TERARK_DB_DLL MutexLockTransaction;
-
 class TERARK_DB_DLL TrbColgroupSegment : public ColgroupWritableSegment {
 
 protected:
-    friend class MutexLockTransaction;
-    std::mutex  m_txnMutex;
+    // transactions keep their writes until commit, then lock the stripes
+    // of the rows and unique keys they touch, in stripe order
+    static const size_t TxnStripeNum = 256;
+    std::mutex  m_txnStripes[TxnStripeNum];
+    // ops of all indices and stores are flushed together on commit
+    mutable TrbLogGroup m_logGroup;
+
+    void removeNoCommit(llong, DbContext *);
+    void updateNoCommit(llong, fstring, DbContext *);
 
 public:
 	class TrbDbTransaction; friend class TrbDbTransaction;
@@ -38,6 +44,7 @@ public:
     void update(llong, fstring, DbContext *) override;
 
     void shrinkToFit(void) override;
+    void commitLog() override;
 
     void saveRecordStore(PathRef segDir) const override;
     void loadRecordStore(PathRef segDir) override;
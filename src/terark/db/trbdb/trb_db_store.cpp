@@ -2,6 +2,7 @@
 #define NOMINMAX
 #include "trb_db_store.hpp"
 #include "trb_db_context.hpp"
+#include <terark/db/db_segment.hpp>
 #include <terark/io/FileStream.hpp>
 #include <terark/io/StreamBuffer.hpp>
 #include <terark/io/DataIO.hpp>
@@ -29,6 +30,7 @@ public:
     bool increment(llong* id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         size_t max = o->m_index.size();
         while(m_where < max)
         {
@@ -46,6 +48,7 @@ public:
     bool seekExact(llong id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         if(id < 0 || id >= llong(o->m_index.size()))
         {
             THROW_STD(out_of_range, "Invalid id = %lld, rows = %zd"
@@ -78,6 +81,7 @@ public:
     bool increment(llong* id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         while(m_where > 0)
         {
             size_t k = --m_where;
@@ -94,6 +98,7 @@ public:
     bool seekExact(llong id, valvec<byte>* val) override
     {
         auto const *o = static_cast<owner_t const *>(m_store.get());
+        SpinRwLock lock(o->m_rwMutex, false);
         if(id < 0 || id >= llong(o->m_index.size()))
         {
             THROW_STD(out_of_range, "Invalid id = %lld, rows = %zd"
@@ -114,12 +119,23 @@ public:
 };
 
 
-TrbWritableStore::TrbWritableStore(PathRef fpath)
-    : m_data(256)
-    , m_fp(fixFilePath(fpath).c_str(), "wb")
+TrbWritableStore::TrbWritableStore(PathRef fpath, TrbLogGroup* logGroup)
+    : TrbLogWriter(fixFilePath(fpath), logGroup)
+    , m_data(256)
 {
-    m_fp.disbuf();
-    NativeDataInput<InputBuffer> in; in.attach(&m_fp);
+    FileStream &fp = m_log.fp();
+    fp.disbuf();
+    if(m_log.hasImage())
+    {
+        TrbImageReader img(m_log.imagePath());
+        loadImage(img);
+        m_log.seekToReplay(&img.header());
+    }
+    else
+    {
+        m_log.seekToReplay(NULL);
+    }
+    NativeDataInput<InputBuffer> in; in.attach(&fp);
     uint32_t index_remove;
     std::string key;
 
@@ -154,7 +170,8 @@ TrbWritableStore::TrbWritableStore(PathRef fpath)
     {
         (void)e;//shut up !
     }
-    m_out.attach(&m_fp);
+    m_log.seekToAppend();
+    m_out.attach(&fp);
 }
 
 fstring TrbWritableStore::readItem(size_type i) const
@@ -197,6 +214,49 @@ bool TrbWritableStore::removeItem(size_type i)
     return true;
 }
 
+void TrbWritableStore::loadImage(TrbImageReader &img)
+{
+    fstring index = img.read();
+    fstring data = img.read();
+    m_index.assign((uint32_t const *)index.data(), index.size() / sizeof(uint32_t));
+    m_data.erase_all();
+    m_data.resize_no_init(data.size());
+    std::memcpy(m_data.data(), data.data(), data.size());
+}
+
+// write m_index and m_data without holes of freed items to the image,
+// then truncate the log
+void TrbWritableStore::checkpoint()
+{
+    m_out.flush();
+    uint64_t logOffset = m_log.fp().tell();
+    valvec<uint32_t> index(m_index.size(), valvec_no_init());
+    valvec<byte> data(m_data.size() - m_data.free_size(), valvec_reserve());
+    for(size_type i = 0; i < m_index.size(); ++i)
+    {
+        if(m_index[i] == 0x80000000U)
+        {
+            index[i] = 0x80000000U;
+            continue;
+        }
+        byte const *ptr = m_data.at<data_object>(m_index[i]).data, *end_ptr;
+        size_type len = load_var_uint32(ptr, &end_ptr);
+        size_type dst_len = pool_type::align_to(end_ptr - ptr + len);
+        index[i] = uint32_t(data.size());
+        data.append(ptr, dst_len);
+    }
+    TrbImageWriter img(m_log.imagePath());
+    img.write(index.data(), index.used_mem_size());
+    img.write(data.data(), data.size());
+    img.commit(logOffset);
+    m_log.truncate();
+}
+
+uint64_t TrbWritableStore::imageBytes() const
+{
+    return dataStorageSize();
+}
+
 std::string TrbWritableStore::fixFilePath(PathRef path)
 {
     return fstring(path.string()).endsWith(".trb")
@@ -237,6 +297,7 @@ llong TrbWritableStore::numDataRows() const
 
 void TrbWritableStore::getValueAppend(llong id, valvec<byte>* val, DbContext *) const
 {
+    SpinRwLock lock(m_rwMutex, false);
     fstring item = readItem(size_t(id));
     val->append(item.begin(), item.end());
 }
@@ -253,29 +314,33 @@ StoreIterator *TrbWritableStore::createStoreIterBackward(DbContext *) const
 
 llong TrbWritableStore::append(fstring row, DbContext *)
 {
+    SpinRwLock lock(m_rwMutex, true);
     size_t id;
     storeItem(id = m_index.size(), row);
     m_out << uint32_t(id) << row;
-    m_out.flush();
+    writeLog();
     return id;
 }
 
 void TrbWritableStore::update(llong id, fstring row, DbContext *)
 {
+    SpinRwLock lock(m_rwMutex, true);
     storeItem(size_t(id), row);
     m_out << uint32_t(id) << row;
-    m_out.flush();
+    writeLog();
 }
 
 void TrbWritableStore::remove(llong id, DbContext *)
 {
+    SpinRwLock lock(m_rwMutex, true);
     removeItem(size_t(id));
     m_out << (uint32_t(id) | 0x80000000U);
-    m_out.flush();
+    writeLog();
 }
 
 void TrbWritableStore::shrinkToFit()
 {
+    SpinRwLock lock(m_rwMutex, true);
     m_index.shrink_to_fit();
     m_data.shrink_to_fit();
 }
@@ -9,13 +9,14 @@
 #include <tbb/mutex.h>
 #include <terark/mempool.hpp>
 #include <terark/io/var_int.hpp>
+#include "trb_db_checkpoint.hpp"
 
 namespace terark { namespace db { namespace trbdb {
 
 class TrbStoreIterForward;
 class TrbStoreIterBackward;
 
-class TERARK_DB_DLL TrbWritableStore : public ReadableStore, public WritableStore {
+class TERARK_DB_DLL TrbWritableStore : public ReadableStore, public WritableStore, public TrbLogWriter {
 protected:
     typedef std::size_t size_type;
     typedef terark::MemPool<4> pool_type;
@@ -25,20 +26,23 @@ protected:
     };
     valvec<uint32_t> m_index;
     pool_type m_data;
-    FileStream m_fp;
-    NativeDataOutput<OutputBuffer> m_out;
 
     fstring readItem(size_type i) const;
     void storeItem(size_type i, fstring d);
     bool removeItem(size_type i);
 
+    void loadImage(TrbImageReader&);
+    void checkpoint() override;
+    uint64_t imageBytes() const override;
+    RefCounter* logOwner() override { return this; }
+
     static std::string fixFilePath(PathRef);
 
     friend class TrbStoreIterForward;
     friend class TrbStoreIterBackward;
 
 public:
-    TrbWritableStore(PathRef);
+    TrbWritableStore(PathRef, TrbLogGroup* logGroup = NULL);
 	~TrbWritableStore();
 
 	void save(PathRef) const override;
@@ -89,8 +89,27 @@ void ZipIntStore::getValueAppend(llong id, valvec<byte>* val, DbContext*) const
 	}
 }
 
+bool ZipIntStore::getValuesBatchBytes(size_t beginId, size_t count, byte* out) const {
+	switch (m_intType) {
+	default:
+		return false;
+	case ColumnType::Sint08: getValuesBatch(beginId, count, ( int8_t *)out); break;
+	case ColumnType::Uint08: getValuesBatch(beginId, count, (uint8_t *)out); break;
+	case ColumnType::Sint16: getValuesBatch(beginId, count, ( int16_t*)out); break;
+	case ColumnType::Uint16: getValuesBatch(beginId, count, (uint16_t*)out); break;
+	case ColumnType::Sint32: getValuesBatch(beginId, count, ( int32_t*)out); break;
+	case ColumnType::Uint32: getValuesBatch(beginId, count, (uint32_t*)out); break;
+	case ColumnType::Sint64: getValuesBatch(beginId, count, ( int64_t*)out); break;
+	case ColumnType::Uint64: getValuesBatch(beginId, count, (uint64_t*)out); break;
+	}
+	return true;
+}
+
 StoreIterator* ZipIntStore::createStoreIterForward(DbContext*) const {
-	return nullptr; // not needed
+	size_t fixlen = m_schema.getFixedRowLen();
+	if (0 == fixlen)
+		return nullptr; // var int, use default iter
+	return new IntBatchStoreIterForward<ZipIntStore>(this, fixlen);
 }
 
 StoreIterator* ZipIntStore::createStoreIterBackward(DbContext*) const {
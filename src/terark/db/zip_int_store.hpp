@@ -23,6 +23,13 @@ public:
 	void load(PathRef path) override;
 	void save(PathRef path) const override;
 
+	/// out[i] = value of record beginId + i, for column scans
+	/// Int should be the column type, or a wider one
+	template<class Int>
+	void getValuesBatch(size_t beginId, size_t count, Int* out) const;
+	/// out is an array of the column type, return false for var ints
+	bool getValuesBatchBytes(size_t beginId, size_t count, byte* out) const;
+
 protected:
 	UintVecMin0 m_dedup;
 	UintVecMin0 m_index;
@@ -39,4 +46,86 @@ protected:
 	void zipValues(const void* data, size_t size);
 };
 
+template<class Int>
+void ZipIntStore::getValuesBatch(size_t beginId, size_t count, Int* out) const {
+	assert(beginId + count <= size_t(numDataRows()));
+	ullong minValue = ullong(m_minValue);
+	if (m_index.size()) {
+		// dedup positions are unpacked by blocks, then values are looked up
+		size_t pos[256];
+		for (size_t i = 0; i < count; i += 256) {
+			size_t n = std::min(count - i, size_t(256));
+			m_index.bulk_get(beginId + i, n, pos);
+			auto dedupData = m_dedup.data();
+			auto dedupBits = m_dedup.uintbits();
+			auto dedupMask = m_dedup.uintmask();
+			for (size_t k = 0; k < n; ++k) {
+				ullong v = UintVecMin0::fast_get(dedupData, dedupBits, dedupMask, pos[k]);
+				out[i + k] = Int(minValue + v);
+			}
+		}
+	}
+	else {
+		m_dedup.bulk_get(beginId, count, out);
+		if (minValue) {
+			for (size_t i = 0; i < count; ++i)
+				out[i] = Int(minValue + ullong(out[i]));
+		}
+	}
+}
+
+/// forward iterator of an int store whose values are unpacked by
+/// Store::getValuesBatchBytes, a block at a time
+template<class Store>
+class IntBatchStoreIterForward : public StoreIterator {
+	static const size_t BlockRows = 256;
+	const Store* m_owner;
+	valvec<byte> m_block; // values of [m_blockBeg, m_blockBeg + m_blockLen)
+	size_t m_fixlen;
+	size_t m_rows;
+	size_t m_id;
+	size_t m_blockBeg;
+	size_t m_blockLen;
+
+	void getValue(size_t id, valvec<byte>* val) {
+		if (id - m_blockBeg >= m_blockLen) {
+			m_blockBeg = id;
+			m_blockLen = std::min(m_rows - id, BlockRows);
+			m_owner->getValuesBatchBytes(id, m_blockLen, m_block.data());
+		}
+		val->assign(m_block.data() + m_fixlen * (id - m_blockBeg), m_fixlen);
+	}
+public:
+	IntBatchStoreIterForward(const Store* owner, size_t fixlen) {
+		m_store.reset(const_cast<Store*>(owner));
+		m_owner = owner;
+		m_fixlen = fixlen;
+		m_block.resize_no_init(fixlen * BlockRows);
+		reset();
+	}
+	bool increment(llong* id, valvec<byte>* val) override {
+		if (m_id < m_rows) {
+			getValue(m_id, val);
+			*id = llong(m_id++);
+			return true;
+		}
+		return false;
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		assert(id >= 0);
+		m_id = size_t(id) + 1;
+		if (size_t(id) < m_rows) {
+			getValue(size_t(id), val);
+			return true;
+		}
+		return false;
+	}
+	void reset() override {
+		m_rows = size_t(m_owner->numDataRows());
+		m_id = 0;
+		m_blockBeg = 0;
+		m_blockLen = 0;
+	}
+};
+
 }} // namespace terark::db
@@ -3,6 +3,7 @@
 
 #include "valvec.hpp"
 #include "stdtypes.hpp"
+#include "bitmanip.hpp"
 #include <terark/util/throw.hpp>
 
 namespace terark {
@@ -88,6 +89,61 @@ public:
 		return (val >> bit_idx % 8) & mask;
 	}
 
+	/// out[i] = get(first + i), for i in [0, num)
+	template<class Int>
+	void bulk_get(size_t first, size_t num, Int* out) const {
+		assert(first + num <= m_size);
+		fast_bulk_get(m_data.data(), m_bits, m_mask, first, num, out);
+	}
+	/// with BMI2, narrow values are unpacked 8 at a time by pdep, 8 values
+	/// are a whole number of bytes
+	template<class Int>
+	static
+	void fast_bulk_get(const byte* data, size_t bits, size_t mask,
+					   size_t first, size_t num, Int* out) {
+		size_t idx = first, end = first + num;
+#if defined(__BMI2__) && TERARK_WORD_BITS == 64
+		if (bits && bits <= 16) {
+			for (; idx < end && idx % 8 != 0; ++idx)
+				*out++ = Int(fast_get(data, bits, mask, idx));
+			if (bits <= 8) {
+				ullong m = pdep_mask(bits, 8);
+				for (; idx + 8 <= end; idx += 8, out += 8) {
+					const byte* p = data + bits * idx / 8;
+					byte y[8]; // 8 values to 8 bytes
+					unaligned_save(y, _pdep_u64(unaligned_load<ullong>(p), m));
+					for (size_t k = 0; k < 8; ++k)
+						out[k] = Int(y[k]);
+				}
+			}
+			else {
+				ullong m = pdep_mask(bits, 16);
+				for (; idx + 8 <= end; idx += 8, out += 8) {
+					const byte* p = data + bits * idx / 8;
+					uint16_t y[8]; // 4 values to 4 uint16, twice
+					unaligned_save(y+0, _pdep_u64(unaligned_load<ullong>(p), m));
+					unaligned_save(y+4, _pdep_u64(unaligned_load<ullong>(p + bits/2) >> bits%2*4, m));
+					for (size_t k = 0; k < 8; ++k)
+						out[k] = Int(y[k]);
+				}
+			}
+		}
+#endif
+		// bit_idx is incremented instead of multiplied
+		size_t bit_idx = bits * idx;
+		for (; idx < end; ++idx, bit_idx += bits) {
+			size_t val = unaligned_load<size_t>(data + bit_idx / 8);
+			*out++ = Int((val >> bit_idx % 8) & mask);
+		}
+	}
+	/// low bits of every lane are set
+	static ullong pdep_mask(size_t bits, size_t lane) {
+		ullong m = 0;
+		for (size_t k = 0; k < 64; k += lane)
+			m |= ((ullong(1) << bits) - 1) << k;
+		return m;
+	}
+
 	void set_wire(size_t idx, size_t val) {
 		assert(idx < m_size);
 		assert(val <= m_mask);
@@ -0,0 +1,175 @@
+// TestBatchInsert.cpp : BatchWriter::insertRows on a table with two unique
+// indices, it must stop at the first row which has a duplicate key in the
+// table or in the batch, rows before it are inserted on commit and rows
+// after it are never inserted
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct UserRow {
+	uint64_t id;
+	uint32_t b;
+	std::string email;
+	std::string name;
+	DATA_IO_LOAD_SAVE(UserRow, &id&b&Schema::StrZero(email)&RestAll(name))
+};
+
+typedef std::map<uint64_t, std::pair<llong, UserRow> > Model; // id -> (recId, row)
+
+static std::string encodeRow(const UserRow& row) {
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	fstring binRow(rowBuilder.written());
+	return std::string(binRow.data(), binRow.size());
+}
+
+static std::string emailOf(uint64_t id) {
+	return "user" + std::to_string(id) + "@example.com";
+}
+
+static UserRow makeRow(uint64_t id) {
+	UserRow row;
+	row.id = id;
+	row.b = uint32_t(id % 10);
+	row.email = emailOf(id);
+	row.name = "name-" + std::to_string(id);
+	return row;
+}
+
+/// insertRows(rows) in one batch, it must return expectNum, the inserted
+/// rows are added to model if the batch is committed
+static void insertBatch(DbTable* tab, const std::vector<UserRow>& rows,
+						size_t expectNum, bool commit, Model* model) {
+	std::vector<std::string> encoded;
+	for (auto& row : rows)
+		encoded.push_back(encodeRow(row));
+	valvec<fstring> binRows;
+	for (auto& s : encoded)
+		binRows.push_back(s);
+	const size_t n = rows.size();
+	valvec<llong> recIds(n, -1);
+	BatchWriter batch(tab);
+	size_t num = batch.insertRows(binRows.data(), n, recIds.data());
+	CHECK(num == expectNum);
+	if (num < n) {
+		CHECK(!batch.strError().empty());
+	}
+	std::set<llong> uniqRecIds;
+	for (size_t i = 0; i < num; ++i) {
+		CHECK(recIds[i] >= 0);
+		CHECK(uniqRecIds.insert(recIds[i]).second);
+	}
+	if (!commit) {
+		batch.rollback();
+		return;
+	}
+	CHECK(batch.commit());
+	for (size_t i = 0; i < num; ++i) {
+		CHECK(model->count(rows[i].id) == 0);
+		(*model)[rows[i].id] = std::make_pair(recIds[i], rows[i]);
+	}
+}
+
+static std::vector<UserRow> makeRows(uint64_t firstId, size_t n) {
+	std::vector<UserRow> rows;
+	for (size_t i = 0; i < n; ++i)
+		rows.push_back(makeRow(firstId + i));
+	return rows;
+}
+
+static void checkTable(DbTable* tab, const Model& model) {
+	DbContextPtr ctx(tab->createDbContext());
+	valvec<llong> recIds;
+	valvec<byte> buf;
+	for (auto& kv : model) {
+		llong recId = kv.second.first;
+		const UserRow& row = kv.second.second;
+		ctx->indexSearchExact(0, Schema::fstringOf(&row.id), &recIds);
+		CHECK(recIds.size() == 1);
+		CHECK(recIds[0] == recId);
+		ctx->indexSearchExact(1, row.email, &recIds);
+		CHECK(recIds.size() == 1);
+		CHECK(recIds[0] == recId);
+		ctx->getValue(recId, &buf);
+		CHECK(std::string((const char*)buf.data(), buf.size()) == encodeRow(row));
+	}
+	CHECK(tab->existingRows() == llong(model.size()));
+}
+
+static bool idExists(DbTable* tab, uint64_t id) {
+	DbContextPtr ctx(tab->createDbContext());
+	return ctx->indexKeyExists(0, Schema::fstringOf(&id));
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "batch-insert-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	Model model;
+	insertBatch(tab.get(), makeRows(1, 1000), 1000, true, &model);
+	checkTable(tab.get(), model);
+
+	// id of rows[3] is in the table
+	std::vector<UserRow> rows = makeRows(2001, 6);
+	rows[3] = makeRow(500);
+	rows[3].email = "new500@example.com";
+	insertBatch(tab.get(), rows, 3, true, &model);
+	checkTable(tab.get(), model);
+	CHECK(!idExists(tab.get(), 2005));
+
+	// id of rows[6] is rows[0]
+	rows = makeRows(3001, 10);
+	rows[6].id = 3001;
+	insertBatch(tab.get(), rows, 6, true, &model);
+	checkTable(tab.get(), model);
+	CHECK(!idExists(tab.get(), 3007));
+
+	// email, the second unique index, of rows[2] is in the table
+	rows = makeRows(4001, 5);
+	rows[2].email = emailOf(17);
+	insertBatch(tab.get(), rows, 2, true, &model);
+	checkTable(tab.get(), model);
+	CHECK(!idExists(tab.get(), 4003));
+
+	// email of rows[4] is rows[1]
+	rows = makeRows(5001, 8);
+	rows[4].email = rows[1].email;
+	insertBatch(tab.get(), rows, 4, true, &model);
+	checkTable(tab.get(), model);
+	CHECK(!idExists(tab.get(), 5005));
+
+	// a rolled back batch leaves no rows and frees its keys
+	insertBatch(tab.get(), makeRows(6001, 50), 50, false, &model);
+	checkTable(tab.get(), model);
+	CHECK(!idExists(tab.get(), 6001));
+	insertBatch(tab.get(), makeRows(6001, 50), 50, true, &model);
+	checkTable(tab.get(), model);
+
+	// both unique indices are the same after all segments are frozen
+	tab->syncFinishWriting();
+	checkTable(tab.get(), model);
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,190 @@
+// TestBatchScan.cpp : ColgroupScanner with predicates must select exactly
+// the live rows which match, both on writable and frozen segments
+//
+
+#include "stdafx.h"
+#include <terark/db/colgroup_scan.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <map>
+#include <random>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct ScanRow {
+	uint64_t id;
+	int64_t  a;
+	uint32_t b;
+	std::string name;
+	DATA_IO_LOAD_SAVE(ScanRow, &id&a&b&RestAll(name))
+};
+
+typedef std::map<llong, ScanRow> Model; // recId -> row
+
+static std::string encodeRow(const ScanRow& row) {
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	fstring binRow(rowBuilder.written());
+	return std::string(binRow.data(), binRow.size());
+}
+
+static ScanRow makeRow(uint64_t id, std::mt19937_64& rng) {
+	ScanRow row;
+	row.id = id;
+	row.a = llong(rng() % 2000) - 1000;
+	row.b = uint32_t(rng() % 100);
+	row.name = "name-" + std::to_string(id);
+	return row;
+}
+
+/// inserts n rows with ids [firstId, firstId+n)
+static void insertRows(DbTable* tab, uint64_t firstId, size_t n,
+					   Model* model, std::mt19937_64& rng) {
+	DbContextPtr ctx(tab->createDbContext());
+	for (size_t i = 0; i < n; ++i) {
+		ScanRow row = makeRow(firstId + i, rng);
+		llong recId = ctx->insertRow(encodeRow(row));
+		CHECK(recId >= 0);
+		CHECK(model->count(recId) == 0);
+		(*model)[recId] = row;
+	}
+}
+
+static void checkRows(DbTable* tab, const Model& model) {
+	DbContextPtr ctx(tab->createDbContext());
+	valvec<llong> recIds;
+	valvec<byte> buf;
+	for (auto& kv : model) {
+		const ScanRow& row = kv.second;
+		ctx->indexSearchExact(0, Schema::fstringOf(&row.id), &recIds);
+		CHECK(recIds.size() == 1);
+		CHECK(recIds[0] == kv.first);
+		ctx->getValue(kv.first, &buf);
+		CHECK(std::string((const char*)buf.data(), buf.size()) == encodeRow(row));
+	}
+}
+
+typedef std::function<bool(const ScanRow&)> RowFilter;
+
+/// projection is {a} if projA, else all fixed columns {a, b}
+static void checkScan(const DbTable* tab, const Model& model,
+					  const valvec<ColumnPredicate>& preds,
+					  const RowFilter& filter, bool projA) {
+	DbContextPtr ctx(tab->createDbContext());
+	size_t cgId = tab->getColgroupId("nums");
+	CHECK(cgId < tab->getColgroupNum());
+	ColgroupScannerPtr scanner(tab->createColgroupScanner(cgId, ctx.get()));
+	const Schema& schema = scanner->schema();
+	size_t colA = schema.getColumnId("a");
+	CHECK(schema.getColumnId("b") == 1);
+	if (projA)
+		scanner->setProjection(&colA, 1);
+	for (auto& pred : preds)
+		scanner->addPredicate(pred);
+	size_t selected = 0;
+	ColgroupBatch batch;
+	while (scanner->next(&batch)) {
+		CHECK(batch.selCount > 0);
+		CHECK(batch.columns.size() == (projA ? 1 : 2));
+		const int64_t* a = batch.column<int64_t>(0);
+		const uint32_t* b = projA ? NULL : batch.column<uint32_t>(1);
+		size_t selCount = 0;
+		for (size_t i = 0; i < batch.rows; ++i) {
+			if (!batch.isSelected(i))
+				continue;
+			selCount++;
+			auto iter = model.find(batch.baseId + i);
+			CHECK(model.end() != iter);
+			CHECK(filter(iter->second));
+			CHECK(a[i] == iter->second.a);
+			if (b)
+				CHECK(b[i] == iter->second.b);
+		}
+		CHECK(selCount == batch.selCount);
+		selected += selCount;
+	}
+	size_t expected = 0;
+	for (auto& kv : model)
+		expected += filter(kv.second);
+	CHECK(selected == expected);
+}
+
+static void checkScans(const DbTable* tab, const Model& model) {
+	const size_t colA = 0, colB = 1; // fields of colgroup "nums"
+	valvec<ColumnPredicate> preds;
+	checkScan(tab, model, preds, [](const ScanRow&) { return true; }, false);
+
+	preds.push_back(ColumnPredicate::range(colB, 10, 19));
+	checkScan(tab, model, preds, [](const ScanRow& r) {
+		return r.b >= 10 && r.b <= 19;
+	}, true);
+
+	preds.push_back(ColumnPredicate::range(colA, -500, 0));
+	checkScan(tab, model, preds, [](const ScanRow& r) {
+		return r.b >= 10 && r.b <= 19 && r.a >= -500 && r.a <= 0;
+	}, false);
+
+	preds.erase_all();
+	const llong inList[] = { 3, 5, 7, 99 };
+	preds.push_back(ColumnPredicate::in(colB, inList, 4));
+	checkScan(tab, model, preds, [](const ScanRow& r) {
+		return r.b == 3 || r.b == 5 || r.b == 7 || r.b == 99;
+	}, true);
+
+	preds.erase_all();
+	preds.push_back(ColumnPredicate::equal(colA, 77));
+	checkScan(tab, model, preds, [](const ScanRow& r) { return r.a == 77; }, false);
+}
+
+static void removeSome(DbTable* tab, Model* model, size_t every) {
+	DbContextPtr ctx(tab->createDbContext());
+	size_t i = 0;
+	for (auto iter = model->begin(); iter != model->end(); ++i) {
+		if (i % every == 0) {
+			ctx->removeRow(iter->first);
+			iter = model->erase(iter);
+		}
+		else
+			++iter;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "batch-scan-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	std::mt19937_64 rng(7);
+	Model model;
+	DbTablePtr tab(DbTable::open(dir));
+	insertRows(tab.get(), 1, 30100, &model, rng);
+	checkRows(tab.get(), model);
+	checkScans(tab.get(), model);
+
+	removeSome(tab.get(), &model, 7);
+	checkScans(tab.get(), model);
+
+	// all segments are frozen and compressed, columns are decoded
+	// directly from readonly stores
+	tab->syncFinishWriting();
+	checkRows(tab.get(), model);
+	checkScans(tab.get(), model);
+	removeSome(tab.get(), &model, 5);
+	checkScans(tab.get(), model);
+
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
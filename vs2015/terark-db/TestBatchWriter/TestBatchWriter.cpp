@@ -0,0 +1,152 @@
+// TestBatchWriter.cpp : BatchWriter on a table with two unique indices,
+// a duplicate key of the second unique index must be rejected, both in
+// the table and in the batch, upserts overwriting a row in the writing
+// segment must keep its id, and keys freed in a batch can be reused
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct UserRow {
+	uint64_t id;
+	uint32_t b;
+	std::string email;
+	std::string name;
+	DATA_IO_LOAD_SAVE(UserRow, &id&b&Schema::StrZero(email)&RestAll(name))
+};
+
+typedef std::map<uint64_t, std::pair<llong, UserRow> > Model; // id -> (recId, row)
+
+static std::string encodeRow(const UserRow& row) {
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	fstring binRow(rowBuilder.written());
+	return std::string(binRow.data(), binRow.size());
+}
+
+static UserRow makeRow(uint64_t id, const std::string& email) {
+	UserRow row;
+	row.id = id;
+	row.b = uint32_t(id % 10);
+	row.email = email;
+	row.name = "name-" + std::to_string(id) + "-" + email;
+	return row;
+}
+
+static std::string emailOf(uint64_t id) {
+	return "user" + std::to_string(id) + "@example.com";
+}
+
+static llong upsert(BatchWriter& batch, const UserRow& row) {
+	return batch.upsertRow(encodeRow(row));
+}
+
+static void checkTable(DbTable* tab, const Model& model) {
+	DbContextPtr ctx(tab->createDbContext());
+	valvec<llong> recIds;
+	valvec<byte> buf;
+	for (auto& kv : model) {
+		llong recId = kv.second.first;
+		const UserRow& row = kv.second.second;
+		ctx->indexSearchExact(0, Schema::fstringOf(&row.id), &recIds);
+		CHECK(recIds.size() == 1);
+		CHECK(recIds[0] == recId);
+		ctx->indexSearchExact(1, row.email, &recIds);
+		CHECK(recIds.size() == 1);
+		CHECK(recIds[0] == recId);
+		ctx->getValue(recId, &buf);
+		CHECK(std::string((const char*)buf.data(), buf.size()) == encodeRow(row));
+	}
+	CHECK(tab->existingRows() == llong(model.size()));
+}
+
+static bool emailExists(DbTable* tab, const std::string& email) {
+	DbContextPtr ctx(tab->createDbContext());
+	return ctx->indexKeyExists(1, email);
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "batch-writer-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	Model model;
+	{
+		BatchWriter batch(tab.get());
+		for (uint64_t id = 1; id <= 1000; ++id) {
+			UserRow row = makeRow(id, emailOf(id));
+			llong recId = upsert(batch, row);
+			CHECK(recId >= 0);
+			model[id] = std::make_pair(recId, row);
+		}
+		CHECK(batch.commit());
+	}
+	checkTable(tab.get(), model);
+
+	{
+		BatchWriter batch(tab.get());
+		// email of id 5 is in the table
+		CHECK(upsert(batch, makeRow(2001, emailOf(5))) < 0);
+		CHECK(!batch.strError().empty());
+		// email of 2002 is in the batch
+		UserRow row = makeRow(2002, "dup@example.com");
+		llong recId = upsert(batch, row);
+		CHECK(recId >= 0);
+		model[2002] = std::make_pair(recId, row);
+		CHECK(upsert(batch, makeRow(2003, "dup@example.com")) < 0);
+		// overwrite id 7 twice, its old email is freed and its id is kept
+		row = makeRow(7, "first@example.com");
+		CHECK(upsert(batch, row) == model[7].first);
+		row = makeRow(7, "second@example.com");
+		CHECK(upsert(batch, row) == model[7].first);
+		model[7].second = row;
+		// "first@" was replaced in the batch, so it is free again
+		row = makeRow(2004, "first@example.com");
+		recId = upsert(batch, row);
+		CHECK(recId >= 0);
+		model[2004] = std::make_pair(recId, row);
+		// remove id 9 and give its email to a new row
+		batch.removeRow(model[9].first);
+		model.erase(9);
+		row = makeRow(2005, emailOf(9));
+		recId = upsert(batch, row);
+		CHECK(recId >= 0);
+		model[2005] = std::make_pair(recId, row);
+		CHECK(batch.commit());
+	}
+	checkTable(tab.get(), model);
+	CHECK(!emailExists(tab.get(), emailOf(7)));
+
+	{
+		BatchWriter batch(tab.get());
+		CHECK(upsert(batch, makeRow(3001, "rolled@example.com")) >= 0);
+		CHECK(upsert(batch, makeRow(11, "rolled11@example.com")) >= 0);
+		batch.rollback();
+	}
+	checkTable(tab.get(), model);
+	CHECK(!emailExists(tab.get(), "rolled@example.com"));
+
+	// both unique indices are the same after all segments are frozen
+	tab->syncFinishWriting();
+	checkTable(tab.get(), model);
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
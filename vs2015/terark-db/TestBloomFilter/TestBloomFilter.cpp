@@ -0,0 +1,148 @@
+// TestBloomFilter.cpp : BloomFilter must never miss a built key, must reject
+// most absent keys, and must give the same answers after save and load;
+// a table with bloomBitsPerKey must find exactly its live keys in frozen
+// segments, also after reopen
+//
+
+#include "stdafx.h"
+#include <terark/db/bloom_filter.hpp>
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <terark/util/sortable_strvec.hpp>
+#include <boost/filesystem.hpp>
+#include <random>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+static fstring keyOf(const uint64_t& id) {
+	return fstring((const char*)&id, sizeof(id));
+}
+
+/// keys are the uint64 in [0, n) * 2, absent keys are odd
+static size_t falsePositives(const BloomFilter& bf, size_t n) {
+	size_t fp = 0;
+	for (uint64_t i = 0; i < n; ++i) {
+		uint64_t k = i * 2;
+		CHECK(bf.mayContain(keyOf(k)));
+		k = i * 2 + 1;
+		fp += bf.mayContain(keyOf(k));
+	}
+	return fp;
+}
+
+static void testFilter(const std::string& dir) {
+	const size_t n = 100000;
+	SortableStrVec fixKeys, varKeys;
+	for (uint64_t i = 0; i < n; ++i) {
+		uint64_t k = i * 2;
+		fixKeys.m_strpool.append((const byte_t*)&k, sizeof(k));
+		varKeys.push_back(keyOf(k));
+	}
+	BloomFilter fixed, varlen;
+	fixed.build(fixKeys, sizeof(uint64_t), 10);
+	varlen.build(varKeys, 0, 10);
+	size_t fp = falsePositives(fixed, n);
+	CHECK(fp < n / 50); // about 1% for 10 bits per key
+	CHECK(falsePositives(varlen, n) == fp);
+
+	std::string fpath = dir + "/test.bloom";
+	fixed.save(fpath);
+	BloomFilter loaded;
+	loaded.load(fpath);
+	CHECK(loaded.mem_size() == fixed.mem_size());
+	CHECK(falsePositives(loaded, n) == fp);
+
+	SortableStrVec empty;
+	BloomFilter none;
+	none.build(empty, sizeof(uint64_t), 10);
+	uint64_t k = 0;
+	size_t hits = 0;
+	for (; k < 1000; ++k)
+		hits += none.mayContain(keyOf(k));
+	CHECK(hits == 0);
+}
+
+struct BloomRow {
+	uint64_t id;
+	std::string name;
+	DATA_IO_LOAD_SAVE(BloomRow, &id&RestAll(name))
+};
+
+/// ids which are multiple of 3 are removed
+static void checkTable(const DbTable* tab, uint64_t maxId) {
+	DbContextPtr ctx(tab->createDbContext());
+	valvec<llong> recIds;
+	valvec<byte> buf;
+	for (uint64_t id = 0; id <= maxId + 1000; ++id) {
+		bool live = id >= 1 && id <= maxId && id % 3 != 0;
+		ctx->indexSearchExact(0, keyOf(id), &recIds);
+		CHECK(recIds.size() == (live ? 1u : 0u));
+		CHECK(ctx->indexKeyExists(0, keyOf(id)) == live);
+		if (live) {
+			BloomRow row;
+			ctx->getValue(recIds[0], &buf);
+			NativeDataInput<MemIO> dio; dio.set(buf.data(), buf.size());
+			dio >> row;
+			CHECK(row.id == id);
+		}
+	}
+}
+
+static size_t countBloomFiles(const std::string& dir) {
+	size_t cnt = 0;
+	for (fs::recursive_directory_iterator it(dir), end; it != end; ++it) {
+		if (it->path().extension() == ".bloom")
+			cnt++;
+	}
+	return cnt;
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "bloom-filter-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	testFilter(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	const uint64_t maxId = 30000;
+	{
+		DbContextPtr ctx(tab->createDbContext());
+		valvec<llong> recIds;
+		NativeDataOutput<AutoGrownMemIO> rowBuilder;
+		for (uint64_t id = 1; id <= maxId; ++id) {
+			BloomRow row;
+			row.id = id;
+			row.name = "name-" + std::to_string(id);
+			rowBuilder.rewind();
+			rowBuilder << row;
+			recIds.push_back(ctx->insertRow(rowBuilder.written()));
+			CHECK(recIds.back() >= 0);
+		}
+		for (uint64_t id = 3; id <= maxId; id += 3)
+			ctx->removeRow(recIds[id - 1]);
+	}
+	checkTable(tab.get(), maxId);
+	tab->syncFinishWriting();
+	CHECK(countBloomFiles(dir) > 0);
+	checkTable(tab.get(), maxId);
+
+	// filters are loaded from .bloom files
+	tab.reset();
+	tab = DbTable::open(dir);
+	checkTable(tab.get(), maxId);
+
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,166 @@
+// TestBulkLoad.cpp : rows loaded by DbTable::bulkLoad must be found by all
+// indices together with rows written before and after the load, and a
+// load with a duplicate unique key must fail without changing the table
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <map>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct LoadRow {
+	uint64_t id;
+	uint32_t b;
+	std::string name;
+	DATA_IO_LOAD_SAVE(LoadRow, &id&b&RestAll(name))
+};
+
+static std::string encodeRow(uint64_t id) {
+	LoadRow row;
+	row.id = id;
+	row.b = uint32_t(id % 97);
+	row.name = "name-" + std::to_string(id);
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	fstring binRow(rowBuilder.written());
+	return std::string(binRow.data(), binRow.size());
+}
+
+/// rows of ids in [first, last], and the extra ids, in this order
+class RowIter : public StoreIterator {
+	valvec<uint64_t> m_ids;
+	size_t m_pos;
+public:
+	RowIter(uint64_t first, uint64_t last) {
+		for (uint64_t id = first; id <= last; ++id)
+			m_ids.push_back(id);
+		m_pos = 0;
+	}
+	void addId(uint64_t id) { m_ids.push_back(id); }
+	bool increment(llong* id, valvec<byte>* val) override {
+		if (m_pos < m_ids.size()) {
+			std::string row = encodeRow(m_ids[m_pos]);
+			val->assign(row.data(), row.size());
+			*id = llong(m_pos++);
+			return true;
+		}
+		return false;
+	}
+	bool seekExact(llong id, valvec<byte>* val) override {
+		m_pos = size_t(id);
+		return increment(&id, val);
+	}
+	void reset() override { m_pos = 0; }
+};
+
+typedef std::map<uint64_t, llong> Model; // id -> recId
+
+static void insertRows(DbTable* tab, uint64_t first, uint64_t last, Model* model) {
+	DbContextPtr ctx(tab->createDbContext());
+	for (uint64_t id = first; id <= last; ++id) {
+		llong recId = ctx->insertRow(encodeRow(id));
+		CHECK(recId >= 0);
+		(*model)[id] = recId;
+	}
+}
+
+/// loaded rows are not in model, their recIds are taken from the index
+static void checkTable(DbTable* tab, Model* model, size_t loaded) {
+	DbContextPtr ctx(tab->createDbContext());
+	CHECK(tab->existingRows() == llong(model->size() + loaded));
+	StoreIteratorPtr iter(tab->createStoreIterForward(ctx.get()));
+	valvec<llong> recIds;
+	valvec<byte> buf;
+	llong recId = -1;
+	size_t rows = 0;
+	while (iter->increment(&recId, &buf)) {
+		LoadRow row;
+		NativeDataInput<MemIO> dio; dio.set(buf.data(), buf.size());
+		dio >> row;
+		CHECK(std::string((const char*)buf.data(), buf.size()) == encodeRow(row.id));
+		ctx->indexSearchExact(0, Schema::fstringOf(&row.id), &recIds);
+		CHECK(recIds.size() == 1);
+		CHECK(recIds[0] == recId);
+		ctx->indexSearchExact(1, Schema::fstringOf(&row.b), &recIds);
+		CHECK(std::find(recIds.begin(), recIds.end(), recId) != recIds.end());
+		auto it = model->find(row.id);
+		if (model->end() != it)
+			CHECK(it->second == recId);
+		rows++;
+	}
+	CHECK(rows == model->size() + loaded);
+}
+
+static void checkDupLoad(DbTable* tab, RowIter& iter) {
+	llong rowsBefore = tab->existingRows();
+	size_t segsBefore = tab->getSegNum();
+	bool failed = false;
+	try {
+		tab->bulkLoad(iter);
+	}
+	catch (const std::invalid_argument&) {
+		failed = true;
+	}
+	CHECK(failed);
+	CHECK(tab->existingRows() == rowsBefore);
+	CHECK(tab->getSegNum() == segsBefore);
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "bulk-load-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	Model model;
+	insertRows(tab.get(), 1, 100, &model);
+
+	RowIter empty(1, 0);
+	CHECK(tab->bulkLoad(empty) == 0);
+
+	RowIter load(1001, 40000);
+	size_t loaded = 39000;
+	size_t segsBefore = tab->getSegNum();
+	CHECK(tab->bulkLoad(load) == llong(loaded));
+	CHECK(tab->getSegNum() > segsBefore + 2); // several readonly segments
+	checkTable(tab.get(), &model, loaded);
+
+	insertRows(tab.get(), 50001, 50100, &model);
+	checkTable(tab.get(), &model, loaded);
+
+	RowIter dupInLoad(60001, 61000);
+	dupInLoad.addId(60500);
+	checkDupLoad(tab.get(), dupInLoad);
+	RowIter dupInTable(70001, 71000);
+	dupInTable.addId(50050); // in the writable segment
+	checkDupLoad(tab.get(), dupInTable);
+	RowIter dupLoaded(80001, 81000);
+	dupLoaded.addId(2000); // in a loaded segment
+	checkDupLoad(tab.get(), dupLoaded);
+	checkTable(tab.get(), &model, loaded);
+
+	tab->compact();
+	checkTable(tab.get(), &model, loaded);
+	tab.reset();
+	tab = DbTable::open(dir);
+	checkTable(tab.get(), &model, loaded);
+
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
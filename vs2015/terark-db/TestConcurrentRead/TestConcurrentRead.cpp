@@ -0,0 +1,154 @@
+// TestConcurrentRead.cpp : lock free readers of the segment array must
+// always see consistent rows while the writer appends rows, freezes
+// segments and compacts, and the table must be usable after clear
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <random>
+#include <thread>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct ReadRow {
+	uint64_t id;
+	std::string name;
+	DATA_IO_LOAD_SAVE(ReadRow, &id&RestAll(name))
+};
+
+static std::string nameOf(uint64_t id) {
+	return "name-" + std::to_string(id * 7919);
+}
+
+static ReadRow decodeRow(valvec<byte>& buf) {
+	ReadRow row;
+	NativeDataInput<MemIO> dio; dio.set(buf.data(), buf.size());
+	dio >> row;
+	return row;
+}
+
+/// row id[i] has recId recIds[i], published is the number of inserted rows
+struct Shared {
+	const size_t maxRows;
+	std::atomic<size_t> published;
+	std::atomic<bool>   stop;
+	std::unique_ptr<std::atomic<llong>[]> recIds;
+	explicit Shared(size_t n) : maxRows(n), recIds(new std::atomic<llong>[n]) {
+		published = 0;
+		stop = false;
+	}
+};
+
+static void insertRows(DbTable* tab, Shared* sh, uint64_t firstId) {
+	DbContextPtr ctx(tab->createDbContext());
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	for (size_t i = 0; i < sh->maxRows; ++i) {
+		ReadRow row;
+		row.id = firstId + i;
+		row.name = nameOf(row.id);
+		rowBuilder.rewind();
+		rowBuilder << row;
+		llong recId = ctx->insertRow(rowBuilder.written());
+		CHECK(recId >= 0);
+		sh->recIds[i].store(recId, std::memory_order_relaxed);
+		sh->published.store(i + 1, std::memory_order_release);
+	}
+}
+
+static void pointReader(const DbTable* tab, Shared* sh, uint64_t firstId, unsigned seed) {
+	DbContextPtr ctx(tab->createDbContext());
+	std::mt19937_64 rng(seed);
+	valvec<llong> ids;
+	valvec<byte> buf;
+	while (!sh->stop.load(std::memory_order_relaxed)) {
+		size_t n = sh->published.load(std::memory_order_acquire);
+		if (0 == n) {
+			std::this_thread::yield();
+			continue;
+		}
+		size_t i = rng() % n;
+		llong recId = sh->recIds[i].load(std::memory_order_relaxed);
+		uint64_t id = firstId + i;
+		ctx->getValue(recId, &buf);
+		ReadRow row = decodeRow(buf);
+		CHECK(row.id == id);
+		CHECK(row.name == nameOf(id));
+		ctx->indexSearchExact(0, fstring((const char*)&id, sizeof(id)), &ids);
+		CHECK(ids.size() == 1);
+		CHECK(ids[0] == recId);
+	}
+}
+
+/// a full scan sees at least the rows published before it starts, in
+/// ascending recId order, each exactly once
+static void scanReader(const DbTable* tab, Shared* sh, uint64_t firstId) {
+	DbContextPtr ctx(tab->createDbContext());
+	valvec<byte> buf;
+	size_t scans = 0;
+	while (!sh->stop.load(std::memory_order_relaxed) || scans < 2) {
+		size_t n = sh->published.load(std::memory_order_acquire);
+		StoreIteratorPtr iter(tab->createStoreIterForward(ctx.get()));
+		llong prev = -1, recId = -1;
+		size_t cnt = 0;
+		while (iter->increment(&recId, &buf)) {
+			CHECK(recId > prev);
+			prev = recId;
+			ReadRow row = decodeRow(buf);
+			CHECK(row.id >= firstId);
+			CHECK(row.id - firstId < sh->maxRows);
+			CHECK(row.name == nameOf(row.id));
+			cnt++;
+		}
+		CHECK(cnt >= n);
+		scans++;
+	}
+}
+
+static void runConcurrent(DbTable* tab, size_t numRows, uint64_t firstId, bool compact) {
+	Shared sh(numRows);
+	std::vector<std::thread> readers;
+	for (unsigned t = 0; t < 4; ++t)
+		readers.emplace_back(pointReader, tab, &sh, firstId, t + 1);
+	readers.emplace_back(scanReader, tab, &sh, firstId);
+	insertRows(tab, &sh, firstId);
+	if (compact)
+		tab->compact();
+	sh.stop = true;
+	for (auto& t : readers)
+		t.join();
+	CHECK(tab->existingRows() == llong(numRows));
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "concurrent-read-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	runConcurrent(tab.get(), 50000, 1, true);
+	CHECK(tab->getSegNum() > 2);
+
+	tab->clear();
+	CHECK(tab->existingRows() == 0);
+	runConcurrent(tab.get(), 20000, 100000, false);
+	tab->clear();
+	runConcurrent(tab.get(), 20000, 200000, true);
+
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,148 @@
+// TestGroupCommit.cpp : concurrent insertRow and upsertRow with
+// EnableGroupCommit, each row must be applied exactly once, duplicate
+// inserts must fail only themselves, and for each upserted key exactly
+// one upsert must report that it is not an overwrite
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <thread>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct GroupRow {
+	uint64_t id;
+	uint32_t writer;
+	std::string name;
+	DATA_IO_LOAD_SAVE(GroupRow, &id&writer&RestAll(name))
+};
+
+static const size_t   NumThreads  = 8;
+static const uint64_t NumInserts  = 20000; // ids [1, NumInserts]
+static const uint64_t UpsertBase  = 1000000;
+static const uint64_t NumUpserted = 2000;  // ids [UpsertBase, +NumUpserted)
+
+static std::string nameOf(uint64_t id, uint32_t writer) {
+	return "name-" + std::to_string(id) + "-" + std::to_string(writer);
+}
+
+/// a failed group commit fails all rows of the group, they are retried
+static llong writeRow(DbContext* ctx, uint64_t id, uint32_t writer, bool isUpsert) {
+	GroupRow row;
+	row.id = id;
+	row.writer = writer;
+	row.name = nameOf(id, writer);
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	for (;;) {
+		try {
+			if (isUpsert)
+				return ctx->upsertRow(rowBuilder.written());
+			else
+				return ctx->insertRow(rowBuilder.written());
+		}
+		catch (const CommitException&) {}
+		catch (const NeedRetryException&) {}
+	}
+}
+
+struct Shared {
+	std::atomic<size_t> insertFail;
+	std::atomic<size_t> newUpserts[NumUpserted];
+	Shared() {
+		insertFail = 0;
+		for (auto& x : newUpserts) x = 0;
+	}
+};
+
+static void writer(DbTable* tab, Shared* sh, uint32_t t) {
+	DbContextPtr ctx(tab->createDbContext());
+	CHECK(ctx->syncIndex);
+	for (uint64_t id = 1 + t; id <= NumInserts; id += NumThreads) {
+		llong recId = writeRow(ctx.get(), id, t, false);
+		CHECK(recId >= 0);
+		if (id % 100 < NumThreads) { // insert a dup of a committed row
+			ctx->errMsg.clear();
+			CHECK(writeRow(ctx.get(), id, t, false) < 0);
+			CHECK(!ctx->errMsg.empty());
+			sh->insertFail++;
+		}
+		uint64_t k = (id * 31 + t) % NumUpserted;
+		recId = writeRow(ctx.get(), UpsertBase + k, t, true);
+		CHECK(recId >= 0);
+		if (0 == ctx->isUpsertOverwritten)
+			sh->newUpserts[k]++;
+	}
+}
+
+static GroupRow readRow(DbContext* ctx, uint64_t id) {
+	valvec<llong> recIds;
+	valvec<byte> buf;
+	ctx->indexSearchExact(0, fstring((const char*)&id, sizeof(id)), &recIds);
+	CHECK(recIds.size() == 1);
+	ctx->getValue(recIds[0], &buf);
+	GroupRow row;
+	NativeDataInput<MemIO> dio; dio.set(buf.data(), buf.size());
+	dio >> row;
+	CHECK(row.id == id);
+	CHECK(row.writer < NumThreads);
+	CHECK(row.name == nameOf(id, row.writer));
+	return row;
+}
+
+static void checkTable(DbTable* tab, const Shared& sh) {
+	DbContextPtr ctx(tab->createDbContext());
+	for (uint64_t id = 1; id <= NumInserts; ++id) {
+		GroupRow row = readRow(ctx.get(), id);
+		CHECK(row.writer == (id - 1) % NumThreads);
+	}
+	size_t upserted = 0;
+	for (uint64_t k = 0; k < NumUpserted; ++k) {
+		uint64_t id = UpsertBase + k;
+		valvec<llong> recIds;
+		ctx->indexSearchExact(0, fstring((const char*)&id, sizeof(id)), &recIds);
+		CHECK(recIds.size() == sh.newUpserts[k]);
+		if (recIds.size()) {
+			readRow(ctx.get(), id);
+			upserted++;
+		}
+	}
+	CHECK(tab->existingRows() == llong(NumInserts + upserted));
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "group-commit-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	std::unique_ptr<Shared> sh(new Shared());
+	std::vector<std::thread> writers;
+	for (uint32_t t = 0; t < NumThreads; ++t)
+		writers.emplace_back(writer, tab.get(), sh.get(), t);
+	for (auto& t : writers)
+		t.join();
+	CHECK(sh->insertFail > 0);
+	checkTable(tab.get(), *sh);
+
+	tab->syncFinishWriting();
+	checkTable(tab.get(), *sh);
+
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
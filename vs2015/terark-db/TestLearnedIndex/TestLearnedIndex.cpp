@@ -0,0 +1,208 @@
+// TestLearnedIndex.cpp : ranges of PlaIntModel must contain the result of
+// plain binary search for any error bound, and LearnedIntKeyIndex must
+// agree with std::lower_bound/upper_bound, also after save and load
+//
+
+#include "stdafx.h"
+#include <terark/db/learned_int_index.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <random>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+/// keys in record order, keys[0] is 0, so UintVecMin0 keeps keys as is
+/// monotone keys are timestamps with jitter and some big jumps
+static valvec<ullong> makeKeys(size_t rows, bool monotone, std::mt19937_64& rng) {
+	valvec<ullong> keys(rows, valvec_no_init());
+	if (monotone) {
+		ullong t = 0;
+		for (size_t i = 0; i < rows; ++i) {
+			keys[i] = t;
+			t += rng() % 100;
+			if (rng() % 1000 == 0)
+				t += rng() % 1000000; // a gap
+		}
+		for (size_t i = 1; i + 1 < rows; i += 97) {
+			std::swap(keys[i], keys[i+1]); // near monotone
+		}
+	}
+	else {
+		keys[0] = 0;
+		for (size_t i = 1; i < rows; ++i) {
+			keys[i] = rng() % (rows * 4); // has duplicates
+		}
+	}
+	return keys;
+}
+
+/// every key, the neighbours of every key, and keys beyond the max
+static valvec<ullong> makeProbes(const valvec<ullong>& sorted) {
+	valvec<ullong> probes;
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		probes.push_back(sorted[i]);
+		probes.push_back(sorted[i] + 1);
+		if (sorted[i])
+			probes.push_back(sorted[i] - 1);
+	}
+	probes.push_back(sorted.back() + 1000);
+	probes.push_back(ullong(-1));
+	return probes;
+}
+
+/// the binary search of ZipIntKeyIndex, started on a narrowed range
+static size_t lowerBoundIn(const valvec<ullong>& sorted, size_t i, size_t j, ullong key) {
+	while (i < j) {
+		size_t mid = (i + j) / 2;
+		if (sorted[mid] < key)
+			i = mid + 1;
+		else
+			j = mid;
+	}
+	return i;
+}
+static size_t upperBoundIn(const valvec<ullong>& sorted, size_t i, size_t j, ullong key) {
+	while (i < j) {
+		size_t mid = (i + j) / 2;
+		if (sorted[mid] <= key)
+			i = mid + 1;
+		else
+			j = mid;
+	}
+	return i;
+}
+
+template<class Accel>
+static void checkRanges(const Accel& accel, const valvec<ullong>& sorted,
+						const valvec<ullong>& probes) {
+	for (ullong key : probes) {
+		size_t lb = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		size_t ub = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		size_t lo = 0, hi = 0;
+		accel.lowerBoundRange(key, &lo, &hi);
+		CHECK(lo <= lb && lb <= hi && hi <= sorted.size());
+		CHECK(lowerBoundIn(sorted, lo, hi, key) == lb);
+		accel.upperBoundRange(key, &lo, &hi);
+		CHECK(lo <= ub && ub <= hi && hi <= sorted.size());
+		CHECK(upperBoundIn(sorted, lo, hi, key) == ub);
+	}
+}
+
+static void testPlaModel(const valvec<ullong>& keys, const valvec<ullong>& sorted,
+						 const valvec<ullong>& probes) {
+	valvec<uint32_t> index(keys.size(), valvec_no_init());
+	for (size_t i = 0; i < index.size(); ++i) index[i] = uint32_t(i);
+	std::stable_sort(index.begin(), index.end(), [&](uint32_t x, uint32_t y) {
+		return keys[x] < keys[y];
+	});
+	UintVecMin0 zkeys, zindex;
+	CHECK(zkeys.build_from(keys) == 0);
+	CHECK(zindex.build_from(index) == 0);
+	const size_t epsVec[] = { 1, 8, 32 };
+	for (size_t eps : epsVec) {
+		PlaIntModel model;
+		model.build(zkeys, zindex, eps);
+		CHECK(model.segNum() > 0);
+		checkRanges(model, sorted, probes);
+	}
+}
+
+static const llong bias = 1000000; // signed keys, minKey is negative
+
+static void checkLearnedIndex(const LearnedIntKeyIndex* idx, const valvec<ullong>& keys,
+							  const valvec<ullong>& sorted, const valvec<ullong>& probes) {
+	IndexIteratorPtr iter(idx->createIndexIterForward(NULL));
+	valvec<byte> retKey;
+	valvec<llong> recIds;
+	for (ullong key : probes) {
+		if (key > ullong(LLONG_MAX))
+			continue;
+		llong sk = llong(key) - bias;
+		fstring binKey((const char*)&sk, sizeof(sk));
+		size_t lb = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		size_t ub = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		llong id = -1;
+		int ret = iter->seekLowerBound(binKey, &id, &retKey);
+		if (lb == sorted.size()) {
+			CHECK(ret < 0);
+		} else {
+			CHECK(ret >= 0);
+			CHECK(retKey.size() == sizeof(llong));
+			CHECK(unaligned_load<llong>(retKey.data()) == llong(sorted[lb]) - bias);
+			CHECK((0 == ret) == (sorted[lb] == key));
+			CHECK(keys[id] == sorted[lb]);
+		}
+		ret = iter->seekUpperBound(binKey, &id, &retKey);
+		if (ub == sorted.size()) {
+			CHECK(ret < 0);
+		} else {
+			CHECK(ret > 0);
+			CHECK(unaligned_load<llong>(retKey.data()) == llong(sorted[ub]) - bias);
+			CHECK(keys[id] == sorted[ub]);
+		}
+		recIds.erase_all();
+		idx->searchExactAppend(binKey, &recIds, NULL);
+		CHECK(recIds.size() == ub - lb);
+		for (llong recId : recIds)
+			CHECK(keys[recId] == key);
+	}
+}
+
+static void testLearnedIndex(const valvec<ullong>& keys, const valvec<ullong>& sorted,
+							 const valvec<ullong>& probes, const std::string& dir) {
+	const size_t epsVec[] = { 1, 16, 256 };
+	for (size_t eps : epsVec) {
+		Schema schema;
+		ColumnMeta colmeta(ColumnType::Sint64);
+		schema.m_columnsMeta.insert_i("ts", colmeta);
+		schema.m_learnedIndexEpsilon = eps;
+		schema.compile();
+		SortableStrVec strVec;
+		for (ullong k : keys) {
+			llong sk = llong(k) - bias;
+			strVec.m_strpool.append((const byte*)&sk, sizeof(sk));
+		}
+		boost::intrusive_ptr<LearnedIntKeyIndex> lint(new LearnedIntKeyIndex(schema));
+		lint->build(ColumnType::Sint64, strVec);
+		CHECK(lint->segNum() > 0);
+		checkLearnedIndex(lint.get(), keys, sorted, probes);
+
+		// the model is loaded by mmap
+		std::string path = dir + "/index-ts";
+		lint->save(path);
+		boost::intrusive_ptr<LearnedIntKeyIndex> loaded(new LearnedIntKeyIndex(schema));
+		loaded->load(path);
+		CHECK(loaded->segNum() == lint->segNum());
+		checkLearnedIndex(loaded.get(), keys, sorted, probes);
+		loaded.reset();
+		fs::remove(path + ".lint");
+	}
+}
+
+int main(int argc, char* argv[]) {
+	size_t rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	std::string dir = argc > 2 ? argv[2] : "learned-index-test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	std::mt19937_64 rng(12345);
+	for (bool monotone : { false, true }) {
+		valvec<ullong> keys = makeKeys(rows, monotone, rng);
+		valvec<ullong> sorted = keys;
+		std::sort(sorted.begin(), sorted.end());
+		valvec<ullong> probes = makeProbes(sorted);
+		printf("rows = %zd, monotone = %d, probes = %zd\n", rows, monotone, probes.size());
+		testPlaModel(keys, sorted, probes);
+		testLearnedIndex(keys, sorted, probes, dir);
+	}
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
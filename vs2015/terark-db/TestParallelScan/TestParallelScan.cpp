@@ -0,0 +1,146 @@
+// TestParallelScan.cpp : parts of DbTable::createParallelScan, scanned
+// concurrently, must cover every live row exactly once, in their own id
+// ranges, also for a pinned snapshot while rows are inserted and removed
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+#include <thread>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct ScanRow {
+	uint64_t id;
+	std::string name;
+	DATA_IO_LOAD_SAVE(ScanRow, &id&RestAll(name))
+};
+
+typedef std::map<llong, uint64_t> Model; // recId -> id
+
+static void insertRows(DbTable* tab, uint64_t firstId, size_t n, Model* model) {
+	DbContextPtr ctx(tab->createDbContext());
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	for (size_t i = 0; i < n; ++i) {
+		ScanRow row;
+		row.id = firstId + i;
+		row.name = "name-" + std::to_string(row.id);
+		rowBuilder.rewind();
+		rowBuilder << row;
+		llong recId = ctx->insertRow(rowBuilder.written());
+		CHECK(recId >= 0);
+		(*model)[recId] = row.id;
+	}
+}
+
+static void removeSome(DbTable* tab, Model* model, size_t every) {
+	DbContextPtr ctx(tab->createDbContext());
+	size_t i = 0;
+	for (auto iter = model->begin(); iter != model->end(); ++i) {
+		if (i % every == 0) {
+			ctx->removeRow(iter->first);
+			iter = model->erase(iter);
+		}
+		else
+			++iter;
+	}
+}
+
+/// rows of iter are in [beginId, endId), in ascending order
+static void scanPart(StoreIterator* iter, llong beginId, llong endId, Model* out) {
+	llong recId = -1, prev = -1;
+	valvec<byte> buf;
+	while (iter->increment(&recId, &buf)) {
+		CHECK(recId > prev);
+		CHECK(recId >= beginId && recId < endId);
+		prev = recId;
+		ScanRow row;
+		NativeDataInput<MemIO> dio; dio.set(buf.data(), buf.size());
+		dio >> row;
+		CHECK(row.name == "name-" + std::to_string(row.id));
+		(*out)[recId] = row.id;
+	}
+}
+
+static void checkParallelScan(const DbTable* tab, const Model& model,
+							  size_t nParts, DbContext* ctx) {
+	valvec<llong> bounds;
+	tab->getParallelScanBounds(nParts, &bounds, ctx);
+	valvec<StoreIteratorPtr> parts = tab->createParallelScan(nParts, ctx);
+	CHECK(parts.size() + 1 == bounds.size());
+	CHECK(parts.size() > 1);
+	CHECK(parts.size() <= nParts);
+	CHECK(bounds[0] == 0);
+	for (size_t i = 1; i < bounds.size(); ++i)
+		CHECK(bounds[i-1] < bounds[i]);
+	std::vector<Model> results(parts.size());
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < parts.size(); ++i) {
+		threads.emplace_back(scanPart, parts[i].get(), bounds[i], bounds[i+1], &results[i]);
+	}
+	for (auto& t : threads)
+		t.join();
+	Model all;
+	for (auto& r : results) {
+		size_t before = all.size();
+		all.insert(r.begin(), r.end());
+		CHECK(all.size() == before + r.size()); // parts are disjoint
+	}
+	CHECK(all == model);
+
+	// a range iterator of any range, seekExact of live and removed rows
+	llong beginId = bounds[1] / 3, endId = bounds[1] + bounds[1] / 2;
+	StoreIteratorPtr range(tab->createStoreIterRange(beginId, endId, ctx));
+	Model part;
+	scanPart(range.get(), beginId, endId, &part);
+	CHECK(part == Model(model.lower_bound(beginId), model.lower_bound(endId)));
+	valvec<byte> buf;
+	for (llong recId = beginId; recId < endId; recId += 5) {
+		CHECK(range->seekExact(recId, &buf) == (model.count(recId) != 0));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "parallel-scan-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	Model model;
+	insertRows(tab.get(), 1, 50000, &model);
+	CHECK(tab->getSegNum() > 2);
+	checkParallelScan(tab.get(), model, 8, NULL);
+	removeSome(tab.get(), &model, 7);
+	checkParallelScan(tab.get(), model, 8, NULL);
+	checkParallelScan(tab.get(), model, 3, NULL);
+
+	// the snapshot has the rows of model, not the later changes
+	DbContextPtr snapCtx(tab->createDbContext());
+	tab->pinSnapshot(snapCtx.get());
+	Model later = model;
+	insertRows(tab.get(), 100001, 20000, &later);
+	removeSome(tab.get(), &later, 5);
+	checkParallelScan(tab.get(), model, 8, snapCtx.get());
+	checkParallelScan(tab.get(), later, 8, NULL);
+	tab->unpinSnapshot(snapCtx.get());
+	snapCtx.reset();
+
+	tab->syncFinishWriting();
+	checkParallelScan(tab.get(), later, 8, NULL);
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,201 @@
+// TestRecordCache.cpp : put/get/erase of RecordCache, capacity bound,
+// version checked put, and scan resistance of the segmented LRU
+//
+
+#include "stdafx.h"
+#include <terark/db/record_cache.hpp>
+#include <thread>
+#include <vector>
+
+using namespace terark;
+using namespace terark::db;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+/// value of record (owner, id), len bytes
+static std::string makeVal(uint64_t owner, llong id, size_t len) {
+	std::string val(len, '\0');
+	for (size_t i = 0; i < len; ++i)
+		val[i] = char('a' + (owner * 7 + id * 13 + i) % 26);
+	return val;
+}
+
+static bool getStr(RecordCache& cache, uint64_t owner, llong id, std::string* val) {
+	valvec<byte> buf;
+	if (!cache.getAppend(owner, id, &buf))
+		return false;
+	val->assign((const char*)buf.data(), buf.size());
+	return true;
+}
+
+static void testPutGetErase() {
+	RecordCache cache(RecordCache::ShardNum * 4096);
+	const uint64_t owner1 = RecordCache::newOwnerId();
+	const uint64_t owner2 = RecordCache::newOwnerId();
+	CHECK(owner1 != owner2);
+	std::string val;
+	CHECK(!getStr(cache, owner1, 1, &val));
+	CHECK(cache.missCount() == 1);
+	for (llong id = 0; id < 100; ++id) {
+		cache.put(owner1, id, makeVal(owner1, id, 50));
+		cache.put(owner2, id, makeVal(owner2, id, 50));
+	}
+	CHECK(cache.usedBytes() == 2 * 100 * 50);
+	for (llong id = 0; id < 100; ++id) {
+		CHECK(getStr(cache, owner1, id, &val) && val == makeVal(owner1, id, 50));
+		CHECK(getStr(cache, owner2, id, &val) && val == makeVal(owner2, id, 50));
+	}
+	CHECK(cache.hitCount() == 200);
+
+	// getAppend appends
+	valvec<byte> buf;
+	buf.append("xy", 2);
+	CHECK(cache.getAppend(owner1, 5, &buf));
+	CHECK(std::string((const char*)buf.data(), buf.size()) == "xy" + makeVal(owner1, 5, 50));
+
+	// a put of an existing key keeps the cached value
+	cache.put(owner1, 5, makeVal(owner1, 6, 50));
+	CHECK(getStr(cache, owner1, 5, &val) && val == makeVal(owner1, 5, 50));
+
+	cache.erase(owner1, 5);
+	CHECK(!getStr(cache, owner1, 5, &val));
+	CHECK(getStr(cache, owner2, 5, &val));
+	cache.erase(owner1, 5); // erase a missing record
+	CHECK(cache.usedBytes() == 199 * 50);
+
+	// owner ids are never reused, records of a destroyed store are only
+	// left for LRU eviction, they are never seen by a new store
+	const uint64_t owner3 = RecordCache::newOwnerId();
+	CHECK(owner3 != owner1 && owner3 != owner2);
+	for (llong id = 0; id < 100; ++id) {
+		CHECK(!getStr(cache, owner3, id, &val));
+	}
+}
+
+static void testRejectedPuts() {
+	const size_t shardCap = 4096;
+	RecordCache cache(RecordCache::ShardNum * shardCap);
+	const uint64_t owner = RecordCache::newOwnerId();
+	std::string val;
+
+	// larger than 1/4 of a shard
+	cache.put(owner, 1, makeVal(owner, 1, shardCap / 4 + 1));
+	CHECK(!getStr(cache, owner, 1, &val));
+	cache.put(owner, 1, makeVal(owner, 1, shardCap / 4));
+	CHECK(getStr(cache, owner, 1, &val));
+
+	// record is changed by a writer during decoding
+	std::atomic<uint64_t> version(0);
+	uint64_t expected = version.load();
+	version++;
+	cache.erase(owner, 2);
+	cache.put(owner, 2, makeVal(owner, 2, 10), &version, expected);
+	CHECK(!getStr(cache, owner, 2, &val));
+	cache.put(owner, 2, makeVal(owner, 2, 10), &version, version.load());
+	CHECK(getStr(cache, owner, 2, &val));
+
+	// disabled cache
+	RecordCache disabled(0);
+	CHECK(!disabled.enabled());
+	disabled.put(owner, 3, makeVal(owner, 3, 1));
+	CHECK(!getStr(disabled, owner, 3, &val));
+	CHECK(disabled.usedBytes() == 0);
+}
+
+static void testCapacity() {
+	const size_t capacity = RecordCache::ShardNum * 4096;
+	RecordCache cache(capacity);
+	const uint64_t owner = RecordCache::newOwnerId();
+	for (llong id = 0; id < 100000; ++id) {
+		cache.put(owner, id, makeVal(owner, id, 100));
+		CHECK(cache.usedBytes() <= capacity);
+	}
+	CHECK(cache.usedBytes() > capacity / 2);
+
+	cache.setCapacity(capacity / 4);
+	CHECK(cache.usedBytes() <= capacity / 4);
+	cache.ensureCapacity(capacity / 8); // never shrinks
+	CHECK(cache.capacity() == capacity / 4);
+	cache.ensureCapacity(capacity);
+	CHECK(cache.capacity() == capacity);
+
+	// the latest records survive
+	std::string val;
+	CHECK(getStr(cache, owner, 99999, &val) && val == makeVal(owner, 99999, 100));
+}
+
+/// hot records hit twice are protected, a scan of records which are
+/// put once can not evict them
+static void testScanResistance() {
+	RecordCache cache(RecordCache::ShardNum * 4096);
+	const uint64_t owner = RecordCache::newOwnerId();
+	const llong hotNum = 200;
+	std::string val;
+	for (llong id = 0; id < hotNum; ++id) {
+		cache.put(owner, id, makeVal(owner, id, 100));
+		CHECK(getStr(cache, owner, id, &val));
+	}
+	for (llong id = hotNum; id < hotNum + 10000; ++id) {
+		cache.put(owner, id, makeVal(owner, id, 100));
+	}
+	for (llong id = 0; id < hotNum; ++id) {
+		CHECK(getStr(cache, owner, id, &val) && val == makeVal(owner, id, 100));
+	}
+	// most of the scanned records are evicted
+	size_t scanHits = 0;
+	for (llong id = hotNum; id < hotNum + 10000; ++id) {
+		scanHits += getStr(cache, owner, id, &val);
+	}
+	CHECK(scanHits < 10000 / 2);
+}
+
+/// readers never see a value of another record, while writers put and
+/// erase the same records
+static void testConcurrent() {
+	const size_t capacity = RecordCache::ShardNum * 4096;
+	RecordCache cache(capacity);
+	const uint64_t owner = RecordCache::newOwnerId();
+	const size_t threadNum = 8;
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < threadNum; ++t) {
+		threads.emplace_back([&,t]() {
+			std::string val;
+			for (llong i = 0; i < 200000; ++i) {
+				llong id = (i * 31 + t * 17) % 5000;
+				switch (i % 4) {
+				case 0:
+				case 1:
+					if (getStr(cache, owner, id, &val))
+						CHECK(val == makeVal(owner, id, 16 + id % 64));
+					break;
+				case 2:
+					cache.put(owner, id, makeVal(owner, id, 16 + id % 64));
+					break;
+				case 3:
+					cache.erase(owner, (id + 1) % 5000);
+					break;
+				}
+			}
+		});
+	}
+	for (auto& th : threads)
+		th.join();
+	CHECK(cache.usedBytes() <= capacity);
+	for (llong id = 0; id < 5000; ++id)
+		cache.erase(owner, id);
+	CHECK(cache.usedBytes() == 0);
+}
+
+int main(int argc, char* argv[]) {
+	testPutGetErase();
+	testRejectedPuts();
+	testCapacity();
+	testScanResistance();
+	testConcurrent();
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,247 @@
+// TestSearchAccel.cpp : ranges of SearchAccel must contain the result of
+// plain binary search, and ZipIntKeyIndex and FixedLenKeyIndex searched
+// through them must agree with std::lower_bound/upper_bound
+//
+
+#include "stdafx.h"
+#include <terark/db/search_accel.hpp>
+#include <terark/db/intkey_index.hpp>
+#include <terark/db/fixed_len_key_index.hpp>
+#include <algorithm>
+#include <random>
+
+using namespace terark;
+using namespace terark::db;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+/// keys in record order, keys[0] is 0, so UintVecMin0 keeps keys as is
+/// monotone keys are timestamps with jitter and some big jumps
+static valvec<ullong> makeKeys(size_t rows, bool monotone, std::mt19937_64& rng) {
+	valvec<ullong> keys(rows, valvec_no_init());
+	if (monotone) {
+		ullong t = 0;
+		for (size_t i = 0; i < rows; ++i) {
+			keys[i] = t;
+			t += rng() % 100;
+			if (rng() % 1000 == 0)
+				t += rng() % 1000000; // a gap
+		}
+		for (size_t i = 1; i + 1 < rows; i += 97) {
+			std::swap(keys[i], keys[i+1]); // near monotone
+		}
+	}
+	else {
+		keys[0] = 0;
+		for (size_t i = 1; i < rows; ++i) {
+			keys[i] = rng() % (rows * 4); // has duplicates
+		}
+	}
+	return keys;
+}
+
+/// every key, the neighbours of every key, and keys beyond the max
+static valvec<ullong> makeProbes(const valvec<ullong>& sorted) {
+	valvec<ullong> probes;
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		probes.push_back(sorted[i]);
+		probes.push_back(sorted[i] + 1);
+		if (sorted[i])
+			probes.push_back(sorted[i] - 1);
+	}
+	probes.push_back(sorted.back() + 1000);
+	probes.push_back(ullong(-1));
+	return probes;
+}
+
+/// the binary search of ZipIntKeyIndex, started on a narrowed range
+static size_t lowerBoundIn(const valvec<ullong>& sorted, size_t i, size_t j, ullong key) {
+	while (i < j) {
+		size_t mid = (i + j) / 2;
+		if (sorted[mid] < key)
+			i = mid + 1;
+		else
+			j = mid;
+	}
+	return i;
+}
+static size_t upperBoundIn(const valvec<ullong>& sorted, size_t i, size_t j, ullong key) {
+	while (i < j) {
+		size_t mid = (i + j) / 2;
+		if (sorted[mid] <= key)
+			i = mid + 1;
+		else
+			j = mid;
+	}
+	return i;
+}
+
+template<class Accel>
+static void checkRanges(const Accel& accel, const valvec<ullong>& sorted,
+						const valvec<ullong>& probes) {
+	for (ullong key : probes) {
+		size_t lb = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		size_t ub = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		size_t lo = 0, hi = 0;
+		accel.lowerBoundRange(key, &lo, &hi);
+		CHECK(lo <= lb && lb <= hi && hi <= sorted.size());
+		CHECK(lowerBoundIn(sorted, lo, hi, key) == lb);
+		accel.upperBoundRange(key, &lo, &hi);
+		CHECK(lo <= ub && ub <= hi && hi <= sorted.size());
+		CHECK(upperBoundIn(sorted, lo, hi, key) == ub);
+	}
+}
+
+static void testSearchAccel(const valvec<ullong>& sorted, const valvec<ullong>& probes) {
+	const size_t steps[] = { 1, 7, 64 };
+	for (size_t step : steps) {
+		valvec<ullong> samples;
+		for (size_t i = 0; i < sorted.size(); i += step)
+			samples.push_back(sorted[i]);
+		SearchAccel accel;
+		accel.build(samples, step, sorted.size());
+		CHECK(!accel.empty());
+		checkRanges(accel, sorted, probes);
+		// prefixRange of exact keys is the union of both ranges
+		for (ullong key : probes) {
+			size_t lb = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+			size_t ub = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+			size_t lo = 0, hi = 0;
+			accel.prefixRange(key, &lo, &hi);
+			CHECK(lo <= lb && ub <= hi);
+		}
+	}
+}
+
+static void testIntKeyIndex(const valvec<ullong>& keys, const valvec<ullong>& sorted,
+							const valvec<ullong>& probes) {
+	// signed keys, minKey of ZipIntKeyIndex is negative
+	const llong bias = 1000000;
+	Schema schema;
+	ColumnMeta colmeta(ColumnType::Sint64);
+	schema.m_columnsMeta.insert_i("ts", colmeta);
+	schema.compile();
+	SortableStrVec strVec;
+	for (ullong k : keys) {
+		llong sk = llong(k) - bias;
+		strVec.m_strpool.append((const byte*)&sk, sizeof(sk));
+	}
+	boost::intrusive_ptr<ZipIntKeyIndex> idx(new ZipIntKeyIndex(schema));
+	idx->build(ColumnType::Sint64, strVec);
+	IndexIteratorPtr iter(idx->createIndexIterForward(NULL));
+	valvec<byte> retKey;
+	valvec<llong> recIds;
+	for (ullong key : probes) {
+		if (key > ullong(LLONG_MAX))
+			continue;
+		llong sk = llong(key) - bias;
+		fstring binKey((const char*)&sk, sizeof(sk));
+		size_t lb = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		size_t ub = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+		llong id = -1;
+		int ret = iter->seekLowerBound(binKey, &id, &retKey);
+		if (lb == sorted.size()) {
+			CHECK(ret < 0);
+		} else {
+			CHECK(ret >= 0);
+			CHECK(retKey.size() == sizeof(llong));
+			CHECK(unaligned_load<llong>(retKey.data()) == llong(sorted[lb]) - bias);
+			CHECK((0 == ret) == (sorted[lb] == key));
+			CHECK(keys[id] == sorted[lb]);
+		}
+		ret = iter->seekUpperBound(binKey, &id, &retKey);
+		if (ub == sorted.size()) {
+			CHECK(ret < 0);
+		} else {
+			CHECK(ret > 0);
+			CHECK(unaligned_load<llong>(retKey.data()) == llong(sorted[ub]) - bias);
+			CHECK(keys[id] == sorted[ub]);
+		}
+		recIds.erase_all();
+		idx->searchExactAppend(binKey, &recIds, NULL);
+		CHECK(recIds.size() == ub - lb);
+		for (llong recId : recIds)
+			CHECK(keys[recId] == key);
+	}
+}
+
+/// 12 byte keys, many keys share the 8 byte prefix of SearchAccel samples
+static void testFixedLenKeyIndex(size_t rows, std::mt19937_64& rng) {
+	const size_t fixlen = 12;
+	Schema schema;
+	ColumnMeta colmeta(ColumnType::Fixed);
+	colmeta.fixedLen = fixlen;
+	schema.m_columnsMeta.insert_i("key", colmeta);
+	schema.compile();
+	CHECK(schema.getFixedRowLen() == fixlen);
+	std::vector<std::string> keys;
+	SortableStrVec strVec;
+	for (size_t i = 0; i < rows; ++i) {
+		std::string key(fixlen, '\0');
+		ullong prefix = rng() % (rows / 16 + 1) * 0x0101010101ULL;
+		uint32_t suffix = uint32_t(rng() % 64);
+		memcpy(&key[0], &prefix, 8);
+		memcpy(&key[8], &suffix, 4);
+		keys.push_back(key);
+		strVec.m_strpool.append((const byte*)key.data(), fixlen);
+	}
+	std::vector<std::string> sorted = keys;
+	std::sort(sorted.begin(), sorted.end());
+	boost::intrusive_ptr<FixedLenKeyIndex> index(new FixedLenKeyIndex(schema));
+	index->build(schema, strVec);
+	IndexIteratorPtr iter(index->createIndexIterForward(NULL));
+	valvec<byte> retKey;
+	valvec<llong> recIds;
+	for (size_t i = 0; i < rows; i += 3) {
+		std::string probes[2] = { keys[i], keys[i] };
+		probes[1][fixlen-1]++; // mostly absent
+		for (auto& key : probes) {
+			size_t lb = std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+			size_t ub = std::upper_bound(sorted.begin(), sorted.end(), key) - sorted.begin();
+			llong id = -1;
+			int ret = iter->seekLowerBound(key, &id, &retKey);
+			if (lb == rows) {
+				CHECK(ret < 0);
+			} else {
+				CHECK(ret >= 0);
+				CHECK(fstring(retKey) == sorted[lb]);
+				CHECK((0 == ret) == (sorted[lb] == key));
+				CHECK(keys[id] == sorted[lb]);
+			}
+			ret = iter->seekUpperBound(key, &id, &retKey);
+			if (ub == rows) {
+				CHECK(ret < 0);
+			} else {
+				CHECK(ret > 0);
+				CHECK(fstring(retKey) == sorted[ub]);
+				CHECK(keys[id] == sorted[ub]);
+			}
+			recIds.erase_all();
+			index->searchExactAppend(key, &recIds, NULL);
+			CHECK(recIds.size() == ub - lb);
+			for (llong recId : recIds)
+				CHECK(keys[recId] == key);
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	size_t rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	std::mt19937_64 rng(12345);
+	for (bool monotone : { false, true }) {
+		valvec<ullong> keys = makeKeys(rows, monotone, rng);
+		valvec<ullong> sorted = keys;
+		std::sort(sorted.begin(), sorted.end());
+		valvec<ullong> probes = makeProbes(sorted);
+		printf("rows = %zd, monotone = %d, probes = %zd\n", rows, monotone, probes.size());
+		testSearchAccel(sorted, probes);
+		testIntKeyIndex(keys, sorted, probes);
+	}
+	testFixedLenKeyIndex(rows, rng);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,122 @@
+// TestSearchBatch.cpp : indexSearchExactBatch must return the same ids as
+// indexSearchExact for each key, on unique and non-unique indices, across
+// writable and frozen segments, with absent, duplicate and removed keys
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <random>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct BatchRow {
+	uint64_t id;
+	uint32_t b;
+	std::string name;
+	DATA_IO_LOAD_SAVE(BatchRow, &id&b&RestAll(name))
+};
+
+static llong insertRow(DbContext* ctx, const BatchRow& row) {
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	return ctx->insertRow(rowBuilder.written());
+}
+
+/// keys are binary index keys, ids of each key are compared as sets
+static size_t checkBatch(const DbTable* tab, size_t indexId,
+					   const std::vector<std::string>& keys) {
+	DbContextPtr ctx(tab->createDbContext());
+	valvec<fstring> fkeys;
+	for (auto& k : keys)
+		fkeys.push_back(k);
+	valvec<llong>  batchIds;
+	valvec<size_t> offsets;
+	tab->indexSearchExactBatch(indexId, fkeys.data(), fkeys.size(),
+							   &batchIds, &offsets, ctx.get());
+	CHECK(offsets.size() == keys.size() + 1);
+	CHECK(offsets[0] == 0);
+	CHECK(offsets.back() == batchIds.size());
+	valvec<llong> ids;
+	size_t found = 0;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		CHECK(offsets[i] <= offsets[i+1]);
+		tab->indexSearchExact(indexId, fkeys[i], &ids, ctx.get());
+		valvec<llong> got(batchIds.data() + offsets[i], offsets[i+1] - offsets[i]);
+		std::sort(ids.begin(), ids.end());
+		std::sort(got.begin(), got.end());
+		CHECK(got.size() == ids.size());
+		CHECK(std::equal(got.begin(), got.end(), ids.begin()));
+		found += ids.size();
+	}
+	return found;
+}
+
+static void checkAll(const DbTable* tab, uint64_t maxId, std::mt19937_64& rng) {
+	std::vector<std::string> keys;
+	for (size_t i = 0; i < 1000; ++i) {
+		uint64_t id = rng() % (maxId + 100); // some ids are absent
+		keys.push_back(std::string((const char*)&id, sizeof(id)));
+	}
+	keys.push_back(keys[0]); // duplicate keys in one batch
+	keys.push_back(keys[1]);
+	CHECK(checkBatch(tab, 0, keys) > 0);
+	checkBatch(tab, 0, std::vector<std::string>(1, keys[2]));
+
+	keys.clear();
+	for (uint32_t b = 0; b < 120; ++b) // b of rows are in [0, 100)
+		keys.push_back(std::string((const char*)&b, sizeof(b)));
+	std::shuffle(keys.begin(), keys.end(), rng);
+	CHECK(checkBatch(tab, 1, keys) > 0);
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "search-batch-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	std::mt19937_64 rng(11);
+	DbTablePtr tab(DbTable::open(dir));
+	DbContextPtr ctx(tab->createDbContext());
+	CHECK(tab->getIndexId("id") == 0);
+	CHECK(tab->getIndexId("b") == 1);
+	const uint64_t maxId = 20000;
+	valvec<llong> recIds;
+	for (uint64_t id = 1; id <= maxId; ++id) {
+		BatchRow row;
+		row.id = id;
+		row.b = uint32_t(rng() % 100);
+		row.name = "name-" + std::to_string(id);
+		llong recId = insertRow(ctx.get(), row);
+		CHECK(recId >= 0);
+		recIds.push_back(recId);
+	}
+	// rows are spread over several frozen segments and the writable one
+	CHECK(tab->getSegNum() > 2);
+	checkAll(tab.get(), maxId, rng);
+
+	for (size_t i = 0; i < recIds.size(); i += 3)
+		ctx->removeRow(recIds[i]);
+	checkAll(tab.get(), maxId, rng);
+
+	tab->syncFinishWriting();
+	checkAll(tab.get(), maxId, rng);
+
+	ctx.reset();
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,173 @@
+// TestStripedTxn.cpp : concurrent upserts and removes through the striped
+// optimistic transactions of the trb writable segment, a conflict may
+// fail a write, which is retried, but no committed write may be lost or
+// applied twice, and a hot key must always have exactly one row
+//
+
+#include "stdafx.h"
+#include <terark/db/db_table.hpp>
+#include <terark/io/DataIO.hpp>
+#include <terark/io/MemStream.hpp>
+#include <terark/io/RangeStream.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+#include <random>
+#include <thread>
+
+using namespace terark;
+using namespace terark::db;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+struct TxnRow {
+	uint64_t id;
+	uint32_t writer;
+	uint32_t version;
+	std::string name;
+	DATA_IO_LOAD_SAVE(TxnRow, &id&writer&version&RestAll(name))
+};
+
+static const size_t   NumThreads = 8;
+static const uint64_t NumHotIds  = 16;   // ids [0, NumHotIds) are written by all
+static const uint64_t NumOwned   = 2000; // owned ids of each thread
+
+typedef std::map<uint64_t, uint32_t> Model; // id -> version
+
+static std::string nameOf(uint64_t id, uint32_t writer, uint32_t version) {
+	return "name-" + std::to_string(id) + "-" + std::to_string(writer)
+		 + "-" + std::to_string(version);
+}
+
+static llong findRow(DbContext* ctx, uint64_t id) {
+	valvec<llong> recIds;
+	ctx->indexSearchExact(0, Schema::fstringOf(&id), &recIds);
+	CHECK(recIds.size() <= 1);
+	return recIds.empty() ? -1 : recIds[0];
+}
+
+static void upsert(DbContext* ctx, uint64_t id, uint32_t writer, uint32_t version) {
+	TxnRow row;
+	row.id = id;
+	row.writer = writer;
+	row.version = version;
+	row.name = nameOf(id, writer, version);
+	NativeDataOutput<AutoGrownMemIO> rowBuilder;
+	rowBuilder << row;
+	for (;;) {
+		try {
+			CHECK(ctx->upsertRow(rowBuilder.written()) >= 0);
+			return;
+		}
+		catch (const CommitException&) {}
+		catch (const NeedRetryException&) {}
+	}
+}
+
+/// only the owner removes its ids, so the id is stable between the
+/// search and the remove
+static void removeOwned(DbContext* ctx, uint64_t id) {
+	for (;;) {
+		llong recId = findRow(ctx, id);
+		CHECK(recId >= 0);
+		try {
+			ctx->removeRow(recId);
+			return;
+		}
+		catch (const CommitException&) {}
+		catch (const NeedRetryException&) {}
+	}
+}
+
+static void writer(DbTable* tab, uint32_t t, Model* model) {
+	DbContextPtr ctx(tab->createDbContext());
+	std::mt19937_64 rng(t + 1);
+	uint32_t version = 0;
+	for (size_t i = 0; i < 20000; ++i) {
+		if (rng() % 8 == 0) {
+			upsert(ctx.get(), rng() % NumHotIds, t, ++version);
+			continue;
+		}
+		uint64_t id = NumHotIds + (rng() % NumOwned) * NumThreads + t;
+		auto iter = model->find(id);
+		if (model->end() != iter && rng() % 4 == 0) {
+			removeOwned(ctx.get(), id);
+			model->erase(iter);
+		}
+		else {
+			upsert(ctx.get(), id, t, ++version);
+			(*model)[id] = version;
+		}
+	}
+}
+
+static TxnRow readRow(DbContext* ctx, llong recId) {
+	valvec<byte> buf;
+	ctx->getValue(recId, &buf);
+	TxnRow row;
+	NativeDataInput<MemIO> dio; dio.set(buf.data(), buf.size());
+	dio >> row;
+	CHECK(row.name == nameOf(row.id, row.writer, row.version));
+	return row;
+}
+
+static void checkTable(DbTable* tab, const Model* models) {
+	DbContextPtr ctx(tab->createDbContext());
+	size_t live = NumHotIds;
+	for (uint64_t id = 0; id < NumHotIds; ++id) {
+		llong recId = findRow(ctx.get(), id);
+		CHECK(recId >= 0);
+		TxnRow row = readRow(ctx.get(), recId);
+		CHECK(row.id == id);
+		CHECK(row.writer < NumThreads);
+	}
+	for (uint32_t t = 0; t < NumThreads; ++t) {
+		const Model& model = models[t];
+		for (uint64_t k = 0; k < NumOwned; ++k) {
+			uint64_t id = NumHotIds + k * NumThreads + t;
+			llong recId = findRow(ctx.get(), id);
+			auto iter = model.find(id);
+			if (model.end() == iter) {
+				CHECK(recId < 0);
+				continue;
+			}
+			CHECK(recId >= 0);
+			TxnRow row = readRow(ctx.get(), recId);
+			CHECK(row.id == id);
+			CHECK(row.writer == t);
+			CHECK(row.version == iter->second);
+			live++;
+		}
+		valvec<llong> recIds;
+		ctx->indexSearchExact(1, Schema::fstringOf(&t), &recIds);
+		CHECK(recIds.size() >= model.size());
+		CHECK(recIds.size() <= model.size() + NumHotIds);
+	}
+	CHECK(tab->existingRows() == llong(live));
+}
+
+int main(int argc, char* argv[]) {
+	std::string dir = argc > 1 ? argv[1] : "striped-txn-db";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	fs::copy_file("dbmeta.json", dir + "/dbmeta.json");
+	DbTablePtr tab(DbTable::open(dir));
+	Model models[NumThreads];
+	std::vector<std::thread> writers;
+	for (uint32_t t = 0; t < NumThreads; ++t)
+		writers.emplace_back(writer, tab.get(), t, &models[t]);
+	for (auto& th : writers)
+		th.join();
+	checkTable(tab.get(), models);
+
+	tab->syncFinishWriting();
+	checkTable(tab.get(), models);
+	tab.reset();
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,233 @@
+// TestTrbCheckpoint.cpp : TrbWritableStore and TrbWritableIndex are dropped
+// without save, as if the process crashed, then reopened from their
+// checkpoint image and log, the reopened ones must have all ops which were
+// written to the log
+//
+
+#include "stdafx.h"
+#include <terark/db/trbdb/trb_db_index.hpp>
+#include <terark/db/trbdb/trb_db_store.hpp>
+#include <terark/db/bg_task_scheduler.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <thread>
+
+using namespace terark;
+using namespace terark::db;
+using namespace terark::db::trbdb;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+typedef std::map<llong, std::string> Model;
+
+/// appends, updates and removes, model has the expected live records
+static size_t randomOps(TrbWritableStore* store, Model* model, size_t n,
+						std::mt19937_64& rng) {
+	size_t bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		std::string val(20 + rng() % 180, 'a' + rng() % 26);
+		unsigned op = rng() % 10;
+		if (op < 7 || model->size() < 10) {
+			llong id = store->append(val, NULL);
+			CHECK(model->count(id) == 0);
+			(*model)[id] = val;
+		}
+		else {
+			auto iter = model->lower_bound(llong(rng() % (model->rbegin()->first + 1)));
+			if (model->end() == iter)
+				iter = model->begin();
+			if (op < 9) {
+				store->update(iter->first, val, NULL);
+				iter->second = val;
+			}
+			else {
+				store->remove(iter->first, NULL);
+				model->erase(iter);
+			}
+		}
+		bytes += val.size();
+	}
+	return bytes;
+}
+
+static std::string toStr(const valvec<byte>& val) {
+	return std::string((const char*)val.data(), val.size());
+}
+
+static void verify(const TrbWritableStore* store, const Model& model) {
+	StoreIteratorPtr iter(store->createStoreIterForward(NULL));
+	llong id = -1;
+	valvec<byte> val;
+	auto expected = model.begin();
+	while (iter->increment(&id, &val)) {
+		CHECK(model.end() != expected);
+		CHECK(expected->first == id);
+		CHECK(expected->second == toStr(val));
+		++expected;
+	}
+	CHECK(model.end() == expected);
+	for (auto& kv : model) {
+		val.erase_all();
+		store->getValueAppend(kv.first, &val, NULL);
+		CHECK(kv.second == toStr(val));
+	}
+}
+
+/// checkpoints run in background flush tasks
+static void waitForCheckpoints() {
+	for (;;) {
+		BgTaskStats st;
+		DbTable::getBgTaskStats(&st);
+		if (0 == st.queued[BgTask::Flush] && 0 == st.running[BgTask::Flush])
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+static void testCrashReplay(const std::string& dir) {
+	std::mt19937_64 rng(54321);
+	const std::string path = dir + "/store";
+	const std::string logPath = path + ".trb";
+	const std::string imgPath = logPath + ".img";
+	Model model;
+	size_t writtenBytes = 0;
+	{
+		TrbWritableStorePtr store(new TrbWritableStore(path));
+		// no log group, every op is flushed to the log
+		writtenBytes += randomOps(store.get(), &model, 2000, rng);
+		verify(store.get(), model);
+		waitForCheckpoints();
+		CHECK(fs::exists(imgPath));
+		// ops after the checkpoint are only in the log
+		writtenBytes += randomOps(store.get(), &model, 300, rng);
+		verify(store.get(), model);
+		// crash: the store is dropped without save
+	}
+	waitForCheckpoints();
+	CHECK(fs::file_size(logPath) < writtenBytes); // log was truncated
+	{
+		TrbWritableStorePtr store(new TrbWritableStore(path));
+		verify(store.get(), model);
+		writtenBytes += randomOps(store.get(), &model, 2000, rng);
+		verify(store.get(), model);
+	}
+	waitForCheckpoints();
+	{
+		// replay again from the newer image and the rest of the log
+		TrbWritableStorePtr store(new TrbWritableStore(path));
+		verify(store.get(), model);
+		// reopen without any new op
+	}
+	{
+		TrbWritableStorePtr store(new TrbWritableStore(path));
+		verify(store.get(), model);
+	}
+}
+
+typedef std::multimap<std::string, llong> IndexModel; // key -> id
+
+/// inserts and removes, keys of a non-unique index are often shared
+static void randomIndexOps(TrbWritableIndex* index, IndexModel* model,
+						   size_t n, bool isUnique, std::mt19937_64& rng) {
+	WritableIndex* windex = index->getWritableIndex();
+	for (size_t i = 0; i < n; ++i) {
+		if (rng() % 4 || model->size() < 10) {
+			uint64_t k = rng() % (isUnique ? 1000000 : 300);
+			std::string key = isUnique
+				? std::string((const char*)&k, sizeof(k))
+				: "key-" + std::to_string(k) + std::string(k % 37, 'x');
+			if (isUnique && model->count(key))
+				continue;
+			static llong nextId = 0; // (key, id) pairs are unique
+			llong id = nextId++;
+			CHECK(windex->insert(key, id, NULL));
+			model->insert(std::make_pair(key, id));
+		}
+		else {
+			auto iter = model->begin();
+			std::advance(iter, rng() % model->size());
+			CHECK(windex->remove(iter->first, iter->second, NULL));
+			model->erase(iter);
+		}
+	}
+}
+
+static void verifyIndex(const TrbWritableIndex* index, const IndexModel& model) {
+	valvec<llong> recIds;
+	for (auto iter = model.begin(); iter != model.end(); ) {
+		auto range = model.equal_range(iter->first);
+		valvec<llong> expected;
+		for (; iter != range.second; ++iter)
+			expected.push_back(iter->second);
+		index->searchExact(range.first->first, &recIds, NULL);
+		std::sort(recIds.begin(), recIds.end());
+		std::sort(expected.begin(), expected.end());
+		CHECK(recIds.size() == expected.size());
+		CHECK(std::equal(recIds.begin(), recIds.end(), expected.begin()));
+	}
+	IndexIteratorPtr iter(index->createIndexIterForward(NULL));
+	llong id = -1;
+	valvec<byte> key;
+	size_t cnt = 0;
+	while (iter->increment(&id, &key))
+		cnt++;
+	CHECK(cnt == model.size());
+}
+
+static void testIndexCrashReplay(const std::string& dir, bool isUnique) {
+	std::mt19937_64 rng(isUnique ? 13579 : 24680);
+	const std::string path = dir + (isUnique ? "/uniq-index" : "/multi-index");
+	const std::string imgPath = path + ".trb.img";
+	Schema schema;
+	ColumnMeta colmeta(isUnique ? ColumnType::Uint64 : ColumnType::Binary);
+	schema.m_columnsMeta.insert_i("key", colmeta);
+	schema.m_isUnique = isUnique;
+	schema.compile();
+	IndexModel model;
+	{
+		TrbWritableIndexPtr index(TrbWritableIndex::createIndex(schema, path));
+		randomIndexOps(index.get(), &model, 3000, isUnique, rng);
+		verifyIndex(index.get(), model);
+		waitForCheckpoints();
+		CHECK(fs::exists(imgPath));
+		randomIndexOps(index.get(), &model, 200, isUnique, rng);
+		// crash: the index is dropped without save
+	}
+	waitForCheckpoints();
+	{
+		TrbWritableIndexPtr index(TrbWritableIndex::createIndex(schema, path));
+		verifyIndex(index.get(), model);
+		randomIndexOps(index.get(), &model, 3000, isUnique, rng);
+		verifyIndex(index.get(), model);
+	}
+	waitForCheckpoints();
+	{
+		TrbWritableIndexPtr index(TrbWritableIndex::createIndex(schema, path));
+		verifyIndex(index.get(), model);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	// checkpoint as soon as the log is larger than 4K and the image
+#if defined(_MSC_VER)
+	_putenv_s("TerarkDB_TrbCheckpointLogBytes", "4096");
+#else
+	setenv("TerarkDB_TrbCheckpointLogBytes", "4096", 1);
+#endif
+	std::string dir = argc > 1 ? argv[1] : "trb-checkpoint-test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	testCrashReplay(dir);
+	testIndexCrashReplay(dir, true);
+	testIndexCrashReplay(dir, false);
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,182 @@
+// TestTrbLogGroup.cpp : TrbWritableStore and TrbWritableIndex sharing a
+// TrbLogGroup are dropped without save after concurrent commits, as if
+// the process crashed, the reopened ones must have all committed ops
+//
+
+#include "stdafx.h"
+#include <terark/db/trbdb/trb_db_checkpoint.hpp>
+#include <terark/db/trbdb/trb_db_index.hpp>
+#include <terark/db/trbdb/trb_db_store.hpp>
+#include <terark/db/bg_task_scheduler.hpp>
+#include <boost/filesystem.hpp>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+using namespace terark;
+using namespace terark::db;
+using namespace terark::db::trbdb;
+namespace fs = boost::filesystem;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+typedef std::map<llong, std::string> Model;
+
+/// appends, updates and removes, model has the expected live records
+static void randomOps(TrbWritableStore* store, Model* model, size_t n,
+					  std::mt19937_64& rng) {
+	for (size_t i = 0; i < n; ++i) {
+		std::string val(20 + rng() % 180, 'a' + rng() % 26);
+		unsigned op = rng() % 10;
+		if (op < 7 || model->size() < 10) {
+			llong id = store->append(val, NULL);
+			CHECK(model->count(id) == 0);
+			(*model)[id] = val;
+		}
+		else {
+			auto iter = model->lower_bound(llong(rng() % (model->rbegin()->first + 1)));
+			if (model->end() == iter)
+				iter = model->begin();
+			if (op < 9) {
+				store->update(iter->first, val, NULL);
+				iter->second = val;
+			}
+			else {
+				store->remove(iter->first, NULL);
+				model->erase(iter);
+			}
+		}
+	}
+}
+
+static std::string toStr(const valvec<byte>& val) {
+	return std::string((const char*)val.data(), val.size());
+}
+
+static void verify(const TrbWritableStore* store, const Model& model) {
+	StoreIteratorPtr iter(store->createStoreIterForward(NULL));
+	llong id = -1;
+	valvec<byte> val;
+	auto expected = model.begin();
+	while (iter->increment(&id, &val)) {
+		CHECK(model.end() != expected);
+		CHECK(expected->first == id);
+		CHECK(expected->second == toStr(val));
+		++expected;
+	}
+	CHECK(model.end() == expected);
+}
+
+/// checkpoints run in background flush tasks
+static void waitForCheckpoints() {
+	for (;;) {
+		BgTaskStats st;
+		DbTable::getBgTaskStats(&st);
+		if (0 == st.queued[BgTask::Flush] && 0 == st.running[BgTask::Flush])
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+static void testCrashReplayLogGroup(const std::string& dir) {
+	std::mt19937_64 rng(65432);
+	const std::string path = dir + "/group";
+	Model model;
+	{
+		TrbLogGroup logGroup;
+		TrbWritableStorePtr store(new TrbWritableStore(path, &logGroup));
+		for (size_t i = 0; i < 50; ++i) {
+			randomOps(store.get(), &model, 50, rng);
+			logGroup.commit();
+		}
+		verify(store.get(), model);
+		waitForCheckpoints();
+		store.reset(); // crash after commit
+	}
+	{
+		TrbLogGroup logGroup;
+		TrbWritableStorePtr store(new TrbWritableStore(path, &logGroup));
+		verify(store.get(), model);
+		randomOps(store.get(), &model, 100, rng);
+		logGroup.commit();
+		waitForCheckpoints();
+		store.reset();
+	}
+	{
+		TrbLogGroup logGroup;
+		TrbWritableStorePtr store(new TrbWritableStore(path, &logGroup));
+		verify(store.get(), model);
+	}
+}
+
+/// each thread appends a row and inserts its key into the index, then
+/// commits, so commits of the threads share flushes of both logs
+static void testConcurrentCommit(const std::string& dir) {
+	const std::string storePath = dir + "/shared-store";
+	const std::string indexPath = dir + "/shared-index";
+	Schema schema;
+	ColumnMeta colmeta(ColumnType::Binary);
+	schema.m_columnsMeta.insert_i("key", colmeta);
+	schema.m_isUnique = true;
+	schema.compile();
+	const size_t numThreads = 4, numOps = 2000;
+	Model model;
+	{
+		TrbLogGroup logGroup;
+		TrbWritableStorePtr store(new TrbWritableStore(storePath, &logGroup));
+		TrbWritableIndexPtr index(TrbWritableIndex::createIndex(schema, indexPath, &logGroup));
+		std::mutex modelMutex;
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < numThreads; ++t) {
+			threads.emplace_back([&,t]() {
+				for (size_t i = 0; i < numOps; ++i) {
+					std::string val = "val-" + std::to_string(t) + "-" + std::to_string(i);
+					llong id = store->append(val, NULL);
+					CHECK(index->getWritableIndex()->insert(val, id, NULL));
+					logGroup.commit();
+					std::lock_guard<std::mutex> lock(modelMutex);
+					model[id] = val;
+				}
+			});
+		}
+		for (auto& th : threads)
+			th.join();
+		verify(store.get(), model);
+		waitForCheckpoints();
+		// crash: both are dropped without save
+	}
+	{
+		TrbLogGroup logGroup;
+		TrbWritableStorePtr store(new TrbWritableStore(storePath, &logGroup));
+		TrbWritableIndexPtr index(TrbWritableIndex::createIndex(schema, indexPath, &logGroup));
+		verify(store.get(), model);
+		valvec<llong> recIds;
+		for (auto& kv : model) {
+			index->searchExact(kv.second, &recIds, NULL);
+			CHECK(recIds.size() == 1);
+			CHECK(recIds[0] == kv.first);
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	// checkpoint as soon as the log is larger than 4K and the image
+#if defined(_MSC_VER)
+	_putenv_s("TerarkDB_TrbCheckpointLogBytes", "4096");
+#else
+	setenv("TerarkDB_TrbCheckpointLogBytes", "4096", 1);
+#endif
+	std::string dir = argc > 1 ? argv[1] : "trb-log-group-test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	testCrashReplayLogGroup(dir);
+	testConcurrentCommit(dir);
+	fs::remove_all(dir);
+	printf("passed\n");
+	return 0;
+}
@@ -0,0 +1,147 @@
+// TestZipIntBatch.cpp : UintVecMin0::bulk_get of any bit width and range,
+// and getValuesBatch, getValuesBatchBytes and store iterators of
+// ZipIntStore and ZipIntKeyIndex must agree with per value decoding
+//
+
+#include "stdafx.h"
+#include <terark/db/zip_int_store.hpp>
+#include <terark/db/intkey_index.hpp>
+#include <algorithm>
+#include <random>
+#include <type_traits>
+
+using namespace terark;
+using namespace terark::db;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		abort(); \
+	} } while (0)
+
+/// unaligned begin and end of every width, both on narrow and wide lanes
+static void testBulkGet(std::mt19937_64& rng) {
+	for (size_t bits = 1; bits <= 40; ++bits) {
+		const size_t n = 1000;
+		ullong mask = (ullong(1) << bits) - 1;
+		valvec<ullong> vals(n, valvec_no_init());
+		for (size_t i = 0; i < n; ++i)
+			vals[i] = rng() & mask;
+		vals[0] = 0;    // min is 0, values are kept as is
+		vals[1] = mask; // all bits are used
+		UintVecMin0 vec;
+		CHECK(vec.build_from(vals) == 0);
+		CHECK(vec.uintbits() == bits);
+		valvec<ullong> out64(n, valvec_no_init());
+		valvec<uint32_t> out32(n, valvec_no_init());
+		for (size_t first = 0; first < 20; ++first) {
+			for (size_t num : { size_t(0), size_t(1), size_t(7), size_t(8), size_t(9),
+								size_t(63), n - first }) {
+				vec.bulk_get(first, num, out64.data());
+				for (size_t i = 0; i < num; ++i)
+					CHECK(out64[i] == vals[first + i]);
+				if (bits <= 32) {
+					vec.bulk_get(first, num, out32.data());
+					for (size_t i = 0; i < num; ++i)
+						CHECK(out32[i] == vals[first + i]);
+				}
+			}
+		}
+	}
+}
+
+template<class Int>
+static void checkBatch(const ReadableStore* store, const valvec<Int>& vals) {
+	const size_t n = vals.size();
+	valvec<byte> val;
+	for (size_t i = 0; i < n; ++i) {
+		val.erase_all();
+		store->getValueAppend(i, &val, NULL);
+		CHECK(val.size() == sizeof(Int));
+		CHECK(unaligned_load<Int>(val.data()) == vals[i]);
+	}
+	valvec<Int> out(n, valvec_no_init());
+	valvec<llong> wide(n, valvec_no_init());
+	for (size_t first : { size_t(0), size_t(1), size_t(255), size_t(300) }) {
+		size_t num = n - first;
+		out.fill(0);
+		bool ok;
+		if (auto zs = dynamic_cast<const ZipIntStore*>(store)) {
+			zs->getValuesBatch(first, num, wide.data());
+			ok = zs->getValuesBatchBytes(first, num, (byte*)out.data());
+		} else {
+			auto zi = dynamic_cast<const ZipIntKeyIndex*>(store);
+			CHECK(NULL != zi);
+			zi->getValuesBatch(first, num, wide.data());
+			ok = zi->getValuesBatchBytes(first, num, (byte*)out.data());
+		}
+		CHECK(ok);
+		for (size_t i = 0; i < num; ++i) {
+			CHECK(out[i] == vals[first + i]);
+			CHECK(wide[i] == llong(vals[first + i]));
+		}
+	}
+	StoreIteratorPtr iter(store->createStoreIterForward(NULL));
+	CHECK(NULL != iter);
+	llong id = -1;
+	size_t num = 0;
+	while (iter->increment(&id, &val)) {
+		CHECK(size_t(id) == num);
+		CHECK(val.size() == sizeof(Int));
+		CHECK(unaligned_load<Int>(val.data()) == vals[num]);
+		num++;
+	}
+	CHECK(num == n);
+	CHECK(iter->seekExact(n / 2, &val));
+	CHECK(unaligned_load<Int>(val.data()) == vals[n / 2]);
+}
+
+/// distinct is the number of distinct values, a few distinct values in
+/// a wide range makes ZipIntStore dedup them
+template<class Int>
+static void testIntStore(ColumnType type, size_t distinct, std::mt19937_64& rng) {
+	Schema schema;
+	ColumnMeta colmeta(type);
+	schema.m_columnsMeta.insert_i("num", colmeta);
+	schema.compile();
+	valvec<Int> pool(distinct, valvec_no_init());
+	for (auto& x : pool)
+		// UintVecMin0 has at most 58 bits
+		x = std::is_signed<Int>::value ? Int(llong(rng()) >> 8) : Int(rng() >> 8);
+	const size_t n = 5000;
+	valvec<Int> vals(n, valvec_no_init());
+	SortableStrVec strVec;
+	for (size_t i = 0; i < n; ++i) {
+		vals[i] = pool[rng() % distinct];
+		strVec.m_strpool.append((const byte*)&vals[i], sizeof(Int));
+	}
+	SortableStrVec keyVec = strVec;
+	boost::intrusive_ptr<ZipIntStore> store(new ZipIntStore(schema));
+	store->build(type, strVec);
+	checkBatch(store.get(), vals);
+	boost::intrusive_ptr<ZipIntKeyIndex> index(new ZipIntKeyIndex(schema));
+	index->build(type, keyVec);
+	checkBatch(index.get(), vals);
+}
+
+template<class Int>
+static void testIntStore(ColumnType type, std::mt19937_64& rng) {
+	testIntStore<Int>(type, 5, rng);
+	testIntStore<Int>(type, 300, rng);
+	testIntStore<Int>(type, 5000, rng);
+}
+
+int main(int argc, char* argv[]) {
+	std::mt19937_64 rng(777);
+	testBulkGet(rng);
+	testIntStore< int8_t >(ColumnType::Sint08, rng);
+	testIntStore<uint8_t >(ColumnType::Uint08, rng);
+	testIntStore< int16_t>(ColumnType::Sint16, rng);
+	testIntStore<uint16_t>(ColumnType::Uint16, rng);
+	testIntStore< int32_t>(ColumnType::Sint32, rng);
+	testIntStore<uint32_t>(ColumnType::Uint32, rng);
+	testIntStore< int64_t>(ColumnType::Sint64, rng);
+	testIntStore<uint64_t>(ColumnType::Uint64, rng);
+	printf("passed\n");
+	return 0;
+}